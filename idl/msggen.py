@@ -0,0 +1,450 @@
+#!/usr/bin/env python3
+"""根据messages.idl生成消息结构体，每个结构体带json和二进制协议的编解码方法
+
+用法: msggen.py <messages.idl> <输出的messages.hpp> [binarycodec.hpp]
+帧头里target字段对应的字段名从binarycodec.hpp的BinaryCodec::targetKey里读出，缺省是仓库里的include/binarycodec.hpp
+"""
+
+import os
+import re
+import sys
+
+CPP_TYPES = {
+    'int': 'int',
+    'bool': 'bool',
+    'string': 'string',
+    'json': 'json',
+}
+
+FIELD_RE = re.compile(r'^(optional\s+)?(\w+)\s+(\w+)(?:\s+"(\w+)")?\s*;$')
+
+
+class Field:
+    def __init__(self, optional, type_, name, wire):
+        self.optional = optional
+        self.type = type_
+        self.name = name
+        self.wire = wire or name
+
+    @property
+    def has_flag(self):
+        return 'has' + self.name[0].upper() + self.name[1:]
+
+    @property
+    def seen_flag(self):
+        return 'seen' + self.name[0].upper() + self.name[1:]
+
+
+class Message:
+    def __init__(self, msgid, name, comment):
+        self.msgid = msgid
+        self.name = name
+        self.comment = comment
+        self.fields = []
+
+
+def parse(path):
+    messages = []
+    current = None
+    comment = ''
+    with open(path, encoding='utf-8') as f:
+        for lineno, raw in enumerate(f, 1):
+            line = raw.strip()
+            if not line:
+                comment = ''
+                continue
+            if line.startswith('//'):
+                comment = line[2:].strip()
+                continue
+            if current is None:
+                m = re.match(r'^message\s+(\w+)\s+(\w+)$', line)
+                if m:
+                    current = Message(m.group(1), m.group(2), comment)
+                    continue
+                raise SystemExit('%s:%d: expect "message <EnMsgType> <Name>"' % (path, lineno))
+            if line == '{':
+                continue
+            if line == '}':
+                messages.append(current)
+                current = None
+                comment = ''
+                continue
+            m = FIELD_RE.match(line)
+            if not m or m.group(2) not in CPP_TYPES:
+                raise SystemExit('%s:%d: bad field "%s"' % (path, lineno, line))
+            current.fields.append(Field(bool(m.group(1)), m.group(2), m.group(3), m.group(4)))
+    if current is not None:
+        raise SystemExit('%s: message %s is not closed' % (path, current.name))
+    return messages
+
+
+def json_check(field):
+    return {
+        'int': 'is_number_integer()',
+        'bool': 'is_boolean()',
+        'string': 'is_string()',
+    }.get(field.type)
+
+
+def emit_assign_flag(out, indent, field):
+    if field.optional:
+        out.append(indent + '%s = true;' % field.has_flag)
+    else:
+        out.append(indent + '%s = true;' % field.seen_flag)
+
+
+def emit_from_json(out, msg):
+    required = [f for f in msg.fields if not f.optional]
+    out.append('    // 一次遍历json对象的所有字段，不会插入不存在的字段')
+    out.append('    bool fromJson(const json &js)')
+    out.append('    {')
+    out.append('        if (!js.is_object())')
+    out.append('        {')
+    out.append('            return false;')
+    out.append('        }')
+    for f in required:
+        out.append('        bool %s = false;' % f.seen_flag)
+    if msg.fields:
+        out.append('        for (auto it = js.begin(); it != js.end(); ++it)')
+        out.append('        {')
+        out.append('            const string &key = it.key();')
+        out.append('            switch (key.size())')
+        out.append('            {')
+        by_len = {}
+        for f in msg.fields:
+            by_len.setdefault(len(f.wire), []).append(f)
+        for length in sorted(by_len):
+            out.append('            case %d:' % length)
+            for i, f in enumerate(by_len[length]):
+                out.append('                %sif (key == "%s")' % ('else ' if i else '', f.wire))
+                out.append('                {')
+                check = json_check(f)
+                if f.type == 'int':
+                    # 超出int范围的整数按类型不对处理，不截断成另一个id
+                    out.append('                    if (!jsonIntFits(*it))')
+                    out.append('                    {')
+                    out.append('                        return false;')
+                    out.append('                    }')
+                    out.append('                    %s = it->get<%s>();' % (f.name, CPP_TYPES[f.type]))
+                elif check:
+                    out.append('                    if (!it->%s)' % check)
+                    out.append('                    {')
+                    out.append('                        return false;')
+                    out.append('                    }')
+                    out.append('                    %s = it->get<%s>();' % (f.name, CPP_TYPES[f.type]))
+                else:
+                    out.append('                    %s = *it;' % f.name)
+                emit_assign_flag(out, '                    ', f)
+                out.append('                }')
+            out.append('                break;')
+        out.append('            default:')
+        out.append('                break;')
+        out.append('            }')
+        out.append('        }')
+    out.append('        return %s;' % (' && '.join(f.seen_flag for f in required) or 'true'))
+    out.append('    }')
+    out.append('')
+
+
+def emit_to_json(out, msg):
+    out.append('    void toJson(json &js) const')
+    out.append('    {')
+    out.append('        js["msgid"] = kMsgId;')
+    for f in msg.fields:
+        if f.optional:
+            out.append('        if (%s)' % f.has_flag)
+            out.append('        {')
+            out.append('            js["%s"] = %s;' % (f.wire, f.name))
+            out.append('        }')
+        else:
+            out.append('        js["%s"] = %s;' % (f.wire, f.name))
+    out.append('    }')
+    out.append('')
+
+
+def emit_to_json_text(out, msg):
+    out.append('    // 直接把json文本写到out后面，不构建json对象')
+    out.append('    void toJsonText(string *out) const')
+    out.append('    {')
+    out.append('        out->append("{\\"msgid\\":");')
+    out.append('        JsonWriter::writeInt(kMsgId, out);')
+    writer = {
+        'int': 'JsonWriter::writeInt(%s, out);',
+        'bool': 'JsonWriter::writeBool(%s, out);',
+        'string': 'JsonWriter::writeString(%s, out);',
+        'json': 'JsonWriter::writeValue(%s, out);',
+    }
+    for f in msg.fields:
+        indent = '        '
+        if f.optional:
+            out.append('        if (%s)' % f.has_flag)
+            out.append('        {')
+            indent = '            '
+        out.append(indent + 'out->append(",\\"%s\\":");' % f.wire)
+        out.append(indent + writer[f.type] % f.name)
+        if f.optional:
+            out.append('        }')
+    out.append("        out->push_back('}');")
+    out.append('    }')
+    out.append('')
+
+
+def is_header_id(f):
+    return f.type == 'int' and f.wire == 'id'
+
+
+# 帧头里target字段对应的json字段名  EnMsgType => 字段名，main()里从BinaryCodec::targetKey读出
+TARGET_KEYS = {}
+
+
+def load_target_keys(path):
+    """解析BinaryCodec::targetKey里的switch：连续的case标签共用后面的return"""
+    with open(path, encoding='utf-8') as f:
+        src = f.read()
+    m = re.search(r'static const char \*targetKey\(int msgid\)\s*\{(.*?)\n    \}', src, re.S)
+    if not m:
+        raise SystemExit('%s: BinaryCodec::targetKey not found' % path)
+    keys = {}
+    labels = []
+    for tok in re.finditer(r'case\s+(\w+)\s*:|return\s+"(\w+)"\s*;|default\s*:', m.group(1)):
+        if tok.group(1):
+            labels.append(tok.group(1))
+            continue
+        for label in labels:
+            keys[label] = tok.group(2)
+        labels = []
+    if not keys:
+        raise SystemExit('%s: no target keys in BinaryCodec::targetKey' % path)
+    return keys
+
+
+def is_header_target(msg, f):
+    return f.type == 'int' and TARGET_KEYS.get(msg.msgid) == f.wire
+
+
+def emit_read_body_field(out, indent, f):
+    if f.type == 'int':
+        out.append(indent + 'int64_t v = 0;')
+        out.append(indent + 'if (!BinaryCodec::readInt(&reader, &v))')
+        out.append(indent + '{')
+        out.append(indent + '    return false;')
+        out.append(indent + '}')
+        out.append(indent + 'if (v < INT_MIN || v > INT_MAX)')
+        out.append(indent + '{')
+        out.append(indent + '    return false;')
+        out.append(indent + '}')
+        out.append(indent + '%s = static_cast<int>(v);' % f.name)
+    elif f.type == 'bool':
+        out.append(indent + 'if (!BinaryCodec::readBool(&reader, &%s))' % f.name)
+        out.append(indent + '{')
+        out.append(indent + '    return false;')
+        out.append(indent + '}')
+    elif f.type == 'string':
+        out.append(indent + 'if (!BinaryCodec::readStringValue(&reader, &%s))' % f.name)
+        out.append(indent + '{')
+        out.append(indent + '    return false;')
+        out.append(indent + '}')
+    else:
+        out.append(indent + 'if (!BinaryCodec::readValue(&reader, &%s, 0))' % f.name)
+        out.append(indent + '{')
+        out.append(indent + '    return false;')
+        out.append(indent + '}')
+    emit_assign_flag(out, indent, f)
+
+
+def emit_from_binary(out, msg):
+    required = [f for f in msg.fields if not f.optional]
+    out.append('    // 帧头里的id和target直接取，帧体一次顺序读完')
+    out.append('    bool fromBinary(const char *data, size_t len)')
+    out.append('    {')
+    out.append('        BinaryCodec::Header header;')
+    out.append('        BinaryCodec::Reader reader;')
+    out.append('        if (!BinaryCodec::openFrame(data, len, &header, &reader) || header.msgid != kMsgId)')
+    out.append('        {')
+    out.append('            return false;')
+    out.append('        }')
+    for f in required:
+        out.append('        bool %s = false;' % f.seen_flag)
+    header_fields = [f for f in msg.fields if is_header_id(f) or is_header_target(msg, f)]
+    for f in header_fields:
+        if is_header_id(f):
+            out.append('        if (header.id != BinaryCodec::kAbsent)')
+            out.append('        {')
+            out.append('            %s = header.id;' % f.name)
+        else:
+            out.append('        if (header.target != BinaryCodec::kAbsent)')
+            out.append('        {')
+            out.append('            %s = header.target;' % f.name)
+        emit_assign_flag(out, '            ', f)
+        out.append('        }')
+    out.append('        while (reader.p < reader.end)')
+    out.append('        {')
+    out.append('            string key;')
+    out.append('            if (!BinaryCodec::readKey(&reader, &key))')
+    out.append('            {')
+    out.append('                return false;')
+    out.append('            }')
+    for i, f in enumerate(msg.fields):
+        out.append('            %sif (key == "%s")' % ('else ' if i else '', f.wire))
+        out.append('            {')
+        emit_read_body_field(out, '                ', f)
+        out.append('            }')
+    if msg.fields:
+        out.append('            else')
+        out.append('            {')
+        indent = '                '
+    else:
+        indent = '            '
+    out.append(indent + '// 不认识的字段跳过，新版本可以在末尾追加字段')
+    out.append(indent + 'json skipped;')
+    out.append(indent + 'if (!BinaryCodec::readValue(&reader, &skipped, 0))')
+    out.append(indent + '{')
+    out.append(indent + '    return false;')
+    out.append(indent + '}')
+    if msg.fields:
+        out.append('            }')
+    out.append('        }')
+    out.append('        return %s;' % (' && '.join(f.seen_flag for f in required) or 'true'))
+    out.append('    }')
+    out.append('')
+
+
+def emit_write_body_field(out, indent, f):
+    out.append(indent + 'BinaryCodec::writeKey("%s", out);' % f.wire)
+    writer = {
+        'int': 'BinaryCodec::writeInt(%s, out);',
+        'bool': 'BinaryCodec::writeBool(%s, out);',
+        'string': 'BinaryCodec::writeStringValue(%s, out);',
+        'json': 'BinaryCodec::writeValue(%s, out);',
+    }[f.type]
+    out.append(indent + writer % f.name)
+
+
+def emit_to_binary(out, msg):
+    out.append('    // 直接写二进制帧，不经过json对象')
+    out.append('    void toBinary(string *out) const')
+    out.append('    {')
+    out.append('        size_t start = BinaryCodec::beginFrame(out);')
+    out.append('        int32_t headerId = BinaryCodec::kAbsent;')
+    out.append('        int32_t headerTarget = BinaryCodec::kAbsent;')
+    for f in msg.fields:
+        indent = '        '
+        if f.optional:
+            out.append('        if (%s)' % f.has_flag)
+            out.append('        {')
+            indent = '            '
+        if is_header_id(f):
+            out.append(indent + 'headerId = %s;' % f.name)
+        elif is_header_target(msg, f):
+            out.append(indent + 'headerTarget = %s;' % f.name)
+        else:
+            emit_write_body_field(out, indent, f)
+        if f.optional:
+            out.append('        }')
+    out.append('        BinaryCodec::finishFrame(out, start, kMsgId, headerId, headerTarget);')
+    out.append('    }')
+
+
+def emit_message(out, msg):
+    if msg.comment:
+        out.append('// %s' % msg.comment)
+    out.append('struct %s' % msg.name)
+    out.append('{')
+    out.append('    enum')
+    out.append('    {')
+    out.append('        kMsgId = %s,' % msg.msgid)
+    out.append('    };')
+    out.append('')
+    for f in msg.fields:
+        init = ' = 0' if f.type == 'int' else ' = false' if f.type == 'bool' else ''
+        out.append('    %s %s%s;' % (CPP_TYPES[f.type], f.name, init))
+    optional = [f for f in msg.fields if f.optional]
+    if optional:
+        out.append('')
+        out.append('    // 可选字段是否存在')
+        for f in optional:
+            out.append('    bool %s = false;' % f.has_flag)
+        for f in optional:
+            param = CPP_TYPES[f.type] if f.type in ('int', 'bool') else 'const %s &' % CPP_TYPES[f.type]
+            out.append('')
+            out.append('    void set%s(%s%svalue)' % (f.name[0].upper() + f.name[1:], param, '' if param.endswith('&') else ' '))
+            out.append('    {')
+            out.append('        %s = value;' % f.name)
+            out.append('        %s = true;' % f.has_flag)
+            out.append('    }')
+    out.append('')
+    emit_from_json(out, msg)
+    emit_to_json(out, msg)
+    emit_to_json_text(out, msg)
+    emit_from_binary(out, msg)
+    emit_to_binary(out, msg)
+    out.append('};')
+    out.append('')
+
+
+def emit_msg_type_name(out, messages):
+    out.append('// 消息类型的名字，日志和指标里使用，未知的msgid返回nullptr')
+    out.append('inline const char *msgTypeName(int msgid)')
+    out.append('{')
+    out.append('    switch (msgid)')
+    out.append('    {')
+    for msg in messages:
+        out.append('    case %s:' % msg.msgid)
+        out.append('        return "%s";' % msg.msgid)
+    out.append('    default:')
+    out.append('        return nullptr;')
+    out.append('    }')
+    out.append('}')
+    out.append('')
+
+
+def main():
+    if len(sys.argv) not in (3, 4):
+        raise SystemExit('usage: msggen.py <messages.idl> <messages.hpp> [binarycodec.hpp]')
+    codec = sys.argv[3] if len(sys.argv) == 4 else os.path.join(
+        os.path.dirname(os.path.abspath(__file__)), '..', 'include', 'binarycodec.hpp')
+    TARGET_KEYS.update(load_target_keys(codec))
+    messages = parse(sys.argv[1])
+    out = [
+        '// 由idl/msggen.py根据idl/messages.idl生成，不要手动修改',
+        '#ifndef MESSAGES_H',
+        '#define MESSAGES_H',
+        '',
+        '#include "binarycodec.hpp"',
+        '#include "json.hpp"',
+        '#include "jsonwriter.hpp"',
+        '#include "public.hpp"',
+        '',
+        '#include <limits.h>',
+        '#include <stdint.h>',
+        '#include <string>',
+        'using namespace std;',
+        'using json = nlohmann::json;',
+        '',
+        '// json里的整数在int范围内，超出范围的和类型不对一样解码失败。',
+        '// 不能直接和INT_MAX比较：json的比较把无符号数转成有符号数，2^64-1会变成-1',
+        'inline bool jsonIntFits(const json &v)',
+        '{',
+        '    if (v.is_number_unsigned())',
+        '    {',
+        '        return v.get<uint64_t>() <= static_cast<uint64_t>(INT_MAX);',
+        '    }',
+        '    if (!v.is_number_integer())',
+        '    {',
+        '        return false;',
+        '    }',
+        '    int64_t i = v.get<int64_t>();',
+        '    return i >= INT_MIN && i <= INT_MAX;',
+        '}',
+        '',
+    ]
+    for msg in messages:
+        emit_message(out, msg)
+    emit_msg_type_name(out, messages)
+    out.append('#endif')
+    with open(sys.argv[2], 'w', encoding='utf-8') as f:
+        f.write('\n'.join(out) + '\n')
+
+
+if __name__ == '__main__':
+    main()
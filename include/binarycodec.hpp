@@ -0,0 +1,612 @@
+#ifndef BINARYCODEC_H
+#define BINARYCODEC_H
+
+#include "json.hpp"
+#include "public.hpp"
+
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <unordered_map>
+using namespace std;
+using json = nlohmann::json;
+
+/*
+server和client公用的紧凑二进制协议，连接建立后通过PROTO_MSG协商，老客户端继续使用json
+
+帧格式（多字节整数都是网络字节序）：
+ 0       1         2        4          8         12        16
+ +-------+---------+--------+----------+---------+---------+--------
+ | magic | version | msgid  | bodylen  |   id    | target  | body...
+ | 0xC5  |    1    | uint16 |  uint32  |  int32  |  int32  |
+ +-------+---------+--------+----------+---------+---------+--------
+target按msgid对应toid/groupid/friendid，id和target不存在时是INT32_MIN，
+这样转发类消息只看帧头就能路由，body原样转发。
+
+body是其余字段的紧凑编码，一个字段是key + value：
+key是varint，常用字段名用kFieldNames里的编号代替，0表示后面紧跟一个字段名字符串；
+value是一个类型字节加内容，整数是zigzag varint，字符串是varint长度加字节，
+数组是varint元素个数加元素，对象是varint字段个数加字段。
+*/
+class BinaryCodec
+{
+public:
+    enum
+    {
+        kMagic = 0xC5,
+        kVersion = 1,
+        kHeaderLen = 16,
+        kMaxDepth = 32,
+    };
+
+    struct Header
+    {
+        int version;
+        int msgid;
+        uint32_t bodyLen;
+        int32_t id;
+        int32_t target;
+    };
+
+    static const int32_t kAbsent = INT32_MIN;
+
+    // 帧的第一个字节是magic就是二进制帧，json帧以'{'开头
+    static bool isBinary(char firstByte)
+    {
+        return static_cast<uint8_t>(firstByte) == kMagic;
+    }
+
+    // 帧头里target字段对应的json字段名，这个消息没有target返回nullptr
+    // msggen.py生成消息结构体时从这里解析出这张表，保持 case X: return "字段名"; 的写法
+    static const char *targetKey(int msgid)
+    {
+        switch (msgid)
+        {
+        case ONE_CHAT_MSG:
+            return "toid";
+        case GROUP_CHAT_MSG:
+        case ADD_GROUP_MSG:
+            return "groupid";
+        case ADD_FRIEND_MSG:
+            return "friendid";
+        default:
+            return nullptr;
+        }
+    }
+
+    // 严格的UTF-8检查：拒绝过长编码、代理区和超过U+10FFFF的码点，和json.hpp序列化时的检查一致
+    static bool validUtf8(const uint8_t *p, size_t len)
+    {
+        const uint8_t *end = p + len;
+        while (p < end)
+        {
+            uint8_t c = *p++;
+            if (c < 0x80)
+            {
+                continue;
+            }
+            int more = 0;
+            uint8_t lo = 0x80;
+            uint8_t hi = 0xBF;
+            if (c >= 0xC2 && c <= 0xDF)
+            {
+                more = 1;
+            }
+            else if (c >= 0xE0 && c <= 0xEF)
+            {
+                more = 2;
+                lo = c == 0xE0 ? 0xA0 : 0x80;
+                hi = c == 0xED ? 0x9F : 0xBF;
+            }
+            else if (c >= 0xF0 && c <= 0xF4)
+            {
+                more = 3;
+                lo = c == 0xF0 ? 0x90 : 0x80;
+                hi = c == 0xF4 ? 0x8F : 0xBF;
+            }
+            else
+            {
+                return false;
+            }
+            if (end - p < more || *p < lo || *p > hi)
+            {
+                return false;
+            }
+            ++p;
+            for (int i = 1; i < more; ++i, ++p)
+            {
+                if ((*p & 0xC0) != 0x80)
+                {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    // 解析帧头，数据不足一个帧头返回false
+    static bool peekHeader(const char *data, size_t len, Header *header)
+    {
+        if (len < kHeaderLen)
+        {
+            return false;
+        }
+        const uint8_t *p = reinterpret_cast<const uint8_t *>(data);
+        header->version = p[1];
+        header->msgid = readUint16(p + 2);
+        header->bodyLen = readUint32(p + 4);
+        header->id = static_cast<int32_t>(readUint32(p + 8));
+        header->target = static_cast<int32_t>(readUint32(p + 12));
+        return true;
+    }
+
+    // 把一个json消息对象编码成完整的二进制帧，追加到out后面
+    static bool encode(const json &js, string *out)
+    {
+        if (!js.is_object())
+        {
+            return false;
+        }
+        auto msgidIt = js.find("msgid");
+        if (msgidIt == js.end() || !msgidIt->is_number_integer())
+        {
+            return false;
+        }
+        int msgid = msgidIt->get<int>();
+        const char *target = targetKey(msgid);
+
+        size_t start = beginFrame(out);
+        int32_t id = kAbsent;
+        int32_t targetValue = kAbsent;
+        for (auto it = js.begin(); it != js.end(); ++it)
+        {
+            const string &key = it.key();
+            if (key == "msgid")
+            {
+                continue;
+            }
+            if (it->is_number_integer() && key == "id")
+            {
+                id = it->get<int32_t>();
+                continue;
+            }
+            if (it->is_number_integer() && target != nullptr && key == target)
+            {
+                targetValue = it->get<int32_t>();
+                continue;
+            }
+            writeKey(key, out);
+            writeValue(*it, out);
+        }
+        finishFrame(out, start, msgid, id, targetValue);
+        return true;
+    }
+
+    // 把一个完整的二进制帧[data, data + len)解码成json消息对象
+    static bool decode(const char *data, size_t len, json *js)
+    {
+        Header header;
+        Reader reader;
+        if (!openFrame(data, len, &header, &reader))
+        {
+            return false;
+        }
+        *js = json::object();
+        (*js)["msgid"] = header.msgid;
+        if (header.id != kAbsent)
+        {
+            (*js)["id"] = header.id;
+        }
+        const char *target = targetKey(header.msgid);
+        if (target != nullptr && header.target != kAbsent)
+        {
+            (*js)[target] = header.target;
+        }
+
+        while (reader.p < reader.end)
+        {
+            string key;
+            if (!readKey(&reader, &key) || !readValue(&reader, &(*js)[key], 0))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /*
+    下面是逐个字段编解码的基础操作，idl生成的消息结构体直接用它们读写帧，不经过json对象
+    */
+
+    // 帧体的读取位置
+    struct Reader
+    {
+        const uint8_t *p;
+        const uint8_t *end;
+    };
+
+    // 检查一个完整的帧并读出帧头，reader指向帧体
+    static bool openFrame(const char *data, size_t len, Header *header, Reader *reader)
+    {
+        if (!peekHeader(data, len, header) || header->version != kVersion ||
+            len != kHeaderLen + header->bodyLen)
+        {
+            return false;
+        }
+        reader->p = reinterpret_cast<const uint8_t *>(data) + kHeaderLen;
+        reader->end = reinterpret_cast<const uint8_t *>(data) + len;
+        return true;
+    }
+
+    // 在out后面预留帧头，返回帧的起始位置
+    static size_t beginFrame(string *out)
+    {
+        size_t start = out->size();
+        out->resize(start + kHeaderLen);
+        return start;
+    }
+
+    // 帧体写完之后回填帧头
+    static void finishFrame(string *out, size_t start, int msgid, int32_t id, int32_t target)
+    {
+        uint8_t *p = reinterpret_cast<uint8_t *>(&(*out)[start]);
+        p[0] = kMagic;
+        p[1] = kVersion;
+        writeUint16(p + 2, static_cast<uint16_t>(msgid));
+        writeUint32(p + 4, static_cast<uint32_t>(out->size() - start - kHeaderLen));
+        writeUint32(p + 8, static_cast<uint32_t>(id));
+        writeUint32(p + 12, static_cast<uint32_t>(target));
+    }
+
+    static void writeKey(const string &key, string *out)
+    {
+        int tag = fieldTag(key);
+        writeVarint(tag, out);
+        if (tag == 0)
+        {
+            writeString(key, out);
+        }
+    }
+
+    static bool readKey(Reader *r, string *key)
+    {
+        uint64_t tag = 0;
+        if (!readVarint(r, &tag))
+        {
+            return false;
+        }
+        if (tag == 0)
+        {
+            return readString(r, key);
+        }
+        size_t count = 0;
+        const char *const *names = fieldNames(&count);
+        if (tag >= count)
+        {
+            return false;
+        }
+        *key = names[tag];
+        return true;
+    }
+
+    static void writeInt(int64_t v, string *out)
+    {
+        out->push_back(kInt);
+        writeVarint((static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63), out);
+    }
+
+    static bool readInt(Reader *r, int64_t *v)
+    {
+        uint64_t zigzag = 0;
+        if (r->p == r->end || *r->p++ != kInt || !readVarint(r, &zigzag))
+        {
+            return false;
+        }
+        *v = static_cast<int64_t>((zigzag >> 1) ^ (~(zigzag & 1) + 1));
+        return true;
+    }
+
+    static void writeStringValue(const string &s, string *out)
+    {
+        out->push_back(kString);
+        writeString(s, out);
+    }
+
+    static bool readStringValue(Reader *r, string *s)
+    {
+        if (r->p == r->end || *r->p++ != kString)
+        {
+            return false;
+        }
+        return readString(r, s);
+    }
+
+    static void writeBool(bool b, string *out)
+    {
+        out->push_back(b ? kTrue : kFalse);
+    }
+
+    static bool readBool(Reader *r, bool *b)
+    {
+        if (r->p == r->end || (*r->p != kTrue && *r->p != kFalse))
+        {
+            return false;
+        }
+        *b = (*r->p++ == kTrue);
+        return true;
+    }
+
+    // 数组的开头，后面紧跟count个元素，逐个元素直接写的时候使用
+    static void writeArrayHeader(size_t count, string *out)
+    {
+        out->push_back(kArray);
+        writeVarint(count, out);
+    }
+
+    static void writeValue(const json &value, string *out)
+    {
+        switch (value.type())
+        {
+        case json::value_t::boolean:
+            writeBool(value.get<bool>(), out);
+            break;
+        case json::value_t::number_integer:
+        case json::value_t::number_unsigned:
+            writeInt(value.get<int64_t>(), out);
+            break;
+        case json::value_t::number_float:
+        {
+            double d = value.get<double>();
+            uint64_t bits = 0;
+            memcpy(&bits, &d, sizeof bits);
+            out->push_back(kDouble);
+            for (int shift = 56; shift >= 0; shift -= 8)
+            {
+                out->push_back(static_cast<char>(bits >> shift));
+            }
+            break;
+        }
+        case json::value_t::string:
+            writeStringValue(value.get_ref<const string &>(), out);
+            break;
+        case json::value_t::array:
+            out->push_back(kArray);
+            writeVarint(value.size(), out);
+            for (const json &element : value)
+            {
+                writeValue(element, out);
+            }
+            break;
+        case json::value_t::object:
+            out->push_back(kObject);
+            writeVarint(value.size(), out);
+            for (auto it = value.begin(); it != value.end(); ++it)
+            {
+                writeKey(it.key(), out);
+                writeValue(*it, out);
+            }
+            break;
+        default:
+            out->push_back(kNull);
+            break;
+        }
+    }
+
+    static bool readValue(Reader *r, json *value, int depth)
+    {
+        if (r->p == r->end || depth > kMaxDepth)
+        {
+            return false;
+        }
+        switch (*r->p)
+        {
+        case kNull:
+            ++r->p;
+            *value = nullptr;
+            return true;
+        case kFalse:
+        case kTrue:
+        {
+            bool b = false;
+            readBool(r, &b);
+            *value = b;
+            return true;
+        }
+        case kInt:
+        {
+            int64_t v = 0;
+            if (!readInt(r, &v))
+            {
+                return false;
+            }
+            *value = v;
+            return true;
+        }
+        case kDouble:
+        {
+            ++r->p;
+            if (r->end - r->p < 8)
+            {
+                return false;
+            }
+            uint64_t bits = 0;
+            for (int i = 0; i < 8; ++i)
+            {
+                bits = bits << 8 | *r->p++;
+            }
+            double d = 0;
+            memcpy(&d, &bits, sizeof d);
+            *value = d;
+            return true;
+        }
+        case kString:
+        {
+            string s;
+            if (!readStringValue(r, &s))
+            {
+                return false;
+            }
+            *value = std::move(s);
+            return true;
+        }
+        case kArray:
+        {
+            ++r->p;
+            uint64_t count = 0;
+            // 每个元素至少占一个字节，个数超过剩余字节数的一定是坏帧
+            if (!readVarint(r, &count) || count > static_cast<uint64_t>(r->end - r->p))
+            {
+                return false;
+            }
+            *value = json::array();
+            for (uint64_t i = 0; i < count; ++i)
+            {
+                json element;
+                if (!readValue(r, &element, depth + 1))
+                {
+                    return false;
+                }
+                value->push_back(std::move(element));
+            }
+            return true;
+        }
+        case kObject:
+        {
+            ++r->p;
+            uint64_t count = 0;
+            if (!readVarint(r, &count) || count > static_cast<uint64_t>(r->end - r->p))
+            {
+                return false;
+            }
+            *value = json::object();
+            for (uint64_t i = 0; i < count; ++i)
+            {
+                string key;
+                if (!readKey(r, &key) || !readValue(r, &(*value)[key], depth + 1))
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+        default:
+            return false;
+        }
+    }
+
+private:
+    enum ValueType
+    {
+        kNull = 0,
+        kFalse,
+        kTrue,
+        kInt,
+        kDouble,
+        kString,
+        kArray,
+        kObject,
+    };
+
+    // 常用字段名的编号就是它在这个表里的下标，只能在末尾追加，0保留给不在表里的字段名
+    static const char *const *fieldNames(size_t *count)
+    {
+        static const char *const kFieldNames[] = {
+            "", "msgid", "id", "toid", "groupid", "friendid", "name", "password",
+            "msg", "time", "errno", "errmsg", "state", "role", "groupname", "groupdesc",
+            "friends", "groups", "users", "offlinemsg", "version",
+        };
+        *count = sizeof(kFieldNames) / sizeof(kFieldNames[0]);
+        return kFieldNames;
+    }
+
+    static int fieldTag(const string &name)
+    {
+        static const unordered_map<string, int> tags = [] {
+            unordered_map<string, int> m;
+            size_t count = 0;
+            const char *const *names = fieldNames(&count);
+            for (size_t i = 1; i < count; ++i)
+            {
+                m[names[i]] = static_cast<int>(i);
+            }
+            return m;
+        }();
+        auto it = tags.find(name);
+        return it == tags.end() ? 0 : it->second;
+    }
+
+    static uint16_t readUint16(const uint8_t *p)
+    {
+        return static_cast<uint16_t>(p[0] << 8 | p[1]);
+    }
+
+    static uint32_t readUint32(const uint8_t *p)
+    {
+        return static_cast<uint32_t>(p[0]) << 24 | static_cast<uint32_t>(p[1]) << 16 |
+               static_cast<uint32_t>(p[2]) << 8 | p[3];
+    }
+
+    static void writeUint16(uint8_t *p, uint16_t v)
+    {
+        p[0] = static_cast<uint8_t>(v >> 8);
+        p[1] = static_cast<uint8_t>(v);
+    }
+
+    static void writeUint32(uint8_t *p, uint32_t v)
+    {
+        p[0] = static_cast<uint8_t>(v >> 24);
+        p[1] = static_cast<uint8_t>(v >> 16);
+        p[2] = static_cast<uint8_t>(v >> 8);
+        p[3] = static_cast<uint8_t>(v);
+    }
+
+    static void writeVarint(uint64_t v, string *out)
+    {
+        while (v >= 0x80)
+        {
+            out->push_back(static_cast<char>(v | 0x80));
+            v >>= 7;
+        }
+        out->push_back(static_cast<char>(v));
+    }
+
+    static bool readVarint(Reader *r, uint64_t *v)
+    {
+        *v = 0;
+        for (int shift = 0; shift < 64; shift += 7)
+        {
+            if (r->p == r->end)
+            {
+                return false;
+            }
+            uint8_t byte = *r->p++;
+            *v |= static_cast<uint64_t>(byte & 0x7F) << shift;
+            if ((byte & 0x80) == 0)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static void writeString(const string &s, string *out)
+    {
+        writeVarint(s.size(), out);
+        out->append(s);
+    }
+
+    // 字符串必须是合法的UTF-8，否则解码出来的json在dump时会抛异常
+    static bool readString(Reader *r, string *s)
+    {
+        uint64_t len = 0;
+        if (!readVarint(r, &len) || len > static_cast<uint64_t>(r->end - r->p) || !validUtf8(r->p, len))
+        {
+            return false;
+        }
+        s->assign(reinterpret_cast<const char *>(r->p), len);
+        r->p += len;
+        return true;
+    }
+};
+
+#endif
@@ -0,0 +1,106 @@
+#ifndef JSONWRITER_H
+#define JSONWRITER_H
+
+#include "json.hpp"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+using namespace std;
+using json = nlohmann::json;
+
+/*
+server和client公用的json文本写入工具：直接把字段追加到输出缓冲区，不构建json对象。
+字段名由调用方（生成的代码）以字面量写入，这里只负责值的编码，
+字符串按json规则转义，非ASCII字节原样输出（和json::dump()的默认行为一致）。
+*/
+class JsonWriter
+{
+public:
+    static void writeInt(int64_t v, string *out)
+    {
+        // 从后往前写十进制数字，比snprintf少了格式串解析
+        char buf[24];
+        char *end = buf + sizeof buf;
+        char *p = end;
+        uint64_t u = v < 0 ? 0 - static_cast<uint64_t>(v) : static_cast<uint64_t>(v);
+        do
+        {
+            *--p = static_cast<char>('0' + u % 10);
+            u /= 10;
+        } while (u != 0);
+        if (v < 0)
+        {
+            *--p = '-';
+        }
+        out->append(p, end - p);
+    }
+
+    static void writeBool(bool b, string *out)
+    {
+        out->append(b ? "true" : "false");
+    }
+
+    static void writeString(const char *s, size_t len, string *out)
+    {
+        out->push_back('"');
+        // 不需要转义的连续字节整段追加
+        size_t run = 0;
+        for (size_t i = 0; i < len; ++i)
+        {
+            unsigned char c = static_cast<unsigned char>(s[i]);
+            if (c >= 0x20 && c != '"' && c != '\\')
+            {
+                continue;
+            }
+            out->append(s + run, i - run);
+            run = i + 1;
+            switch (c)
+            {
+            case '"':
+                out->append("\\\"");
+                break;
+            case '\\':
+                out->append("\\\\");
+                break;
+            case '\b':
+                out->append("\\b");
+                break;
+            case '\f':
+                out->append("\\f");
+                break;
+            case '\n':
+                out->append("\\n");
+                break;
+            case '\r':
+                out->append("\\r");
+                break;
+            case '\t':
+                out->append("\\t");
+                break;
+            default:
+            {
+                char buf[8];
+                snprintf(buf, sizeof buf, "\\u%04x", c);
+                out->append(buf, 6);
+                break;
+            }
+            }
+        }
+        out->append(s + run, len - run);
+        out->push_back('"');
+    }
+
+    static void writeString(const string &s, string *out)
+    {
+        writeString(s.data(), s.size(), out);
+    }
+
+    // json类型的字段本身就是json对象，直接序列化
+    static void writeValue(const json &value, string *out)
+    {
+        out->append(value.dump());
+    }
+};
+
+#endif
@@ -18,6 +18,19 @@ enum EnMsgType
     ADD_GROUP_MSG, // 加入群组
     GROUP_CHAT_MSG, // 群聊天
     LOGINOUT_MSG, // 退出登录消息
+
+    PROTO_MSG, // 协商连接上使用的协议
+    PROTO_MSG_ACK, // 协商协议响应消息
+    OFFLINE_MSG, // 登录之后分批推送的离线消息
+    HEARTBEAT_MSG, // 心跳消息
+    HEARTBEAT_MSG_ACK, // 心跳响应消息
+};
+
+// 连接上使用的协议，没有协商过的连接都是json
+enum EnProtocol
+{
+    PROTO_JSON = 0, // json文本
+    PROTO_BINARY = 1, // 紧凑二进制协议，见binarycodec.hpp
 };
 
 
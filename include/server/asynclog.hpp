@@ -0,0 +1,53 @@
+#ifndef ASYNCLOG_H
+#define ASYNCLOG_H
+
+#include "metrics.hpp"
+
+#include <atomic>
+#include <stdint.h>
+#include <string>
+using namespace std;
+
+/*
+异步日志：muduo的LOG_*默认在调用线程里直接写stdout，磁盘或者管道慢的时候会卡住IO线程。
+start之后LOG_*只把日志行拷贝到内存缓冲（双缓冲），由后台线程写到按大小和天滚动的日志文件里，
+后台线程写不过来时丢弃多余的日志（muduo AsyncLogging的做法），不会阻塞调用的线程。
+LOG_FATAL在abort之前会先把缓冲里的日志写到文件。
+*/
+class AsyncLog
+{
+public:
+    // 日志写到当前目录下basename开头的文件里（muduo LogFile的命名），一个文件超过rollBytes换新文件，
+    // 启动时在创建ChatServer之前调用一次
+    static void start(const string &basename, int64_t rollBytes);
+    // 把缓冲里的日志写到文件，停止后台线程，之后的日志回到stdout。进程退出之前调用
+    static void stop();
+};
+
+/*
+日志限速：可以由客户端或者外部故障大量触发的错误日志（非法帧、数据库或者redis断开）每秒最多记录perSecond条，
+多出来的只计数，下一条记录的日志带上中间丢掉了多少条，同时计入chat_log_suppressed_total{site=...}。
+  static LogRateLimiter limiter("invalid_frame", 10);
+  uint64_t suppressed = 0;
+  if (limiter.allow(&suppressed)) LOG_ERROR << ... << LogRateLimiter::note(suppressed);
+*/
+class LogRateLimiter
+{
+public:
+    LogRateLimiter(const string &site, int perSecond);
+
+    // 这一秒还没超过限制返回true，suppressed是上次记录之后丢掉的条数
+    bool allow(uint64_t *suppressed);
+
+    // 丢掉过日志时附加在日志后面的说明
+    static string note(uint64_t suppressed);
+
+private:
+    const int _perSecond;
+    Metrics::Id _suppressedTotal;
+    atomic<int64_t> _second;
+    atomic<int> _count;
+    atomic<uint64_t> _suppressed;
+};
+
+#endif
@@ -0,0 +1,112 @@
+#ifndef BALANCEDSERVER_H
+#define BALANCEDSERVER_H
+
+#include <muduo/base/noncopyable.h>
+#include <muduo/net/Callbacks.h>
+#include <muduo/net/Channel.h>
+#include <muduo/net/EventLoop.h>
+#include <muduo/net/EventLoopThreadPool.h>
+#include <muduo/net/InetAddress.h>
+#include <muduo/net/TcpConnection.h>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include "loopselector.hpp"
+using namespace std;
+using namespace muduo;
+using namespace muduo::net;
+
+/*
+和muduo TcpServer用法一样的服务器，区别是新连接交给LoopSelector分配IO loop，而不是固定轮询。
+muduo的TcpServer选loop的逻辑写死在私有的newConnection里，没有扩展点，
+所以这里自己监听、接受连接，连接本身还是muduo的TcpConnection，建立和销毁的流程和TcpServer一致。
+接受连接、连接表都在构造时传入的loop线程里。
+*/
+class BalancedServer : noncopyable
+{
+public:
+    typedef function<void(EventLoop *)> ThreadInitCallback;
+    // 接管过来的连接建立之后，在连接所属的IO线程里回调
+    typedef function<void(const TcpConnectionPtr &)> AdoptCallback;
+
+    // 连接和它的socket fd，不停机升级时把fd交给新进程
+    struct ConnectionInfo
+    {
+        TcpConnectionPtr conn;
+        int sockfd;
+    };
+
+    // 一次读事件最多接受的连接数，重连风暴时不用每个连接都回一次epoll，也不会饿死loop上的其他事件
+    static const int kMaxAcceptsPerEvent = 64;
+
+    BalancedServer(EventLoop *loop,
+                   const InetAddress &listenAddr,
+                   const string &nameArg,
+                   bool reusePort,
+                   LoopSelector::Policy policy,
+                   int listenFd = -1);
+    ~BalancedServer();
+
+    const string &name() const { return _name; }
+    EventLoop *getLoop() const { return _loop; }
+
+    // 和TcpServer一样，0表示连接都在loop自己的线程里处理
+    void setThreadNum(int numThreads);
+    void setThreadInitCallback(const ThreadInitCallback &cb) { _threadInitCallback = cb; }
+    void setConnectionCallback(const ConnectionCallback &cb) { _connectionCallback = cb; }
+    void setMessageCallback(const MessageCallback &cb) { _messageCallback = cb; }
+
+    // 启动IO线程并开始监听
+    void start();
+
+    // 各个IO loop的负载统计
+    vector<LoopStats> loopStats() const { return _selector.stats(); }
+
+    // 以下都只能在构造时传入的loop线程里调用
+    int listenFd() const { return _listenFd; }
+    // 停止接受新连接，监听socket不关闭
+    void stopAccepting();
+    // stopAccepting之后重新开始接受新连接
+    void resumeAccepting();
+    // 当前所有的连接
+    vector<ConnectionInfo> connections() const;
+    // 接管一条已经建立的连接，按负载分配IO loop，建立之后调用cb
+    void adoptConnection(int sockfd, const AdoptCallback &cb);
+
+private:
+    // 监听socket可读，接受新连接
+    void handleRead(Timestamp receiveTime);
+    // 把新连接分配给一个IO loop，cb不为空时在连接建立之后调用
+    void newConnection(int sockfd, const InetAddress &peerAddr, const AdoptCallback &cb = AdoptCallback());
+    // 连接关闭，可能在IO线程里调用
+    void removeConnection(const TcpConnectionPtr &conn);
+    void removeConnectionInLoop(const TcpConnectionPtr &conn);
+
+    // 连接表里的一项
+    struct ConnEntry
+    {
+        TcpConnectionPtr conn;
+        int loopIndex;
+        int sockfd;
+    };
+
+    EventLoop *_loop;
+    const string _name;
+    const string _ipPort;
+    int _listenFd; // 构造时传入的是从老进程接过来的、已经在监听的socket
+    int _idleFd; // 文件描述符用完时先关掉它腾出一个，接受之后马上关闭，避免监听socket一直可读
+    Channel _acceptChannel;
+    bool _listening;
+    shared_ptr<EventLoopThreadPool> _threadPool;
+    LoopSelector _selector;
+
+    ConnectionCallback _connectionCallback;
+    MessageCallback _messageCallback;
+    ThreadInitCallback _threadInitCallback;
+
+    int _nextConnId;
+    unordered_map<string, ConnEntry> _connections;
+};
+
+#endif
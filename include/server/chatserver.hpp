@@ -1,11 +1,73 @@
 #ifndef CHATSERVER_H
 #define CHATSERVER_H
 
-#include <muduo/net/TcpServer.h>
+#include <muduo/net/Channel.h>
 #include <muduo/net/EventLoop.h>
+#include <muduo/net/EventLoopThreadPool.h>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include "balancedserver.hpp"
+#include "idledetector.hpp"
+#include "hotrestart.hpp"
+#include "loginadmission.hpp"
+#include "metrics.hpp"
+#include "metricsserver.hpp"
+#include "overloadguard.hpp"
+using namespace std;
 using namespace muduo;
 using namespace muduo::net;
 
+struct MsgRoute;
+
+// 服务器的线程配置
+struct ServerOptions
+{
+    // 每个cpu核一个IO线程，绑核时是cpu列表的长度
+    static const int kAutoThreads = -1;
+
+    // IO线程数，0表示所有连接都在主线程的loop里处理
+    int threadNum = kAutoThreads;
+
+    // 绑核用的cpu列表，空表示不绑核。主线程（acceptor）绑定cpus[0]，第i个IO线程绑定cpus[i % cpus.size()]；
+    // reusePort模式下主线程也是一个IO loop，第i个IO线程绑定cpus[(i + 1) % cpus.size()]
+    vector<int> cpus;
+
+    // 每个IO loop各自用SO_REUSEPORT监听同一个端口，由内核把新连接分散到各个loop上，
+    // 不再由主线程一个acceptor接受所有连接。这时threadNum是包括主线程在内的loop总数
+    bool reusePort = false;
+
+    // 新连接分配IO loop的策略，reusePort模式下由内核分配，每个loop只处理自己接受的连接
+    LoopSelector::Policy balance = LoopSelector::kLeastConnections;
+
+    // 多少秒没有收到任何消息就断开连接，0表示不检测
+    int idleSeconds = IdleDetector::kDefaultIdleSeconds;
+
+    // 登录准入控制：同时执行的登录数、排队上限和排队期限
+    LoginAdmission::Options login;
+
+    // 本机管理端口，GET /metrics 返回Prometheus格式的指标，0表示不开启
+    uint16_t metricsPort = 0;
+
+    // 采样的聊天消息的各阶段时间写到这个文件（Chrome Trace Event格式），空表示不追踪
+    string tracePath;
+    // 每多少条聊天消息采样一条
+    int traceSampleEvery = 1000;
+
+    // 收到的每一帧录制到这个文件，用ChatReplay重放，空表示不录制
+    string recordPath;
+
+    // 一次数据库连接或者一条语句超过多少毫秒记慢查询日志，0表示不记录
+    int slowQueryMs = 100;
+
+    // IO loop调度延迟超过阈值时推迟或者丢弃低优先级的消息
+    OverloadGuard::Options overload;
+
+    // 从老进程接过来的监听socket，依次给主线程和reusePort模式下各个IO loop的服务器使用，
+    // 用不完的关闭，不够的新建
+    vector<int> listenFds;
+};
+
 
 // 聊天服务器的主类
 class ChatServer
@@ -14,11 +76,19 @@ public:
     // 初始化聊天服务器对象
     ChatServer(EventLoop *loop,
                const InetAddress &listenAddr,
-               const string &nameArg);
+               const string &nameArg,
+               const ServerOptions &options = ServerOptions());
+    ~ChatServer();
 
     // 启动服务
     void start();
 
+    // 不停机升级：在path上等待新进程来接管，start()之后调用
+    void enableHotRestart(const string &path);
+    // 不停机升级：恢复从老进程接过来的连接，start()之后、loop()之前调用，
+    // 所有连接恢复之后通知老进程退出
+    void adopt(Inheritance *inheritance);
+
 private:
     // 上报链接相关信息的回调函数
     void onConnection(const TcpConnectionPtr &);
@@ -28,8 +98,69 @@ private:
                    Buffer *,
                    Timestamp);
 
-    TcpServer _server;  // 组合的muduo库，实现服务器功能的类对象
+    // 把一帧完整的消息[begin, end)分发给业务层
+    void dispatch(const TcpConnectionPtr &,
+                  const MsgRoute &,
+                  const char *begin,
+                  const char *end,
+                  Timestamp);
+
+    // 过载时推迟处理Session里的deferredFrame，seq是它的推迟序号，deferred是推迟的次数
+    void defer(const TcpConnectionPtr &conn, const MsgRoute &route, Timestamp time, uint32_t seq, int deferred);
+
+    // IO线程启动时的回调：按配置绑核，安装空闲检测的时间轮
+    void onThreadInit(EventLoop *loop);
+
+    // 输出拥塞连接的缓冲统计
+    void logFlowStats();
+
+    // 输出各个IO loop的连接数和调度延迟
+    void logLoopStats();
+
+    // 输出登录准入的排队和拒绝统计
+    void logAdmissionStats();
+
+    // 注册各个消息类型的处理耗时，以及流控、IO loop、登录准入的统计
+    void registerMetrics();
+    // 输出指标时取流控、IO loop、登录准入的当前统计
+    void collectMetrics(string *out);
+
+    // 新进程连上了控制socket：冻结所有连接，交给新进程之后退出；交接失败时解冻没发出去的连接，继续服务
+    void handleTakeover();
+    // 在连接所属的IO线程里冻结连接，取出交给新进程的状态
+    static bool freeze(const TcpConnectionPtr &conn, int sockfd, ConnHandoff *handoff);
+    // 交接失败，关掉已经发给新进程的连接（前sentConns个），其余的解冻继续服务
+    void recover(const vector<TcpConnectionPtr> &conns, vector<ConnHandoff> &handoffs, size_t sentConns);
+    // 在连接所属的IO线程里解冻一条没有发出去的连接
+    void resume(const TcpConnectionPtr &conn, ConnHandoff &handoff);
+    // 在新进程里恢复一条接过来的连接
+    void restore(const TcpConnectionPtr &conn, ConnHandoff &handoff);
+
+    // 单帧消息的最大长度，超过还没扫描到完整的对象就认为客户端异常
+    static const size_t kMaxFrameSize = 64 * 1024;
+
+    // 输出统计的间隔（秒）
+    static constexpr double kStatsInterval = 10.0;
+
+    // 给_server或者reusePort模式下每个loop的服务器设置回调
+    void setCallbacks(BalancedServer &server);
+
+    BalancedServer _server; // 接受连接并按负载分配给IO loop，连接本身是muduo的TcpConnection
     EventLoop *_loop;   // 指向事件循环对象的指针
+    InetAddress _listenAddr; // 监听地址，reusePort模式下每个loop都要监听
+    int _threadNum;     // IO线程数，reusePort模式下不包括主线程
+    bool _reusePort;    // 每个loop各自监听
+    unique_ptr<EventLoopThreadPool> _ioLoops; // reusePort模式下主线程之外的IO loop
+    vector<unique_ptr<BalancedServer>> _ioServers; // reusePort模式下每个IO loop上的服务器
+    int _idleSeconds;   // 空闲超时，0表示不检测
+    vector<int> _cpus;  // 绑核用的cpu列表
+    atomic_int _nextCpu{0}; // 下一个启动的IO线程用的cpu列表下标
+    vector<int> _listenFds; // 从老进程接过来的监听socket
+    int _controlFd;     // 不停机升级的控制socket，-1表示没有启用
+    unique_ptr<Channel> _controlChannel;
+    uint16_t _metricsPort; // 管理端口，0表示不开启
+    unique_ptr<MetricsServer> _metrics;
+    vector<Metrics::Id> _handlerTimers; // 下标是msgid，各个消息类型的处理耗时
 };
 
 #endif
\ No newline at end of file
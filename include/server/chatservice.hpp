@@ -13,13 +13,19 @@ using namespace std;
 #include "groupmodel.hpp"
 #include "friendmodel.hpp"
 #include "redis.hpp"
+#include "jsonscanner.hpp"
+#include "messages.hpp"
+#include "responsebuilder.hpp"
+#include "loginadmission.hpp"
+#include "instrumentedmutex.hpp"
 using namespace muduo::net;
 using namespace muduo;
 using json = nlohmann::json;
 
 
-// 表示处理消息的事件u回调方法类型
-using MsgHandler = std::function<void(const TcpConnectionPtr &conn, json &js, Timestamp)>;
+// 表示处理消息的事件u回调方法类型，拿到扫描出的路由字段和一帧原始数据
+// frame直接指向发送方连接的输入缓冲区，只在回调期间有效
+using MsgHandler = std::function<void(const TcpConnectionPtr &conn, const MsgRoute &route, const StringPiece &frame, Timestamp)>;
 
 // 聊天服务器业务类
 class ChatService
@@ -27,24 +33,38 @@ class ChatService
 public:
     // 获取单例对象的接口函数
     static ChatService *instance();
-    // 处理登录业务
-    void login(const TcpConnectionPtr &conn, json &js, Timestamp time);
+    // 启动登录准入控制的工作线程，启动时调用一次
+    void startLoginAdmission(const LoginAdmission::Options &options);
+    // 登录准入的统计
+    AdmissionStats loginStats() const { return _loginAdmission.stats(); }
+    // 登录请求交给准入控制排队，由工作线程执行login
+    void admitLogin(const TcpConnectionPtr &conn, LoginMsg &msg, Timestamp time);
+    // 处理登录业务，在登录准入控制的工作线程里执行
+    void login(const TcpConnectionPtr &conn, LoginMsg &msg, Timestamp time);
     // 处理注册业务
-    void reg(const TcpConnectionPtr &conn, json &js, Timestamp time);
+    void reg(const TcpConnectionPtr &conn, RegMsg &msg, Timestamp time);
     // 一对一聊天业务
-    void oneChat(const TcpConnectionPtr &conn, json &js, Timestamp time);
+    void oneChat(const TcpConnectionPtr &conn, const MsgRoute &route, const StringPiece &frame, Timestamp time);
     // 添加好友业务
-    void addFriend(const TcpConnectionPtr &conn, json &js, Timestamp time);
+    void addFriend(const TcpConnectionPtr &conn, AddFriendMsg &msg, Timestamp time);
     // 创建群组业务
-    void createGroup(const TcpConnectionPtr &conn, json &js, Timestamp time);
+    void createGroup(const TcpConnectionPtr &conn, CreateGroupMsg &msg, Timestamp time);
     // 加入群组业务
-    void addGroup(const TcpConnectionPtr &conn, json &js, Timestamp time);
+    void addGroup(const TcpConnectionPtr &conn, AddGroupMsg &msg, Timestamp time);
     // 群组聊天业务
-    void groupChat(const TcpConnectionPtr &conn, json &js, Timestamp time);
+    void groupChat(const TcpConnectionPtr &conn, const MsgRoute &route, const StringPiece &frame, Timestamp time);
     // 处理注销业务
-    void loginout(const TcpConnectionPtr &conn, json &js, Timestamp time);
+    void loginout(const TcpConnectionPtr &conn, LoginoutMsg &msg, Timestamp time);
+    // 协商连接上使用的协议
+    void negotiate(const TcpConnectionPtr &conn, ProtoMsg &msg, Timestamp time);
+    // 心跳，连接的空闲计时在ChatServer收到任何消息时都会刷新，这里只回应
+    void heartbeat(const TcpConnectionPtr &conn, HeartbeatMsg &msg, Timestamp time);
     // 处理客户端异常退出
     void clientCloseException(const TcpConnectionPtr &conn);
+    // 不停机升级：恢复从老进程接过来的连接上的登录状态，在连接所属的IO线程里调用
+    void restoreSession(const TcpConnectionPtr &conn, int userid, vector<string> offlinemsg);
+    // 不停机升级失败：连接已经交给了新进程，从在线表里去掉、取消订阅，数据库里的状态不变
+    void releaseSession(const TcpConnectionPtr &conn);
     // 服务器异常，业务重置方法
     void reset();
     // 获取消息对应的处理器
@@ -55,14 +75,25 @@ private:
     // 单例模式？ 构造函数私有化
     ChatService();
 
+    // 登录成功，按快照v2发送好友和群组
+    void loginSnapshot(const TcpConnectionPtr &conn, LoginMsg &msg, User &user, vector<string> &offlinemsg);
+    // 登录之后分批推送离线消息，见OfflineStream，都在连接所属的IO线程里调用
+    void startOfflineStream(const TcpConnectionPtr &conn, int userid, vector<string> msgs);
+    void resumeOfflineStream(const TcpConnectionPtr &conn);
+    void stopOfflineStream(const TcpConnectionPtr &conn);
+    // 离线消息已经从数据库删掉、放进了登录响应：回到IO线程确认连接还在，断开了就存回数据库
+    void keepOfflineIfClosed(const TcpConnectionPtr &conn, int userid, vector<string> msgs);
+    // 发给冻结连接、跨线程排队的聊天消息存成离线消息，在连接所属的IO线程里调用
+    void spillFrozen(const TcpConnectionPtr &conn, const string &frame);
+
     // 存储消息id和其对应的业务处理方法
     unordered_map<int, MsgHandler> _msgHandlerMap;
 
     // 存储在线用户的通信连接
     unordered_map<int, TcpConnectionPtr> _userConnMap;
 
-    // 定义互斥锁，保证_userCOnnMap的线程安全
-    mutex _connMutex;
+    // 定义互斥锁，保证_userCOnnMap的线程安全，按调用点统计等锁和持锁时间
+    InstrumentedMutex _connMutex;
 
     // 数据操作类对象
     UserModel _userModel;
@@ -72,6 +103,12 @@ private:
 
     // redis操作对象
     Redis _redis;
+
+    // 响应构造，内容固定的响应在这里预先编码好
+    ResponseBuilder _responses;
+
+    // 登录准入控制，最后一个成员：最先析构，等正在执行的登录结束之后其他成员才析构
+    LoginAdmission _loginAdmission;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,22 @@
+#ifndef CPUAFFINITY_H
+#define CPUAFFINITY_H
+
+#include <string>
+#include <vector>
+using namespace std;
+
+// IO线程绑核用的工具函数
+class CpuAffinity
+{
+public:
+    // 在线的cpu核数
+    static int onlineCpus();
+
+    // 解析cpu列表，格式和taskset -c一样，例如"0-3,8,10-11"
+    static bool parseCpuList(const string &text, vector<int> *cpus);
+
+    // 把当前线程绑定到cpu上
+    static bool pinCurrentThread(int cpu);
+};
+
+#endif
@@ -22,6 +22,12 @@ public:
     // 获取连接
     MYSQL *getConnection();
 
+    // 慢查询阈值（毫秒），一次连接或者一条语句（执行加取结果）超过阈值时记录日志，0表示不记录
+    static void setSlowQueryMs(int ms);
+    // 语句的指纹：字符串和数字常量换成?，连续的空白合成一个空格，
+    // 同一个model方法拼出来的语句指纹相同，按指纹统计耗时
+    static string fingerprint(const string &sql);
+
 private:
     MYSQL *_conn;
 
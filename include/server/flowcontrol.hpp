@@ -0,0 +1,125 @@
+#ifndef FLOWCONTROL_H
+#define FLOWCONTROL_H
+
+#include <muduo/net/TcpConnection.h>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+using namespace std;
+using namespace muduo;
+using namespace muduo::net;
+
+// 每条连接的流控状态和统计，保存在Session里
+struct FlowState
+{
+    // 输出缓冲区里的字节数，在连接所属的IO线程里发送之后更新，写完时清零
+    atomic<size_t> outputBytes{0};
+    // 其他线程转发给这条连接、还没有进入输出缓冲区的字节数
+    atomic<size_t> pendingBytes{0};
+    // outputBytes + pendingBytes出现过的最大值
+    atomic<size_t> peakBytes{0};
+    // 超过高水位之后到输出缓冲区写完之前是拥塞状态
+    atomic_bool congested{false};
+
+    atomic<uint64_t> highWaterHits{0}; // 超过高水位的次数
+    atomic<uint64_t> spilled{0};       // 拥塞时改存离线消息的条数
+    atomic<uint64_t> dropped{0};       // 拥塞时丢弃的条数
+
+    // kPause策略下是否暂停了读，只在IO线程里访问
+    bool paused = false;
+
+    size_t buffered() const { return outputBytes.load(memory_order_relaxed) + pendingBytes.load(memory_order_relaxed); }
+};
+
+// 一条连接的缓冲统计
+struct FlowStats
+{
+    string name;
+    int userid;
+    size_t buffered;
+    size_t peak;
+    bool congested;
+    uint64_t highWaterHits;
+    uint64_t spilled;
+    uint64_t dropped;
+};
+
+/*
+连接级的背压和慢消费者处理。业务层所有的发送都经过这里（MsgCodec -> FlowControl::send）：
+- 连接的输出缓冲区超过高水位（muduo的HighWaterMarkCallback）进入拥塞状态，输出缓冲区写完时退出；
+- 拥塞时按策略处理发给它的消息：
+  kPause      暂停读这个客户端的请求，消息照常发送，让它先把积压的收完
+  kSpill      聊天消息改存离线消息，下次登录时再推送
+  kDrop       群聊这类非必要的消息直接丢弃，一对一消息改存离线消息
+  kDisconnect 超过高水位就断开连接，没发出去的聊天消息改存离线消息
+- 不管什么策略，积压超过高水位的kHardLimitFactor倍就断开连接，一个坏客户端不会把服务器拖到OOM；
+- 响应类的消息（登录/注册响应、离线消息推送等）不受策略影响，只受硬上限限制。
+*/
+class FlowControl
+{
+public:
+    enum Policy
+    {
+        kPause,
+        kSpill,
+        kDrop,
+        kDisconnect,
+    };
+
+    // 消息的类别，决定拥塞时怎么处理
+    enum MsgClass
+    {
+        kEssential, // 响应类消息，总是发送
+        kChat,      // 一对一聊天，拥塞时可以改存离线消息
+        kBulk,      // 群聊，kDrop策略下拥塞时可以丢弃
+    };
+
+    // 发送的结果
+    enum Verdict
+    {
+        kSent,    // 已经交给连接发送
+        kSpilled, // 连接拥塞，调用方应该改存离线消息
+        kDropped, // 连接拥塞，按策略丢弃
+    };
+
+    // 硬上限是高水位的倍数
+    static const size_t kHardLimitFactor = 4;
+
+    // 设置策略和高水位，在服务器启动之前调用
+    static void configure(Policy policy, size_t highWaterMark);
+    // 策略名pause/spill/drop/disconnect转成Policy
+    static bool parsePolicy(const string &name, Policy *policy);
+    static const char *policyName(Policy policy);
+
+    // 跨线程排队期间连接被冻结（交给了新进程），排队的聊天消息交给它存成离线消息，在IO线程里调用
+    typedef function<void(const TcpConnectionPtr &, const string &frame)> SpillCallback;
+
+    // 输出缓冲区写完时的回调，离线消息推送用它继续推送下一批
+    static void setDrainCallback(const WriteCompleteCallback &cb);
+    static void setSpillCallback(const SpillCallback &cb);
+
+    // 连接建立之后（已经设置好Session）设置高水位回调并登记到统计里
+    static void attach(const TcpConnectionPtr &conn);
+    // 连接断开时从统计里去掉
+    static void detach(const TcpConnectionPtr &conn);
+
+    // 把一帧交给连接发送，可以在任意线程调用
+    static Verdict send(const TcpConnectionPtr &conn, const StringPiece &frame, MsgClass cls);
+
+    // 输出缓冲区写完时需要收到回调，离线消息推送期间使用，只在IO线程里调用
+    static void watchDrain(const TcpConnectionPtr &conn);
+
+    // 所有连接的缓冲统计
+    static vector<FlowStats> stats();
+
+private:
+    static void onHighWaterMark(const TcpConnectionPtr &conn, size_t bytes);
+    static void onWriteComplete(const TcpConnectionPtr &conn);
+    // 在IO线程里发送，更新输出缓冲区的统计
+    static void sendInLoop(const TcpConnectionPtr &conn, const StringPiece &frame);
+};
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef HOTRESTART_H
+#define HOTRESTART_H
+
+#include <string>
+#include <vector>
+using namespace std;
+
+// 交接给新进程的一条客户端连接
+struct ConnHandoff
+{
+    int fd = -1;
+    int userid = -1;       // 没有登录是-1
+    int protocol = 0;      // 协商好的协议，见EnProtocol
+    string input;          // 输入缓冲区里还没处理的半帧
+    string output;         // 输出缓冲区里还没写出去的字节
+    vector<string> offline; // 还没推送完的离线消息
+};
+
+// 新进程从老进程接过来的全部东西
+struct Inheritance
+{
+    vector<int> listenFds;
+    vector<ConnHandoff> conns;
+    int control = -1; // 和老进程之间的连接，接管完成之后用finish()通知老进程退出
+};
+
+/*
+不停机升级：老进程在一个unix域socket（-u path）上等待新进程来接管，
+新进程启动时带上 -T 连过去，老进程停止接受连接、冻结所有客户端连接，
+用SCM_RIGHTS把监听socket和每条客户端连接的fd连同会话状态交给新进程，
+新进程恢复好连接（用户在线表、redis订阅）之后通知老进程，老进程直接_exit，
+不走数据库里把用户置为offline的流程，客户端不会断开。
+
+控制连接上的格式（同一台机器上，整数都是本机字节序）：
+  新 -> 老  'T'
+  老 -> 新  Record{kind=kHello, count=监听socket数, extra=连接数}
+            每个监听socket Record{kind=kListen} + fd
+            每条连接       Record{kind=kConn, count=负载长度} + fd，之后是负载
+  新 -> 老  'D'
+带fd的Record单独用一次sendmsg发送，接收方读Record时一次recvmsg正好拿到它的fd。
+*/
+class HotRestart
+{
+public:
+    // 老进程：在path上监听接管请求，返回监听的fd，失败返回-1
+    static int listenControl(const string &path);
+    // 老进程：接受一个接管请求，读到'T'之后返回连接的fd，失败返回-1
+    static int acceptTakeover(int listenFd);
+    // 老进程：把监听socket和连接交给新进程，等新进程接管完成。
+    // sentConns是已经发给新进程的连接数（conns的前sentConns个），失败时也有效
+    static bool handoff(int control, const vector<int> &listenFds, const vector<ConnHandoff> &conns,
+                        size_t *sentConns);
+
+    // 新进程：连接path上的老进程，接过监听socket和连接
+    static bool takeover(const string &path, Inheritance *inheritance);
+    // 新进程：接管完成，通知老进程退出
+    static void finish(Inheritance *inheritance);
+};
+
+#endif
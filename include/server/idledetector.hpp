@@ -0,0 +1,65 @@
+#ifndef IDLEDETECTOR_H
+#define IDLEDETECTOR_H
+
+#include <muduo/net/EventLoop.h>
+#include <muduo/net/TcpConnection.h>
+#include <memory>
+#include <vector>
+using namespace std;
+using namespace muduo;
+using namespace muduo::net;
+
+struct Session;
+
+/*
+空闲连接检测，每个IO loop一个时间轮：
+轮上有idleSeconds个格子，每秒转一格，清空最老的一格；连接每收到一条消息（包括HEARTBEAT_MSG）
+就把它的Entry放进当前格子，同一秒内收到多条只放一次。一个Entry的引用全部随格子清空时，
+说明这条连接idleSeconds秒都没有收到消息，析构时forceClose，之后走正常的断开流程
+（ChatServer::onConnection -> ChatService::clientCloseException），用户下线、消息改存离线消息。
+收消息和每秒转动都是O(1)，不用为每条连接单独设定时器。
+换了网络的手机客户端留下的半开连接收不到FIN，只能靠这里清理。
+所有函数都只在loop线程里调用。
+*/
+class IdleDetector
+{
+public:
+    // 默认的空闲超时，客户端每30秒发一次心跳，连续丢3次才断开
+    static const int kDefaultIdleSeconds = 90;
+
+    // 时间轮里的一项，最后一个引用释放时连接空闲超时
+    struct Entry
+    {
+        explicit Entry(IdleDetector *detector, const TcpConnectionPtr &conn);
+        ~Entry();
+
+        IdleDetector *detector;
+        weak_ptr<TcpConnection> conn;
+        int64_t tick; // 最近一次放进的格子对应的时刻，同一格只放一次
+    };
+
+    IdleDetector(EventLoop *loop, int idleSeconds);
+    ~IdleDetector();
+
+    // 在loop上创建时间轮，保存在loop的context里
+    static void install(EventLoop *loop, int idleSeconds);
+    // loop上的时间轮，没有安装返回nullptr
+    static IdleDetector *ofLoop(EventLoop *loop);
+
+    // 新连接开始计时
+    void add(const TcpConnectionPtr &conn, Session *session);
+    // 连接上收到了消息
+    static void touch(Session *session);
+
+private:
+    // 每秒转一格
+    void onTick();
+    void refresh(const shared_ptr<Entry> &entry);
+
+    EventLoop *_loop;
+    vector<vector<shared_ptr<Entry>>> _buckets;
+    int64_t _tick;
+    bool _stopping; // 析构时清空格子不算超时
+};
+
+#endif
@@ -0,0 +1,95 @@
+#ifndef INSTRUMENTEDMUTEX_H
+#define INSTRUMENTEDMUTEX_H
+
+#include "metrics.hpp"
+
+#include <atomic>
+#include <mutex>
+#include <string>
+using namespace std;
+
+/*
+可以统计等锁和持锁时间的互斥锁。每个加锁的地方（调用点）注册一个Site，
+InstrumentedLockGuard按调用点把时间记到直方图里：
+  chat_mutex_wait_us{mutex=..., site=...}       等锁的时间，没有竞争时记0
+  chat_mutex_hold_us{mutex=..., site=...}       持锁的时间
+  chat_mutex_contended_total{mutex=..., site=...} 需要等待的次数
+哪个调用点持锁太久拖慢了其他调用点，对比各个site的hold和wait就能看出来。
+统计可以在运行时打开和关闭（main里是SIGUSR2），关闭时加锁只比std::mutex多读一次原子变量，不读时钟。
+*/
+class InstrumentedMutex
+{
+public:
+    // 一个调用点的统计
+    struct Site
+    {
+        Metrics::Id wait;
+        Metrics::Id hold;
+        Metrics::Id contended;
+    };
+
+    // 注册调用点，启动时（或者第一次用到时）调用
+    static Site site(const string &mutexName, const string &siteName);
+
+    // 打开或者关闭统计，任意线程都可以调用，也可以在信号处理函数里调用
+    static void setEnabled(bool on) { s_enabled.store(on, memory_order_relaxed); }
+    static bool enabled() { return s_enabled.load(memory_order_relaxed); }
+
+    // 和std::mutex一样，不需要统计的地方可以直接用lock_guard
+    void lock() { _mutex.lock(); }
+    bool try_lock() { return _mutex.try_lock(); }
+    void unlock() { _mutex.unlock(); }
+
+private:
+    mutex _mutex;
+    static atomic_bool s_enabled;
+};
+
+// 和lock_guard一样，统计打开时另外记录这个调用点的等锁和持锁时间
+class InstrumentedLockGuard
+{
+public:
+    InstrumentedLockGuard(InstrumentedMutex &mutex, const InstrumentedMutex::Site &site)
+        : _mutex(mutex), _site(site), _lockedUs(0)
+    {
+        if (!InstrumentedMutex::enabled())
+        {
+            _mutex.lock();
+            return;
+        }
+        // 没有竞争时只读一次时钟
+        if (_mutex.try_lock())
+        {
+            _lockedUs = Metrics::nowUs();
+            Metrics::observe(_site.wait, 0);
+            return;
+        }
+        int64_t start = Metrics::nowUs();
+        _mutex.lock();
+        _lockedUs = Metrics::nowUs();
+        Metrics::observe(_site.wait, _lockedUs - start);
+        Metrics::add(_site.contended);
+    }
+
+    ~InstrumentedLockGuard()
+    {
+        if (_lockedUs == 0)
+        {
+            _mutex.unlock();
+            return;
+        }
+        int64_t held = Metrics::nowUs() - _lockedUs;
+        _mutex.unlock();
+        Metrics::observe(_site.hold, held);
+    }
+
+    InstrumentedLockGuard(const InstrumentedLockGuard &) = delete;
+    InstrumentedLockGuard &operator=(const InstrumentedLockGuard &) = delete;
+
+private:
+    InstrumentedMutex &_mutex;
+    InstrumentedMutex::Site _site;
+    int64_t _lockedUs; // 0表示加锁时统计是关闭的
+};
+
+#endif
@@ -0,0 +1,38 @@
+#ifndef JSONSCANNER_H
+#define JSONSCANNER_H
+
+#include <cstddef>
+
+// 从一帧json文本中按需提取出来的路由字段，字段不存在或者不是整数时为-1
+struct MsgRoute
+{
+    int msgid = -1;
+    int id = -1;
+    int toid = -1;
+    int groupid = -1;
+    int protocol = 0; // 帧的编码，见EnProtocol
+};
+
+/*
+按需json扫描器：不构建json对象（DOM），只扫描顶层对象，把msgid/id/toid/groupid几个整数字段取出来，
+其余的字段只做结构上的跳过。字符串和嵌套对象的跳过在支持SSE2的平台上一次比较16个字节。
+同时它也负责切帧：扫描到顶层对象的右括号就是一帧的结束。
+*/
+class JsonScanner
+{
+public:
+    enum Status
+    {
+        kComplete,   // 扫描到了一个完整的顶层对象
+        kIncomplete, // 数据还不完整，需要等待更多的数据
+        kInvalid,    // 不是合法的json对象
+    };
+
+    // 从[begin, end)扫描一个顶层json对象，kComplete时*frameEnd指向对象右括号的下一个字节
+    static Status scan(const char *begin, const char *end, MsgRoute *route, const char **frameEnd);
+
+    // 跳过帧与帧之间的分隔符（客户端发送的'\0'以及空白字符）
+    static const char *skipDelimiters(const char *begin, const char *end);
+};
+
+#endif
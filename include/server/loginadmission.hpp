@@ -0,0 +1,97 @@
+#ifndef LOGINADMISSION_H
+#define LOGINADMISSION_H
+
+#include <muduo/base/noncopyable.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+using namespace std;
+
+// 登录准入的统计
+struct AdmissionStats
+{
+    int running;         // 正在执行的登录
+    size_t queued;       // 排队等待的登录
+    int64_t admitted;    // 执行过的登录
+    int64_t rejected;    // 队列满了直接拒绝的
+    int64_t expired;     // 排队超过期限没有执行的
+    int64_t waitUs;      // 排队时间（微秒，滑动平均）
+    int64_t maxWaitUs;   // 出现过的最长排队时间
+    int64_t serviceUs;   // 一次登录的执行时间（微秒，滑动平均）
+};
+
+/*
+登录准入控制。节点重启之后所有客户端同时重连、同时发LOGIN_MSG，每次登录要串行查好几次数据库，
+原来在IO线程里执行，整个loop上已登录用户的聊天消息都要排在这些查询后面。
+登录改为交给固定数量的工作线程执行，同时执行的登录数就是工作线程数（数据库的并发压力有上限），
+其余的排队；队列满了，或者排队超过期限还没轮到，不再执行而是回复客户端多久之后重试，
+重试时间按当前的排队长度和平均执行时间估算，再加上随机抖动，避免被拒绝的客户端又同时回来。
+IO线程只负责解码和入队，聊天消息不受登录风暴影响。
+concurrency为0时不启动工作线程，登录和原来一样在IO线程里直接执行。
+*/
+class LoginAdmission : muduo::noncopyable
+{
+public:
+    struct Options
+    {
+        int concurrency = 8;      // 同时执行的登录数（工作线程数）
+        size_t queueSize = 1024;  // 排队的上限
+        int deadlineMs = 3000;    // 排队超过这个时间就不再执行
+    };
+
+    typedef function<void()> Task;
+    // 登录没有执行，参数是建议客户端多久之后重试（毫秒）
+    typedef function<void(int retryAfterMs)> RejectCallback;
+
+    // 建议的重试时间范围（毫秒）
+    static const int kMinRetryAfterMs = 1000;
+    static const int kMaxRetryAfterMs = 30000;
+
+    LoginAdmission();
+    ~LoginAdmission();
+
+    // 启动工作线程，只调用一次
+    void start(const Options &options);
+
+    // 提交一个登录，在IO线程里调用：排上队的由工作线程执行run，否则调用reject
+    void submit(const Task &run, const RejectCallback &reject);
+
+    AdmissionStats stats() const;
+
+private:
+    typedef chrono::steady_clock Clock;
+
+    struct Pending
+    {
+        Task run;
+        RejectCallback reject;
+        Clock::time_point enqueued;
+    };
+
+    // 工作线程
+    void workerLoop();
+    // 按排队长度估算的重试时间
+    int retryAfterMs(size_t queued);
+
+    Options _options;
+    mutable mutex _mutex;
+    condition_variable _cond;
+    deque<Pending> _queue;
+    vector<thread> _workers;
+    bool _stopping;
+
+    atomic_int _running;
+    atomic<int64_t> _admitted;
+    atomic<int64_t> _rejected;
+    atomic<int64_t> _expired;
+    atomic<int64_t> _waitUs;
+    atomic<int64_t> _maxWaitUs;
+    atomic<int64_t> _serviceUs;
+};
+
+#endif
@@ -0,0 +1,71 @@
+#ifndef LOGINSNAPSHOT_H
+#define LOGINSNAPSHOT_H
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include "user.hpp"
+#include "group.hpp"
+using namespace std;
+
+/*
+登录快照v2：登录成功的响应里好友、群组、群成员都用嵌套数组表示，不再是一层层dump出来的json字符串。
+每个用户在users里只出现一次，好友和群成员都按id引用，同一个人在很多群里也只编码一次。
+{"msgid":2,"errno":0,"id":1,"name":"zhang san","snapshot":2,
+ "users":[[id,"name","state"],...],
+ "friendver":3,"friends":[id,...],
+ "groups":[[id,"groupname","groupdesc",[[userid,"role"],...],version],...],
+ "offlinemsg":["...",...]}
+客户端的snapshot版本>=3时离线消息不放在响应里，只发"offlinecount":条数，之后用OFFLINE_MSG分批推送，见OfflineStream。
+
+增量同步：客户端在LOGIN_MSG里带上本地保存的friendver和groupvers（[[groupid,version],...]），
+- 好友列表版本一致时不发friends，只发"online":[在线好友的id]，客户端沿用本地的好友列表并刷新状态；
+- 群组版本一致时这个群只发[id,version]，客户端沿用本地的群信息；
+- 没有出现在groups里的本地群组说明已经不在群里了。
+二进制协议下结构相同，数组用BinaryCodec的数组编码，id放在帧头里。
+和idl生成的消息结构体一样提供toJsonText/toBinary，由MsgCodec::sendMsg直接编码到发送缓冲区。
+*/
+class LoginSnapshot
+{
+public:
+    enum
+    {
+        kVersion = 2,
+        kStreamOffline = 3, // 离线消息在响应之后分批推送
+    };
+
+    // 引用的好友、群组和离线消息在快照发送完之前必须有效
+    LoginSnapshot(User &user, const vector<string> &offlinemsg);
+
+    // 好友列表，changed为false时客户端已有这个版本的好友列表
+    void setFriends(vector<User> &friends, int version, bool changed);
+    // 群组列表，knownVersions里版本一致的群组客户端已经有了
+    void setGroups(vector<Group> &groups, const unordered_map<int, int> &knownVersions);
+    // 离线消息在响应之后分批推送，响应里只带条数
+    void setOfflineCount(int count) { _offlineCount = count; }
+
+    void toJsonText(string *out) const;
+    void toBinary(string *out) const;
+
+private:
+    User &_user;
+    const vector<string> &_offlinemsg;
+
+    vector<User> *_friends = nullptr;
+    int _friendVersion = 0;
+    bool _friendsChanged = true;
+
+    vector<Group> *_groups = nullptr;
+    // 和_groups一一对应，需要发送完整群信息的群组
+    vector<bool> _groupsChanged;
+
+    int _offlineCount = -1; // 小于0表示离线消息放在响应里
+
+    // 去重后的用户表，按第一次出现的顺序，只包括需要发送的好友和群成员
+    vector<User *> _users;
+    unordered_map<int, size_t> _userIndex;
+
+    void addUser(User *user);
+};
+
+#endif
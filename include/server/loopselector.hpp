@@ -0,0 +1,95 @@
+#ifndef LOOPSELECTOR_H
+#define LOOPSELECTOR_H
+
+#include <muduo/base/Timestamp.h>
+#include <muduo/net/EventLoop.h>
+#include <muduo/net/InetAddress.h>
+#include <muduo/net/TimerId.h>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+using namespace std;
+using namespace muduo;
+using namespace muduo::net;
+
+// 一个IO loop的负载统计
+struct LoopStats
+{
+    int index;
+    int connections; // 分配到这个loop上的连接数
+    int64_t lagUs;   // loop的调度延迟（微秒，滑动平均）
+    int64_t maxLagUs; // 出现过的最大调度延迟
+    bool overloaded;  // 调度延迟超过了OverloadGuard的阈值
+};
+
+/*
+新连接分配给哪个IO loop。muduo的TcpServer固定轮询，不看各个loop的负载，
+大群里的活跃用户碰巧集中到一个loop上时这个loop会很忙而其他loop闲着。
+每个loop上有一个定时探针测量调度延迟：定时器实际触发的时间比预期晚了多少，
+loop在处理耗时的回调时延迟就会上升，比连接数更直接地反映loop有多忙。
+- kRoundRobin       轮询，和muduo TcpServer一样
+- kLeastConnections 连接数最少的loop
+- kLeastLag         调度延迟最低的几个loop（相差不超过kLagToleranceUs）里连接数最少的
+- kPeerHash         按客户端ip哈希，同一个客户端（或者同一个NAT出口）重连之后还在同一个loop上
+select在接受连接的线程里调用，连接数和延迟在各个loop线程里更新。
+*/
+class LoopSelector
+{
+public:
+    enum Policy
+    {
+        kRoundRobin,
+        kLeastConnections,
+        kLeastLag,
+        kPeerHash,
+    };
+
+    // 调度延迟探针的间隔（秒）
+    static constexpr double kProbeInterval = 0.1;
+    // 调度延迟相差在这个范围之内认为一样忙
+    static const int64_t kLagToleranceUs = 1000;
+
+    explicit LoopSelector(Policy policy);
+    ~LoopSelector();
+
+    // 策略名rr/conn/lag/hash转成Policy
+    static bool parsePolicy(const string &name, Policy *policy);
+    static const char *policyName(Policy policy);
+
+    // 开始在每个loop上测量调度延迟
+    void start(const vector<EventLoop *> &loops);
+
+    // 给新连接选一个loop，返回下标
+    int select(const InetAddress &peerAddr);
+    EventLoop *loopAt(int index) const { return _loads[index]->loop; }
+
+    // 连接分配到loop上 / 从loop上断开
+    void connectionAdded(int index);
+    void connectionRemoved(int index);
+
+    // 各个loop的负载统计，可以在任意线程调用
+    vector<LoopStats> stats() const;
+
+private:
+    // 每个loop的负载，连接数和延迟可以跨线程读取
+    struct LoopLoad
+    {
+        EventLoop *loop = nullptr;
+        TimerId probeTimer;
+        atomic_int connections{0};
+        atomic<int64_t> lagUs{0};
+        atomic<int64_t> maxLagUs{0};
+        atomic_bool overloaded{false};
+        Timestamp lastProbe; // 只在loop线程里访问
+    };
+
+    // 在loop线程里测量一次调度延迟
+    void probe(LoopLoad *load);
+
+    Policy _policy;
+    vector<unique_ptr<LoopLoad>> _loads;
+    size_t _next; // 轮询的下一个下标，只在接受连接的线程里访问
+};
+
+#endif
@@ -0,0 +1,76 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+#include <chrono>
+#include <functional>
+#include <string>
+using namespace std;
+
+/*
+进程内的指标：计数器和直方图，按Prometheus文本格式输出，见MetricsServer。
+每个线程有自己的一份计数（第一次记录时创建，线程退出后保留），记录时只写本线程的内存，
+不加锁也没有原子的读改写；输出时把所有线程的计数加起来，读到的值可能比正在写的线程慢一点。
+直方图和HdrHistogram一样按对数分档：每个2的幂区间再等分kSubBuckets档，相对误差不超过1/kSubBuckets，
+从0到2^40都是同样的精度，不用事先知道取值范围。输出的桶边界le是0、1、3、7……2^k-1，正好是档的上界。
+指标在启动时（或者第一次用到时）注册，注册之后用返回的Id记录。
+labels是花括号里的内容，比如 op="query"，同名指标的各个labels是同一族的不同序列。
+*/
+class Metrics
+{
+public:
+    typedef int Id;
+    // 输出时额外追加的指标，比如从其他模块的统计里取的gauge
+    typedef function<void(string *out)> Collector;
+
+    // 每个2的幂区间分多少档
+    static const int kSubBuckets = 8;
+    // 最多可以注册的计数器和直方图
+    static const int kMaxCounters = 128;
+    static const int kMaxHistograms = 128;
+
+    // 注册计数器，同名同labels的重复注册返回同一个Id
+    static Id counter(const string &name, const string &help, const string &labels = "");
+    // 注册直方图
+    static Id histogram(const string &name, const string &help, const string &labels = "");
+    // 注册输出时调用的Collector
+    static void addCollector(const Collector &collector);
+
+    // 计数器加n
+    static void add(Id counter, uint64_t n = 1);
+    // 直方图记录一个值，负数按0记录
+    static void observe(Id histogram, int64_t value);
+
+    // 单调时钟（微秒），计时用
+    static int64_t nowUs()
+    {
+        return chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // 所有指标的Prometheus文本格式
+    static string render();
+
+    // 直接读取当前值，给压测工具之类不走Prometheus的地方用
+    static uint64_t counterValue(Id counter);
+    static uint64_t histogramCount(Id histogram);
+    // 分位数q（0到1）所在的档里最大的值，没有记录过返回0
+    static int64_t quantile(Id histogram, double q);
+
+    // 给Collector用：一族指标的HELP和TYPE，一个样本
+    static void writeHeader(string *out, const string &name, const char *type, const string &help);
+    static void writeSample(string *out, const string &name, const string &labels, double value);
+};
+
+// 作用域计时：析构时把经过的时间（微秒）记到直方图里
+class ScopedTimer
+{
+public:
+    explicit ScopedTimer(Metrics::Id histogram) : _histogram(histogram), _start(Metrics::nowUs()) {}
+    ~ScopedTimer() { Metrics::observe(_histogram, Metrics::nowUs() - _start); }
+
+private:
+    Metrics::Id _histogram;
+    int64_t _start;
+};
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef METRICSSERVER_H
+#define METRICSSERVER_H
+
+#include <muduo/net/TcpServer.h>
+#include <muduo/net/EventLoop.h>
+using namespace muduo;
+using namespace muduo::net;
+
+/*
+管理端口：GET /metrics 返回Metrics::render()的Prometheus文本，其他路径返回404。
+只实现抓取需要的最小HTTP：读到请求头结束就响应，响应之后关闭连接。
+跑在传入的loop上（主线程），不占用IO线程；应该只监听本机地址。
+*/
+class MetricsServer
+{
+public:
+    // 请求头的最大长度，超过就关闭连接
+    static const size_t kMaxRequestSize = 8 * 1024;
+
+    MetricsServer(EventLoop *loop, const InetAddress &listenAddr);
+
+    void start();
+
+private:
+    void onConnection(const TcpConnectionPtr &conn);
+    void onMessage(const TcpConnectionPtr &conn, Buffer *buffer, Timestamp time);
+
+    TcpServer _server;
+};
+
+#endif
@@ -15,6 +15,9 @@ public:
     // 返回用户的好友列表
     vector<User> query(int userid);
 
+    // 返回用户好友列表的版本号，好友列表每变化一次加一
+    int queryVersion(int userid);
+
 };
 
 #endif
\ No newline at end of file
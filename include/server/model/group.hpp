@@ -10,26 +10,30 @@ using namespace std;
 class Group
 {
 public:
-    Group(int id = -1, string name = "", string desc = "")
+    Group(int id = -1, string name = "", string desc = "", int version = 0)
     {
         this->id = id;
         this->name = name;
         this->desc = desc;
+        this->version = version;
     }
 
     void setId(int id) {this->id = id;}
     void setName(string name) {this->name = name;}
     void setDesc(string desc) {this->desc = desc;}
+    void setVersion(int version) {this->version = version;}
 
     int getId() {return this->id;}
     string getName() {return this->name;}
     string getDesc() {return this->desc;}
+    int getVersion() {return this->version;}
     vector<GroupUser> &getUsers() {return this->users;}
 
 private:
     int id;
     string name;
     string desc;
+    int version; // 群成员每变化一次加一
     vector<GroupUser> users;
 };
 
@@ -4,6 +4,7 @@
 #include "group.hpp"
 #include <string>
 #include <vector>
+#include <unordered_map>
 
 using namespace std;
 
@@ -19,6 +20,10 @@ public:
     // 查询用户所在群组信息
     vector<Group> queryGroups(int userid);
 
+    // 查询用户所在群组信息，knownVersions是客户端已有的群组版本（groupid => version），
+    // 版本一致的群组只返回群组本身，不再查询群成员
+    vector<Group> queryGroups(int userid, const unordered_map<int, int> &knownVersions);
+
     // 根据指定的groupid查询群组用户id列表，除userid自己，主要用户群聊业务给群组其他成员群发消息
     vector<int> queryGroupUsers(int userid, int groupid);
 
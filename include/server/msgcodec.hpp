@@ -0,0 +1,116 @@
+#ifndef MSGCODEC_H
+#define MSGCODEC_H
+
+#include <muduo/net/TcpConnection.h>
+#include <json.hpp>
+#include <string>
+#include "flowcontrol.hpp"
+#include "jsonscanner.hpp"
+#include "messages.hpp"
+#include <muduo/base/Logging.h>
+using namespace std;
+using namespace muduo;
+using namespace muduo::net;
+using json = nlohmann::json;
+
+// 预先按两种协议各编码好的一条消息，内容固定的响应只在启动时编码一次
+struct EncodedMsg
+{
+    string text;   // json文本
+    string binary; // 二进制帧
+};
+
+// 按照每条连接协商好的协议编码消息，业务层发送消息都经过这里，编码好的帧交给FlowControl发送
+class MsgCodec
+{
+public:
+    // 按照连接上的协议发送一条消息
+    static FlowControl::Verdict send(const TcpConnectionPtr &conn, const json &js,
+                                     FlowControl::MsgClass cls = FlowControl::kEssential);
+
+    // 发送一条json文本消息（redis通道上收到的消息、离线消息都是json文本）
+    static FlowControl::Verdict sendText(const TcpConnectionPtr &conn, const string &text,
+                                         FlowControl::MsgClass cls = FlowControl::kChat);
+
+    // 把收到的一帧转发给conn，两边协议一致时原样转发，不一致时转码。
+    // 返回kSpilled时接收方拥塞，调用方应该把消息存成离线消息
+    static FlowControl::Verdict forward(const TcpConnectionPtr &conn, const MsgRoute &route, const StringPiece &frame,
+                                        FlowControl::MsgClass cls = FlowControl::kChat);
+
+    // 把收到的一帧转成json文本，跨服务器转发和离线存储统一使用json文本。
+    // 解码失败或者不是合法的UTF-8时返回空字符串，调用方应该丢掉这一帧
+    static string toJsonText(const MsgRoute &route, const StringPiece &frame);
+
+    // 把收到的一帧解码成json对象
+    static bool decode(const MsgRoute &route, const StringPiece &frame, json *js);
+
+    // 把收到的一帧解码成idl生成的消息结构体，二进制帧直接从字节读取，不构建json对象
+    template <typename Msg>
+    static bool decodeMsg(const MsgRoute &route, const StringPiece &frame, Msg *msg);
+
+    // 按照连接上的协议发送一条idl生成的消息结构体，直接编码到线程局部的缓冲区，不构建json对象
+    template <typename Msg>
+    static void sendMsg(const TcpConnectionPtr &conn, const Msg &msg);
+
+    // 把消息按两种协议各编码一份
+    template <typename Msg>
+    static EncodedMsg encode(const Msg &msg);
+
+    // 按照连接上的协议发送预先编码好的消息
+    static void sendEncoded(const TcpConnectionPtr &conn, const EncodedMsg &msg);
+
+private:
+    // 连接上协商好的协议，见EnProtocol
+    static int protocolOf(const TcpConnectionPtr &conn);
+
+    // 编码用的线程局部缓冲区，clear()之后保留容量，发送响应时不再分配内存
+    static string &scratch();
+};
+
+template <typename Msg>
+bool MsgCodec::decodeMsg(const MsgRoute &route, const StringPiece &frame, Msg *msg)
+{
+    if (route.protocol == PROTO_BINARY)
+    {
+        return msg->fromBinary(frame.data(), frame.size());
+    }
+
+    try
+    {
+        return msg->fromJson(json::parse(frame.begin(), frame.end()));
+    }
+    catch (const json::exception &e)
+    {
+        LOG_ERROR << "json parse error:" << e.what();
+        return false;
+    }
+}
+
+template <typename Msg>
+void MsgCodec::sendMsg(const TcpConnectionPtr &conn, const Msg &msg)
+{
+    // 在连接所属的IO线程里直接写socket或者输出缓冲区，在其他线程里会拷贝一份，
+    // 所以缓冲区在send返回之后就可以复用
+    string &buf = scratch();
+    buf.clear();
+    if (protocolOf(conn) == PROTO_BINARY)
+    {
+        msg.toBinary(&buf);
+    }
+    else
+    {
+        msg.toJsonText(&buf);
+    }
+    FlowControl::send(conn, buf, FlowControl::kEssential);
+}
+
+template <typename Msg>
+EncodedMsg MsgCodec::encode(const Msg &msg)
+{
+    EncodedMsg encoded;
+    msg.toJsonText(&encoded.text);
+    msg.toBinary(&encoded.binary);
+    return encoded;
+}
+
+#endif
@@ -0,0 +1,47 @@
+#ifndef OFFLINESTREAM_H
+#define OFFLINESTREAM_H
+
+#include <muduo/net/TcpConnection.h>
+#include <string>
+#include <vector>
+using namespace std;
+using namespace muduo::net;
+
+/*
+登录之后把离线消息分批推送给客户端，不再整个塞进LOGIN_MSG_ACK：
+{"msgid":OFFLINE_MSG,"remain":还没推送的条数,"msgs":[离线消息,...]}
+json协议下离线消息本身就是json文本，原样嵌进msgs数组；二进制协议下作为字符串发送。
+流控：连接的输出缓冲区超过kHighWaterMark就暂停，等输出缓冲区写完（WriteCompleteCallback）再继续，
+慢客户端的离线消息积压不会一次全部编码进输出缓冲区。
+只在连接所属的IO线程里访问。
+*/
+class OfflineStream
+{
+public:
+    // 每批最多的消息条数和字节数
+    static const size_t kBatchMsgs = 64;
+    static const size_t kBatchBytes = 16 * 1024;
+    // 输出缓冲区超过这个大小就暂停推送
+    static const size_t kHighWaterMark = 64 * 1024;
+
+    OfflineStream(int userid, vector<string> msgs);
+
+    // 推送到输出缓冲区超过高水位或者全部推送完，全部推送完返回true
+    bool pump(const TcpConnectionPtr &conn);
+
+    // 离线消息属于哪个用户
+    int userid() const { return _userid; }
+
+    // 取出还没有推送的离线消息，连接断开或者用户注销时存回数据库
+    vector<string> takeRemaining();
+
+private:
+    int _userid;
+    vector<string> _msgs;
+    size_t _next; // 下一条要推送的消息
+
+    // 编码[_next, end)这一批消息
+    void encodeBatch(int protocol, size_t end, string *out) const;
+};
+
+#endif
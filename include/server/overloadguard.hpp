@@ -0,0 +1,53 @@
+#ifndef OVERLOADGUARD_H
+#define OVERLOADGUARD_H
+
+#include <stdint.h>
+using namespace std;
+
+/*
+IO loop过载时推迟或者丢弃低优先级的消息。handler在IO线程里同步查MySQL，
+loop的调度延迟（LoopSelector的探针测量，滑动平均）是最直接的饱和信号：
+延迟超过阈值认为这个loop过载，降到阈值的一半以下才恢复，避免在阈值附近来回切换。
+过载的loop上：
+- 加好友、建群、加群推迟deferSeconds秒再处理，最多推迟maxDefers次，之后不管是否过载都处理，
+  这些是没有响应、客户端也不会重发的写操作，不能丢；
+  推迟期间同一条连接后面的消息（包括聊天）都等它处理完再按顺序处理，不会跑到它前面；
+  推迟期间客户端断开连接的话，推迟的和后面排着的消息都不再处理
+- 心跳不回复：收到心跳时空闲检测已经刷新过，客户端也不等心跳响应
+聊天、登录等其他消息本身不推迟。过载状态是每个loop线程各自的，只影响这个loop上的连接。
+*/
+class OverloadGuard
+{
+public:
+    struct Options
+    {
+        // 调度延迟超过多少微秒认为过载，0表示不检测
+        int64_t lagThresholdUs = 50000;
+        // 推迟多久再处理
+        double deferSeconds = 0.5;
+        // 最多推迟几次
+        int maxDefers = 4;
+    };
+
+    // 过载时对一条消息的处理
+    enum Action
+    {
+        kRun,   // 正常处理
+        kDefer, // 推迟处理
+        kShed,  // 丢弃
+    };
+
+    // 设置阈值，在服务器启动之前调用
+    static void configure(const Options &options);
+    static const Options &options();
+
+    // 探针在loop线程里报告调度延迟，返回这个loop是否过载
+    static bool reportLag(int64_t lagUs);
+    // 当前线程的loop是否过载
+    static bool overloaded();
+
+    // 当前线程收到的消息怎么处理，deferred是这条消息已经推迟过的次数
+    static Action admit(int msgid, int deferred);
+};
+
+#endif
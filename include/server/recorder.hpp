@@ -0,0 +1,77 @@
+#ifndef RECORDER_H
+#define RECORDER_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <mutex>
+#include <string>
+using namespace std;
+
+/*
+流量录制：把收到的每一帧（json或者二进制帧的原始字节）连同接收时间和连接编号写到文件里，
+用ChatReplay按原来的节奏（或者加速）重放到另一个服务器上，复现线上的性能问题，对比两个版本的延迟。
+文件格式（整数都是小端）：
+  文件头  "CRP1" 4字节，录制开始的时间（微秒） 8字节
+  记录    类型 1字节（kOpen/kFrame/kClose），连接编号 varint，
+          和上一条记录的时间差（微秒，zigzag varint，几个IO线程并发写入时可能是负数），
+          kFrame还有帧的长度 varint和帧的原始字节
+录制的文件里有密码和聊天内容，只在测试环境或者经过授权时开启。
+*/
+class Recorder
+{
+public:
+    enum Type
+    {
+        kOpen = 1,
+        kFrame = 2,
+        kClose = 3,
+    };
+
+    // 一条记录，timeUs是相对录制开始的时间
+    struct Record
+    {
+        int type = 0;
+        uint32_t conn = 0;
+        int64_t timeUs = 0;
+        string data;
+    };
+
+    // 读取录制的文件
+    class Reader
+    {
+    public:
+        Reader();
+        ~Reader();
+
+        bool open(const string &path);
+        // 录制开始的时间（微秒）
+        int64_t startUs() const { return _startUs; }
+        // 读下一条记录，文件结束或者格式错误返回false
+        bool next(Record *record);
+
+        Reader(const Reader &) = delete;
+        Reader &operator=(const Reader &) = delete;
+
+    private:
+        bool readVarint(uint64_t *v);
+
+        FILE *_file;
+        int64_t _startUs;
+        int64_t _lastUs;
+    };
+
+    // 开始录制，启动时调用一次
+    static bool start(const string &path);
+    static bool enabled();
+
+    // 新连接，返回连接编号（从1开始）
+    static uint32_t open(int64_t timeUs);
+    // 连接上收到的一帧，timeUs是epoll返回的时间
+    static void frame(uint32_t conn, int64_t timeUs, const char *begin, const char *end);
+    // 连接断开
+    static void close(uint32_t conn, int64_t timeUs);
+    // 把缓冲的数据交给后台线程，等它写到文件再返回，进程退出之前调用。后台线程每秒自己写一次
+    static void flush();
+};
+
+#endif
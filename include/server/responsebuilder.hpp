@@ -0,0 +1,45 @@
+#ifndef RESPONSEBUILDER_H
+#define RESPONSEBUILDER_H
+
+#include <muduo/net/TcpConnection.h>
+#include <string>
+#include <vector>
+#include "msgcodec.hpp"
+using namespace std;
+using namespace muduo::net;
+
+/*
+业务层的响应构造：
+内容固定的响应（登录/注册失败、协议协商响应）在构造时按两种协议各编码一次，之后每次只是发送同一段字节；
+带参数的响应填好消息结构体后直接编码到发送缓冲区，不构建json对象。
+*/
+class ResponseBuilder
+{
+public:
+    ResponseBuilder();
+
+    // 登录失败：用户名或密码错误
+    void loginFailed(const TcpConnectionPtr &conn) const;
+    // 登录失败：该帐号已经登录
+    void loginRepeated(const TcpConnectionPtr &conn) const;
+    // 登录没有执行：服务器繁忙，retryAfterMs毫秒之后重试
+    void loginBusy(const TcpConnectionPtr &conn, int retryAfterMs) const;
+    // 注册成功，带上新用户的id
+    void regSucceeded(const TcpConnectionPtr &conn, int userid) const;
+    // 注册失败
+    void regFailed(const TcpConnectionPtr &conn) const;
+    // 协议协商响应，客户端收到响应之后才切换协议，所以总是用json发送
+    void protoAck(const TcpConnectionPtr &conn, int version) const;
+    // 心跳响应
+    void heartbeatAck(const TcpConnectionPtr &conn) const;
+
+private:
+    EncodedMsg _loginFailed;
+    EncodedMsg _loginRepeated;
+    EncodedMsg _regFailed;
+    EncodedMsg _heartbeatAck;
+    // 下标是协商出的版本号
+    vector<string> _protoAcks;
+};
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+#include <muduo/net/TcpConnection.h>
+#include <atomic>
+#include <memory>
+#include <string>
+#include "public.hpp"
+#include "flowcontrol.hpp"
+#include "offlinestream.hpp"
+#include "idledetector.hpp"
+using namespace std;
+using namespace muduo::net;
+
+// 每条连接上的会话状态，连接建立时创建，保存在TcpConnection的context里
+struct Session
+{
+    // 连接上协商好的协议，见EnProtocol，其他IO线程给这条连接转发消息时会读取
+    atomic_int protocol{PROTO_JSON};
+
+    // 登录的用户id，没有登录是-1，流控的统计和日志里使用
+    atomic_int userid{-1};
+
+    // 背压状态和缓冲统计，见FlowControl
+    FlowState flow;
+
+    // 登录之后还没有推送完的离线消息，只在连接所属的IO线程里访问
+    unique_ptr<OfflineStream> offline;
+
+    // 空闲检测时间轮里的项，只在连接所属的IO线程里访问
+    weak_ptr<IdleDetector::Entry> idle;
+
+    // 不停机升级时连接已经交给新进程，老进程不再读写、也不再关闭它，见HotRestart
+    atomic_bool frozen{false};
+
+    // 录制流量时连接的编号，0表示不录制，见Recorder
+    uint32_t recordId = 0;
+
+    // 过载时推迟处理的一帧，不为空时后面收到的帧留在输入缓冲区里，等它处理完再按顺序分发，
+    // deferSeq是推迟的序号，冻结或者交接失败之后过期的定时器不再处理。只在连接所属的IO线程里访问
+    string deferredFrame;
+    uint32_t deferSeq = 0;
+};
+
+using SessionPtr = shared_ptr<Session>;
+
+// 取出连接上的会话状态，连接还没有建立会话返回nullptr
+inline Session *getSession(const TcpConnectionPtr &conn)
+{
+    const SessionPtr *session = boost::any_cast<SessionPtr>(&conn->getContext());
+    return session != nullptr ? session->get() : nullptr;
+}
+
+#endif
@@ -0,0 +1,102 @@
+#ifndef LOGSTORAGE_H
+#define LOGSTORAGE_H
+
+#include "storage.hpp"
+#include "json.hpp"
+
+#include <stdio.h>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+using namespace std;
+using json = nlohmann::json;
+
+/*
+进程内的存储：所有数据都在内存的哈希表里，每次修改追加一行json到日志文件（写到内核就返回，不fsync）。
+  {"op":"user","id":1,"name":"a","password":"p","state":"offline","friendver":0,"friends":[2,3]}
+  {"op":"state","id":1,"state":"online"}          {"op":"reset"}
+  {"op":"friend","userid":1,"friendid":2}
+  {"op":"group","id":1,"name":"g","desc":"d","version":0,"members":[[1,"creator"]]}
+  {"op":"member","groupid":1,"userid":2,"role":"normal"}
+  {"op":"offline","userid":1,"msg":"..."}         {"op":"removeoffline","userid":1}
+open时按顺序重放日志建立索引，然后把当前状态压缩成每个用户、每个群一行，写新文件替换旧文件，
+日志只会增长到两次启动之间的修改量。进程崩溃时最后一行可能不完整（没有换行符），丢掉这一行；
+中间有坏记录时open失败，文件保持原样。
+只能有一个进程打开同一个文件，不支持多个服务器共用，也不支持不停机升级。
+*/
+class LogStorage : public Storage
+{
+public:
+    LogStorage();
+    ~LogStorage();
+
+    // 打开（不存在时新建）日志文件，失败时error是原因
+    bool open(const string &path, string *error);
+    // open时重放的记录数，和最后不完整、被丢掉的字节数
+    size_t replayedRecords() const { return _replayed; }
+    size_t discardedBytes() const { return _discarded; }
+
+    bool insertUser(User &user) override;
+    User queryUser(int id) override;
+    bool updateUserState(int id, const string &state) override;
+    void resetUserState() override;
+
+    void insertFriend(int userid, int friendid) override;
+    vector<User> queryFriends(int userid) override;
+    int queryFriendVersion(int userid) override;
+
+    bool createGroup(Group &group) override;
+    void addGroup(int userid, int groupid, const string &role) override;
+    vector<Group> queryGroups(int userid, const unordered_map<int, int> &knownVersions) override;
+    vector<int> queryGroupUsers(int userid, int groupid) override;
+
+    void insertOfflineMsg(int userid, const string &msg) override;
+    void removeOfflineMsg(int userid) override;
+    vector<string> queryOfflineMsg(int userid) override;
+
+    LogStorage(const LogStorage &) = delete;
+    LogStorage &operator=(const LogStorage &) = delete;
+
+private:
+    struct UserRow
+    {
+        string name;
+        string password;
+        string state;
+        int friendver = 0;
+        vector<int> friends;
+        vector<int> groups; // 所在的群，由群成员生成，不写日志
+    };
+
+    struct GroupRow
+    {
+        string name;
+        string desc;
+        int version = 0;
+        vector<pair<int, string>> members; // userid和群角色
+    };
+
+    // 把一条记录应用到内存索引，重放和修改共用，记录不合法（比如重复的用户名）返回false；
+    // dryRun时只检查，不修改
+    bool apply(const json &record, bool dryRun = false);
+    // 检查记录合法、写进日志之后才应用到内存，写日志失败时返回false，之后的修改都失败，调用方持有_mutex
+    bool commit(const json &record);
+    // 把当前状态写到新文件替换旧文件，之后在新文件上追加
+    bool compact(string *error);
+
+    mutex _mutex;
+    string _path;
+    FILE *_file;
+    size_t _replayed;
+    size_t _discarded;
+
+    unordered_map<int, UserRow> _users;
+    unordered_map<string, int> _userNames;
+    int _nextUserId;
+    unordered_map<int, GroupRow> _groups;
+    int _nextGroupId;
+    unordered_map<int, vector<string>> _offlineMsgs;
+};
+
+#endif
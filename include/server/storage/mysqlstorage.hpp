@@ -0,0 +1,41 @@
+#ifndef MYSQLSTORAGE_H
+#define MYSQLSTORAGE_H
+
+#include "storage.hpp"
+
+#include <mysql/mysql.h>
+
+// 存在MySQL里，每次调用新建一个连接（db.h），表结构见test/testmuduo/chat.sql
+class MySQLStorage : public Storage
+{
+public:
+    bool insertUser(User &user) override;
+    User queryUser(int id) override;
+    bool updateUserState(int id, const string &state) override;
+    void resetUserState() override;
+
+    void insertFriend(int userid, int friendid) override;
+    vector<User> queryFriends(int userid) override;
+    int queryFriendVersion(int userid) override;
+
+    bool createGroup(Group &group) override;
+    void addGroup(int userid, int groupid, const string &role) override;
+    vector<Group> queryGroups(int userid, const unordered_map<int, int> &knownVersions) override;
+    vector<int> queryGroupUsers(int userid, int groupid) override;
+
+    void insertOfflineMsg(int userid, const string &msg) override;
+    void removeOfflineMsg(int userid) override;
+    vector<string> queryOfflineMsg(int userid) override;
+
+    // 拼SQL，字符串参数用conn按它的字符集转义，conn只要mysql_init过，不需要已经连上
+    // 不查库，微基准（src/bench/server）直接测这些函数
+    static string insertUserSql(MYSQL *conn, User &user);
+    static string updateUserStateSql(MYSQL *conn, int id, const string &state);
+    static string createGroupSql(MYSQL *conn, Group &group);
+    static string addGroupSql(MYSQL *conn, int userid, int groupid, const string &role);
+    static string insertOfflineMsgSql(MYSQL *conn, int userid, const string &msg);
+    // queryGroups对每个群执行一次的群成员查询
+    static string groupMembersSql(int groupid);
+};
+
+#endif
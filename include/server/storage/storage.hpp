@@ -0,0 +1,54 @@
+#ifndef STORAGE_H
+#define STORAGE_H
+
+#include "user.hpp"
+#include "group.hpp"
+#include <string>
+#include <vector>
+#include <unordered_map>
+using namespace std;
+
+/*
+model下面的存储接口：用户、好友、群组、离线消息四张表的全部操作。
+model只负责调用，具体存在哪里由实现决定：
+  MySQLStorage  原来model里的sql，存在MySQL里，多个服务器共用一个库
+  LogStorage    进程内的追加日志加内存索引，不需要mysqld，单机部署和压测用
+进程启动时（main里）选定一个实现，之后所有线程共用，实现必须是线程安全的。
+*/
+class Storage
+{
+public:
+    virtual ~Storage() {}
+
+    // 用户，insertUser成功时把新分配的id设置到user里
+    virtual bool insertUser(User &user) = 0;
+    // 用户不存在时返回id为-1的User
+    virtual User queryUser(int id) = 0;
+    virtual bool updateUserState(int id, const string &state) = 0;
+    // 所有online的用户改成offline
+    virtual void resetUserState() = 0;
+
+    // 好友，添加成功时好友列表的版本号加一
+    virtual void insertFriend(int userid, int friendid) = 0;
+    virtual vector<User> queryFriends(int userid) = 0;
+    virtual int queryFriendVersion(int userid) = 0;
+
+    // 群组，createGroup成功时把新分配的id设置到group里，addGroup成功时群的版本号加一
+    virtual bool createGroup(Group &group) = 0;
+    virtual void addGroup(int userid, int groupid, const string &role) = 0;
+    // 用户所在的群组，knownVersions里版本一致的群组不带群成员
+    virtual vector<Group> queryGroups(int userid, const unordered_map<int, int> &knownVersions) = 0;
+    // 群里除userid以外的成员
+    virtual vector<int> queryGroupUsers(int userid, int groupid) = 0;
+
+    // 离线消息
+    virtual void insertOfflineMsg(int userid, const string &msg) = 0;
+    virtual void removeOfflineMsg(int userid) = 0;
+    virtual vector<string> queryOfflineMsg(int userid) = 0;
+
+    // 进程使用的存储，启动时在创建ChatServer之前设置一次，之后不再改变
+    static Storage *instance();
+    static void setInstance(Storage *storage);
+};
+
+#endif
@@ -0,0 +1,79 @@
+#ifndef TRACER_H
+#define TRACER_H
+
+#include <stdint.h>
+#include <string>
+using namespace std;
+
+/*
+聊天消息的端到端追踪：每sampleEvery条聊天消息采样一条，记录它经过的各个阶段的时间，
+  receive        IO线程从epoll返回的时间（muduo传给handler的Timestamp）
+  dispatch       开始分发给handler
+  presence       查完接收方是否在线（数据库）
+  publish        redis publish返回
+  remote receive 另一个节点从redis收到
+  remote send    另一个节点写给接收方
+采样的消息转发到redis时，在json文本末尾加上trace字段（trace id和publish的时间），
+收到的节点去掉这个字段再推送给客户端，客户端看到的消息和不追踪时一样。
+每个节点把自己这一段写到本地的trace文件（Chrome Trace Event的json数组格式，可以直接用
+chrome://tracing或者Perfetto打开，几个节点的文件合在一起按trace id串起来），
+各阶段的耗时记到chat_trace_stage_us直方图，从/metrics看。
+时间都是墙上时钟，跨节点的redis阶段要求节点之间的时钟同步。
+*/
+class Tracer
+{
+public:
+    enum Stage
+    {
+        kReceive,
+        kDispatch,
+        kPresence,
+        kPublish,
+        kStages,
+    };
+
+    // 从redis收到的消息带的trace
+    struct Remote
+    {
+        uint64_t id = 0;
+        int64_t publishUs = 0;
+        int64_t receiveUs = 0;
+    };
+
+    // 一条消息在本节点的处理过程，在dispatch里创建，析构时输出。
+    // 聊天消息按采样率采样，采样的消息在这个作用域里是当前线程的当前trace
+    class Scope
+    {
+    public:
+        Scope(int msgid, int64_t receiveUs);
+        ~Scope();
+
+        Scope(const Scope &) = delete;
+        Scope &operator=(const Scope &) = delete;
+
+    private:
+        friend class Tracer;
+
+        bool _sampled;
+        int _msgid;
+        uint64_t _id;
+        int64_t _stages[kStages];
+        // 第一次publish到redis的时间，跨节点的箭头从这里开始
+        int64_t _injectUs;
+    };
+
+    // 打开trace文件（追加），每sampleEvery条聊天消息采样一条，启动时调用一次
+    static bool start(const string &path, int sampleEvery);
+
+    // 给当前线程正在处理的消息记录一个阶段的时间，没有采样时什么也不做。
+    // 同一阶段只记第一次，群聊记的是第一个要跨节点转发的成员
+    static void mark(Stage stage);
+    // 要publish到redis的文本：当前消息被采样时在末尾加上trace字段，否则原样返回
+    static string inject(const string &text);
+    // 从redis收到的文本：带trace字段时去掉它，填好remote返回true
+    static bool extract(string *text, Remote *remote);
+    // 从redis收到的消息推送完了，输出另一个节点上的这一段
+    static void finishRemote(const Remote &remote);
+};
+
+#endif
@@ -0,0 +1,148 @@
+#include "jsonscanner.hpp"
+#include "public.hpp"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+using namespace std;
+
+/*
+ChatServer接受新连接的速率测试，模拟发布之后所有客户端同时重连：
+每个线程循环 建连 -> 发一个协议协商请求（PROTO_MSG，不访问数据库）-> 收到响应 -> RST关闭，
+统计每秒完成的握手数和从connect到收到第一个响应的延迟分布。
+关闭时用SO_LINGER 0直接发RST，客户端不留TIME_WAIT，不会把本地端口耗尽。
+配合acceptrate.sh对比单acceptor和 -r（每个loop一个SO_REUSEPORT监听socket）。
+*/
+namespace
+{
+
+const string kRequest = "{\"msgid\":" + to_string(PROTO_MSG) + ",\"version\":0}";
+
+atomic_bool g_stop{false};
+atomic<int64_t> g_failed{0};
+
+// 建连、发请求、等响应，返回握手用时（微秒），失败返回-1
+int64_t handshake(const sockaddr_in &addr)
+{
+    auto begin = chrono::steady_clock::now();
+    int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    int64_t result = -1;
+    if (::connect(fd, reinterpret_cast<const sockaddr *>(&addr), sizeof addr) == 0 &&
+        ::write(fd, kRequest.data(), kRequest.size()) == static_cast<ssize_t>(kRequest.size()))
+    {
+        char buf[256];
+        size_t len = 0;
+        while (len < sizeof buf)
+        {
+            ssize_t n = ::read(fd, buf + len, sizeof buf - len);
+            if (n <= 0)
+            {
+                break;
+            }
+            len += n;
+            MsgRoute route;
+            const char *frameEnd = nullptr;
+            const char *start = JsonScanner::skipDelimiters(buf, buf + len);
+            if (JsonScanner::scan(start, buf + len, &route, &frameEnd) == JsonScanner::kComplete)
+            {
+                result = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - begin).count();
+                break;
+            }
+        }
+    }
+    linger lin = {1, 0};
+    ::setsockopt(fd, SOL_SOCKET, SO_LINGER, &lin, sizeof lin);
+    ::close(fd);
+    return result;
+}
+
+// 一个压测线程，记录每次握手的延迟
+void worker(sockaddr_in addr, vector<int64_t> *latencies)
+{
+    while (!g_stop.load(memory_order_relaxed))
+    {
+        int64_t us = handshake(addr);
+        if (us < 0)
+        {
+            ++g_failed;
+            continue;
+        }
+        latencies->push_back(us);
+    }
+}
+
+int64_t percentile(const vector<int64_t> &sorted, double p)
+{
+    if (sorted.empty())
+    {
+        return 0;
+    }
+    size_t index = static_cast<size_t>(p * (sorted.size() - 1));
+    return sorted[index];
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    if (argc < 3)
+    {
+        cerr << "Usage: " << argv[0] << " <ip> <port> [threads=64] [seconds=10]" << endl;
+        return -1;
+    }
+
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(static_cast<uint16_t>(atoi(argv[2])));
+    if (::inet_pton(AF_INET, argv[1], &addr.sin_addr) != 1)
+    {
+        cerr << "invalid ip: " << argv[1] << endl;
+        return -1;
+    }
+    int threads = argc > 3 ? atoi(argv[3]) : 64;
+    int seconds = argc > 4 ? atoi(argv[4]) : 10;
+
+    vector<vector<int64_t>> latencies(threads);
+    vector<thread> workers;
+    auto begin = chrono::steady_clock::now();
+    for (int i = 0; i < threads; ++i)
+    {
+        workers.emplace_back(worker, addr, &latencies[i]);
+    }
+    this_thread::sleep_for(chrono::seconds(seconds));
+    g_stop = true;
+    for (thread &t : workers)
+    {
+        t.join();
+    }
+    double elapsed = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+
+    vector<int64_t> all;
+    for (auto &v : latencies)
+    {
+        all.insert(all.end(), v.begin(), v.end());
+    }
+    sort(all.begin(), all.end());
+    cout << "threads " << threads
+         << " handshakes " << all.size()
+         << " failed " << g_failed.load()
+         << " rate " << static_cast<int64_t>(all.size() / elapsed) << " conn/s"
+         << " latency us p50 " << percentile(all, 0.50)
+         << " p99 " << percentile(all, 0.99)
+         << " p999 " << percentile(all, 0.999) << endl;
+    return 0;
+}
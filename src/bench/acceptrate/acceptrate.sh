@@ -0,0 +1,34 @@
+#!/bin/bash
+
+# 重连风暴下ChatServer接受新连接的速率：同样的IO线程数，分别用单acceptor和 -r（每个loop一个SO_REUSEPORT监听socket）
+# 用法: src/bench/acceptrate/acceptrate.sh [IO线程数=cpu核数/2] [压测线程数=64] [每档秒数=10]
+# 服务器绑定前N个核，压测客户端用剩下的核
+
+WORKDIR=$(cd "$(dirname "$0")/../../.." && pwd)
+SERVER=$WORKDIR/bin/ChatServer
+BENCH=$WORKDIR/bin/AcceptRateBench
+PORT=${PORT:-16001}
+
+CPUS=$(nproc)
+THREADS=${1:-$((CPUS / 2))}
+CLIENTS=${2:-64}
+SECONDS_PER_RUN=${3:-10}
+if [ "$THREADS" -lt 1 ]; then
+	THREADS=1
+fi
+
+CLIENT_PIN=""
+if [ "$CPUS" -gt "$THREADS" ]; then
+	CLIENT_PIN="taskset -c $THREADS-$((CPUS - 1))"
+fi
+
+for mode in "" "-r"; do
+	"$SERVER" -t "$THREADS" -c "0-$((THREADS - 1))" $mode 127.0.0.1 "$PORT" >/dev/null 2>&1 &
+	pid=$!
+	sleep 1
+	echo -n "io threads $THREADS ${mode:-single acceptor}: "
+	$CLIENT_PIN "$BENCH" 127.0.0.1 "$PORT" "$CLIENTS" "$SECONDS_PER_RUN"
+	# 用SIGTERM结束，SIGINT会去数据库重置用户状态
+	kill -TERM "$pid"
+	wait "$pid" 2>/dev/null
+done
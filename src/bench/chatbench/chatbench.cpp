@@ -0,0 +1,692 @@
+#include "json.hpp"
+#include "jsonscanner.hpp"
+#include "metrics.hpp"
+#include "public.hpp"
+
+#include <muduo/base/Logging.h>
+#include <muduo/net/EventLoop.h>
+#include <muduo/net/EventLoopThreadPool.h>
+#include <muduo/net/InetAddress.h>
+#include <muduo/net/TcpClient.h>
+
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+using namespace std;
+using namespace placeholders;
+using namespace muduo;
+using namespace muduo::net;
+using json = nlohmann::json;
+
+/*
+ChatServer的负载生成器：一个进程模拟N个用户，每个用户一条连接，连接分散在几个事件循环线程上。
+1. 注册N个新用户（用户名带上进程号，每次运行都是新用户）
+2. 建立好友和群组：用户i的好友是i+1..i+f，第k个群是从k*群大小开始的连续群大小个用户，
+   第一个成员创建群组，服务器没有建群的响应，创建者登录时从登录响应的群组列表里拿到群id
+3. 所有用户登录，服务器繁忙（errno 3）时按retryafter重试
+4. 每个用户按固定速率发消息，按比例发群聊或者给随机一个好友发一对一聊天，
+   消息正文开头是发送时的时间戳（微秒），收到消息时算出端到端的投递延迟
+预热1秒之后开始统计，输出发送和投递的吞吐以及延迟的分位数。
+发送和接收在同一个进程里，时间戳用同一个时钟。
+*/
+namespace
+{
+
+// 压测参数
+struct BenchOptions
+{
+    int users = 100;
+    int threads = 4;
+    int friends = 5;       // 每个用户的好友数，一对一聊天发给好友
+    int groups = 10;
+    int groupSize = 20;
+    int groupPercent = 20; // 群聊占发送消息的百分比
+    double rate = 1.0;     // 每个用户每秒发送的消息数
+    int seconds = 30;
+    int msgBytes = 64;     // 时间戳之后填充的正文长度
+};
+
+const char *kPassword = "bench";
+// 预热多久之后开始统计（秒）
+const double kWarmupSeconds = 1.0;
+
+// 投递延迟，all是两种消息合在一起
+const char *kDeliveryHelp = "End-to-end delivery latency in microseconds";
+const Metrics::Id kDeliveryAll = Metrics::histogram("chatbench_delivery_us", kDeliveryHelp, "type=\"all\"");
+const Metrics::Id kDeliveryOne = Metrics::histogram("chatbench_delivery_us", kDeliveryHelp, "type=\"one\"");
+const Metrics::Id kDeliveryGroup = Metrics::histogram("chatbench_delivery_us", kDeliveryHelp, "type=\"group\"");
+const Metrics::Id kSentOne = Metrics::counter("chatbench_sent_total", "Messages sent", "type=\"one\"");
+const Metrics::Id kSentGroup = Metrics::counter("chatbench_sent_total", "Messages sent", "type=\"group\"");
+const Metrics::Id kDeliveredOne = Metrics::counter("chatbench_delivered_total", "Messages delivered", "type=\"one\"");
+const Metrics::Id kDeliveredGroup = Metrics::counter("chatbench_delivered_total", "Messages delivered", "type=\"group\"");
+const Metrics::Id kLoginBusy = Metrics::counter("chatbench_login_busy_total", "Logins told to retry later");
+
+// 统计期间才记录延迟，只记录统计开始之后发出的消息
+atomic_bool g_measuring{false};
+atomic<int64_t> g_measureStartUs{0};
+// 停止之后不再发送
+atomic_bool g_running{false};
+
+int64_t nowUs()
+{
+    return Timestamp::now().microSecondsSinceEpoch();
+}
+
+// 每个线程一个随机数发生器
+minstd_rand &randomEngine()
+{
+    thread_local minstd_rand engine(static_cast<unsigned>(nowUs()) ^ static_cast<unsigned>(hash<thread::id>()(this_thread::get_id())));
+    return engine;
+}
+
+class Bench;
+
+// 一个模拟用户，连接上的回调和发送都在它所属的事件循环线程里
+class BenchUser
+{
+public:
+    BenchUser(Bench *bench, EventLoop *loop, const InetAddress &serverAddr, int index);
+
+    EventLoop *loop() const { return _loop; }
+    int id() const { return _id; }
+    bool creator() const { return !_created.empty(); }
+
+    // 拓扑：好友和所在的群（都是下标），created是自己创建的群
+    void addFriend(int index) { _friends.push_back(index); }
+    void joinGroup(int group, bool creator);
+
+    void connect() { _client.connect(); }
+    void stop() { _client.disconnect(); }
+
+    // 各个阶段要做的事，在所属的事件循环线程里调用
+    void sendRegister();
+    void createGroups();
+    void joinGroups();
+    void startChat();
+
+private:
+    void onConnection(const TcpConnectionPtr &conn);
+    void onMessage(const TcpConnectionPtr &conn, Buffer *buffer, Timestamp time);
+    void handle(const json &js);
+    void onLoginAck(const json &js);
+    void onChat(const json &js, bool group);
+
+    void send(const json &js);
+    void sendFriends();
+    void sendLogin();
+    void sendChat();
+
+    Bench *_bench;
+    EventLoop *_loop;
+    int _index;
+    TcpClient _client;
+    TcpConnectionPtr _conn;
+    int _id;
+    bool _loggedIn;
+    vector<int> _friends;
+    vector<int> _groups;
+    vector<int> _created;
+};
+
+// 压测的各个阶段，一个阶段所有参与的用户都完成之后进入下一个阶段
+class Bench
+{
+public:
+    Bench(EventLoop *loop, EventLoopThreadPool *pool, const InetAddress &serverAddr, const BenchOptions &options);
+
+    const BenchOptions &options() const { return _options; }
+    string userName(int index) const { return "bench" + _tag + "_" + to_string(index); }
+    string groupName(int group) const { return "benchgroup" + _tag + "_" + to_string(group); }
+    int userId(int index) const { return _users[index]->id(); }
+    int groupId(int group) const { return _groupIds[group]; }
+    void setGroupId(int group, int id) { _groupIds[group] = id; }
+
+    void start();
+
+    // 一个用户完成了当前阶段，在用户的事件循环线程里调用
+    void userDone();
+    // 出错，结束压测
+    void fail(const string &reason);
+
+private:
+    enum Phase
+    {
+        kConnect,
+        kRegister,
+        kCreate,
+        kJoin,
+        kRun,
+    };
+
+    // 进入下一个阶段，在主线程里调用
+    void nextPhase();
+    // 对参与的用户执行action，等其中expected个用户完成
+    void runPhase(int expected, const function<void(BenchUser *)> &action);
+    void beginMeasure();
+    void finish();
+
+    EventLoop *_loop;
+    BenchOptions _options;
+    string _tag;
+    vector<unique_ptr<BenchUser>> _users;
+    vector<atomic_int> _groupIds;
+    Phase _phase;
+    atomic_int _pending;
+    int64_t _phaseStartUs;
+
+    uint64_t _sentOne, _sentGroup, _deliveredOne, _deliveredGroup;
+};
+
+BenchUser::BenchUser(Bench *bench, EventLoop *loop, const InetAddress &serverAddr, int index)
+    : _bench(bench),
+      _loop(loop),
+      _index(index),
+      _client(loop, serverAddr, "user" + to_string(index)),
+      _id(-1),
+      _loggedIn(false)
+{
+    _client.setConnectionCallback(std::bind(&BenchUser::onConnection, this, _1));
+    _client.setMessageCallback(std::bind(&BenchUser::onMessage, this, _1, _2, _3));
+}
+
+void BenchUser::joinGroup(int group, bool creator)
+{
+    _groups.push_back(group);
+    if (creator)
+    {
+        _created.push_back(group);
+    }
+}
+
+void BenchUser::onConnection(const TcpConnectionPtr &conn)
+{
+    if (!conn->connected())
+    {
+        if (g_running)
+        {
+            _bench->fail("user " + to_string(_index) + " disconnected");
+        }
+        return;
+    }
+    conn->setTcpNoDelay(true);
+    _conn = conn;
+    _bench->userDone();
+}
+
+void BenchUser::onMessage(const TcpConnectionPtr &conn, Buffer *buffer, Timestamp)
+{
+    while (buffer->readableBytes() > 0)
+    {
+        const char *end = buffer->peek() + buffer->readableBytes();
+        buffer->retrieveUntil(JsonScanner::skipDelimiters(buffer->peek(), end));
+        MsgRoute route;
+        const char *frameEnd = nullptr;
+        JsonScanner::Status status = JsonScanner::scan(buffer->peek(), end, &route, &frameEnd);
+        if (status != JsonScanner::kComplete)
+        {
+            if (status == JsonScanner::kInvalid)
+            {
+                LOG_ERROR << "invalid frame, discard!";
+                buffer->retrieveAll();
+            }
+            break;
+        }
+        json js = json::parse(buffer->peek(), frameEnd, nullptr, false);
+        buffer->retrieveUntil(frameEnd);
+        if (!js.is_discarded())
+        {
+            handle(js);
+        }
+    }
+}
+
+void BenchUser::handle(const json &js)
+{
+    switch (js.value("msgid", 0))
+    {
+    case REG_MSG_ACK:
+        if (js.value("errno", -1) != 0)
+        {
+            _bench->fail("register failed");
+            return;
+        }
+        _id = js["id"].get<int>();
+        _bench->userDone();
+        break;
+    case LOGIN_MSG_ACK:
+        onLoginAck(js);
+        break;
+    case ONE_CHAT_MSG:
+        onChat(js, false);
+        break;
+    case GROUP_CHAT_MSG:
+        onChat(js, true);
+        break;
+    default:
+        break;
+    }
+}
+
+void BenchUser::onLoginAck(const json &js)
+{
+    int err = js.value("errno", -1);
+    // 服务器繁忙，按建议的时间重试
+    if (err == 3)
+    {
+        Metrics::add(kLoginBusy);
+        _loop->runAfter(js.value("retryafter", 1000) / 1000.0, std::bind(&BenchUser::sendLogin, this));
+        return;
+    }
+    if (err != 0)
+    {
+        _bench->fail("user " + to_string(_index) + " login failed: " + js.value("errmsg", string()));
+        return;
+    }
+
+    // 登录响应里的群组列表是json文本数组，按群名找到自己创建的群的id
+    if (js.contains("groups"))
+    {
+        for (const json &item : js["groups"])
+        {
+            json group = item.is_string() ? json::parse(item.get<string>(), nullptr, false) : item;
+            if (!group.is_object())
+            {
+                continue;
+            }
+            string name = group.value("groupname", string());
+            for (int created : _created)
+            {
+                if (name == _bench->groupName(created))
+                {
+                    _bench->setGroupId(created, group["id"].get<int>());
+                }
+            }
+        }
+    }
+    _loggedIn = true;
+    _bench->userDone();
+}
+
+void BenchUser::onChat(const json &js, bool group)
+{
+    Metrics::add(group ? kDeliveredGroup : kDeliveredOne);
+    // 正文开头是发送时的时间戳
+    string msg = js.value("msg", string());
+    int64_t sentUs = strtoll(msg.c_str(), nullptr, 10);
+    if (!g_measuring || sentUs < g_measureStartUs)
+    {
+        return;
+    }
+    int64_t latency = nowUs() - sentUs;
+    Metrics::observe(kDeliveryAll, latency);
+    Metrics::observe(group ? kDeliveryGroup : kDeliveryOne, latency);
+}
+
+void BenchUser::send(const json &js)
+{
+    _conn->send(js.dump());
+}
+
+// 注册
+void BenchUser::sendRegister()
+{
+    json js;
+    js["msgid"] = REG_MSG;
+    js["name"] = _bench->userName(_index);
+    js["password"] = kPassword;
+    send(js);
+}
+
+void BenchUser::sendFriends()
+{
+    for (int index : _friends)
+    {
+        json js;
+        js["msgid"] = ADD_FRIEND_MSG;
+        js["id"] = _id;
+        js["friendid"] = _bench->userId(index);
+        send(js);
+    }
+}
+
+void BenchUser::sendLogin()
+{
+    json js;
+    js["msgid"] = LOGIN_MSG;
+    js["id"] = _id;
+    js["password"] = kPassword;
+    send(js);
+}
+
+// 创建者：加好友、建群，然后登录，登录响应里带回群id
+void BenchUser::createGroups()
+{
+    sendFriends();
+    for (int group : _created)
+    {
+        json js;
+        js["msgid"] = CREATE_GROUP_MSG;
+        js["id"] = _id;
+        js["groupname"] = _bench->groupName(group);
+        js["groupdesc"] = "chatbench";
+        send(js);
+    }
+    sendLogin();
+}
+
+// 加入别人创建的群，还没登录的加好友然后登录
+void BenchUser::joinGroups()
+{
+    for (int group : _groups)
+    {
+        if (find(_created.begin(), _created.end(), group) != _created.end())
+        {
+            continue;
+        }
+        json js;
+        js["msgid"] = ADD_GROUP_MSG;
+        js["id"] = _id;
+        js["groupid"] = _bench->groupId(group);
+        send(js);
+    }
+    if (!_loggedIn)
+    {
+        sendFriends();
+        sendLogin();
+    }
+}
+
+// 按固定速率发消息，第一条的时间随机错开
+void BenchUser::startChat()
+{
+    double interval = 1.0 / _bench->options().rate;
+    double offset = interval * (randomEngine()() % 1000) / 1000.0;
+    _loop->runAfter(offset, [this, interval]()
+    {
+        sendChat();
+        _loop->runEvery(interval, std::bind(&BenchUser::sendChat, this));
+    });
+}
+
+void BenchUser::sendChat()
+{
+    if (!g_running || (_friends.empty() && _groups.empty()))
+    {
+        return;
+    }
+    const BenchOptions &options = _bench->options();
+    bool group = _friends.empty() || (!_groups.empty() && static_cast<int>(randomEngine()() % 100) < options.groupPercent);
+
+    json js;
+    js["msgid"] = group ? GROUP_CHAT_MSG : ONE_CHAT_MSG;
+    js["id"] = _id;
+    js["name"] = _bench->userName(_index);
+    if (group)
+    {
+        js["groupid"] = _bench->groupId(_groups[randomEngine()() % _groups.size()]);
+    }
+    else
+    {
+        js["toid"] = _bench->userId(_friends[randomEngine()() % _friends.size()]);
+    }
+    js["msg"] = to_string(nowUs()) + " " + string(options.msgBytes, 'x');
+    js["time"] = "chatbench";
+    send(js);
+    Metrics::add(group ? kSentGroup : kSentOne);
+}
+
+Bench::Bench(EventLoop *loop, EventLoopThreadPool *pool, const InetAddress &serverAddr, const BenchOptions &options)
+    : _loop(loop),
+      _options(options),
+      _tag(to_string(getpid()) + "_" + to_string(nowUs() / 1000000)),
+      _groupIds(options.groups),
+      _phase(kConnect),
+      _pending(0),
+      _phaseStartUs(0),
+      _sentOne(0),
+      _sentGroup(0),
+      _deliveredOne(0),
+      _deliveredGroup(0)
+{
+    int n = _options.users;
+    for (int i = 0; i < n; ++i)
+    {
+        _users.emplace_back(new BenchUser(this, pool->getNextLoop(), serverAddr, i));
+    }
+    // 用户i的好友是i+1..i+f
+    int friends = min(_options.friends, n - 1);
+    for (int i = 0; i < n; ++i)
+    {
+        for (int j = 1; j <= friends; ++j)
+        {
+            _users[i]->addFriend((i + j) % n);
+        }
+    }
+    // 第k个群是从k*群大小开始的连续群大小个用户，第一个成员创建
+    int groupSize = min(_options.groupSize, n);
+    for (int k = 0; k < _options.groups; ++k)
+    {
+        for (int j = 0; j < groupSize; ++j)
+        {
+            _users[(k * groupSize + j) % n]->joinGroup(k, j == 0);
+        }
+    }
+}
+
+void Bench::start()
+{
+    g_running = true;
+    _phaseStartUs = nowUs();
+    _pending = static_cast<int>(_users.size());
+    for (auto &user : _users)
+    {
+        user->connect();
+    }
+}
+
+void Bench::userDone()
+{
+    if (--_pending == 0)
+    {
+        _loop->queueInLoop(std::bind(&Bench::nextPhase, this));
+    }
+}
+
+void Bench::fail(const string &reason)
+{
+    _loop->queueInLoop([this, reason]()
+    {
+        if (!g_running)
+        {
+            return;
+        }
+        cerr << "chatbench failed: " << reason << endl;
+        g_running = false;
+        _loop->quit();
+    });
+}
+
+void Bench::runPhase(int expected, const function<void(BenchUser *)> &action)
+{
+    _pending = expected;
+    for (auto &user : _users)
+    {
+        BenchUser *u = user.get();
+        u->loop()->runInLoop([u, action]() { action(u); });
+    }
+    if (expected == 0)
+    {
+        _loop->queueInLoop(std::bind(&Bench::nextPhase, this));
+    }
+}
+
+void Bench::nextPhase()
+{
+    int64_t now = nowUs();
+    static const char *kNames[] = {"connect", "register", "create groups", "join and login", "run"};
+    cout << kNames[_phase] << " done in " << (now - _phaseStartUs) / 1000 << "ms" << endl;
+    _phaseStartUs = now;
+
+    int creators = 0;
+    for (auto &user : _users)
+    {
+        creators += user->creator() ? 1 : 0;
+    }
+    switch (_phase)
+    {
+    case kConnect:
+        _phase = kRegister;
+        runPhase(static_cast<int>(_users.size()), [](BenchUser *u) { u->sendRegister(); });
+        break;
+    case kRegister:
+        _phase = kCreate;
+        runPhase(creators, [](BenchUser *u)
+        {
+            if (u->creator())
+            {
+                u->createGroups();
+            }
+        });
+        break;
+    case kCreate:
+        _phase = kJoin;
+        runPhase(static_cast<int>(_users.size()) - creators, [](BenchUser *u) { u->joinGroups(); });
+        break;
+    case kJoin:
+        _phase = kRun;
+        for (auto &user : _users)
+        {
+            BenchUser *u = user.get();
+            u->loop()->runInLoop([u]() { u->startChat(); });
+        }
+        _loop->runAfter(kWarmupSeconds, std::bind(&Bench::beginMeasure, this));
+        _loop->runAfter(kWarmupSeconds + _options.seconds, std::bind(&Bench::finish, this));
+        break;
+    case kRun:
+        break;
+    }
+}
+
+void Bench::beginMeasure()
+{
+    _sentOne = Metrics::counterValue(kSentOne);
+    _sentGroup = Metrics::counterValue(kSentGroup);
+    _deliveredOne = Metrics::counterValue(kDeliveredOne);
+    _deliveredGroup = Metrics::counterValue(kDeliveredGroup);
+    g_measureStartUs = nowUs();
+    g_measuring = true;
+}
+
+void Bench::finish()
+{
+    g_measuring = false;
+    g_running = false;
+    double elapsed = (nowUs() - g_measureStartUs) / 1e6;
+    uint64_t sentOne = Metrics::counterValue(kSentOne) - _sentOne;
+    uint64_t sentGroup = Metrics::counterValue(kSentGroup) - _sentGroup;
+    uint64_t deliveredOne = Metrics::counterValue(kDeliveredOne) - _deliveredOne;
+    uint64_t deliveredGroup = Metrics::counterValue(kDeliveredGroup) - _deliveredGroup;
+
+    cout << "users " << _options.users << ", friends " << _options.friends << " each, groups " << _options.groups
+         << " x " << _options.groupSize << ", group chat " << _options.groupPercent << "%, "
+         << _options.rate << " msg/s per user, login busy " << Metrics::counterValue(kLoginBusy) << endl;
+    printf("sent      %10llu msgs (one %llu, group %llu) %10.0f msg/s\n",
+           static_cast<unsigned long long>(sentOne + sentGroup), static_cast<unsigned long long>(sentOne),
+           static_cast<unsigned long long>(sentGroup), (sentOne + sentGroup) / elapsed);
+    printf("delivered %10llu msgs (one %llu, group %llu) %10.0f msg/s\n",
+           static_cast<unsigned long long>(deliveredOne + deliveredGroup), static_cast<unsigned long long>(deliveredOne),
+           static_cast<unsigned long long>(deliveredGroup), (deliveredOne + deliveredGroup) / elapsed);
+    printf("latency us    count      p50      p99     p999\n");
+    const pair<const char *, Metrics::Id> kRows[] = {{"all", kDeliveryAll}, {"one", kDeliveryOne}, {"group", kDeliveryGroup}};
+    for (const auto &row : kRows)
+    {
+        printf("%-8s %10llu %8lld %8lld %8lld\n", row.first,
+               static_cast<unsigned long long>(Metrics::histogramCount(row.second)),
+               static_cast<long long>(Metrics::quantile(row.second, 0.5)),
+               static_cast<long long>(Metrics::quantile(row.second, 0.99)),
+               static_cast<long long>(Metrics::quantile(row.second, 0.999)));
+    }
+
+    for (auto &user : _users)
+    {
+        user->stop();
+    }
+    _loop->quit();
+}
+
+void usage(const char *prog)
+{
+    cerr << "Usage: " << prog << " [-n users=100] [-t threads=4] [-f friends=5] [-g groups=10] [-s group size=20]"
+         << " [-p group chat %=20] [-r msgs per second per user=1] [-d seconds=30] [-b msg bytes=64] <ip> <port>" << endl;
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    const char *prog = argv[0];
+    BenchOptions options;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:t:f:g:s:p:r:d:b:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'n':
+            options.users = atoi(optarg);
+            break;
+        case 't':
+            options.threads = atoi(optarg);
+            break;
+        case 'f':
+            options.friends = atoi(optarg);
+            break;
+        case 'g':
+            options.groups = atoi(optarg);
+            break;
+        case 's':
+            options.groupSize = atoi(optarg);
+            break;
+        case 'p':
+            options.groupPercent = atoi(optarg);
+            break;
+        case 'r':
+            options.rate = atof(optarg);
+            break;
+        case 'd':
+            options.seconds = atoi(optarg);
+            break;
+        case 'b':
+            options.msgBytes = atoi(optarg);
+            break;
+        default:
+            usage(prog);
+            return -1;
+        }
+    }
+    if (argc - optind < 2 || options.users < 2 || options.threads < 1 || options.rate <= 0 ||
+        options.friends < 0 || options.groups < 0 || options.groupSize < 1 || options.seconds < 1 || options.msgBytes < 0)
+    {
+        usage(prog);
+        return -1;
+    }
+    Logger::setLogLevel(Logger::WARN);
+
+    InetAddress serverAddr(argv[optind], static_cast<uint16_t>(atoi(argv[optind + 1])));
+    EventLoop loop;
+    EventLoopThreadPool pool(&loop, "chatbench");
+    pool.setThreadNum(options.threads);
+    pool.start();
+
+    Bench bench(&loop, &pool, serverAddr, options);
+    bench.start();
+    loop.loop();
+    return Metrics::histogramCount(kDeliveryAll) > 0 ? 0 : 1;
+}
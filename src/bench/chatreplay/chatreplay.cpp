@@ -0,0 +1,528 @@
+#include "binarycodec.hpp"
+#include "jsonscanner.hpp"
+#include "metrics.hpp"
+#include "public.hpp"
+#include "recorder.hpp"
+
+#include <muduo/base/Logging.h>
+#include <muduo/net/EventLoop.h>
+#include <muduo/net/EventLoopThreadPool.h>
+#include <muduo/net/InetAddress.h>
+#include <muduo/net/TcpClient.h>
+
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+using namespace std;
+using namespace placeholders;
+using namespace muduo;
+using namespace muduo::net;
+
+/*
+重放服务器用-w录制的流量：按录制时的节奏（-s加速）重新建立每条连接，原样发送每一帧，然后断开。
+请求和响应一一对应的消息（登录、注册、心跳、协议协商）按连接记下发送时间，收到对应的响应时算出延迟，
+输出每种请求的延迟分位数，也可以写到结果文件里，下次重放时和它对比，看两个版本的服务器谁快谁慢。
+录制里的用户id和群id是原来数据库里的，重放的服务器要用录制时的数据库快照，否则登录会失败。
+*/
+namespace
+{
+
+struct ReplayOptions
+{
+    double speed = 1.0; // 重放速度，2表示两倍速
+    int threads = 4;
+    string resultPath;   // 把这次的结果写到文件里
+    string baselinePath; // 和这个结果文件对比
+};
+
+// 所有帧都发完之后等多久再断开，等最后的响应回来（秒）
+const double kDrainSeconds = 2.0;
+// 发帧的定时器间隔（秒）
+const double kPumpInterval = 0.001;
+
+const char *kAckHelp = "Request to response latency in microseconds";
+const Metrics::Id kAckLogin = Metrics::histogram("chatreplay_ack_us", kAckHelp, "type=\"login\"");
+const Metrics::Id kAckReg = Metrics::histogram("chatreplay_ack_us", kAckHelp, "type=\"reg\"");
+const Metrics::Id kAckHeartbeat = Metrics::histogram("chatreplay_ack_us", kAckHelp, "type=\"heartbeat\"");
+const Metrics::Id kAckProto = Metrics::histogram("chatreplay_ack_us", kAckHelp, "type=\"proto\"");
+// 帧实际发出的时间比录制的节奏晚了多少，太大说明重放端跟不上，结果不可信
+const Metrics::Id kPumpLag = Metrics::histogram("chatreplay_pump_lag_us", "How late frames were sent compared to the capture");
+const Metrics::Id kFramesSent = Metrics::counter("chatreplay_frames_total", "Frames sent");
+const Metrics::Id kConnFailed = Metrics::counter("chatreplay_conn_failed_total", "Connections closed before the capture closed them");
+
+int64_t nowUs()
+{
+    return Timestamp::now().microSecondsSinceEpoch();
+}
+
+// 请求的msgid对应的响应msgid，没有一一对应的响应返回-1
+int ackOf(int msgid)
+{
+    switch (msgid)
+    {
+    case LOGIN_MSG:
+        return LOGIN_MSG_ACK;
+    case REG_MSG:
+        return REG_MSG_ACK;
+    case HEARTBEAT_MSG:
+        return HEARTBEAT_MSG_ACK;
+    case PROTO_MSG:
+        return PROTO_MSG_ACK;
+    default:
+        return -1;
+    }
+}
+
+Metrics::Id histogramOf(int ack)
+{
+    switch (ack)
+    {
+    case LOGIN_MSG_ACK:
+        return kAckLogin;
+    case REG_MSG_ACK:
+        return kAckReg;
+    case HEARTBEAT_MSG_ACK:
+        return kAckHeartbeat;
+    default:
+        return kAckProto;
+    }
+}
+
+// 一帧的msgid，json帧用JsonScanner，二进制帧在帧头里
+int frameMsgid(const char *begin, const char *end)
+{
+    if (begin == end)
+    {
+        return -1;
+    }
+    if (BinaryCodec::isBinary(*begin))
+    {
+        BinaryCodec::Header header;
+        return BinaryCodec::peekHeader(begin, end - begin, &header) ? header.msgid : -1;
+    }
+    MsgRoute route;
+    const char *frameEnd = nullptr;
+    return JsonScanner::scan(begin, end, &route, &frameEnd) == JsonScanner::kComplete ? route.msgid : -1;
+}
+
+// 录制里的一条连接，除了构造以外都在所属的事件循环线程里调用
+class ReplayConn
+{
+public:
+    ReplayConn(EventLoop *loop, const InetAddress &serverAddr, uint32_t id)
+        : _loop(loop),
+          _client(loop, serverAddr, "replay" + to_string(id)),
+          _closing(false),
+          _closed(false)
+    {
+        _client.setConnectionCallback(std::bind(&ReplayConn::onConnection, this, _1));
+        _client.setMessageCallback(std::bind(&ReplayConn::onMessage, this, _1, _2, _3));
+    }
+
+    EventLoop *loop() const { return _loop; }
+
+    void connect() { _client.connect(); }
+
+    // 还没连上时先排队，连上之后按顺序发出
+    void send(const string &frame)
+    {
+        if (_closed)
+        {
+            return;
+        }
+        if (!_conn)
+        {
+            _queued.push_back(frame);
+            return;
+        }
+        sendNow(frame);
+    }
+
+    // 录制里这条连接断开了，排队的帧发完之后再断开
+    void close()
+    {
+        _closing = true;
+        if (_conn)
+        {
+            _client.disconnect();
+        }
+    }
+
+private:
+    void onConnection(const TcpConnectionPtr &conn)
+    {
+        if (!conn->connected())
+        {
+            if (!_closing)
+            {
+                Metrics::add(kConnFailed);
+            }
+            _closed = true;
+            _conn.reset();
+            _pending.clear();
+            return;
+        }
+        conn->setTcpNoDelay(true);
+        _conn = conn;
+        for (const string &frame : _queued)
+        {
+            sendNow(frame);
+        }
+        _queued.clear();
+        if (_closing)
+        {
+            _client.disconnect();
+        }
+    }
+
+    void sendNow(const string &frame)
+    {
+        int ack = ackOf(frameMsgid(frame.data(), frame.data() + frame.size()));
+        if (ack != -1)
+        {
+            _pending.push_back({ack, nowUs()});
+        }
+        _conn->send(frame);
+        Metrics::add(kFramesSent);
+    }
+
+    // 响应按发送的顺序回来，取同类请求里最早的一个
+    void onAck(int msgid, int64_t receiveUs)
+    {
+        for (auto it = _pending.begin(); it != _pending.end(); ++it)
+        {
+            if (it->first == msgid)
+            {
+                Metrics::observe(histogramOf(msgid), receiveUs - it->second);
+                _pending.erase(it);
+                return;
+            }
+        }
+    }
+
+    void onMessage(const TcpConnectionPtr &conn, Buffer *buffer, Timestamp time)
+    {
+        while (buffer->readableBytes() > 0)
+        {
+            const char *end = buffer->peek() + buffer->readableBytes();
+            buffer->retrieveUntil(JsonScanner::skipDelimiters(buffer->peek(), end));
+            if (buffer->readableBytes() == 0)
+            {
+                break;
+            }
+
+            const char *frameEnd = nullptr;
+            int msgid = -1;
+            if (BinaryCodec::isBinary(*buffer->peek()))
+            {
+                BinaryCodec::Header header;
+                if (!BinaryCodec::peekHeader(buffer->peek(), buffer->readableBytes(), &header) ||
+                    buffer->readableBytes() < BinaryCodec::kHeaderLen + header.bodyLen)
+                {
+                    break;
+                }
+                msgid = header.msgid;
+                frameEnd = buffer->peek() + BinaryCodec::kHeaderLen + header.bodyLen;
+            }
+            else
+            {
+                MsgRoute route;
+                JsonScanner::Status status = JsonScanner::scan(buffer->peek(), end, &route, &frameEnd);
+                if (status == JsonScanner::kIncomplete)
+                {
+                    break;
+                }
+                if (status == JsonScanner::kInvalid)
+                {
+                    LOG_ERROR << conn->name() << " invalid frame, discard!";
+                    buffer->retrieveAll();
+                    break;
+                }
+                msgid = route.msgid;
+            }
+            onAck(msgid, time.microSecondsSinceEpoch());
+            buffer->retrieveUntil(frameEnd);
+        }
+    }
+
+    EventLoop *_loop;
+    TcpClient _client;
+    TcpConnectionPtr _conn;
+    vector<string> _queued;
+    // 等待响应的请求：响应的msgid和发送时间
+    deque<pair<int, int64_t>> _pending;
+    bool _closing;
+    bool _closed;
+};
+
+// 按录制的时间把记录分给各个连接，在主线程里调用
+class Replay
+{
+public:
+    Replay(EventLoop *loop, EventLoopThreadPool *pool, const InetAddress &serverAddr, const ReplayOptions &options)
+        : _loop(loop),
+          _pool(pool),
+          _serverAddr(serverAddr),
+          _options(options),
+          _startUs(0),
+          _hasNext(false),
+          _records(0)
+    {
+    }
+
+    bool open(const string &path)
+    {
+        if (!_reader.open(path))
+        {
+            return false;
+        }
+        _hasNext = _reader.next(&_next);
+        return true;
+    }
+
+    void start()
+    {
+        _startUs = nowUs();
+        _loop->runEvery(kPumpInterval, std::bind(&Replay::pump, this));
+    }
+
+    bool report() const;
+
+private:
+    // 把已经到时间的记录都发出去
+    void pump()
+    {
+        if (!_hasNext)
+        {
+            return;
+        }
+        int64_t now = nowUs();
+        while (_hasNext)
+        {
+            int64_t dueUs = _startUs + static_cast<int64_t>(_next.timeUs / _options.speed);
+            if (dueUs > now)
+            {
+                return;
+            }
+            Metrics::observe(kPumpLag, now - dueUs);
+            apply(_next);
+            ++_records;
+            _hasNext = _reader.next(&_next);
+        }
+        cout << "replayed " << _records << " records in " << (now - _startUs) / 1000 << "ms" << endl;
+        _loop->runAfter(kDrainSeconds, std::bind(&Replay::finish, this));
+    }
+
+    void apply(const Recorder::Record &record)
+    {
+        if (record.type == Recorder::kOpen)
+        {
+            unique_ptr<ReplayConn> &conn = _conns[record.conn];
+            if (!conn)
+            {
+                conn.reset(new ReplayConn(_pool->getNextLoop(), _serverAddr, record.conn));
+                ReplayConn *c = conn.get();
+                c->loop()->runInLoop([c]() { c->connect(); });
+            }
+            return;
+        }
+        auto it = _conns.find(record.conn);
+        if (it == _conns.end())
+        {
+            return;
+        }
+        ReplayConn *c = it->second.get();
+        if (record.type == Recorder::kFrame)
+        {
+            string frame = record.data;
+            c->loop()->runInLoop([c, frame]() { c->send(frame); });
+        }
+        else
+        {
+            c->loop()->runInLoop([c]() { c->close(); });
+        }
+    }
+
+    void finish()
+    {
+        for (auto &item : _conns)
+        {
+            ReplayConn *c = item.second.get();
+            c->loop()->runInLoop([c]() { c->close(); });
+        }
+        _loop->quit();
+    }
+
+    EventLoop *_loop;
+    EventLoopThreadPool *_pool;
+    InetAddress _serverAddr;
+    ReplayOptions _options;
+    Recorder::Reader _reader;
+    Recorder::Record _next;
+    int64_t _startUs;
+    bool _hasNext;
+    uint64_t _records;
+    unordered_map<uint32_t, unique_ptr<ReplayConn>> _conns;
+};
+
+// 结果文件每行一种请求：名字 个数 p50 p99 p999
+struct ResultRow
+{
+    uint64_t count = 0;
+    long long p50 = 0;
+    long long p99 = 0;
+    long long p999 = 0;
+};
+
+map<string, ResultRow> loadResult(const string &path)
+{
+    map<string, ResultRow> rows;
+    ifstream in(path);
+    string line;
+    while (getline(in, line))
+    {
+        istringstream fields(line);
+        string name;
+        ResultRow row;
+        if (fields >> name >> row.count >> row.p50 >> row.p99 >> row.p999)
+        {
+            rows[name] = row;
+        }
+    }
+    return rows;
+}
+
+string delta(long long now, long long base)
+{
+    if (base <= 0)
+    {
+        return "";
+    }
+    char buf[32];
+    snprintf(buf, sizeof buf, " (%+.1f%%)", (now - base) * 100.0 / base);
+    return buf;
+}
+
+bool Replay::report() const
+{
+    cout << "frames sent " << Metrics::counterValue(kFramesSent) << ", connections failed "
+         << Metrics::counterValue(kConnFailed) << ", pump lag p99 " << Metrics::quantile(kPumpLag, 0.99) << "us" << endl;
+
+    map<string, ResultRow> baseline;
+    if (!_options.baselinePath.empty())
+    {
+        baseline = loadResult(_options.baselinePath);
+        if (baseline.empty())
+        {
+            cerr << "no results in baseline " << _options.baselinePath << endl;
+        }
+    }
+    ofstream out;
+    if (!_options.resultPath.empty())
+    {
+        out.open(_options.resultPath);
+        if (!out)
+        {
+            cerr << "can not write " << _options.resultPath << endl;
+            return false;
+        }
+    }
+
+    printf("latency us     count      p50      p99     p999\n");
+    const pair<const char *, Metrics::Id> kRows[] = {
+        {"login", kAckLogin}, {"reg", kAckReg}, {"heartbeat", kAckHeartbeat}, {"proto", kAckProto}};
+    for (const auto &item : kRows)
+    {
+        ResultRow row;
+        row.count = Metrics::histogramCount(item.second);
+        if (row.count == 0)
+        {
+            continue;
+        }
+        row.p50 = Metrics::quantile(item.second, 0.5);
+        row.p99 = Metrics::quantile(item.second, 0.99);
+        row.p999 = Metrics::quantile(item.second, 0.999);
+        printf("%-10s %9llu %8lld %8lld %8lld\n", item.first, static_cast<unsigned long long>(row.count),
+               row.p50, row.p99, row.p999);
+        auto base = baseline.find(item.first);
+        if (base != baseline.end())
+        {
+            printf("  vs base  %9llu %8lld%s %8lld%s %8lld%s\n", static_cast<unsigned long long>(base->second.count),
+                   base->second.p50, delta(row.p50, base->second.p50).c_str(),
+                   base->second.p99, delta(row.p99, base->second.p99).c_str(),
+                   base->second.p999, delta(row.p999, base->second.p999).c_str());
+        }
+        if (out)
+        {
+            out << item.first << " " << row.count << " " << row.p50 << " " << row.p99 << " " << row.p999 << "\n";
+        }
+    }
+    return true;
+}
+
+void usage(const char *prog)
+{
+    cerr << "Usage: " << prog << " [-s speed=1] [-t threads=4] [-o result file] [-c baseline result file]"
+         << " <capture file> <ip> <port>" << endl;
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    const char *prog = argv[0];
+    ReplayOptions options;
+    int opt;
+    while ((opt = getopt(argc, argv, "s:t:o:c:")) != -1)
+    {
+        switch (opt)
+        {
+        case 's':
+            options.speed = atof(optarg);
+            break;
+        case 't':
+            options.threads = atoi(optarg);
+            break;
+        case 'o':
+            options.resultPath = optarg;
+            break;
+        case 'c':
+            options.baselinePath = optarg;
+            break;
+        default:
+            usage(prog);
+            return -1;
+        }
+    }
+    if (argc - optind < 3 || options.speed <= 0 || options.threads < 1)
+    {
+        usage(prog);
+        return -1;
+    }
+    Logger::setLogLevel(Logger::WARN);
+
+    InetAddress serverAddr(argv[optind + 1], static_cast<uint16_t>(atoi(argv[optind + 2])));
+    EventLoop loop;
+    EventLoopThreadPool pool(&loop, "chatreplay");
+    pool.setThreadNum(options.threads);
+    pool.start();
+
+    Replay replay(&loop, &pool, serverAddr, options);
+    if (!replay.open(argv[optind]))
+    {
+        cerr << "can not read capture " << argv[optind] << endl;
+        return -1;
+    }
+    replay.start();
+    loop.loop();
+    return replay.report() ? 0 : 1;
+}
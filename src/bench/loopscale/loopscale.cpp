@@ -0,0 +1,158 @@
+#include "jsonscanner.hpp"
+#include "public.hpp"
+
+#include <muduo/base/Logging.h>
+#include <muduo/net/EventLoop.h>
+#include <muduo/net/EventLoopThreadPool.h>
+#include <muduo/net/InetAddress.h>
+#include <muduo/net/TcpClient.h>
+
+#include <atomic>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+using namespace std;
+using namespace placeholders;
+using namespace muduo;
+using namespace muduo::net;
+
+/*
+ChatServer IO线程扩展性的吞吐测试：多条连接在流水线上不停发协议协商请求（PROTO_MSG，version 0），
+收到一个响应就再发一个。协商请求不访问数据库和redis，测的是服务器的网络收发、分帧、分发、
+解码和编码这条路径，每秒完成的请求数随服务器IO线程数的变化就是扩展性。
+配合loopscale.sh用不同的 -t 启动ChatServer。
+*/
+namespace
+{
+
+const string kRequest = "{\"msgid\":" + to_string(PROTO_MSG) + ",\"version\":0}";
+
+atomic<int64_t> g_responses{0};
+atomic_int g_connected{0};
+
+// 一条压测连接
+class BenchConn
+{
+public:
+    BenchConn(EventLoop *loop, const InetAddress &serverAddr, const string &name, int pipeline)
+        : _client(loop, serverAddr, name), _pipeline(pipeline)
+    {
+        _client.setConnectionCallback(std::bind(&BenchConn::onConnection, this, _1));
+        _client.setMessageCallback(std::bind(&BenchConn::onMessage, this, _1, _2, _3));
+    }
+
+    void start() { _client.connect(); }
+    void stop() { _client.disconnect(); }
+
+private:
+    void onConnection(const TcpConnectionPtr &conn)
+    {
+        if (!conn->connected())
+        {
+            return;
+        }
+        conn->setTcpNoDelay(true);
+        ++g_connected;
+        // 先把流水线填满
+        string requests;
+        for (int i = 0; i < _pipeline; ++i)
+        {
+            requests += kRequest;
+        }
+        conn->send(requests);
+    }
+
+    void onMessage(const TcpConnectionPtr &conn, Buffer *buffer, Timestamp)
+    {
+        // 一个响应对应补发一个请求，攒到一起发
+        int n = 0;
+        while (buffer->readableBytes() > 0)
+        {
+            const char *end = buffer->peek() + buffer->readableBytes();
+            buffer->retrieveUntil(JsonScanner::skipDelimiters(buffer->peek(), end));
+            MsgRoute route;
+            const char *frameEnd = nullptr;
+            JsonScanner::Status status = JsonScanner::scan(buffer->peek(), end, &route, &frameEnd);
+            if (status != JsonScanner::kComplete)
+            {
+                if (status == JsonScanner::kInvalid)
+                {
+                    LOG_ERROR << "invalid response, discard!";
+                    buffer->retrieveAll();
+                }
+                break;
+            }
+            buffer->retrieveUntil(frameEnd);
+            ++n;
+        }
+        if (n > 0)
+        {
+            g_responses += n;
+            string requests;
+            for (int i = 0; i < n; ++i)
+            {
+                requests += kRequest;
+            }
+            conn->send(requests);
+        }
+    }
+
+    TcpClient _client;
+    int _pipeline;
+};
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    if (argc < 3)
+    {
+        cerr << "Usage: " << argv[0] << " <ip> <port> [connections=64] [client threads=4] [pipeline=16] [seconds=10]" << endl;
+        return -1;
+    }
+    Logger::setLogLevel(Logger::WARN);
+
+    InetAddress serverAddr(argv[1], static_cast<uint16_t>(atoi(argv[2])));
+    int connections = argc > 3 ? atoi(argv[3]) : 64;
+    int threads = argc > 4 ? atoi(argv[4]) : 4;
+    int pipeline = argc > 5 ? atoi(argv[5]) : 16;
+    int seconds = argc > 6 ? atoi(argv[6]) : 10;
+
+    EventLoop loop;
+    EventLoopThreadPool pool(&loop, "loopscale");
+    pool.setThreadNum(threads);
+    pool.start();
+
+    vector<unique_ptr<BenchConn>> sessions;
+    for (int i = 0; i < connections; ++i)
+    {
+        sessions.emplace_back(new BenchConn(pool.getNextLoop(), serverAddr, "conn" + to_string(i), pipeline));
+        sessions.back()->start();
+    }
+
+    // 预热1秒之后开始计数
+    int64_t begin = 0;
+    Timestamp beginTime;
+    loop.runAfter(1.0, [&]()
+    {
+        begin = g_responses.load();
+        beginTime = Timestamp::now();
+    });
+    loop.runAfter(1.0 + seconds, [&]()
+    {
+        int64_t count = g_responses.load() - begin;
+        double elapsed = timeDifference(Timestamp::now(), beginTime);
+        cout << "connections " << g_connected.load() << "/" << connections
+             << " pipeline " << pipeline
+             << " requests " << count
+             << " throughput " << static_cast<int64_t>(count / elapsed) << " req/s" << endl;
+        for (auto &session : sessions)
+        {
+            session->stop();
+        }
+        loop.quit();
+    });
+    loop.loop();
+    return 0;
+}
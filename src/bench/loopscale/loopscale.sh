@@ -0,0 +1,47 @@
+#!/bin/bash
+
+# ChatServer在1..N个IO线程下的吞吐，每一档重新启动服务器
+# 用法: src/bench/loopscale/loopscale.sh [最大IO线程数=cpu核数/2] [连接数=256] [每档秒数=10]
+# 服务器绑定前N个核，压测客户端用剩下的核，避免两边抢cpu
+
+WORKDIR=$(cd "$(dirname "$0")/../../.." && pwd)
+SERVER=$WORKDIR/bin/ChatServer
+BENCH=$WORKDIR/bin/LoopScaleBench
+PORT=${PORT:-16000}
+
+CPUS=$(nproc)
+MAX=${1:-$((CPUS / 2))}
+CONNS=${2:-256}
+SECONDS_PER_RUN=${3:-10}
+if [ "$MAX" -lt 1 ]; then
+	MAX=1
+fi
+
+# 客户端线程绑到服务器没用的核上
+CLIENT_THREADS=$((CPUS - MAX))
+CLIENT_PIN=""
+if [ "$CLIENT_THREADS" -gt 0 ]; then
+	CLIENT_PIN="taskset -c $MAX-$((CPUS - 1))"
+else
+	CLIENT_THREADS=1
+fi
+
+threads=1
+while [ "$threads" -le "$MAX" ]; do
+	"$SERVER" -t "$threads" -c "0-$((threads - 1))" 127.0.0.1 "$PORT" >/dev/null 2>&1 &
+	pid=$!
+	sleep 1
+	echo -n "io threads $threads: "
+	$CLIENT_PIN "$BENCH" 127.0.0.1 "$PORT" "$CONNS" "$CLIENT_THREADS" 16 "$SECONDS_PER_RUN"
+	# 用SIGTERM结束，SIGINT会去数据库重置用户状态
+	kill -TERM "$pid"
+	wait "$pid" 2>/dev/null
+
+	if [ "$threads" -eq "$MAX" ]; then
+		break
+	fi
+	threads=$((threads * 2))
+	if [ "$threads" -gt "$MAX" ]; then
+		threads=$MAX
+	fi
+done
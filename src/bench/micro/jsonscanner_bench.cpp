@@ -0,0 +1,108 @@
+#include "jsonscanner.hpp"
+#include "json.hpp"
+#include "public.hpp"
+
+#include <benchmark/benchmark.h>
+#include <string.h>
+#include <string>
+using namespace std;
+using json = nlohmann::json;
+
+namespace
+{
+
+// 和ChatClient发出的格式一致的聊天消息，msgLen是聊天内容的字节数
+string makeChatFrame(int msgid, size_t msgLen)
+{
+    json js;
+    js["msgid"] = msgid;
+    js["id"] = 1;
+    js["name"] = "zhang san";
+    if (msgid == ONE_CHAT_MSG)
+    {
+        js["toid"] = 2;
+    }
+    else
+    {
+        js["groupid"] = 1;
+    }
+    js["msg"] = string(msgLen, 'a');
+    js["time"] = "2026-10-19 12:00:00";
+    return js.dump();
+}
+
+// 修改前的路径：构建DOM，读路由字段，再dump出转发的字符串
+void BM_ParseDump(benchmark::State &state, int msgid)
+{
+    string frame = makeChatFrame(msgid, state.range(0));
+    for (auto _ : state)
+    {
+        json js = json::parse(frame);
+        int route = msgid == ONE_CHAT_MSG ? js["toid"].get<int>() : js["groupid"].get<int>();
+        string out = js.dump();
+        benchmark::DoNotOptimize(route);
+        benchmark::DoNotOptimize(out.data());
+    }
+    state.SetItemsProcessed(state.iterations());
+    state.SetBytesProcessed(state.iterations() * frame.size());
+}
+
+// 快速路径：按需扫描路由字段，原始字节原样转发
+void BM_ScanForward(benchmark::State &state, int msgid)
+{
+    string frame = makeChatFrame(msgid, state.range(0));
+    for (auto _ : state)
+    {
+        MsgRoute route;
+        const char *frameEnd = nullptr;
+        JsonScanner::scan(frame.data(), frame.data() + frame.size(), &route, &frameEnd);
+        string out(frame.c_str(), frameEnd);
+        benchmark::DoNotOptimize(route);
+        benchmark::DoNotOptimize(out.data());
+    }
+    state.SetItemsProcessed(state.iterations());
+    state.SetBytesProcessed(state.iterations() * frame.size());
+}
+
+// 路由字段的边界情况，结果不对时报错，不计时：
+// 超出int范围的id按不是整数处理（-1），不能截断成别的id
+void BM_ScanRouteEdgeCases(benchmark::State &state)
+{
+    struct Case
+    {
+        const char *frame;
+        int toid;
+    };
+    const Case kCases[] = {
+        {"{\"msgid\":5,\"toid\":2}", 2},
+        {"{\"msgid\":5,\"toid\":2147483647}", 2147483647},
+        {"{\"msgid\":5,\"toid\":-2147483648}", -2147483647 - 1},
+        {"{\"msgid\":5,\"toid\":2147483648}", -1},
+        {"{\"msgid\":5,\"toid\":4294967298}", -1},
+        {"{\"msgid\":5,\"toid\":-2147483649}", -1},
+        {"{\"msgid\":5,\"toid\":12345678901}", -1},
+        {"{\"msgid\":5,\"toid\":\"2\"}", -1},
+    };
+    for (auto _ : state)
+    {
+        for (const Case &c : kCases)
+        {
+            MsgRoute route;
+            const char *frameEnd = nullptr;
+            const char *end = c.frame + strlen(c.frame);
+            if (JsonScanner::scan(c.frame, end, &route, &frameEnd) != JsonScanner::kComplete || route.toid != c.toid)
+            {
+                state.SkipWithError((string("wrong toid for ") + c.frame).c_str());
+                return;
+            }
+        }
+    }
+}
+
+} // namespace
+
+BENCHMARK(BM_ScanRouteEdgeCases);
+BENCHMARK_CAPTURE(BM_ParseDump, one_chat, ONE_CHAT_MSG)->Arg(16)->Arg(256)->Arg(4096);
+BENCHMARK_CAPTURE(BM_ScanForward, one_chat, ONE_CHAT_MSG)->Arg(16)->Arg(256)->Arg(4096);
+BENCHMARK_CAPTURE(BM_ParseDump, group_chat, GROUP_CHAT_MSG)->Arg(16)->Arg(256)->Arg(4096);
+BENCHMARK_CAPTURE(BM_ScanForward, group_chat, GROUP_CHAT_MSG)->Arg(16)->Arg(256)->Arg(4096);
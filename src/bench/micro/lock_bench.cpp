@@ -0,0 +1,61 @@
+#include "instrumentedmutex.hpp"
+
+#include <benchmark/benchmark.h>
+#include <memory>
+#include <string>
+#include <unordered_map>
+using namespace std;
+
+/*
+InstrumentedMutex打开和关闭统计时的加锁开销，多个线程抢同一把锁。
+锁里做的事情和_connMutex的调用点差不多：查一次unordered_map，拷贝出一个shared_ptr。
+ChatService::getHandler见src/bench/server/dispatch_bench.cpp。
+*/
+namespace
+{
+
+const int kEntries = 10000;
+
+const InstrumentedMutex::Site kSite = InstrumentedMutex::site("bench", "lookup");
+
+// 所有线程共用，第一次用到时初始化
+struct LockedMap
+{
+    InstrumentedMutex mutex;
+    unordered_map<int, shared_ptr<int>> entries;
+
+    LockedMap()
+    {
+        for (int id = 0; id < kEntries; ++id)
+        {
+            entries.insert({id, make_shared<int>(id)});
+        }
+    }
+};
+
+// 参数1表示打开统计，0表示关闭
+void BM_InstrumentedLookup(benchmark::State &state)
+{
+    static LockedMap map;
+    InstrumentedMutex::setEnabled(state.range(0) != 0);
+    int id = state.thread_index() * 7919;
+    for (auto _ : state)
+    {
+        shared_ptr<int> entry;
+        {
+            InstrumentedLockGuard lock(map.mutex, kSite);
+            auto it = map.entries.find(id % kEntries);
+            if (it != map.entries.end())
+            {
+                entry = it->second;
+            }
+        }
+        benchmark::DoNotOptimize(entry.get());
+        id += 13;
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+} // namespace
+
+BENCHMARK(BM_InstrumentedLookup)->Arg(0)->Arg(1)->ThreadRange(1, 8)->UseRealTime();
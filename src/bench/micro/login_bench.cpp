@@ -0,0 +1,220 @@
+#include "loginsnapshot.hpp"
+#include "json.hpp"
+#include "public.hpp"
+
+#include <benchmark/benchmark.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+using namespace std;
+using json = nlohmann::json;
+
+/*
+登录成功响应的编码（服务端）和解码（客户端）开销，参数是用户加入的群数。
+每个群20个成员，成员从同一批100个用户里取，好友20个，模拟用户在很多群里互相重叠的情况。
+*/
+namespace
+{
+
+struct Fixture
+{
+    User user{1, "zhang san", "", "online"};
+    vector<User> friends;
+    vector<Group> groups;
+    vector<string> offlinemsg;
+
+    explicit Fixture(int groupCount)
+    {
+        for (int i = 0; i < 20; ++i)
+        {
+            friends.push_back(User(100 + i, "friend " + to_string(i), "", i % 2 ? "online" : "offline"));
+        }
+        for (int g = 0; g < groupCount; ++g)
+        {
+            Group group(1000 + g, "group " + to_string(g), "a group for benchmark");
+            for (int m = 0; m < 20; ++m)
+            {
+                int id = 100 + (g * 7 + m) % 100;
+                GroupUser member;
+                member.setId(id);
+                member.setName("friend " + to_string(id - 100));
+                member.setState(id % 2 ? "online" : "offline");
+                member.setRole(m == 0 ? "creator" : "normal");
+                group.getUsers().push_back(member);
+            }
+            groups.push_back(group);
+        }
+    }
+
+    // knownVersions为空时是完整的快照
+    LoginSnapshot snapshot(const unordered_map<int, int> &knownVersions = unordered_map<int, int>(), bool friendsChanged = true)
+    {
+        LoginSnapshot snapshot(user, offlinemsg);
+        snapshot.setFriends(friends, 1, friendsChanged);
+        snapshot.setGroups(groups, knownVersions);
+        return snapshot;
+    }
+};
+
+// 修改前：好友、群、群成员各自dump成字符串，再放进响应里dump一次
+string encodeV1(Fixture &f)
+{
+    json response;
+    response["msgid"] = LOGIN_MSG_ACK;
+    response["errno"] = 0;
+    response["id"] = f.user.getId();
+    response["name"] = f.user.getName();
+    vector<string> vec2;
+    for (User &user : f.friends)
+    {
+        json js;
+        js["id"] = user.getId();
+        js["name"] = user.getName();
+        js["state"] = user.getState();
+        vec2.push_back(js.dump());
+    }
+    response["friends"] = vec2;
+    vector<string> vec3;
+    for (Group &group : f.groups)
+    {
+        json js;
+        js["id"] = group.getId();
+        js["groupname"] = group.getName();
+        js["groupdesc"] = group.getDesc();
+        vector<string> userV;
+        for (GroupUser &user : group.getUsers())
+        {
+            json js;
+            js["id"] = user.getId();
+            js["name"] = user.getName();
+            js["state"] = user.getState();
+            js["role"] = user.getRole();
+            userV.push_back(js.dump());
+        }
+        js["users"] = userV;
+        vec3.push_back(js.dump());
+    }
+    response["groups"] = vec3;
+    return response.dump();
+}
+
+void BM_LoginEncodeV1(benchmark::State &state)
+{
+    Fixture f(state.range(0));
+    size_t bytes = 0;
+    for (auto _ : state)
+    {
+        string text = encodeV1(f);
+        bytes = text.size();
+        benchmark::DoNotOptimize(text.data());
+    }
+    state.counters["frame_bytes"] = bytes;
+}
+
+void BM_LoginEncodeV2(benchmark::State &state)
+{
+    Fixture f(state.range(0));
+    string out;
+    for (auto _ : state)
+    {
+        out.clear();
+        f.snapshot().toJsonText(&out);
+        benchmark::DoNotOptimize(out.data());
+    }
+    state.counters["frame_bytes"] = out.size();
+}
+
+void BM_LoginEncodeV2Binary(benchmark::State &state)
+{
+    Fixture f(state.range(0));
+    string out;
+    for (auto _ : state)
+    {
+        out.clear();
+        f.snapshot().toBinary(&out);
+        benchmark::DoNotOptimize(out.data());
+    }
+    state.counters["frame_bytes"] = out.size();
+}
+
+// 重连时好友和群组都没有变化，只发版本号和在线好友
+void BM_LoginEncodeDelta(benchmark::State &state)
+{
+    Fixture f(state.range(0));
+    unordered_map<int, int> knownVersions;
+    for (Group &group : f.groups)
+    {
+        knownVersions[group.getId()] = group.getVersion();
+    }
+    string out;
+    for (auto _ : state)
+    {
+        out.clear();
+        f.snapshot(knownVersions, false).toJsonText(&out);
+        benchmark::DoNotOptimize(out.data());
+    }
+    state.counters["frame_bytes"] = out.size();
+}
+
+// 客户端解析：v1每个元素还要再json::parse一次
+void BM_LoginDecodeV1(benchmark::State &state)
+{
+    Fixture f(state.range(0));
+    string text = encodeV1(f);
+    for (auto _ : state)
+    {
+        json response = json::parse(text);
+        size_t members = 0;
+        vector<string> vec = response["friends"];
+        for (string &str : vec)
+        {
+            json js = json::parse(str);
+            benchmark::DoNotOptimize(js);
+        }
+        vector<string> vec1 = response["groups"];
+        for (string &groupstr : vec1)
+        {
+            json grpjs = json::parse(groupstr);
+            vector<string> vec2 = grpjs["users"];
+            for (string &userstr : vec2)
+            {
+                json js = json::parse(userstr);
+                members += js["id"].get<int>();
+            }
+        }
+        benchmark::DoNotOptimize(members);
+    }
+}
+
+void BM_LoginDecodeV2(benchmark::State &state)
+{
+    Fixture f(state.range(0));
+    string text;
+    f.snapshot().toJsonText(&text);
+    for (auto _ : state)
+    {
+        json response = json::parse(text);
+        size_t members = 0;
+        for (json &u : response["users"])
+        {
+            benchmark::DoNotOptimize(u);
+        }
+        for (json &grpjs : response["groups"])
+        {
+            for (json &member : grpjs[3])
+            {
+                members += member[0].get<int>();
+            }
+        }
+        benchmark::DoNotOptimize(members);
+    }
+}
+
+} // namespace
+
+BENCHMARK(BM_LoginEncodeV1)->Arg(1)->Arg(50);
+BENCHMARK(BM_LoginEncodeV2)->Arg(1)->Arg(50);
+BENCHMARK(BM_LoginEncodeV2Binary)->Arg(1)->Arg(50);
+BENCHMARK(BM_LoginEncodeDelta)->Arg(1)->Arg(50);
+BENCHMARK(BM_LoginDecodeV1)->Arg(1)->Arg(50);
+BENCHMARK(BM_LoginDecodeV2)->Arg(1)->Arg(50);
@@ -0,0 +1,92 @@
+#include "group.hpp"
+#include "user.hpp"
+
+#include <benchmark/benchmark.h>
+#include <string>
+#include <vector>
+using namespace std;
+
+/*
+登录路径上model层的CPU开销，不包括数据库的往返：
+1. GroupModel::queryGroups逐行构建Group和GroupUser，push_back拷贝进vector，按值返回
+2. 编码登录响应时逐个调用getName()/getState()/getRole()，每次返回一个string的拷贝
+MySQLStorage拼SQL的开销要链接mysqlclient，见src/bench/server/sql_bench.cpp。
+*/
+namespace
+{
+
+// 和queryGroups一样的构建方式，每个群20个成员
+vector<Group> buildGroups(int groupCount)
+{
+    vector<Group> groupVec;
+    for (int g = 0; g < groupCount; ++g)
+    {
+        Group group;
+        group.setId(1000 + g);
+        group.setName("group " + to_string(g));
+        group.setDesc("a group for benchmark");
+        group.setVersion(1);
+        groupVec.push_back(group);
+    }
+    for (Group &group : groupVec)
+    {
+        for (int m = 0; m < 20; ++m)
+        {
+            GroupUser user;
+            user.setId(100 + m);
+            user.setName("friend " + to_string(m));
+            user.setState(m % 2 ? "online" : "offline");
+            user.setRole(m == 0 ? "creator" : "normal");
+            group.getUsers().push_back(user);
+        }
+    }
+    return groupVec;
+}
+
+void BM_ModelBuildGroups(benchmark::State &state)
+{
+    for (auto _ : state)
+    {
+        vector<Group> groups = buildGroups(state.range(0));
+        benchmark::DoNotOptimize(groups.data());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+// login里vector<Group> groupVec = queryGroups(id)如果没有被省略拷贝，就是这一次深拷贝
+void BM_ModelCopyGroups(benchmark::State &state)
+{
+    vector<Group> groups = buildGroups(state.range(0));
+    for (auto _ : state)
+    {
+        vector<Group> copy = groups;
+        benchmark::DoNotOptimize(copy.data());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+// 编码时读每个成员的字段，getter按值返回string
+void BM_ModelGetters(benchmark::State &state)
+{
+    vector<Group> groups = buildGroups(state.range(0));
+    for (auto _ : state)
+    {
+        size_t bytes = 0;
+        for (Group &group : groups)
+        {
+            bytes += group.getName().size() + group.getDesc().size();
+            for (GroupUser &user : group.getUsers())
+            {
+                bytes += user.getName().size() + user.getState().size() + user.getRole().size();
+            }
+        }
+        benchmark::DoNotOptimize(bytes);
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+} // namespace
+
+BENCHMARK(BM_ModelBuildGroups)->Arg(1)->Arg(50);
+BENCHMARK(BM_ModelCopyGroups)->Arg(1)->Arg(50);
+BENCHMARK(BM_ModelGetters)->Arg(1)->Arg(50);
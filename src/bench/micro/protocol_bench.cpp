@@ -0,0 +1,102 @@
+#include "binarycodec.hpp"
+#include "json.hpp"
+#include "public.hpp"
+
+#include <benchmark/benchmark.h>
+#include <string>
+using namespace std;
+using json = nlohmann::json;
+
+// 同一条聊天消息分别用json文本和二进制协议编解码的开销，frame_bytes是线上的字节数
+namespace
+{
+
+json makeOneChat()
+{
+    json js;
+    js["msgid"] = ONE_CHAT_MSG;
+    js["id"] = 1024;
+    js["name"] = "zhang san";
+    js["toid"] = 2048;
+    js["msg"] = "see you at 8 tonight";
+    js["time"] = "2026-10-19 12:00:00";
+    return js;
+}
+
+void BM_JsonEncode(benchmark::State &state)
+{
+    json js = makeOneChat();
+    size_t bytes = 0;
+    for (auto _ : state)
+    {
+        string frame = js.dump();
+        bytes = frame.size();
+        benchmark::DoNotOptimize(frame.data());
+    }
+    state.counters["frame_bytes"] = bytes;
+    state.SetItemsProcessed(state.iterations());
+}
+
+void BM_BinaryEncode(benchmark::State &state)
+{
+    json js = makeOneChat();
+    size_t bytes = 0;
+    for (auto _ : state)
+    {
+        string frame;
+        BinaryCodec::encode(js, &frame);
+        bytes = frame.size();
+        benchmark::DoNotOptimize(frame.data());
+    }
+    state.counters["frame_bytes"] = bytes;
+    state.SetItemsProcessed(state.iterations());
+}
+
+void BM_JsonDecode(benchmark::State &state)
+{
+    string frame = makeOneChat().dump();
+    for (auto _ : state)
+    {
+        json js = json::parse(frame);
+        benchmark::DoNotOptimize(js);
+    }
+    state.counters["frame_bytes"] = frame.size();
+    state.SetItemsProcessed(state.iterations());
+}
+
+void BM_BinaryDecode(benchmark::State &state)
+{
+    string frame;
+    BinaryCodec::encode(makeOneChat(), &frame);
+    for (auto _ : state)
+    {
+        json js;
+        BinaryCodec::decode(frame.data(), frame.size(), &js);
+        benchmark::DoNotOptimize(js);
+    }
+    state.counters["frame_bytes"] = frame.size();
+    state.SetItemsProcessed(state.iterations());
+}
+
+// 二进制帧的转发只需要看帧头
+void BM_BinaryRoute(benchmark::State &state)
+{
+    string frame;
+    BinaryCodec::encode(makeOneChat(), &frame);
+    for (auto _ : state)
+    {
+        BinaryCodec::Header header;
+        BinaryCodec::peekHeader(frame.data(), frame.size(), &header);
+        benchmark::DoNotOptimize(header);
+    }
+    state.counters["frame_bytes"] = frame.size();
+    state.SetItemsProcessed(state.iterations());
+}
+
+} // namespace
+
+BENCHMARK(BM_JsonEncode);
+BENCHMARK(BM_BinaryEncode);
+BENCHMARK(BM_JsonDecode);
+BENCHMARK(BM_BinaryDecode);
+BENCHMARK(BM_BinaryRoute);
@@ -0,0 +1,77 @@
+#include "jsonscanner.hpp"
+#include "json.hpp"
+#include "public.hpp"
+
+#include <benchmark/benchmark.h>
+#include <string>
+#include <vector>
+using namespace std;
+using json = nlohmann::json;
+
+/*
+一对一聊天消息在服务端转发一次的CPU开销，不包括socket的读写系统调用。
+输入缓冲区和接收方的输出缓冲区用vector<char>模拟muduo的Buffer，每轮都清空复用。
+*/
+namespace
+{
+
+string makeOneChatFrame(size_t msgLen)
+{
+    json js;
+    js["msgid"] = ONE_CHAT_MSG;
+    js["id"] = 1;
+    js["name"] = "zhang san";
+    js["toid"] = 2;
+    js["msg"] = string(msgLen, 'a');
+    js["time"] = "2026-10-19 12:00:00";
+    return js.dump();
+}
+
+// 修改前：retrieveAllAsString拷贝出来，构建DOM，dump成新的字符串，再拷贝进输出缓冲区
+void BM_RelayDom(benchmark::State &state)
+{
+    string frame = makeOneChatFrame(state.range(0));
+    vector<char> input(frame.begin(), frame.end());
+    vector<char> output;
+    output.reserve(64 * 1024);
+    for (auto _ : state)
+    {
+        string buf(input.data(), input.size());
+        json js = json::parse(buf);
+        int toid = js["toid"].get<int>();
+        string out = js.dump();
+        output.clear();
+        output.insert(output.end(), out.begin(), out.end());
+        benchmark::DoNotOptimize(toid);
+        benchmark::DoNotOptimize(output.data());
+    }
+    state.SetItemsProcessed(state.iterations());
+    state.SetBytesProcessed(state.iterations() * frame.size());
+}
+
+// 修改后：在输入缓冲区上扫描路由字段，原始字节一次拷贝进输出缓冲区
+void BM_RelayZeroCopy(benchmark::State &state)
+{
+    string frame = makeOneChatFrame(state.range(0));
+    vector<char> input(frame.begin(), frame.end());
+    vector<char> output;
+    output.reserve(64 * 1024);
+    for (auto _ : state)
+    {
+        const char *begin = input.data();
+        MsgRoute route;
+        const char *frameEnd = nullptr;
+        JsonScanner::scan(begin, begin + input.size(), &route, &frameEnd);
+        output.clear();
+        output.insert(output.end(), begin, frameEnd);
+        benchmark::DoNotOptimize(route);
+        benchmark::DoNotOptimize(output.data());
+    }
+    state.SetItemsProcessed(state.iterations());
+    state.SetBytesProcessed(state.iterations() * frame.size());
+}
+
+} // namespace
+
+BENCHMARK(BM_RelayDom)->Arg(32)->Arg(4096);
+BENCHMARK(BM_RelayZeroCopy)->Arg(32)->Arg(4096);
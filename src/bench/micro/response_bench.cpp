@@ -0,0 +1,107 @@
+#include "messages.hpp"
+#include "json.hpp"
+#include "public.hpp"
+
+#include <benchmark/benchmark.h>
+#include <string>
+using namespace std;
+using json = nlohmann::json;
+
+/*
+登录/注册响应的编码开销，不包括socket的写系统调用。
+output模拟连接的输出缓冲区，每轮都清空复用。
+*/
+namespace
+{
+
+// 修改前：每次构建json对象再dump
+void BM_LoginFailedDom(benchmark::State &state)
+{
+    string output;
+    for (auto _ : state)
+    {
+        json response;
+        response["msgid"] = LOGIN_MSG_ACK;
+        response["errno"] = 1;
+        response["errmsg"] = "用户名或密码错误";
+        string text = response.dump();
+        output.assign(text);
+        benchmark::DoNotOptimize(output.data());
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+// 修改后：启动时编码一次，每次只拷贝进输出缓冲区
+void BM_LoginFailedCanned(benchmark::State &state)
+{
+    LoginMsgAck response;
+    response.err = 1;
+    response.setErrmsg("用户名或密码错误");
+    string canned;
+    response.toJsonText(&canned);
+    string output;
+    for (auto _ : state)
+    {
+        output.assign(canned);
+        benchmark::DoNotOptimize(output.data());
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+void BM_RegAckDom(benchmark::State &state)
+{
+    string output;
+    int id = 0;
+    for (auto _ : state)
+    {
+        json response;
+        response["msgid"] = REG_MSG_ACK;
+        response["errno"] = 0;
+        response["id"] = ++id;
+        string text = response.dump();
+        output.assign(text);
+        benchmark::DoNotOptimize(output.data());
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+// 带参数的响应直接写进复用的缓冲区
+void BM_RegAckStream(benchmark::State &state)
+{
+    string output;
+    int id = 0;
+    for (auto _ : state)
+    {
+        RegMsgAck response;
+        response.err = 0;
+        response.setId(++id);
+        output.clear();
+        response.toJsonText(&output);
+        benchmark::DoNotOptimize(output.data());
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+void BM_RegAckStreamBinary(benchmark::State &state)
+{
+    string output;
+    int id = 0;
+    for (auto _ : state)
+    {
+        RegMsgAck response;
+        response.err = 0;
+        response.setId(++id);
+        output.clear();
+        response.toBinary(&output);
+        benchmark::DoNotOptimize(output.data());
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+} // namespace
+
+BENCHMARK(BM_LoginFailedDom);
+BENCHMARK(BM_LoginFailedCanned);
+BENCHMARK(BM_RegAckDom);
+BENCHMARK(BM_RegAckStream);
+BENCHMARK(BM_RegAckStreamBinary);
@@ -0,0 +1,106 @@
+#include "logstorage.hpp"
+
+#include <benchmark/benchmark.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+using namespace std;
+
+/*
+进程内存储LogStorage在热路径上的开销，不需要mysqld：
+1. 群聊每条消息都要queryGroupUsers，在内存里按群id找成员
+2. 登录和注销各写一次状态，追加一行日志并fflush
+3. 登录时queryGroups构建群组和群成员
+和src/bench/server/sql_bench.cpp里的MySQL对照项一起看，MySQL那边还要加上一次连接和一次网络往返。
+*/
+namespace
+{
+
+const int kUsers = 1000;
+
+// 每个benchmark一个新的日志文件，结束时删除
+class StorageFixture
+{
+public:
+    explicit StorageFixture(int groupSize) : _path("/tmp/chat_storage_bench." + to_string(getpid()) + ".log")
+    {
+        remove(_path.c_str());
+        string error;
+        if (!_storage.open(_path, &error))
+        {
+            fprintf(stderr, "%s\n", error.c_str());
+            abort();
+        }
+        for (int i = 0; i < kUsers; ++i)
+        {
+            User user(-1, "user" + to_string(i), "123456");
+            _storage.insertUser(user);
+        }
+        // 用户1在10个群里，每个群groupSize个成员
+        for (int g = 0; g < 10; ++g)
+        {
+            Group group(-1, "group" + to_string(g), "storage bench");
+            _storage.createGroup(group);
+            for (int m = 0; m < groupSize; ++m)
+            {
+                _storage.addGroup(1 + (g * groupSize + m) % kUsers, group.getId(), m == 0 ? "creator" : "normal");
+            }
+            _storage.addGroup(1, group.getId(), "normal");
+        }
+    }
+
+    ~StorageFixture()
+    {
+        remove(_path.c_str());
+        remove((_path + ".tmp").c_str());
+    }
+
+    LogStorage &storage() { return _storage; }
+
+private:
+    string _path;
+    LogStorage _storage;
+};
+
+void BM_LogStorageQueryGroupUsers(benchmark::State &state)
+{
+    StorageFixture fixture(static_cast<int>(state.range(0)));
+    for (auto _ : state)
+    {
+        vector<int> ids = fixture.storage().queryGroupUsers(1, 1);
+        benchmark::DoNotOptimize(ids.data());
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+// 每次都改变状态，每次都追加一行日志
+void BM_LogStorageUpdateState(benchmark::State &state)
+{
+    StorageFixture fixture(10);
+    bool online = false;
+    for (auto _ : state)
+    {
+        online = !online;
+        fixture.storage().updateUserState(1, online ? "online" : "offline");
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+void BM_LogStorageQueryGroups(benchmark::State &state)
+{
+    StorageFixture fixture(static_cast<int>(state.range(0)));
+    for (auto _ : state)
+    {
+        vector<Group> groups = fixture.storage().queryGroups(1, unordered_map<int, int>());
+        benchmark::DoNotOptimize(groups.data());
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+} // namespace
+
+BENCHMARK(BM_LogStorageQueryGroupUsers)->Arg(20)->Arg(500);
+BENCHMARK(BM_LogStorageUpdateState);
+BENCHMARK(BM_LogStorageQueryGroups)->Arg(20);
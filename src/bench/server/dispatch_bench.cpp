@@ -0,0 +1,38 @@
+#include "chatservice.hpp"
+#include "public.hpp"
+
+#include <benchmark/benchmark.h>
+using namespace std;
+
+/*
+每条消息都要经过ChatService::getHandler：按msgid查_msgHandlerMap，按值返回MsgHandler（std::function）。
+这里调用服务器里的单例，构造时会去连redis，连不上只记一条错误日志，不影响查表。
+*/
+namespace
+{
+
+void BM_GetHandler(benchmark::State &state)
+{
+    ChatService *service = ChatService::instance();
+    for (auto _ : state)
+    {
+        MsgHandler handler = service->getHandler(ONE_CHAT_MSG);
+        benchmark::DoNotOptimize(&handler);
+    }
+}
+
+// 没有注册的msgid，返回一个新构造的空操作处理器
+void BM_GetHandlerMissing(benchmark::State &state)
+{
+    ChatService *service = ChatService::instance();
+    for (auto _ : state)
+    {
+        MsgHandler handler = service->getHandler(-1);
+        benchmark::DoNotOptimize(&handler);
+    }
+}
+
+} // namespace
+
+BENCHMARK(BM_GetHandler);
+BENCHMARK(BM_GetHandlerMissing);
@@ -0,0 +1,61 @@
+#include "db.h"
+#include "mysqlstorage.hpp"
+
+#include <benchmark/benchmark.h>
+#include <string>
+using namespace std;
+
+/*
+MySQLStorage拼SQL的开销，不包括连接和数据库的往返：
+1. 整数参数sprintf进char sql[1024]
+2. 字符串参数用mysql_real_escape_string转义之后拼进std::string
+转义用的是mysql_init之后还没连接的句柄，不需要mysqld。不走数据库的LogStorage见src/bench/micro/storage_bench.cpp。
+*/
+namespace
+{
+
+// UserModel::insert
+void BM_SqlInsertUser(benchmark::State &state)
+{
+    MySQL mysql;
+    User user(-1, "zhang san", "123456", "offline");
+    for (auto _ : state)
+    {
+        string sql = MySQLStorage::insertUserSql(mysql.getConnection(), user);
+        benchmark::DoNotOptimize(sql.data());
+    }
+}
+
+// GroupModel::queryGroups的第二条查询，每个群执行一次
+void BM_SqlQueryGroupUsers(benchmark::State &state)
+{
+    int groupid = 1000;
+    for (auto _ : state)
+    {
+        string sql = MySQLStorage::groupMembersSql(groupid++);
+        benchmark::DoNotOptimize(sql.data());
+    }
+}
+
+// OfflineMsgModel::insert，参数是消息的字节数，消息是json，每个引号都要转义
+void BM_SqlInsertOffline(benchmark::State &state)
+{
+    MySQL mysql;
+    string msg(state.range(0), 'a');
+    for (size_t i = 0; i < msg.size(); i += 8)
+    {
+        msg[i] = '"';
+    }
+    for (auto _ : state)
+    {
+        string sql = MySQLStorage::insertOfflineMsgSql(mysql.getConnection(), 1, msg);
+        benchmark::DoNotOptimize(sql.data());
+    }
+    state.SetBytesProcessed(state.iterations() * msg.size());
+}
+
+} // namespace
+
+BENCHMARK(BM_SqlInsertUser);
+BENCHMARK(BM_SqlQueryGroupUsers);
+BENCHMARK(BM_SqlInsertOffline)->Arg(64)->Arg(512)->Arg(65536);
@@ -7,6 +7,9 @@
 #include <ctime>
 #include <unordered_map>
 #include <functional>
+#include <fstream>
+#include <cstdio>
+#include <cstdlib>
 using namespace std;
 using json = nlohmann::json;
 
@@ -17,10 +20,13 @@ using json = nlohmann::json;
 #include <arpa/inet.h>
 #include <semaphore.h>
 #include <atomic>
+#include <mutex>
 
 #include "group.hpp"
 #include "user.hpp"
 #include "public.hpp"
+#include "binarycodec.hpp"
+#include "jsonscanner.hpp"
 
 // 记录当前系统登录的用户信息
 User g_currentUser;
@@ -36,16 +42,48 @@ bool isMainMenuRunning = false;
 sem_t rwsem;
 // 记录登录状态
 atomic_bool g_isLoginSuccess{false};
+// 和服务器协商好的协议
+atomic_int g_protocol{PROTO_JSON};
+// 用于等待协议协商的响应
+sem_t protosem;
+// 心跳线程和main线程都会发送，一条消息要一次完整地写进socket
+mutex g_sendMutex;
+// 心跳间隔（秒），服务器默认90秒没有收到消息就断开连接
+const int kHeartbeatInterval = 30;
+// 最近一次收到心跳响应的时间（steady_clock的秒数），心跳线程用来发现服务器或者网络已经断了
+atomic<int64_t> g_lastHeartbeatAck{0};
+// 服务器繁忙时建议的重试时间（毫秒），0表示不用重试
+atomic_int g_loginRetryAfter{0};
+// 服务器繁忙时最多重试几次登录
+const int kMaxLoginRetries = 5;
 
 
 // 接收线程
 void readTaskHandler(int clientfd);
+// 心跳线程
+void heartbeatTaskHandler(int clientfd);
 // 获取系统时间（聊天信息需要添加时间信息）
 string getCurrentTime();
 // 主聊天页面程序
 void mainMenu(int);
 // 显示当前登录成功用户的基本信息
 void showCurrentUserData();
+// 按照和服务器协商好的协议编码并发送一条消息
+int sendMsg(int clientfd, const json &js);
+// 单调时钟的秒数，不受修改系统时间的影响
+int64_t nowSeconds()
+{
+    return std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// 和服务器协商连接上使用的协议
+void negotiateProtocol(int clientfd);
+// 登录时带上本地保存的好友列表和群组的版本号
+void addSyncVersions(int userid, json &js);
+// 显示一条聊天消息
+void showChatMsg(json &js);
+// 单调时钟的秒数
+int64_t nowSeconds();
 
 // 聊天客户端程序实现，main线程用作发送线程，子线程用作接收线程
 int main(int argc, char **argv)
@@ -86,11 +124,19 @@ int main(int argc, char **argv)
 
     // 初始化读写线程通信用的信号量
     sem_init(&rwsem, 0, 0);
+    sem_init(&protosem, 0, 0);
 
     // 连接服务器成功，启动接收子线程
     std::thread readTask(readTaskHandler, clientfd); // pthread_create
     readTask.detach();                               // pthread_detach
 
+    // 优先使用二进制协议，老版本的服务器不支持时继续使用json
+    negotiateProtocol(clientfd);
+
+    // 协议确定之后开始定时发送心跳，停在菜单上不操作也不会被服务器当成断网的连接清理掉
+    std::thread heartbeatTask(heartbeatTaskHandler, clientfd);
+    heartbeatTask.detach();
+
     // main线程用于接收用户输入，负责发送数据
     for (;;)
     {
@@ -121,18 +167,31 @@ int main(int argc, char **argv)
             js["msgid"] = LOGIN_MSG;
             js["id"] = id;
             js["password"] = pwd;
-            string request = js.dump();
-
-            g_isLoginSuccess = false;
+            js["snapshot"] = 3; // 支持登录快照v2，离线消息在登录响应之后分批推送
+            addSyncVersions(id, js);
 
-            int len = send(clientfd, request.c_str(), strlen(request.c_str()) + 1, 0);
-            if (len == -1)
+            for (int retry = 0; retry <= kMaxLoginRetries; ++retry)
             {
-                cerr << "send login msg error:" << request << endl;
+                g_isLoginSuccess = false;
+                g_loginRetryAfter = 0;
+
+                int len = sendMsg(clientfd, js);
+                if (len == -1)
+                {
+                    cerr << "send login msg error:" << js.dump() << endl;
+                }
+
+                sem_wait(&rwsem); // 等待信号量，由子线程处理完登录的响应消息后，通知这里
+
+                // 服务器繁忙，按它建议的时间之后重新登录
+                if (g_isLoginSuccess || g_loginRetryAfter == 0 || retry == kMaxLoginRetries)
+                {
+                    break;
+                }
+                cerr << "retry login after " << g_loginRetryAfter << "ms" << endl;
+                std::this_thread::sleep_for(std::chrono::milliseconds(g_loginRetryAfter.load()));
             }
 
-            sem_wait(&rwsem); // 等待信号量，由子线程处理完登录的响应消息后，通知这里
-                
             if (g_isLoginSuccess) 
             {
                 // 进入聊天主菜单页面
@@ -154,12 +213,11 @@ int main(int argc, char **argv)
             js["msgid"] = REG_MSG;
             js["name"] = name;
             js["password"] = pwd;
-            string request = js.dump();
 
-            int len = send(clientfd, request.c_str(), strlen(request.c_str()) + 1, 0);
+            int len = sendMsg(clientfd, js);
             if (len == -1)
             {
-                cerr << "send reg msg error:" << request << endl;
+                cerr << "send reg msg error:" << js.dump() << endl;
             }
             
             sem_wait(&rwsem); // 等待信号量，子线程处理完注册消息会通知
@@ -168,6 +226,7 @@ int main(int argc, char **argv)
         case 3: // quit业务
             close(clientfd);
             sem_destroy(&rwsem);
+            sem_destroy(&protosem);
             exit(0);
         default:
             cerr << "invalid input!" << endl;
@@ -192,6 +251,206 @@ void doRegResponse(json &responsejs)
     }
 }
 
+// 本地保存的好友列表和群组列表，格式和完整的登录快照v2一样：
+// {"friendver":3,"users":[[id,"name","state"],...],"friends":[id,...],"groups":[[id,"groupname","groupdesc",[[userid,"role"],...],version],...]}
+string syncCachePath(int userid)
+{
+    const char *home = getenv("HOME");
+    return string(home != nullptr ? home : ".") + "/.chatclient_" + to_string(userid) + ".json";
+}
+
+// 检查本地保存的快照的结构，字段类型不对的文件当作没有
+bool isValidSyncCache(const json &cache)
+{
+    if (!cache.is_object() || (cache.contains("friendver") && !cache["friendver"].is_number_integer()))
+    {
+        return false;
+    }
+    for (const json &u : cache.value("users", json::array()))
+    {
+        if (!u.is_array() || u.size() != 3 || !u[0].is_number_integer() || !u[1].is_string() || !u[2].is_string())
+        {
+            return false;
+        }
+    }
+    for (const json &id : cache.value("friends", json::array()))
+    {
+        if (!id.is_number_integer())
+        {
+            return false;
+        }
+    }
+    for (const json &grpjs : cache.value("groups", json::array()))
+    {
+        if (!grpjs.is_array() || grpjs.size() != 5 || !grpjs[0].is_number_integer() || !grpjs[1].is_string() ||
+            !grpjs[2].is_string() || !grpjs[3].is_array() || !grpjs[4].is_number_integer())
+        {
+            return false;
+        }
+        for (const json &member : grpjs[3])
+        {
+            if (!member.is_array() || member.size() != 2 || !member[0].is_number_integer() || !member[1].is_string())
+            {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// 读取本地保存的好友列表和群组列表，没有或者已经损坏时返回空对象
+json loadSyncCache(int userid)
+{
+    ifstream in(syncCachePath(userid));
+    if (!in)
+    {
+        return json::object();
+    }
+    json cache = json::parse(in, nullptr, false);
+    return isValidSyncCache(cache) ? cache : json::object();
+}
+
+// 先写临时文件再rename，写到一半退出也不会留下损坏的文件
+void saveSyncCache(int userid, const json &cache)
+{
+    string path = syncCachePath(userid);
+    string tmp = path + ".tmp";
+    {
+        ofstream out(tmp, ios::trunc);
+        if (!out)
+        {
+            return;
+        }
+        out << cache.dump();
+        if (!out)
+        {
+            return;
+        }
+    }
+    rename(tmp.c_str(), path.c_str());
+}
+
+// 登录时带上本地保存的版本号，服务器只发送有变化的部分
+void addSyncVersions(int userid, json &js)
+{
+    json cache = loadSyncCache(userid);
+    if (cache.contains("friendver") && cache.contains("friends"))
+    {
+        js["friendver"] = cache["friendver"];
+    }
+    json groupvers = json::array();
+    for (json &grpjs : cache.value("groups", json::array()))
+    {
+        if (grpjs.is_array() && grpjs.size() == 5)
+        {
+            groupvers.push_back({grpjs[0], grpjs[4]});
+        }
+    }
+    js["groupvers"] = groupvers;
+}
+
+// 登录快照v2：用户表去重，好友和群成员按id引用用户表
+// 服务器只发送有变化的部分，没变的从本地保存的快照里取，合并之后再保存回本地
+void doLoginSnapshot(json &responsejs)
+{
+    json cache = loadSyncCache(g_currentUser.getId());
+
+    unordered_map<int, User> users;
+    for (json *table : {&cache, &responsejs})
+    {
+        for (json &u : table->value("users", json::array()))
+        {
+            int id = u[0].get<int>();
+            users[id] = User(id, u[1].get<string>(), "", u[2].get<string>());
+        }
+    }
+
+    // 好友列表没变时服务器只发在线好友的id
+    json friends = responsejs.contains("friends") ? responsejs["friends"] : cache.value("friends", json::array());
+    if (responsejs.contains("online"))
+    {
+        unordered_map<int, bool> online;
+        for (json &id : responsejs["online"])
+        {
+            online[id.get<int>()] = true;
+        }
+        for (json &id : friends)
+        {
+            users[id.get<int>()].setState(online.count(id.get<int>()) ? "online" : "offline");
+        }
+    }
+
+    g_currentUserFriendList.clear();
+    for (json &id : friends)
+    {
+        g_currentUserFriendList.push_back(users[id.get<int>()]);
+    }
+
+    // 没变的群组服务器只发[id,version]
+    unordered_map<int, json> cachedGroups;
+    for (json &grpjs : cache.value("groups", json::array()))
+    {
+        cachedGroups[grpjs[0].get<int>()] = grpjs;
+    }
+    json groups = json::array();
+    for (json &grpjs : responsejs.value("groups", json::array()))
+    {
+        if (grpjs.size() == 2)
+        {
+            auto it = cachedGroups.find(grpjs[0].get<int>());
+            if (it != cachedGroups.end())
+            {
+                groups.push_back(it->second);
+            }
+            continue;
+        }
+        groups.push_back(grpjs);
+    }
+
+    g_currentUserGroupList.clear();
+    json usedUsers = json::array();
+    unordered_map<int, bool> saved;
+    auto saveUser = [&](User &u)
+    {
+        if (!saved[u.getId()])
+        {
+            saved[u.getId()] = true;
+            usedUsers.push_back({u.getId(), u.getName(), u.getState()});
+        }
+    };
+    for (User &u : g_currentUserFriendList)
+    {
+        saveUser(u);
+    }
+    for (json &grpjs : groups)
+    {
+        Group group(grpjs[0].get<int>(), grpjs[1].get<string>(), grpjs[2].get<string>());
+        for (json &member : grpjs[3])
+        {
+            User &u = users[member[0].get<int>()];
+            GroupUser user;
+            user.setId(u.getId());
+            user.setName(u.getName());
+            user.setState(u.getState());
+            user.setRole(member[1].get<string>());
+            group.getUsers().push_back(user);
+            saveUser(u);
+        }
+        g_currentUserGroupList.push_back(group);
+    }
+
+    // 合并之后的快照保存到本地，下次登录只同步变化的部分
+    json merged;
+    if (responsejs.contains("friendver"))
+    {
+        merged["friendver"] = responsejs["friendver"];
+    }
+    merged["users"] = usedUsers;
+    merged["friends"] = friends;
+    merged["groups"] = groups;
+    saveSyncCache(g_currentUser.getId(), merged);
+}
+
 // 处理登录的响应逻辑
 void doLoginResponse(json &responsejs)
 {
@@ -199,6 +458,10 @@ void doLoginResponse(json &responsejs)
     {
         cerr << responsejs["errmsg"] << endl;
         g_isLoginSuccess = false;
+        if (responsejs.contains("retryafter"))
+        {
+            g_loginRetryAfter = responsejs["retryafter"].get<int>();
+        }
     }
     else // 登录成功
     {
@@ -206,52 +469,59 @@ void doLoginResponse(json &responsejs)
         g_currentUser.setId(responsejs["id"].get<int>());
         g_currentUser.setName(responsejs["name"]);
 
-        // 记录当前用户的好友列表信息
-        if (responsejs.contains("friends"))
+        if (responsejs.value("snapshot", 1) >= 2)
         {
-            // 初始化
-            g_currentUserFriendList.clear();
-
-            vector<string> vec = responsejs["friends"];
-            for (string &str : vec)
-            {
-                json js = json::parse(str);
-                User user;
-                user.setId(js["id"].get<int>());
-                user.setName(js["name"]);
-                user.setState(js["state"]);
-                g_currentUserFriendList.push_back(user);
-            }
+            doLoginSnapshot(responsejs);
         }
-
-        // 记录当前用户的群组列表信息
-        if (responsejs.contains("groups"))
+        else
         {
-            // 初始化
-            g_currentUserGroupList.clear();
-
-            vector<string> vec1 = responsejs["groups"];
-            for (string &groupstr : vec1)
+            // 记录当前用户的好友列表信息
+            if (responsejs.contains("friends"))
             {
-                json grpjs = json::parse(groupstr);
-                Group group;
-                group.setId(grpjs["id"].get<int>());
-                group.setName(grpjs["groupname"]);
-                group.setDesc(grpjs["groupdesc"]);
-
-                vector<string> vec2 = grpjs["users"];
-                for (string &userstr : vec2)
+                // 初始化
+                g_currentUserFriendList.clear();
+
+                vector<string> vec = responsejs["friends"];
+                for (string &str : vec)
                 {
-                    GroupUser user;
-                    json js = json::parse(userstr);
+                    json js = json::parse(str);
+                    User user;
                     user.setId(js["id"].get<int>());
                     user.setName(js["name"]);
                     user.setState(js["state"]);
-                    user.setRole(js["role"]);
-                    group.getUsers().push_back(user);
+                    g_currentUserFriendList.push_back(user);
                 }
+            }
+
+            // 记录当前用户的群组列表信息
+            if (responsejs.contains("groups"))
+            {
+                // 初始化
+                g_currentUserGroupList.clear();
 
-                g_currentUserGroupList.push_back(group);
+                vector<string> vec1 = responsejs["groups"];
+                for (string &groupstr : vec1)
+                {
+                    json grpjs = json::parse(groupstr);
+                    Group group;
+                    group.setId(grpjs["id"].get<int>());
+                    group.setName(grpjs["groupname"]);
+                    group.setDesc(grpjs["groupdesc"]);
+
+                    vector<string> vec2 = grpjs["users"];
+                    for (string &userstr : vec2)
+                    {
+                        GroupUser user;
+                        json js = json::parse(userstr);
+                        user.setId(js["id"].get<int>());
+                        user.setName(js["name"]);
+                        user.setState(js["state"]);
+                        user.setRole(js["role"]);
+                        group.getUsers().push_back(user);
+                    }
+
+                    g_currentUserGroupList.push_back(group);
+                }
             }
         }
 
@@ -265,70 +535,228 @@ void doLoginResponse(json &responsejs)
             for (string &str : vec)
             {
                 json js = json::parse(str);
-                // time + [id] + name + " said: " + xxx
-                if (ONE_CHAT_MSG == js["msgid"].get<int>())
-                {
-                    cout << js["time"].get<string>() << " [" << js["id"] << "]" << js["name"].get<string>()
-                            << " said: " << js["msg"].get<string>() << endl;
-                }
-                else
-                {
-                    cout << "群消息[" << js["groupid"] << "]:" << js["time"].get<string>() << " [" << js["id"] << "]" << js["name"].get<string>()
-                            << " said: " << js["msg"].get<string>() << endl;
-                }
+                showChatMsg(js);
             }
         }
+        // 离线消息在登录响应之后分批推送过来
+        if (responsejs.value("offlinecount", 0) > 0)
+        {
+            cout << "you have " << responsejs["offlinecount"] << " offline messages:" << endl;
+        }
 
         g_isLoginSuccess = true;
     }
 }
 
+// 从接收缓冲区的pos处切出一帧完整的消息解码成json，pos移到这一帧之后，数据还不完整返回false
+// 一次切出所有的帧之后调用方再统一从recvbuf里删掉，不用每一帧都移动一次后面的数据
+bool takeFrame(const string &recvbuf, size_t &pos, json &js)
+{
+    const char *end = recvbuf.data() + recvbuf.size();
+    const char *begin = JsonScanner::skipDelimiters(recvbuf.data() + pos, end);
+    pos = begin - recvbuf.data();
+    if (begin == end)
+    {
+        return false;
+    }
+
+    size_t frameLen = 0;
+    js = json();
+    if (BinaryCodec::isBinary(*begin))
+    {
+        BinaryCodec::Header header;
+        if (!BinaryCodec::peekHeader(begin, end - begin, &header) ||
+            static_cast<size_t>(end - begin) < BinaryCodec::kHeaderLen + header.bodyLen)
+        {
+            return false;
+        }
+        frameLen = BinaryCodec::kHeaderLen + header.bodyLen;
+        if (!BinaryCodec::decode(begin, frameLen, &js))
+        {
+            cerr << "binary decode error!" << endl;
+        }
+    }
+    else
+    {
+        MsgRoute route;
+        const char *frameEnd = nullptr;
+        JsonScanner::Status status = JsonScanner::scan(begin, end, &route, &frameEnd);
+        if (JsonScanner::kIncomplete == status)
+        {
+            return false;
+        }
+        if (JsonScanner::kInvalid == status)
+        {
+            cerr << "invalid frame from server, discard!" << endl;
+            pos = recvbuf.size();
+            return false;
+        }
+        frameLen = frameEnd - begin;
+        js = json::parse(begin, frameEnd, nullptr, false);
+    }
+    pos += frameLen;
+    return true;
+}
+
+// 显示一条聊天消息  time + [id] + name + " said: " + xxx
+void showChatMsg(json &js)
+{
+    if (!js.is_object())
+    {
+        return;
+    }
+    if (ONE_CHAT_MSG == js.value("msgid", 0))
+    {
+        cout << js["time"].get<string>() << " [" << js["id"] << "]" << js["name"].get<string>()
+             << " said: " << js["msg"].get<string>() << endl;
+    }
+    else
+    {
+        cout << "群消息[" << js["groupid"] << "]:" << js["time"].get<string>() << " [" << js["id"] << "]" << js["name"].get<string>()
+             << " said: " << js["msg"].get<string>() << endl;
+    }
+}
+
 // 子线程 - 接收线程
 void readTaskHandler(int clientfd)
 {
+    // 接收缓冲区，一次recv可能收到好几条消息，也可能只有半条，登录之后的离线消息会连续到达很多帧
+    string recvbuf;
+    char buffer[64 * 1024];
     for (;;)
     {
-        char buffer[1024] = {0};
-        int len = recv(clientfd, buffer, 1024, 0);  // 阻塞了
+        int len = recv(clientfd, buffer, sizeof buffer, 0);  // 阻塞了
         if (-1 == len || 0 == len)
         {
             close(clientfd);
             exit(-1);
         }
+        recvbuf.append(buffer, len);
 
         // 接收ChatServer转发的数据，反序列化生成json数据对象
-        json js = json::parse(buffer);
-        int msgtype = js["msgid"].get<int>();
-        if (ONE_CHAT_MSG == msgtype)
+        json js;
+        size_t pos = 0;
+        while (takeFrame(recvbuf, pos, js))
         {
-            cout << js["time"].get<string>() << " [" << js["id"] << "]" << js["name"].get<string>()
-                 << " said: " << js["msg"].get<string>() << endl;
-            continue;
-        }
+            if (!js.is_object() || !js.contains("msgid"))
+            {
+                continue;
+            }
+            int msgtype = js["msgid"].get<int>();
+            if (ONE_CHAT_MSG == msgtype || GROUP_CHAT_MSG == msgtype)
+            {
+                showChatMsg(js);
+                continue;
+            }
 
-        if (GROUP_CHAT_MSG == msgtype)
-        {
-            cout << "群消息[" << js["groupid"] << "]:" << js["time"].get<string>() << " [" << js["id"] << "]" << js["name"].get<string>()
-                 << " said: " << js["msg"].get<string>() << endl;
-            continue;
+            if (OFFLINE_MSG == msgtype)
+            {
+                // json协议下是消息对象，二进制协议下是消息的json文本
+                for (json &msg : js["msgs"])
+                {
+                    json offline = msg.is_string() ? json::parse(msg.get<string>(), nullptr, false) : msg;
+                    showChatMsg(offline);
+                }
+                continue;
+            }
+
+            if (LOGIN_MSG_ACK == msgtype)
+            {
+                doLoginResponse(js); // 处理登录响应的业务逻辑
+                sem_post(&rwsem);    // 通知主线程，登录结果处理完成
+                continue;
+            }
+
+            if (REG_MSG_ACK == msgtype)
+            {
+                doRegResponse(js);
+                sem_post(&rwsem);    // 通知主线程，注册结果处理完成
+                continue;
+            }
+
+            if (HEARTBEAT_MSG_ACK == msgtype)
+            {
+                g_lastHeartbeatAck = nowSeconds();
+                continue;
+            }
+
+            if (PROTO_MSG_ACK == msgtype)
+            {
+                // 服务器同意使用二进制协议之后，后续的消息都用二进制发送
+                if (js["version"].get<int>() >= 1)
+                {
+                    g_protocol = PROTO_BINARY;
+                }
+                sem_post(&protosem); // 通知主线程，协议协商完成
+                continue;
+            }
         }
+        recvbuf.erase(0, pos);
+    }
+}
+
+// 按照和服务器协商好的协议编码并发送一条消息
+int sendMsg(int clientfd, const json &js)
+{
+    string buffer;
+    if (PROTO_BINARY == g_protocol)
+    {
+        BinaryCodec::encode(js, &buffer);
+    }
+    else
+    {
+        // json帧以'\0'结尾
+        buffer = js.dump();
+        buffer.push_back('\0');
+    }
+    lock_guard<mutex> lock(g_sendMutex);
+    return send(clientfd, buffer.data(), buffer.size(), 0);
+}
 
-        if (LOGIN_MSG_ACK == msgtype)
+// 子线程 - 心跳线程
+void heartbeatTaskHandler(int clientfd)
+{
+    json js;
+    js["msgid"] = HEARTBEAT_MSG;
+    int64_t sentAt = 0;
+    for (;;)
+    {
+        std::this_thread::sleep_for(std::chrono::seconds(kHeartbeatInterval));
+        // 上一次心跳过了一个间隔还没有响应，关闭socket，接收线程的recv返回0之后退出程序
+        if (sentAt != 0 && g_lastHeartbeatAck < sentAt)
         {
-            doLoginResponse(js); // 处理登录响应的业务逻辑
-            sem_post(&rwsem);    // 通知主线程，登录结果处理完成
-            continue;
+            cerr << "no heartbeat ack from server in " << kHeartbeatInterval << "s, connection lost" << endl;
+            shutdown(clientfd, SHUT_RDWR);
+            return;
         }
-
-        if (REG_MSG_ACK == msgtype)
+        sentAt = nowSeconds();
+        if (-1 == sendMsg(clientfd, js))
         {
-            doRegResponse(js);
-            sem_post(&rwsem);    // 通知主线程，注册结果处理完成
-            continue;
+            cerr << "send heartbeat error" << endl;
+            return;
         }
     }
 }
 
+// 和服务器协商连接上使用的协议
+void negotiateProtocol(int clientfd)
+{
+    json js;
+    js["msgid"] = PROTO_MSG;
+    js["version"] = static_cast<int>(BinaryCodec::kVersion);
+    if (-1 == sendMsg(clientfd, js))
+    {
+        cerr << "send proto msg error -> " << js.dump() << endl;
+        return;
+    }
+
+    // 老版本的服务器不认识PROTO_MSG，不会回应，最多等一秒
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += 1;
+    sem_timedwait(&protosem, &deadline);
+}
+
 // 显示当前登录成功用户的基本信息
 void showCurrentUserData()
 {
@@ -443,12 +871,10 @@ void addfriend(int clientfd, string str)
     js["msgid"] = ADD_FRIEND_MSG;
     js["id"] = g_currentUser.getId();
     js["friendid"] = friendid;
-    string buffer = js.dump();
-
-    int len = send(clientfd, buffer.c_str(), strlen(buffer.c_str()) + 1, 0);
+    int len = sendMsg(clientfd, js);
     if (-1 == len)
     {
-        cerr << "send addfriend msg error -> " << buffer << endl;
+        cerr << "send addfriend msg error -> " << js.dump() << endl;
     }
 }
 // "chat" command handler
@@ -471,12 +897,10 @@ void chat(int clientfd, string str)
     js["toid"] = friendid;
     js["msg"] = message;
     js["time"] = getCurrentTime();
-    string buffer = js.dump();
-
-    int len = send(clientfd, buffer.c_str(), strlen(buffer.c_str()) + 1, 0);
+    int len = sendMsg(clientfd, js);
     if (-1 == len)
     {
-        cerr << "send chat msg error -> " << buffer << endl;
+        cerr << "send chat msg error -> " << js.dump() << endl;
     }
 }
 // "creategroup" command handler  groupname:groupdesc
@@ -497,12 +921,10 @@ void creategroup(int clientfd, string str)
     js["id"] = g_currentUser.getId();
     js["groupname"] = groupname;
     js["groupdesc"] = groupdesc;
-    string buffer = js.dump();
-
-    int len = send(clientfd, buffer.c_str(), strlen(buffer.c_str()) + 1, 0);
+    int len = sendMsg(clientfd, js);
     if (-1 == len)
     {
-        cerr << "send creategroup msg error -> " << buffer << endl;
+        cerr << "send creategroup msg error -> " << js.dump() << endl;
     }
 }
 // "addgroup" command handler
@@ -513,12 +935,10 @@ void addgroup(int clientfd, string str)
     js["msgid"] = ADD_GROUP_MSG;
     js["id"] = g_currentUser.getId();
     js["groupid"] = groupid;
-    string buffer = js.dump();
-
-    int len = send(clientfd, buffer.c_str(), strlen(buffer.c_str()) + 1, 0);
+    int len = sendMsg(clientfd, js);
     if (-1 == len)
     {
-        cerr << "send addgroup msg error -> " << buffer << endl;
+        cerr << "send addgroup msg error -> " << js.dump() << endl;
     }
 }
 // "groupchat" command handler   groupid:message
@@ -541,12 +961,10 @@ void groupchat(int clientfd, string str)
     js["groupid"] = groupid;
     js["msg"] = message;
     js["time"] = getCurrentTime();
-    string buffer = js.dump();
-
-    int len = send(clientfd, buffer.c_str(), strlen(buffer.c_str()) + 1, 0);
+    int len = sendMsg(clientfd, js);
     if (-1 == len)
     {
-        cerr << "send groupchat msg error -> " << buffer << endl;
+        cerr << "send groupchat msg error -> " << js.dump() << endl;
     }
 }
 // "loginout" command handler
@@ -555,12 +973,10 @@ void loginout(int clientfd, string)
     json js;
     js["msgid"] = LOGINOUT_MSG;
     js["id"] = g_currentUser.getId();
-    string buffer = js.dump();
-
-    int len = send(clientfd, buffer.c_str(), strlen(buffer.c_str()) + 1, 0);
+    int len = sendMsg(clientfd, js);
     if (-1 == len)
     {
-        cerr << "send loginout msg error -> " << buffer << endl;
+        cerr << "send loginout msg error -> " << js.dump() << endl;
     }
     else
     {
@@ -0,0 +1,91 @@
+#include "asynclog.hpp"
+
+#include <muduo/base/AsyncLogging.h>
+#include <muduo/base/Logging.h>
+#include <stdio.h>
+
+namespace
+{
+
+// 启动之后不再释放：stop之后别的线程可能还在往里append
+muduo::AsyncLogging *g_async = nullptr;
+atomic_bool g_running{false};
+
+void asyncOutput(const char *msg, int len)
+{
+    g_async->append(msg, len);
+}
+
+// 和muduo默认的输出一样写stdout
+void stdoutOutput(const char *msg, int len)
+{
+    fwrite(msg, 1, len, stdout);
+}
+
+void stdoutFlush()
+{
+    fflush(stdout);
+}
+
+// LOG_FATAL在abort之前调用
+void fatalFlush()
+{
+    AsyncLog::stop();
+}
+
+} // namespace
+
+void AsyncLog::start(const string &basename, int64_t rollBytes)
+{
+    g_async = new muduo::AsyncLogging(basename, static_cast<off_t>(rollBytes));
+    g_async->start();
+    g_running = true;
+    muduo::Logger::setOutput(asyncOutput);
+    muduo::Logger::setFlush(fatalFlush);
+}
+
+void AsyncLog::stop()
+{
+    if (!g_running.exchange(false))
+    {
+        return;
+    }
+    muduo::Logger::setOutput(stdoutOutput);
+    muduo::Logger::setFlush(stdoutFlush);
+    // 后台线程把剩下的缓冲写完才退出
+    g_async->stop();
+}
+
+LogRateLimiter::LogRateLimiter(const string &site, int perSecond)
+    : _perSecond(perSecond),
+      _suppressedTotal(Metrics::counter("chat_log_suppressed_total", "Log lines dropped by rate limiting",
+                                        "site=\"" + site + "\"")),
+      _second(0),
+      _count(0),
+      _suppressed(0)
+{
+}
+
+bool LogRateLimiter::allow(uint64_t *suppressed)
+{
+    int64_t second = Metrics::nowUs() / 1000000;
+    int64_t current = _second.load(memory_order_relaxed);
+    // 进入新的一秒，重新计数；几个线程同时进来时只有一个清零
+    if (second != current && _second.compare_exchange_strong(current, second, memory_order_relaxed))
+    {
+        _count.store(0, memory_order_relaxed);
+    }
+    if (_count.fetch_add(1, memory_order_relaxed) < _perSecond)
+    {
+        *suppressed = _suppressed.exchange(0, memory_order_relaxed);
+        return true;
+    }
+    _suppressed.fetch_add(1, memory_order_relaxed);
+    Metrics::add(_suppressedTotal);
+    return false;
+}
+
+string LogRateLimiter::note(uint64_t suppressed)
+{
+    return suppressed == 0 ? string() : " (" + to_string(suppressed) + " similar lines suppressed)";
+}
@@ -0,0 +1,257 @@
+#include "balancedserver.hpp"
+
+#include <muduo/base/Logging.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace
+{
+
+socklen_t addrLen(sa_family_t family)
+{
+    return family == AF_INET6 ? sizeof(sockaddr_in6) : sizeof(sockaddr_in);
+}
+
+// 创建非阻塞的监听socket并绑定地址，失败时直接退出，和muduo的Acceptor一样
+int createListenSocket(const InetAddress &listenAddr, bool reusePort)
+{
+    int fd = ::socket(listenAddr.family(), SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_TCP);
+    if (fd < 0)
+    {
+        LOG_SYSFATAL << "create listen socket failed";
+    }
+    int on = 1;
+    ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof on);
+    if (reusePort && ::setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof on) < 0)
+    {
+        LOG_SYSERR << "SO_REUSEPORT failed";
+    }
+    if (::bind(fd, listenAddr.getSockAddr(), addrLen(listenAddr.family())) < 0)
+    {
+        LOG_SYSFATAL << "bind " << listenAddr.toIpPort() << " failed";
+    }
+    return fd;
+}
+
+// sockaddr转成InetAddress
+InetAddress toInetAddress(const sockaddr_in6 &addr)
+{
+    if (addr.sin6_family == AF_INET)
+    {
+        return InetAddress(*reinterpret_cast<const sockaddr_in *>(&addr));
+    }
+    return InetAddress(addr);
+}
+
+} // namespace
+
+BalancedServer::BalancedServer(EventLoop *loop,
+                               const InetAddress &listenAddr,
+                               const string &nameArg,
+                               bool reusePort,
+                               LoopSelector::Policy policy,
+                               int listenFd)
+    : _loop(loop),
+      _name(nameArg),
+      _ipPort(listenAddr.toIpPort()),
+      _listenFd(listenFd >= 0 ? listenFd : createListenSocket(listenAddr, reusePort)),
+      _idleFd(::open("/dev/null", O_RDONLY | O_CLOEXEC)),
+      _acceptChannel(loop, _listenFd),
+      _listening(false),
+      _threadPool(new EventLoopThreadPool(loop, nameArg)),
+      _selector(policy),
+      _connectionCallback(defaultConnectionCallback),
+      _messageCallback(defaultMessageCallback),
+      _nextConnId(1)
+{
+    _acceptChannel.setReadCallback(std::bind(&BalancedServer::handleRead, this, _1));
+}
+
+BalancedServer::~BalancedServer()
+{
+    // 和TcpServer一样只能在_loop线程里析构
+    for (auto &item : _connections)
+    {
+        TcpConnectionPtr conn(item.second.conn);
+        item.second.conn.reset();
+        conn->getLoop()->runInLoop(std::bind(&TcpConnection::connectDestroyed, conn));
+    }
+    if (_listening)
+    {
+        _acceptChannel.disableAll();
+        _acceptChannel.remove();
+    }
+    ::close(_listenFd);
+    ::close(_idleFd);
+}
+
+void BalancedServer::setThreadNum(int numThreads)
+{
+    _threadPool->setThreadNum(numThreads);
+}
+
+// 启动IO线程并开始监听
+void BalancedServer::start()
+{
+    if (_listening)
+    {
+        return;
+    }
+    _threadPool->start(_threadInitCallback);
+    // 没有IO线程时getAllLoops()返回_loop自己
+    _selector.start(_threadPool->getAllLoops());
+    _loop->runInLoop([this]()
+    {
+        if (::listen(_listenFd, SOMAXCONN) < 0)
+        {
+            LOG_SYSFATAL << "listen " << _ipPort << " failed";
+        }
+        _listening = true;
+        _acceptChannel.enableReading();
+    });
+}
+
+// 停止接受新连接，监听socket不关闭
+void BalancedServer::stopAccepting()
+{
+    _loop->assertInLoopThread();
+    if (!_listening)
+    {
+        return;
+    }
+    _acceptChannel.disableAll();
+    _acceptChannel.remove();
+    _listening = false;
+}
+
+// stopAccepting之后重新开始接受新连接，监听socket一直在listen
+void BalancedServer::resumeAccepting()
+{
+    _loop->assertInLoopThread();
+    if (_listening)
+    {
+        return;
+    }
+    _listening = true;
+    _acceptChannel.enableReading();
+}
+
+// 当前所有的连接
+vector<BalancedServer::ConnectionInfo> BalancedServer::connections() const
+{
+    _loop->assertInLoopThread();
+    vector<ConnectionInfo> result;
+    result.reserve(_connections.size());
+    for (const auto &item : _connections)
+    {
+        result.push_back(ConnectionInfo{item.second.conn, item.second.sockfd});
+    }
+    return result;
+}
+
+// 接管一条已经建立的连接
+void BalancedServer::adoptConnection(int sockfd, const AdoptCallback &cb)
+{
+    _loop->assertInLoopThread();
+    // 文件状态标志是老进程accept4时设置的，和老进程共享，这里再确认一次
+    ::fcntl(sockfd, F_SETFL, ::fcntl(sockfd, F_GETFL) | O_NONBLOCK);
+    sockaddr_in6 peer = {};
+    socklen_t len = sizeof peer;
+    if (::getpeername(sockfd, reinterpret_cast<sockaddr *>(&peer), &len) < 0)
+    {
+        // 交接期间客户端已经断开，照样建立连接，读到关闭时走正常的断开流程
+        LOG_SYSERR << _name << " getpeername of adopted fd " << sockfd << " failed";
+    }
+    newConnection(sockfd, toInetAddress(peer), cb);
+}
+
+// 监听socket可读，接受新连接
+void BalancedServer::handleRead(Timestamp receiveTime)
+{
+    for (int i = 0; i < kMaxAcceptsPerEvent; ++i)
+    {
+        sockaddr_in6 addr = {};
+        socklen_t len = sizeof addr;
+        int connfd = ::accept4(_listenFd, reinterpret_cast<sockaddr *>(&addr), &len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (connfd >= 0)
+        {
+            newConnection(connfd, toInetAddress(addr));
+            continue;
+        }
+
+        if (errno == EMFILE)
+        {
+            // 文件描述符用完了：腾出预留的一个，接受之后马上关闭，客户端会收到关闭而不是一直等待
+            ::close(_idleFd);
+            _idleFd = ::accept(_listenFd, nullptr, nullptr);
+            ::close(_idleFd);
+            _idleFd = ::open("/dev/null", O_RDONLY | O_CLOEXEC);
+            LOG_ERROR << _name << " too many open files, reject a connection";
+        }
+        else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != ECONNABORTED && errno != EINTR)
+        {
+            LOG_SYSERR << _name << " accept failed";
+        }
+        break;
+    }
+}
+
+// 把新连接分配给一个IO loop
+void BalancedServer::newConnection(int sockfd, const InetAddress &peerAddr, const AdoptCallback &cb)
+{
+    int index = _selector.select(peerAddr);
+    EventLoop *ioLoop = _selector.loopAt(index);
+
+    char buf[64];
+    snprintf(buf, sizeof buf, "-%s#%d", _ipPort.c_str(), _nextConnId);
+    ++_nextConnId;
+    string connName = _name + buf;
+
+    sockaddr_in6 local = {};
+    socklen_t len = sizeof local;
+    if (::getsockname(sockfd, reinterpret_cast<sockaddr *>(&local), &len) < 0)
+    {
+        LOG_SYSERR << "getsockname failed";
+    }
+    InetAddress localAddr = toInetAddress(local);
+
+    LOG_INFO << _name << " new connection " << connName << " from " << peerAddr.toIpPort() << " to loop " << index;
+    TcpConnectionPtr conn(new TcpConnection(ioLoop, connName, sockfd, localAddr, peerAddr));
+    _connections[connName] = ConnEntry{conn, index, sockfd};
+    _selector.connectionAdded(index);
+    conn->setConnectionCallback(_connectionCallback);
+    conn->setMessageCallback(_messageCallback);
+    conn->setCloseCallback(std::bind(&BalancedServer::removeConnection, this, _1));
+    if (!cb)
+    {
+        ioLoop->runInLoop(std::bind(&TcpConnection::connectEstablished, conn));
+        return;
+    }
+    ioLoop->runInLoop([conn, cb]()
+    {
+        conn->connectEstablished();
+        cb(conn);
+    });
+}
+
+// 连接关闭，在连接所属的IO线程里调用
+void BalancedServer::removeConnection(const TcpConnectionPtr &conn)
+{
+    _loop->runInLoop(std::bind(&BalancedServer::removeConnectionInLoop, this, conn));
+}
+
+void BalancedServer::removeConnectionInLoop(const TcpConnectionPtr &conn)
+{
+    auto it = _connections.find(conn->name());
+    if (it == _connections.end())
+    {
+        return;
+    }
+    _selector.connectionRemoved(it->second.loopIndex);
+    _connections.erase(it);
+    conn->getLoop()->queueInLoop(std::bind(&TcpConnection::connectDestroyed, conn));
+}
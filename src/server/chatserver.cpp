@@ -4,38 +4,304 @@
 #include <string>
 #include <functional>
 #include "chatservice.hpp"
+#include "jsonscanner.hpp"
+#include "binarycodec.hpp"
+#include "session.hpp"
+#include "flowcontrol.hpp"
+#include "cpuaffinity.hpp"
+#include "tracer.hpp"
+#include "db.h"
+#include "recorder.hpp"
+#include "asynclog.hpp"
+#include <muduo/base/CountDownLatch.h>
+#include <muduo/base/Logging.h>
+#include <map>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
 using namespace std;
 using namespace placeholders;
 using json = nlohmann::json;
 
+namespace
+{
+
+// 客户端发来的非法帧，每秒最多记录10条
+LogRateLimiter badFrameLog("bad_frame", 10);
+
+// 从[begin, end)切出一个二进制帧，路由字段直接从帧头里取
+JsonScanner::Status scanBinary(const char *begin, const char *end, size_t maxFrameSize,
+                               MsgRoute *route, const char **frameEnd)
+{
+    BinaryCodec::Header header;
+    if (!BinaryCodec::peekHeader(begin, end - begin, &header))
+    {
+        return JsonScanner::kIncomplete;
+    }
+    if (header.version != BinaryCodec::kVersion || header.bodyLen > maxFrameSize)
+    {
+        return JsonScanner::kInvalid;
+    }
+    if (static_cast<size_t>(end - begin) < BinaryCodec::kHeaderLen + header.bodyLen)
+    {
+        return JsonScanner::kIncomplete;
+    }
+
+    route->protocol = PROTO_BINARY;
+    route->msgid = header.msgid;
+    route->id = header.id == BinaryCodec::kAbsent ? -1 : header.id;
+    int target = header.target == BinaryCodec::kAbsent ? -1 : header.target;
+    if (header.msgid == ONE_CHAT_MSG)
+    {
+        route->toid = target;
+    }
+    else if (header.msgid == GROUP_CHAT_MSG || header.msgid == ADD_GROUP_MSG)
+    {
+        route->groupid = target;
+    }
+    *frameEnd = begin + BinaryCodec::kHeaderLen + header.bodyLen;
+    return JsonScanner::kComplete;
+}
+
+// 在loop线程里执行task并等它执行完
+void runInLoopAndWait(EventLoop *loop, const function<void()> &task)
+{
+    if (loop->isInLoopThread())
+    {
+        task();
+        return;
+    }
+    CountDownLatch latch(1);
+    loop->runInLoop([&task, &latch]()
+    {
+        task();
+        latch.countDown();
+    });
+    latch.wait();
+}
+
+} // namespace
+
 // 初始化聊天服务器对象
 ChatServer::ChatServer(EventLoop *loop,
                        const InetAddress &listenAddr,
-                       const string &nameArg)
-    : _server(loop, listenAddr, nameArg), _loop(loop)
+                       const string &nameArg,
+                       const ServerOptions &options)
+    : _server(loop, listenAddr, nameArg, options.reusePort, options.balance,
+              options.listenFds.empty() ? -1 : options.listenFds[0]),
+      _loop(loop),
+      _listenAddr(listenAddr),
+      _threadNum(0),
+      _reusePort(options.reusePort),
+      _idleSeconds(options.idleSeconds),
+      _cpus(options.cpus),
+      _listenFds(options.listenFds),
+      _controlFd(-1),
+      _metricsPort(options.metricsPort)
+{
+    setCallbacks(_server);
+
+    // 设置线程数量，默认每个cpu核一个IO线程
+    int threadNum = options.threadNum;
+    if (threadNum == ServerOptions::kAutoThreads)
+    {
+        threadNum = _cpus.empty() ? CpuAffinity::onlineCpus() : static_cast<int>(_cpus.size());
+    }
+
+    if (_reusePort)
+    {
+        // 主线程的loop只处理自己接受的连接，其余的loop各有一个服务器，在start()里创建
+        _server.setThreadNum(0);
+        _threadNum = threadNum > 1 ? threadNum - 1 : 0;
+        _ioLoops.reset(new EventLoopThreadPool(loop, nameArg + "-io"));
+        _ioLoops->setThreadNum(_threadNum);
+        // 主线程占用cpus[0]
+        _nextCpu = 1;
+    }
+    else
+    {
+        _threadNum = threadNum;
+        _server.setThreadNum(threadNum);
+    }
+    // 没有IO线程时muduo也会用主线程的loop回调一次
+    _server.setThreadInitCallback(std::bind(&ChatServer::onThreadInit, this, _1));
+    string mode = _reusePort ? "SO_REUSEPORT per loop" : string("balance by ") + LoopSelector::policyName(options.balance);
+    LOG_INFO << nameArg << " io threads " << threadNum << ", " << mode
+             << (_cpus.empty() ? ", no cpu affinity" : ", pinned") << ", idle timeout " << _idleSeconds << "s";
+
+    // 业务单例在启动时创建：连接redis、预先编码内容固定的响应、启动登录的工作线程，不留给第一条消息的IO线程
+    ChatService::instance()->startLoginAdmission(options.login);
+    registerMetrics();
+    MySQL::setSlowQueryMs(options.slowQueryMs);
+    OverloadGuard::configure(options.overload);
+
+    if (!options.recordPath.empty())
+    {
+        if (Recorder::start(options.recordPath))
+        {
+            LOG_WARN << "recording inbound traffic to " << options.recordPath;
+        }
+        else
+        {
+            LOG_ERROR << "open record file " << options.recordPath << " failed, recording disabled";
+        }
+    }
+
+    if (!options.tracePath.empty())
+    {
+        if (Tracer::start(options.tracePath, options.traceSampleEvery))
+        {
+            LOG_INFO << "tracing 1 of every " << options.traceSampleEvery << " chat messages to " << options.tracePath;
+        }
+        else
+        {
+            LOG_ERROR << "open trace file " << options.tracePath << " failed, tracing disabled";
+        }
+    }
+}
+
+ChatServer::~ChatServer()
+{
+    if (_controlChannel)
+    {
+        _controlChannel->disableAll();
+        _controlChannel->remove();
+    }
+    if (_controlFd >= 0)
+    {
+        ::close(_controlFd);
+    }
+
+    // 服务器只能在它所属的loop线程里析构
+    for (auto &server : _ioServers)
+    {
+        CountDownLatch latch(1);
+        BalancedServer *ioServer = server.release();
+        ioServer->getLoop()->runInLoop([ioServer, &latch]()
+        {
+            delete ioServer;
+            latch.countDown();
+        });
+        latch.wait();
+    }
+}
+
+// 给服务器设置回调
+void ChatServer::setCallbacks(BalancedServer &server)
 {
     // 注册链接回调
-    _server.setConnectionCallback(std::bind(&ChatServer::onConnection, this, _1));
+    server.setConnectionCallback(std::bind(&ChatServer::onConnection, this, _1));
 
     // 注册消息回调
-    _server.setMessageCallback(std::bind(&ChatServer::onMessage, this, _1, _2, _3));
-
-    // 设置线程数量
-    _server.setThreadNum(4);
+    server.setMessageCallback(std::bind(&ChatServer::onMessage, this, _1, _2, _3));
 }
 
 // 启动服务
 void ChatServer::start()
 {
+    // 主线程跑acceptor，绑定cpu列表的第一个核
+    if (!_cpus.empty())
+    {
+        CpuAffinity::pinCurrentThread(_cpus[0]);
+    }
+
+    if (_reusePort)
+    {
+        // 每个IO loop上各建一个监听同一端口的服务器，新连接由内核按四元组哈希分给各个监听socket
+        _ioLoops->start(std::bind(&ChatServer::onThreadInit, this, _1));
+        vector<EventLoop *> loops = _ioLoops->getAllLoops();
+        for (size_t i = 0; i < loops.size() && _threadNum > 0; ++i)
+        {
+            int listenFd = i + 1 < _listenFds.size() ? _listenFds[i + 1] : -1;
+            string name = _server.name() + "#" + to_string(i + 1);
+            // 服务器的线程池只能在它自己的loop线程里启动（muduo的EventLoopThreadPool::start会检查）
+            BalancedServer *ioServer = nullptr;
+            runInLoopAndWait(loops[i], [this, &loops, &ioServer, i, listenFd, &name]()
+            {
+                ioServer = new BalancedServer(loops[i], _listenAddr, name, true, LoopSelector::kRoundRobin, listenFd);
+                setCallbacks(*ioServer);
+                ioServer->start();
+            });
+            _ioServers.emplace_back(ioServer);
+        }
+    }
+    // 老进程的监听socket比这里的服务器多，多出来的关闭，连接队列里还没接受的连接会被重置
+    for (size_t i = 1 + _ioServers.size(); i < _listenFds.size(); ++i)
+    {
+        LOG_WARN << "close surplus inherited listen socket " << _listenFds[i];
+        ::close(_listenFds[i]);
+    }
+    _listenFds.clear();
     _server.start();
+
+    // 定时输出拥塞连接的缓冲统计和各个IO loop的负载
+    _loop->runEvery(kStatsInterval, std::bind(&ChatServer::logFlowStats, this));
+    _loop->runEvery(kStatsInterval, std::bind(&ChatServer::logLoopStats, this));
+    _loop->runEvery(kStatsInterval, std::bind(&ChatServer::logAdmissionStats, this));
+
+    // 管理端口只监听本机，跑在主线程的loop上
+    if (_metricsPort > 0)
+    {
+        _metrics.reset(new MetricsServer(_loop, InetAddress(_metricsPort, true)));
+        _metrics->start();
+    }
+}
+
+// IO线程启动时的回调：按配置绑核，安装空闲检测的时间轮
+void ChatServer::onThreadInit(EventLoop *loop)
+{
+    if (_idleSeconds > 0)
+    {
+        IdleDetector::install(loop, _idleSeconds);
+    }
+
+    // 没有IO线程时muduo用主线程的loop回调一次，主线程在start()里已经绑过了
+    if (_cpus.empty() || loop == _loop)
+    {
+        return;
+    }
+    int index = _nextCpu++;
+    int cpu = _cpus[index % _cpus.size()];
+    if (CpuAffinity::pinCurrentThread(cpu))
+    {
+        LOG_INFO << "io thread " << index << " pinned to cpu " << cpu;
+    }
 }
 
 // 上报链接相关信息的回调函数
 void ChatServer::onConnection(const TcpConnectionPtr &conn)
 {
+    // 新连接建立会话，默认使用json协议
+    if(conn->connected())
+    {
+        auto session = std::make_shared<Session>();
+        if (Recorder::enabled())
+        {
+            session->recordId = Recorder::open(Timestamp::now().microSecondsSinceEpoch());
+        }
+        conn->setContext(session);
+        FlowControl::attach(conn);
+        // 开始空闲计时
+        IdleDetector *idle = IdleDetector::ofLoop(conn->getLoop());
+        if (idle != nullptr)
+        {
+            idle->add(conn, session.get());
+        }
+    }
     // 客户端断开连接
-    if(!conn->connected())
+    else
     {
+        FlowControl::detach(conn);
+        // 已经交给新进程的连接，用户的状态由新进程维护
+        Session *session = getSession(conn);
+        if (session != nullptr && session->recordId != 0)
+        {
+            Recorder::close(session->recordId, Timestamp::now().microSecondsSinceEpoch());
+        }
+        if (session != nullptr && session->frozen)
+        {
+            return;
+        }
         ChatService::instance()->clientCloseException(conn);
         conn->shutdown();
     }
@@ -46,13 +312,501 @@ void ChatServer::onMessage(const TcpConnectionPtr &conn,
                Buffer *buffer,
                Timestamp time)
 {
-    string buf = buffer->retrieveAllAsString();
-    // 数据的反序列化
-    json js = json::parse(buf);
+    // 收到任何数据都说明连接还活着，一次读事件刷新一次空闲计时
+    Session *session = getSession(conn);
+    if (session != nullptr)
+    {
+        IdleDetector::touch(session);
+    }
+
+    // 一次读事件里可能有好几条消息，也可能只有半条：逐帧扫描，残缺的帧留在buffer里等后续数据到达。
+    // 有推迟处理的帧时后面的帧都留在buffer里，等它处理完再分发，同一条连接上的消息不会被重排
+    while (buffer->readableBytes() > 0 && (session == nullptr || session->deferredFrame.empty()))
+    {
+        const char *end = buffer->peek() + buffer->readableBytes();
+        buffer->retrieveUntil(JsonScanner::skipDelimiters(buffer->peek(), end));
+        if (buffer->readableBytes() == 0)
+        {
+            break;
+        }
+
+        MsgRoute route;
+        const char *frameEnd = nullptr;
+        // 二进制帧以magic字节开头，其他的按json文本扫描
+        JsonScanner::Status status = BinaryCodec::isBinary(*buffer->peek())
+                                         ? scanBinary(buffer->peek(), end, kMaxFrameSize, &route, &frameEnd)
+                                         : JsonScanner::scan(buffer->peek(), end, &route, &frameEnd);
+        if (status == JsonScanner::kIncomplete)
+        {
+            if (buffer->readableBytes() > kMaxFrameSize)
+            {
+                uint64_t suppressed = 0;
+                if (badFrameLog.allow(&suppressed))
+                {
+                    LOG_ERROR << conn->peerAddress().toIpPort() << " frame too large, shutdown!" << LogRateLimiter::note(suppressed);
+                }
+                buffer->retrieveAll();
+                conn->shutdown();
+            }
+            break;
+        }
+        if (status == JsonScanner::kInvalid)
+        {
+            uint64_t suppressed = 0;
+            if (badFrameLog.allow(&suppressed))
+            {
+                LOG_ERROR << conn->peerAddress().toIpPort() << " invalid frame, discard!" << LogRateLimiter::note(suppressed);
+            }
+            buffer->retrieveAll();
+            break;
+        }
+
+        if (session != nullptr && session->recordId != 0)
+        {
+            Recorder::frame(session->recordId, time.microSecondsSinceEpoch(), buffer->peek(), frameEnd);
+        }
+        dispatch(conn, route, buffer->peek(), frameEnd, time);
+        buffer->retrieveUntil(frameEnd);
+    }
+}
+
+// 把一帧完整的消息分发给业务层
+void ChatServer::dispatch(const TcpConnectionPtr &conn,
+                          const MsgRoute &route,
+                          const char *begin,
+                          const char *end,
+                          Timestamp time)
+{
+    // 直接把输入缓冲区里的这段字节交给业务层，帧在回调返回之后才从buffer中取走
+    // 聊天消息只用扫描出的路由字段原样转发，其他消息由handler解码成idl生成的消息结构体
+    StringPiece frame(begin, static_cast<int>(end - begin));
+
     // 达到的目的：完全解耦网络模块的代码和业务模块的代码
-    // 通过js["msgid"] 获取=》业务handler
-    auto msgHandler = ChatService::instance()->getHandler(js["msgid"].get<int>());
-    // 回调消息绑定好的事件处理器，来执行相应的业务处理
-    msgHandler(conn, js, time);
+    // 通过msgid 获取=》业务handler
+    auto msgHandler = ChatService::instance()->getHandler(route.msgid);
+    // 回调消息绑定好的事件处理器，来执行相应的业务处理，记录处理耗时
+    // 这个loop过载时推迟或者丢弃低优先级的消息
+    OverloadGuard::Action action = OverloadGuard::admit(route.msgid, 0);
+    Session *session = getSession(conn);
+    if (action == OverloadGuard::kShed)
+    {
+        return;
+    }
+    if (action == OverloadGuard::kDefer && session != nullptr)
+    {
+        session->deferredFrame.assign(begin, end);
+        defer(conn, route, time, ++session->deferSeq, 1);
+        return;
+    }
+
+    size_t type = route.msgid > 0 && static_cast<size_t>(route.msgid) < _handlerTimers.size() ? route.msgid : 0;
+    ScopedTimer timer(_handlerTimers[type]);
+    // 采样的聊天消息从epoll返回的时间开始记录各个阶段
+    Tracer::Scope trace(route.msgid, time.microSecondsSinceEpoch());
+    msgHandler(conn, route, frame, time);
+}
+
+// 过载时推迟处理一帧消息：帧拷贝到Session里，过一会儿在同一个loop里再分发，仍然过载就继续推迟。
+// 处理完之后接着分发推迟期间留在输入缓冲区里的帧
+void ChatServer::defer(const TcpConnectionPtr &conn, const MsgRoute &route, Timestamp time, uint32_t seq, int deferred)
+{
+    conn->getLoop()->runAfter(OverloadGuard::options().deferSeconds, [this, conn, route, time, seq, deferred]()
+    {
+        // 连接断开了，或者推迟的帧已经随连接交给了新进程
+        Session *session = getSession(conn);
+        if (!conn->connected() || session == nullptr || session->frozen || session->deferSeq != seq ||
+            session->deferredFrame.empty())
+        {
+            return;
+        }
+        if (OverloadGuard::admit(route.msgid, deferred) == OverloadGuard::kDefer)
+        {
+            defer(conn, route, time, seq, deferred + 1);
+            return;
+        }
+        string frame;
+        frame.swap(session->deferredFrame);
+        {
+            size_t type = route.msgid > 0 && static_cast<size_t>(route.msgid) < _handlerTimers.size() ? route.msgid : 0;
+            ScopedTimer timer(_handlerTimers[type]);
+            ChatService::instance()->getHandler(route.msgid)(conn, route, StringPiece(frame.data(), static_cast<int>(frame.size())), time);
+        }
+        if (conn->inputBuffer()->readableBytes() > 0)
+        {
+            onMessage(conn, conn->inputBuffer(), Timestamp::now());
+        }
+    });
+}
 
+// 输出拥塞连接的缓冲统计
+void ChatServer::logFlowStats()
+{
+    size_t total = 0;
+    int congested = 0;
+    for (const FlowStats &stats : FlowControl::stats())
+    {
+        total += stats.buffered;
+        if (!stats.congested)
+        {
+            continue;
+        }
+        ++congested;
+        LOG_WARN << "congested " << stats.name << " user " << stats.userid
+                 << " buffered " << stats.buffered << " peak " << stats.peak
+                 << " high water hits " << stats.highWaterHits
+                 << " spilled " << stats.spilled << " dropped " << stats.dropped;
+    }
+    if (congested > 0)
+    {
+        LOG_WARN << congested << " congested connections, total buffered " << total << " bytes";
+    }
+}
+
+// 输出各个IO loop的连接数和调度延迟
+void ChatServer::logLoopStats()
+{
+    vector<LoopStats> loads = _server.loopStats();
+    // reusePort模式下每个服务器只有自己的一个loop
+    for (auto &server : _ioServers)
+    {
+        for (LoopStats stats : server->loopStats())
+        {
+            stats.index = static_cast<int>(loads.size());
+            loads.push_back(stats);
+        }
+    }
+    for (const LoopStats &stats : loads)
+    {
+        LOG_INFO << "loop " << stats.index << " connections " << stats.connections
+                 << " lag " << stats.lagUs << "us max " << stats.maxLagUs << "us"
+                 << (stats.overloaded ? " overloaded" : "");
+    }
+}
+
+// 注册各个消息类型的处理耗时，以及流控、IO loop、登录准入的统计
+void ChatServer::registerMetrics()
+{
+    const char *help = "Message handler latency on the IO thread in microseconds";
+    // 下标0是未知的msgid
+    _handlerTimers.push_back(Metrics::histogram("chat_handler_duration_us", help, "type=\"unknown\""));
+    for (int msgid = 1; msgTypeName(msgid) != nullptr; ++msgid)
+    {
+        _handlerTimers.push_back(Metrics::histogram("chat_handler_duration_us", help,
+                                                    string("type=\"") + msgTypeName(msgid) + "\""));
+    }
+    Metrics::addCollector(std::bind(&ChatServer::collectMetrics, this, _1));
+}
+
+// 输出指标时取流控、IO loop、登录准入的当前统计
+void ChatServer::collectMetrics(string *out)
+{
+    size_t buffered = 0;
+    int congested = 0;
+    vector<FlowStats> flows = FlowControl::stats();
+    for (const FlowStats &stats : flows)
+    {
+        buffered += stats.buffered;
+        congested += stats.congested ? 1 : 0;
+    }
+    Metrics::writeHeader(out, "chat_connections", "gauge", "Open client connections");
+    Metrics::writeSample(out, "chat_connections", "", flows.size());
+    Metrics::writeHeader(out, "chat_congested_connections", "gauge", "Connections over the output high water mark");
+    Metrics::writeSample(out, "chat_congested_connections", "", congested);
+    Metrics::writeHeader(out, "chat_buffered_bytes", "gauge", "Bytes waiting in output buffers and cross-thread sends");
+    Metrics::writeSample(out, "chat_buffered_bytes", "", buffered);
+
+    vector<LoopStats> loads = _server.loopStats();
+    for (auto &server : _ioServers)
+    {
+        for (LoopStats stats : server->loopStats())
+        {
+            stats.index = static_cast<int>(loads.size());
+            loads.push_back(stats);
+        }
+    }
+    Metrics::writeHeader(out, "chat_loop_connections", "gauge", "Connections assigned to each IO loop");
+    for (const LoopStats &stats : loads)
+    {
+        Metrics::writeSample(out, "chat_loop_connections", "loop=\"" + to_string(stats.index) + "\"", stats.connections);
+    }
+    Metrics::writeHeader(out, "chat_loop_lag_us", "gauge", "IO loop scheduling lag in microseconds (moving average)");
+    for (const LoopStats &stats : loads)
+    {
+        Metrics::writeSample(out, "chat_loop_lag_us", "loop=\"" + to_string(stats.index) + "\"", stats.lagUs);
+    }
+    Metrics::writeHeader(out, "chat_loop_max_lag_us", "gauge", "Largest IO loop scheduling lag seen, in microseconds");
+    for (const LoopStats &stats : loads)
+    {
+        Metrics::writeSample(out, "chat_loop_max_lag_us", "loop=\"" + to_string(stats.index) + "\"", stats.maxLagUs);
+    }
+    Metrics::writeHeader(out, "chat_loop_overloaded", "gauge", "1 while the IO loop lag is over the overload threshold");
+    for (const LoopStats &stats : loads)
+    {
+        Metrics::writeSample(out, "chat_loop_overloaded", "loop=\"" + to_string(stats.index) + "\"", stats.overloaded ? 1 : 0);
+    }
+
+    AdmissionStats login = ChatService::instance()->loginStats();
+    Metrics::writeHeader(out, "chat_login_running", "gauge", "Logins running on worker threads");
+    Metrics::writeSample(out, "chat_login_running", "", login.running);
+    Metrics::writeHeader(out, "chat_login_queued", "gauge", "Logins waiting for a worker");
+    Metrics::writeSample(out, "chat_login_queued", "", login.queued);
+    Metrics::writeHeader(out, "chat_logins_total", "counter", "Logins by admission result");
+    Metrics::writeSample(out, "chat_logins_total", "result=\"admitted\"", login.admitted);
+    Metrics::writeSample(out, "chat_logins_total", "result=\"rejected\"", login.rejected);
+    Metrics::writeSample(out, "chat_logins_total", "result=\"expired\"", login.expired);
+}
+
+// 输出登录准入的排队和拒绝统计
+void ChatServer::logAdmissionStats()
+{
+    AdmissionStats stats = ChatService::instance()->loginStats();
+    LOG_INFO << "login running " << stats.running << " queued " << stats.queued
+             << " admitted " << stats.admitted << " rejected " << stats.rejected << " expired " << stats.expired
+             << " wait " << stats.waitUs << "us max " << stats.maxWaitUs << "us service " << stats.serviceUs << "us";
+}
+
+// 不停机升级：在path上等待新进程来接管
+void ChatServer::enableHotRestart(const string &path)
+{
+    _controlFd = HotRestart::listenControl(path);
+    if (_controlFd < 0)
+    {
+        LOG_ERROR << "hot restart disabled";
+        return;
+    }
+    _controlChannel.reset(new Channel(_loop, _controlFd));
+    _controlChannel->setReadCallback(std::bind(&ChatServer::handleTakeover, this));
+    _controlChannel->enableReading();
+    LOG_INFO << "hot restart control socket " << path;
+}
+
+// 新进程连上了控制socket：冻结所有连接，交给新进程之后退出；交接失败时解冻没发出去的连接，继续服务
+void ChatServer::handleTakeover()
+{
+    int control = HotRestart::acceptTakeover(_controlFd);
+    if (control < 0)
+    {
+        return;
+    }
+    LOG_INFO << "hot restart: hand over to the new process";
+
+    vector<BalancedServer *> servers{&_server};
+    for (auto &server : _ioServers)
+    {
+        servers.push_back(server.get());
+    }
+
+    // 所有服务器都停止接受连接，新连接留在监听socket的队列里由新进程接受
+    vector<int> listenFds;
+    map<EventLoop *, vector<BalancedServer::ConnectionInfo>> loopConns;
+    for (BalancedServer *server : servers)
+    {
+        vector<BalancedServer::ConnectionInfo> conns;
+        runInLoopAndWait(server->getLoop(), [server, &conns]()
+        {
+            server->stopAccepting();
+            conns = server->connections();
+        });
+        listenFds.push_back(server->listenFd());
+        for (const auto &info : conns)
+        {
+            loopConns[info.conn->getLoop()].push_back(info);
+        }
+    }
+
+    // 在每个IO loop里冻结它的连接，之后老进程不再读写这些连接，frozen和handoffs一一对应
+    vector<ConnHandoff> handoffs;
+    vector<TcpConnectionPtr> frozen;
+    for (auto &item : loopConns)
+    {
+        const vector<BalancedServer::ConnectionInfo> &conns = item.second;
+        runInLoopAndWait(item.first, [&conns, &handoffs, &frozen]()
+        {
+            for (const auto &info : conns)
+            {
+                ConnHandoff handoff;
+                if (freeze(info.conn, info.sockfd, &handoff))
+                {
+                    handoffs.push_back(std::move(handoff));
+                    frozen.push_back(info.conn);
+                }
+            }
+        });
+    }
+
+    size_t sentConns = 0;
+    if (!HotRestart::handoff(control, listenFds, handoffs, &sentConns))
+    {
+        // 升级失败不能变成停机：没发出去的连接解冻，继续接受新连接，老进程接着服务
+        LOG_ERROR << "hot restart failed after handing over " << sentConns << " of " << handoffs.size()
+                  << " connections, keep serving";
+        ::close(control);
+        recover(frozen, handoffs, sentConns);
+        for (BalancedServer *server : servers)
+        {
+            server->getLoop()->runInLoop([server]()
+            {
+                server->resumeAccepting();
+            });
+        }
+        return;
+    }
+    LOG_INFO << "hot restart: handed over " << listenFds.size() << " listen sockets and "
+             << handoffs.size() << " connections, exit";
+    Recorder::flush();
+    AsyncLog::stop();
+    fflush(stdout);
+    // 不析构、不reset()：连接还在新进程里，用户保持在线
+    _exit(0);
+}
+
+// 交接失败：已经发给新进程的连接可能已经被新进程接管，老进程只关掉自己这一份fd，
+// 不改数据库里的用户状态；没发出去的连接在各自的IO线程里解冻，继续由老进程服务
+void ChatServer::recover(const vector<TcpConnectionPtr> &conns, vector<ConnHandoff> &handoffs, size_t sentConns)
+{
+    for (size_t i = 0; i < conns.size(); ++i)
+    {
+        TcpConnectionPtr conn = conns[i];
+        auto handoff = std::make_shared<ConnHandoff>(std::move(handoffs[i]));
+        bool sent = i < sentConns;
+        conn->getLoop()->runInLoop([this, conn, handoff, sent]()
+        {
+            if (sent)
+            {
+                // 连接还是冻结的，断开时onConnection不会把用户改成离线
+                ChatService::instance()->releaseSession(conn);
+                conn->forceClose();
+                return;
+            }
+            resume(conn, *handoff);
+        });
+    }
+}
+
+// 交接失败，解冻一条没有发出去的连接，把冻结时取出的状态放回去，和新进程里的restore()对应
+void ChatServer::resume(const TcpConnectionPtr &conn, ConnHandoff &handoff)
+{
+    Session *session = getSession(conn);
+    if (session == nullptr)
+    {
+        return;
+    }
+    session->frozen = false;
+    if (!conn->connected())
+    {
+        // 冻结期间断开了，断开回调跳过了下线流程：冻结时取出的离线消息存回数据库，用户改成离线
+        if (handoff.userid != -1)
+        {
+            OfflineMsgModel offlineMsgModel;
+            for (const string &msg : handoff.offline)
+            {
+                offlineMsgModel.insert(handoff.userid, msg);
+            }
+        }
+        ChatService::instance()->clientCloseException(conn);
+        return;
+    }
+    // 输出缓冲区里没写完的字节放回去，后面的消息接在它后面
+    if (!handoff.output.empty())
+    {
+        FlowControl::send(conn, handoff.output, FlowControl::kEssential);
+    }
+    // 在线表和redis订阅都还在，离线消息接着推送
+    if (!handoff.offline.empty())
+    {
+        ChatService::instance()->restoreSession(conn, handoff.userid, std::move(handoff.offline));
+    }
+    // 冻结前因为背压暂停了读的连接，等输出缓冲区写完再恢复
+    if (!session->flow.paused)
+    {
+        conn->startRead();
+    }
+    if (!handoff.input.empty())
+    {
+        conn->inputBuffer()->append(handoff.input);
+        onMessage(conn, conn->inputBuffer(), Timestamp::now());
+    }
+}
+
+// 在连接所属的IO线程里冻结连接，取出交给新进程的状态
+bool ChatServer::freeze(const TcpConnectionPtr &conn, int sockfd, ConnHandoff *handoff)
+{
+    Session *session = getSession(conn);
+    if (session == nullptr || !conn->connected())
+    {
+        return false;
+    }
+    // 冻结之后发给它的聊天消息存成离线消息，见FlowControl::send
+    session->frozen = true;
+    conn->stopRead();
+
+    handoff->fd = sockfd;
+    handoff->userid = session->userid;
+    handoff->protocol = session->protocol;
+    // 输入缓冲区里是推迟期间收到的帧和半帧，放在推迟的那一帧后面，
+    // 输出缓冲区里是还没写出去的字节，都交给新进程
+    handoff->input = session->deferredFrame + conn->inputBuffer()->retrieveAllAsString();
+    session->deferredFrame.clear();
+    handoff->output = conn->outputBuffer()->retrieveAllAsString();
+    if (session->offline)
+    {
+        handoff->offline = session->offline->takeRemaining();
+        session->offline.reset();
+    }
+    return true;
+}
+
+// 不停机升级：恢复从老进程接过来的连接
+void ChatServer::adopt(Inheritance *inheritance)
+{
+    vector<BalancedServer *> servers{&_server};
+    for (auto &server : _ioServers)
+    {
+        servers.push_back(server.get());
+    }
+
+    // 连接轮流交给各个服务器，由服务器按负载分配IO loop
+    vector<ConnHandoff> &conns = inheritance->conns;
+    CountDownLatch latch(static_cast<int>(conns.size()));
+    for (size_t i = 0; i < conns.size(); ++i)
+    {
+        BalancedServer *server = servers[i % servers.size()];
+        auto handoff = std::make_shared<ConnHandoff>(std::move(conns[i]));
+        server->getLoop()->runInLoop([this, server, handoff, &latch]()
+        {
+            server->adoptConnection(handoff->fd, [this, handoff, &latch](const TcpConnectionPtr &conn)
+            {
+                restore(conn, *handoff);
+                latch.countDown();
+            });
+        });
+    }
+    latch.wait();
+    LOG_INFO << "hot restart: adopted " << conns.size() << " connections";
+    conns.clear();
+
+    HotRestart::finish(inheritance);
+}
+
+// 在新进程里恢复一条接过来的连接，连接建立时已经创建了会话
+void ChatServer::restore(const TcpConnectionPtr &conn, ConnHandoff &handoff)
+{
+    Session *session = getSession(conn);
+    if (session == nullptr)
+    {
+        return;
+    }
+    session->protocol = handoff.protocol;
+    // 先发老进程没写完的字节，后面的消息接在它后面
+    if (!handoff.output.empty())
+    {
+        FlowControl::send(conn, handoff.output, FlowControl::kEssential);
+    }
+    ChatService::instance()->restoreSession(conn, handoff.userid, std::move(handoff.offline));
+    // 老进程收到的半帧放回输入缓冲区，和之后收到的数据拼成完整的帧
+    if (!handoff.input.empty())
+    {
+        conn->inputBuffer()->append(handoff.input);
+        onMessage(conn, conn->inputBuffer(), Timestamp::now());
+    }
 }
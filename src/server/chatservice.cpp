@@ -1,11 +1,56 @@
 #include "chatservice.hpp"
 #include "public.hpp"
+#include "binarycodec.hpp"
+#include "msgcodec.hpp"
+#include "session.hpp"
+#include "loginsnapshot.hpp"
+#include "metrics.hpp"
+#include "tracer.hpp"
+#include "asynclog.hpp"
 
 #include <muduo/base/Logging.h>
 #include <vector>
 using namespace std;
+using namespace placeholders;
 using namespace muduo;
 
+namespace
+{
+
+// _connMutex的各个调用点，群聊在锁里查数据库，持锁时间会变成其他IO线程的等锁时间
+const InstrumentedMutex::Site kLoginSite = InstrumentedMutex::site("conn", "login");
+const InstrumentedMutex::Site kLoginoutSite = InstrumentedMutex::site("conn", "loginout");
+const InstrumentedMutex::Site kRestoreSite = InstrumentedMutex::site("conn", "restoreSession");
+const InstrumentedMutex::Site kCloseSite = InstrumentedMutex::site("conn", "clientCloseException");
+const InstrumentedMutex::Site kOneChatSite = InstrumentedMutex::site("conn", "oneChat");
+const InstrumentedMutex::Site kGroupChatSite = InstrumentedMutex::site("conn", "groupChat");
+const InstrumentedMutex::Site kRedisSite = InstrumentedMutex::site("conn", "handleRedisSubscribeMessage");
+
+// 客户端发来的错误请求，每秒最多记录10条
+LogRateLimiter badRequestLog("bad_request", 10);
+
+// 把解码消息结构体和调用业务方法包装成MsgHandler，解码失败的消息直接丢弃
+template <typename Msg>
+MsgHandler bindMsgHandler(ChatService *service, void (ChatService::*handler)(const TcpConnectionPtr &, Msg &, Timestamp))
+{
+    return [service, handler](const TcpConnectionPtr &conn, const MsgRoute &route, const StringPiece &frame, Timestamp time)
+    {
+        Msg msg;
+        if (!MsgCodec::decodeMsg(route, frame, &msg))
+        {
+            uint64_t suppressed = 0;
+            if (badRequestLog.allow(&suppressed))
+            {
+                LOG_ERROR << "msgid:" << route.msgid << " decode error!" << LogRateLimiter::note(suppressed);
+            }
+            return;
+        }
+        (service->*handler)(conn, msg, time);
+    };
+}
+
+} // namespace
+
 // 获取单例对象的接口函数
 /*
 为什么要设计成单例模式？单例模式有什么好处？讲解一下单例模式是什么
@@ -26,15 +71,19 @@ ChatService *ChatService::instance()
 // 注册消息以及对应的Handler回调操作
 ChatService::ChatService()
 {
-    _msgHandlerMap.insert({LOGIN_MSG, std::bind(&ChatService::login, this, _1, _2, _3)});
-    _msgHandlerMap.insert({LOGINOUT_MSG, std::bind(&ChatService::loginout, this, _1, _2, _3)});
-    _msgHandlerMap.insert({REG_MSG, std::bind(&ChatService::reg, this, _1, _2, _3)});
-    _msgHandlerMap.insert({ONE_CHAT_MSG, std::bind(&ChatService::oneChat, this, _1, _2, _3)});
-    _msgHandlerMap.insert({ADD_FRIEND_MSG, std::bind(&ChatService::addFriend, this, _1, _2, _3)});
+    _msgHandlerMap.insert({LOGIN_MSG, bindMsgHandler(this, &ChatService::admitLogin)});
+    _msgHandlerMap.insert({LOGINOUT_MSG, bindMsgHandler(this, &ChatService::loginout)});
+    _msgHandlerMap.insert({REG_MSG, bindMsgHandler(this, &ChatService::reg)});
+    _msgHandlerMap.insert({ADD_FRIEND_MSG, bindMsgHandler(this, &ChatService::addFriend)});
+
+    _msgHandlerMap.insert({CREATE_GROUP_MSG, bindMsgHandler(this, &ChatService::createGroup)});
+    _msgHandlerMap.insert({ADD_GROUP_MSG, bindMsgHandler(this, &ChatService::addGroup)});
+    _msgHandlerMap.insert({PROTO_MSG, bindMsgHandler(this, &ChatService::negotiate)});
+    _msgHandlerMap.insert({HEARTBEAT_MSG, bindMsgHandler(this, &ChatService::heartbeat)});
 
-    _msgHandlerMap.insert({CREATE_GROUP_MSG, std::bind(&ChatService::createGroup, this, _1, _2, _3)});
-    _msgHandlerMap.insert({ADD_GROUP_MSG, std::bind(&ChatService::addGroup, this, _1, _2, _3)});
-    _msgHandlerMap.insert({GROUP_CHAT_MSG, std::bind(&ChatService::groupChat, this, _1, _2, _3)});
+    // 聊天消息只需要路由字段就能转发，不解码消息体
+    _msgHandlerMap.insert({ONE_CHAT_MSG, std::bind(&ChatService::oneChat, this, _1, _2, _3, _4)});
+    _msgHandlerMap.insert({GROUP_CHAT_MSG, std::bind(&ChatService::groupChat, this, _1, _2, _3, _4)});
 
     // 连接redis服务器
     if (_redis.connect())
@@ -42,6 +91,34 @@ ChatService::ChatService()
         // 设置上报消息的回调
         _redis.init_notify_handler(std::bind(&ChatService::handleRedisSubscribeMessage, this, _1, _2));
     }
+
+    // 连接拥塞解除、输出缓冲区写完时继续推送离线消息
+    FlowControl::setDrainCallback(std::bind(&ChatService::resumeOfflineStream, this, _1));
+    // 不停机升级时，冻结之前排队、冻结之后才轮到的聊天消息改存离线消息
+    FlowControl::setSpillCallback(std::bind(&ChatService::spillFrozen, this, _1, _2));
+}
+
+// 启动登录准入控制的工作线程
+void ChatService::startLoginAdmission(const LoginAdmission::Options &options)
+{
+    _loginAdmission.start(options);
+}
+
+// 登录请求交给准入控制排队，在IO线程里调用
+void ChatService::admitLogin(const TcpConnectionPtr &conn, LoginMsg &msg, Timestamp time)
+{
+    _loginAdmission.submit([this, conn, msg, time]() mutable
+    {
+        // 排队期间客户端可能已经断开，不再查数据库
+        if (conn->connected())
+        {
+            login(conn, msg, time);
+        }
+    },
+    [this, conn](int retryAfterMs)
+    {
+        _responses.loginBusy(conn, retryAfterMs);
+    });
 }
 
 // 获取消息对应的处理器
@@ -57,9 +134,13 @@ MsgHandler ChatService::getHandler(int msgid)
     if (it == _msgHandlerMap.end())
     {
         // 返回一个默认的处理器，空操作
-        return [=](const TcpConnectionPtr &conn, json &js, Timestamp)
+        return [=](const TcpConnectionPtr &conn, const MsgRoute &, const StringPiece &, Timestamp)
         {
-            LOG_ERROR << "msgid:" << msgid << " can not find handler!";
+            uint64_t suppressed = 0;
+            if (badRequestLog.allow(&suppressed))
+            {
+                LOG_ERROR << "msgid:" << msgid << " can not find handler!" << LogRateLimiter::note(suppressed);
+            }
         };
     }
     else
@@ -89,10 +170,10 @@ conn->send(response.dump()); 为什么都要 .dump()？客户端发给服务器
 {"msgid":1,"id":2,"password":"123456"}
 这样双方都能方便地解析和处理消息内容。
 */
-void ChatService::login(const TcpConnectionPtr &conn, json &js, Timestamp time)
+void ChatService::login(const TcpConnectionPtr &conn, LoginMsg &msg, Timestamp time)
 {
-    int id = js["id"].get<int>();
-    string pwd = js["password"];
+    int id = msg.id;
+    string pwd = msg.password;
 
     User user = _userModel.query(id);
     if (user.getId() == id && user.getPwd() == pwd)
@@ -100,19 +181,20 @@ void ChatService::login(const TcpConnectionPtr &conn, json &js, Timestamp time)
         if (user.getState() == "online")
         {
             // 该用户已经登录，不允许重复登录
-            json response;
-            response["msgid"] = LOGIN_MSG_ACK;
-            response["errno"] = 2; // 0表示成功
-            response["errmsg"] = "该帐号已经登录，请不要重复登录";
-            conn->send(response.dump());
+            _responses.loginRepeated(conn);
         }
         else
         {
             // 登录成功，记录用户连接信息
             {
-                lock_guard<mutex> lock(_connMutex);
+                InstrumentedLockGuard lock(_connMutex, kLoginSite);
                 _userConnMap.insert({id, conn});
             }
+            Session *session = getSession(conn);
+            if (session != nullptr)
+            {
+                session->userid = id;
+            }
 
             // id用户登录成功后，向redis订阅channel(id)
             _redis.subscribe(id);
@@ -121,23 +203,46 @@ void ChatService::login(const TcpConnectionPtr &conn, json &js, Timestamp time)
             user.setState("online");
             _userModel.updateState(user);
 
+            // 登录在工作线程里执行，查询期间连接可能已经断开，断开的回调没有找到这个用户：
+            // 回到IO线程里再确认一次，断开了就按异常退出处理
+            conn->getLoop()->runInLoop([this, conn]()
+            {
+                if (!conn->connected())
+                {
+                    clientCloseException(conn);
+                }
+            });
+
 
-            json response;
-            response["msgid"] = LOGIN_MSG_ACK;
-            response["errno"] = 0; // 0表示成功
-            response["id"] = user.getId();
-            response["name"] = user.getName();
             // 查看该用户是否有离线消息
             vector<string> vec = _offlineMsgModel.query(id);
             if(!vec.empty())
             {
-                response["offlinemsg"] = vec;
                 // 读取该用户的离线消息后，把该用户的所有离线消息删除掉
                 _offlineMsgModel.remove(id);
             }
-            
-            // 查询该用户的好友信息并返回
+
+            // 支持快照v2的客户端：嵌套数组直接编码到发送缓冲区，用户去重，不再嵌套dump
+            if (msg.hasSnapshot && msg.snapshot >= LoginSnapshot::kVersion)
+            {
+                loginSnapshot(conn, msg, user, vec);
+                return;
+            }
+
+            // 查询该用户的好友信息和群组信息
             vector<User> userVec = _friendModel.query(id);
+            vector<Group> groupVec = _groupModel.queryGroups(id);
+
+            LoginMsgAck response;
+            response.err = 0; // 0表示成功
+            response.setId(user.getId());
+            response.setName(user.getName());
+            if(!vec.empty())
+            {
+                response.setOfflinemsg(vec);
+            }
+            
+            // 好友信息
             if(!userVec.empty())
             {
                 vector<string> vec2;
@@ -149,11 +254,10 @@ void ChatService::login(const TcpConnectionPtr &conn, json &js, Timestamp time)
                     js["state"] = user.getState();
                     vec2.push_back(js.dump());
                 }
-                response["friends"] = vec2;
+                response.setFriends(vec2);
             }
 
-            // 查询该用户的群组信息并返回
-            vector<Group> groupVec = _groupModel.queryGroups(id);
+            // 群组信息
             if(!groupVec.empty())
             {
                 vector<string> vec3;
@@ -176,26 +280,151 @@ void ChatService::login(const TcpConnectionPtr &conn, json &js, Timestamp time)
                     js["users"] = userV;
                     vec3.push_back(js.dump());
                 }
-                response["groups"] = vec3;
+                response.setGroups(vec3);
             }
-            conn->send(response.dump());
+            MsgCodec::sendMsg(conn, response);
+            keepOfflineIfClosed(conn, id, std::move(vec));
         }
     }
     else
     {
         // 该用户不存在，登录失败 / 密码错误
-        json response;
-        response["msgid"] = LOGIN_MSG_ACK;
-        response["errno"] = 1;
-        response["errmsg"] = "用户名或密码错误";
-        conn->send(response.dump());
+        _responses.loginFailed(conn);
+    }
+}
+
+// 登录成功，按快照v2发送好友和群组，客户端带了本地的版本号时只发有变化的部分
+void ChatService::loginSnapshot(const TcpConnectionPtr &conn, LoginMsg &msg, User &user, vector<string> &offlinemsg)
+{
+    int id = user.getId();
+
+    // 先读版本再读列表，并发修改时客户端拿到的版本只会偏旧，下次登录再同步一次
+    int friendver = _friendModel.queryVersion(id);
+    vector<User> userVec = _friendModel.query(id);
+    bool friendsChanged = !msg.hasFriendver || msg.friendver != friendver;
+
+    // 客户端已有的群组版本  groupid => version
+    unordered_map<int, int> knownVersions;
+    if (msg.hasGroupvers && msg.groupvers.is_array())
+    {
+        for (const json &entry : msg.groupvers)
+        {
+            if (entry.is_array() && entry.size() == 2 && entry[0].is_number_integer() && entry[1].is_number_integer())
+            {
+                knownVersions[entry[0].get<int>()] = entry[1].get<int>();
+            }
+        }
+    }
+    // 版本一致的群组不再查询群成员
+    vector<Group> groupVec = _groupModel.queryGroups(id, knownVersions);
+
+    // 支持分批推送的客户端，响应里只带离线消息的条数，响应发出去之后再推送
+    bool stream = msg.snapshot >= LoginSnapshot::kStreamOffline;
+    vector<string> none;
+    LoginSnapshot snapshot(user, stream ? none : offlinemsg);
+    snapshot.setFriends(userVec, friendver, friendsChanged);
+    snapshot.setGroups(groupVec, knownVersions);
+    if (stream)
+    {
+        snapshot.setOfflineCount(static_cast<int>(offlinemsg.size()));
+    }
+    MsgCodec::sendMsg(conn, snapshot);
+
+    if (stream && !offlinemsg.empty())
+    {
+        startOfflineStream(conn, id, std::move(offlinemsg));
+    }
+    else if (!stream)
+    {
+        keepOfflineIfClosed(conn, id, std::move(offlinemsg));
+    }
+}
+
+// 开始分批推送离线消息，输出缓冲区超过高水位时暂停，写完之后在WriteCompleteCallback里继续
+void ChatService::startOfflineStream(const TcpConnectionPtr &conn, int userid, vector<string> msgs)
+{
+    // 登录在工作线程里执行，推送要回到连接所属的IO线程
+    if (!conn->getLoop()->isInLoopThread())
+    {
+        conn->getLoop()->runInLoop([this, conn, userid, msgs]()
+        {
+            startOfflineStream(conn, userid, msgs);
+        });
+        return;
+    }
+    // 登录期间连接已经断开，断开的回调里还没有可以存回的推送，在这里存回去
+    Session *session = getSession(conn);
+    if (!conn->connected() || session == nullptr)
+    {
+        for (const string &msg : msgs)
+        {
+            _offlineMsgModel.insert(userid, msg);
+        }
+        return;
+    }
+    session->offline.reset(new OfflineStream(userid, std::move(msgs)));
+    // 推送期间由FlowControl在写完成时回调resumeOfflineStream，推送完之后它会取消写完成回调
+    FlowControl::watchDrain(conn);
+    resumeOfflineStream(conn);
+}
+
+// 连接的输出缓冲区写完了，继续推送离线消息
+void ChatService::resumeOfflineStream(const TcpConnectionPtr &conn)
+{
+    Session *session = getSession(conn);
+    if (session == nullptr || !session->offline)
+    {
+        return;
+    }
+    if (session->offline->pump(conn))
+    {
+        session->offline.reset();
+    }
+}
+
+// 停止推送离线消息，还没推送的存回数据库，下次登录再推送
+void ChatService::stopOfflineStream(const TcpConnectionPtr &conn)
+{
+    Session *session = getSession(conn);
+    if (session == nullptr || !session->offline)
+    {
+        return;
+    }
+    int userid = session->offline->userid();
+    for (const string &msg : session->offline->takeRemaining())
+    {
+        _offlineMsgModel.insert(userid, msg);
+    }
+    session->offline.reset();
+}
+
+// 响应是从工作线程发出的，muduo在IO线程里发送，这时连接已经断开的话直接丢掉。
+// 这个检查排在发送之后执行：断开了说明响应没有发出去，存回数据库下次登录再取。
+// 发送之后、检查之前才断开的，消息可能已经写进了socket，下次登录会重复收到，重复好过丢失
+void ChatService::keepOfflineIfClosed(const TcpConnectionPtr &conn, int userid, vector<string> msgs)
+{
+    if (msgs.empty())
+    {
+        return;
     }
+    conn->getLoop()->runInLoop([this, conn, userid, msgs]()
+    {
+        if (conn->connected())
+        {
+            return;
+        }
+        for (const string &msg : msgs)
+        {
+            _offlineMsgModel.insert(userid, msg);
+        }
+    });
 }
+
 // 处理注册业务 name password
-void ChatService::reg(const TcpConnectionPtr &conn, json &js, Timestamp time)
+void ChatService::reg(const TcpConnectionPtr &conn, RegMsg &msg, Timestamp time)
 {
-    string name = js["name"];
-    string pwd = js["password"];
+    string name = msg.name;
+    string pwd = msg.password;
 
     User user;
     user.setName(name);
@@ -204,35 +433,35 @@ void ChatService::reg(const TcpConnectionPtr &conn, json &js, Timestamp time)
     if (state)
     {
         // 注册成功
-        json response;
-        response["msgid"] = REG_MSG_ACK;
-        response["errno"] = 0; // 0表示成功
-
         // 这是是怎么拿到返回的用户id的？
         /*
         在注册时，_userModel.insert(user) 会把新用户插入数据库，并通过 user.setId(...) 把数据库生成的自增主键 id 设置到 user 对象里。
         所以注册成功后，user.getId() 就能拿到新分配的用户 id。
         */
-        response["id"] = user.getId();
-        conn->send(response.dump());
+        _responses.regSucceeded(conn, user.getId());
     }
     else
     {
         // 注册失败
-        json response;
-        response["msgid"] = REG_MSG_ACK;
-        response["errno"] = 1; // 1表示失败
-        conn->send(response.dump());
+        _responses.regFailed(conn);
     }
 }
 
 // 处理注销业务
-void ChatService::loginout(const TcpConnectionPtr &conn, json &js, Timestamp time)
+void ChatService::loginout(const TcpConnectionPtr &conn, LoginoutMsg &msg, Timestamp time)
 {
-    int userid = js["id"].get<int>();
+    int userid = msg.id;
+
+    // 离线消息还没推送完就注销了
+    stopOfflineStream(conn);
+    Session *session = getSession(conn);
+    if (session != nullptr)
+    {
+        session->userid = -1;
+    }
 
     {
-        lock_guard<mutex> lock(_connMutex);
+        InstrumentedLockGuard lock(_connMutex, kLoginoutSite);
         auto it = _userConnMap.find(userid);
         if(it != _userConnMap.end())
         {
@@ -250,14 +479,84 @@ void ChatService::loginout(const TcpConnectionPtr &conn, json &js, Timestamp tim
     _userModel.updateState(user);
 }
 
+// 不停机升级：恢复从老进程接过来的连接上的登录状态
+void ChatService::restoreSession(const TcpConnectionPtr &conn, int userid, vector<string> offlinemsg)
+{
+    if (userid < 0)
+    {
+        return;
+    }
+    {
+        InstrumentedLockGuard lock(_connMutex, kRestoreSite);
+        _userConnMap[userid] = conn;
+    }
+    Session *session = getSession(conn);
+    if (session != nullptr)
+    {
+        session->userid = userid;
+    }
+
+    // 数据库里的状态还是online，不用更新，只需要在这个进程里重新订阅
+    _redis.subscribe(userid);
+
+    // 老进程还没推送完的离线消息接着推送
+    if (!offlinemsg.empty())
+    {
+        startOfflineStream(conn, userid, std::move(offlinemsg));
+    }
+}
+
+// 连接已经交给新进程，老进程不再转发给它，用户的在线状态由新进程维护
+void ChatService::releaseSession(const TcpConnectionPtr &conn)
+{
+    int userid = -1;
+    {
+        InstrumentedLockGuard lock(_connMutex, kCloseSite);
+        for (auto it = _userConnMap.begin(); it != _userConnMap.end(); ++it)
+        {
+            if (it->second == conn)
+            {
+                userid = it->first;
+                _userConnMap.erase(it);
+                break;
+            }
+        }
+    }
+    if (userid != -1)
+    {
+        _redis.unsubscribe(userid);
+    }
+}
+
+// 发给冻结连接的聊天消息存成离线消息，frame是按接收方协议编码的一帧
+void ChatService::spillFrozen(const TcpConnectionPtr &conn, const string &frame)
+{
+    Session *session = getSession(conn);
+    int userid = session != nullptr ? session->userid.load() : -1;
+    if (userid == -1 || frame.empty())
+    {
+        return;
+    }
+    MsgRoute route;
+    route.protocol = BinaryCodec::isBinary(frame[0]) ? PROTO_BINARY : PROTO_JSON;
+    string text = MsgCodec::toJsonText(route, frame);
+    if (!text.empty())
+    {
+        _offlineMsgModel.insert(userid, text);
+    }
+}
+
 // 处理客户端异常退出
 void ChatService::clientCloseException(const TcpConnectionPtr &conn)
 {
+    // 离线消息还没推送完连接就断开了
+    stopOfflineStream(conn);
+
     User user;
     {
         // 为什么这里要注意线程安全？
 
-        lock_guard<mutex> locak(_connMutex);
+        InstrumentedLockGuard lock(_connMutex, kCloseSite);
         for(auto it = _userConnMap.begin(); it != _userConnMap.end(); ++it)
         {
             if(it->second == conn)
@@ -282,51 +581,77 @@ void ChatService::clientCloseException(const TcpConnectionPtr &conn)
 
 }
 
-// 一对一聊天业务
-void ChatService::oneChat(const TcpConnectionPtr &conn, json &js, Timestamp time)
+// 一对一聊天业务  frame是发送方输入缓冲区里的原始json文本，原样转发，不再反序列化再序列化
+void ChatService::oneChat(const TcpConnectionPtr &conn, const MsgRoute &route, const StringPiece &frame, Timestamp time)
 {
-    // .get<int>()作用是什么？
-    int toid = js["toid"].get<int>();
+    int toid = route.toid;
+    if (toid == -1)
+    {
+        uint64_t suppressed = 0;
+        if (badRequestLog.allow(&suppressed))
+        {
+            LOG_ERROR << "one chat msg without toid!" << LogRateLimiter::note(suppressed);
+        }
+        return;
+    }
 
+    bool spilled = false;
     {
-        lock_guard<mutex> lock(_connMutex);
+        InstrumentedLockGuard lock(_connMutex, kOneChatSite);
         auto it = _userConnMap.find(toid);
         if(it != _userConnMap.end())
         {
             // toid在线，转发消息   服务器主动推送消息给toid用户
-            it->second->send(js.dump());
-            return ;
+            // 双方协议一致时从发送方的输入缓冲区直接写到接收方的socket或者输出缓冲区，最多一次拷贝
+            if (MsgCodec::forward(it->second, route, frame, FlowControl::kChat) != FlowControl::kSpilled)
+            {
+                return;
+            }
+            // toid的连接拥塞，改存离线消息，下次登录时推送
+            spilled = true;
         }
     }
 
-    // 查询toid是否在线
-    User user = _userModel.query(toid);
-    if(user.getState() == "online")
+    // 跨服务器转发和离线存储都用json文本，转不成json文本的帧直接丢掉，不发布也不存
+    string text = MsgCodec::toJsonText(route, frame);
+    if (text.empty())
     {
-        _redis.publish(toid, js.dump());
         return;
     }
 
+    if (!spilled)
+    {
+        // 查询toid是否在线
+        User user = _userModel.query(toid);
+        Tracer::mark(Tracer::kPresence);
+        if(user.getState() == "online")
+        {
+            _redis.publish(toid, Tracer::inject(text));
+            Tracer::mark(Tracer::kPublish);
+            return;
+        }
+    }
+
     // toid不在线，存储离线消息
-    _offlineMsgModel.insert(toid, js.dump());
+    _offlineMsgModel.insert(toid, text);
 }
 
 // 添加好友业务  msgid id friendid
-void ChatService::addFriend(const TcpConnectionPtr &conn, json &js, Timestamp time)
+void ChatService::addFriend(const TcpConnectionPtr &conn, AddFriendMsg &msg, Timestamp time)
 {
-    int userid = js["id"].get<int>();
-    int friendid = js["friendid"].get<int>();
+    int userid = msg.id;
+    int friendid = msg.friendid;
 
     // 存储好友信息
     _friendModel.insert(userid, friendid);
 }
 
 // 创建群组业务
-void ChatService::createGroup(const TcpConnectionPtr &conn, json &js, Timestamp time)
+void ChatService::createGroup(const TcpConnectionPtr &conn, CreateGroupMsg &msg, Timestamp time)
 {
-    int userid = js["id"].get<int>();
-    string name = js["groupname"];
-    string desc = js["groupdesc"];
+    int userid = msg.id;
+    string name = msg.groupname;
+    string desc = msg.groupdesc;
 
     // 存储新创建的群组信息
     Group group(-1, name, desc);
@@ -338,56 +663,132 @@ void ChatService::createGroup(const TcpConnectionPtr &conn, json &js, Timestamp
 }
 
 // 加入群组业务
-void ChatService::addGroup(const TcpConnectionPtr &conn, json &js, Timestamp time)
+void ChatService::addGroup(const TcpConnectionPtr &conn, AddGroupMsg &msg, Timestamp time)
 {
-    int userid = js["id"].get<int>();
-    int groupid = js["groupid"].get<int>();
+    int userid = msg.id;
+    int groupid = msg.groupid;
     _groupModel.addGroup(userid, groupid, "normal");
 }
 
 // 群组聊天业务
-void ChatService::groupChat(const TcpConnectionPtr &conn, json &js, Timestamp time)
+void ChatService::groupChat(const TcpConnectionPtr &conn, const MsgRoute &route, const StringPiece &frame, Timestamp time)
 {
-    int userid = js["id"].get<int>();
-    int groupid = js["groupid"].get<int>();
+    int userid = route.id;
+    int groupid = route.groupid;
+    if (groupid == -1)
+    {
+        uint64_t suppressed = 0;
+        if (badRequestLog.allow(&suppressed))
+        {
+            LOG_ERROR << "group chat msg without groupid!" << LogRateLimiter::note(suppressed);
+        }
+        return;
+    }
     vector<int> useridVec = _groupModel.queryGroupUsers(userid, groupid);
 
+    // 跨服务器转发和离线存储用的json文本，用到时才生成，整个群只生成一次；
+    // 转不成json文本的帧整条丢掉，不再发给后面的成员
+    string text;
+    bool converted = false;
+    auto jsonText = [&]() -> bool {
+        if (!converted)
+        {
+            text = MsgCodec::toJsonText(route, frame);
+            converted = true;
+        }
+        return !text.empty();
+    };
+
     // 为什么这里要注意线程安全？
-    lock_guard<mutex> lock(_connMutex);
+    InstrumentedLockGuard lock(_connMutex, kGroupChatSite);
     for(int id : useridVec)
     {
         auto it = _userConnMap.find(id);
         if(it != _userConnMap.end())
         {
-            // 转发群消息
-            it->second->send(js.dump());
+            // 转发群消息，接收方拥塞时按策略改存离线消息或者丢弃
+            if (MsgCodec::forward(it->second, route, frame, FlowControl::kBulk) == FlowControl::kSpilled)
+            {
+                if (!jsonText())
+                {
+                    return;
+                }
+                _offlineMsgModel.insert(id, text);
+            }
         }
         else
         {
+            if (!jsonText())
+            {
+                return;
+            }
             // 查询toid是否在线
             User user = _userModel.query(id);
+            Tracer::mark(Tracer::kPresence);
             if(user.getState() == "online")
             {
-                _redis.publish(id, js.dump());
+                _redis.publish(id, Tracer::inject(text));
+                Tracer::mark(Tracer::kPublish);
             }
             else
             {
                 // 存储离线消息
-                _offlineMsgModel.insert(id, js.dump());
+                _offlineMsgModel.insert(id, text);
             }
         }
     }
 }
 
+// 协商连接上使用的协议  msgid version
+void ChatService::negotiate(const TcpConnectionPtr &conn, ProtoMsg &msg, Timestamp time)
+{
+    // 取双方都支持的最高版本，0表示继续使用json
+    int version = msg.hasVersion ? msg.version : 0;
+    if (version > BinaryCodec::kVersion)
+    {
+        version = BinaryCodec::kVersion;
+    }
+    else if (version < 0)
+    {
+        version = 0;
+    }
+
+    // 协商响应本身总是用json发送，客户端收到响应之后才切换协议
+    _responses.protoAck(conn, version);
+
+    Session *session = getSession(conn);
+    if (session != nullptr && version >= 1)
+    {
+        session->protocol = PROTO_BINARY;
+    }
+}
+
+// 心跳  msgid
+void ChatService::heartbeat(const TcpConnectionPtr &conn, HeartbeatMsg &msg, Timestamp time)
+{
+    _responses.heartbeatAck(conn);
+}
+
 // 从redis消息队列中获取订阅的消息
 void ChatService::handleRedisSubscribeMessage(int userid, string message)
 {
-    lock_guard<mutex> lock(_connMutex);
+    // 采样的消息末尾带着trace字段，推送给客户端之前去掉
+    Tracer::Remote trace;
+    bool traced = Tracer::extract(&message, &trace);
+
+    InstrumentedLockGuard lock(_connMutex, kRedisSite);
     auto it = _userConnMap.find(userid);
     if(it != _userConnMap.end())
     {
-        // 用户在线，直接推送消息
-        it->second->send(message);
+        // 用户在线，直接推送消息，连接拥塞时改存离线消息
+        if (MsgCodec::sendText(it->second, message, FlowControl::kChat) != FlowControl::kSpilled)
+        {
+            if (traced)
+            {
+                Tracer::finishRemote(trace);
+            }
+            return;
+        }
     }
 
     // 用户不在线，存储离线消息
@@ -0,0 +1,71 @@
+#include "cpuaffinity.hpp"
+
+#include <muduo/base/Logging.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// 在线的cpu核数
+int CpuAffinity::onlineCpus()
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? static_cast<int>(n) : 1;
+}
+
+// 解析cpu列表
+bool CpuAffinity::parseCpuList(const string &text, vector<int> *cpus)
+{
+    cpus->clear();
+    const char *p = text.c_str();
+    while (*p != '\0')
+    {
+        char *end = nullptr;
+        long first = strtol(p, &end, 10);
+        if (end == p || first < 0 || first >= CPU_SETSIZE)
+        {
+            return false;
+        }
+        long last = first;
+        p = end;
+        if (*p == '-')
+        {
+            ++p;
+            last = strtol(p, &end, 10);
+            if (end == p || last < first || last >= CPU_SETSIZE)
+            {
+                return false;
+            }
+            p = end;
+        }
+        for (long cpu = first; cpu <= last; ++cpu)
+        {
+            cpus->push_back(static_cast<int>(cpu));
+        }
+        if (*p == ',')
+        {
+            ++p;
+        }
+        else if (*p != '\0')
+        {
+            return false;
+        }
+    }
+    return !cpus->empty();
+}
+
+// 把当前线程绑定到cpu上
+bool CpuAffinity::pinCurrentThread(int cpu)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    int err = pthread_setaffinity_np(pthread_self(), sizeof set, &set);
+    if (err != 0)
+    {
+        LOG_ERROR << "pin thread to cpu " << cpu << " failed: " << strerror(err);
+        return false;
+    }
+    return true;
+}
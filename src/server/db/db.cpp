@@ -1,12 +1,103 @@
 #include "db.h"
+#include "asynclog.hpp"
+#include "metrics.hpp"
 #include <muduo/base/Logging.h>
 
+#include <atomic>
+#include <ctype.h>
+#include <mutex>
+#include <unordered_map>
+
 
 static string server = "127.0.0.1";
 static string user = "root";
 static string password = "123";
 static string dbname = "chat";
 
+// 每次连接、执行语句、取结果的耗时和失败次数
+static const char *kDurationHelp = "MySQL call latency in microseconds";
+static const char *kErrorsHelp = "Failed MySQL calls";
+static Metrics::Id connectUs = Metrics::histogram("chat_mysql_duration_us", kDurationHelp, "op=\"connect\"");
+static Metrics::Id queryUs = Metrics::histogram("chat_mysql_duration_us", kDurationHelp, "op=\"query\"");
+static Metrics::Id fetchUs = Metrics::histogram("chat_mysql_duration_us", kDurationHelp, "op=\"fetch\"");
+static Metrics::Id updateUs = Metrics::histogram("chat_mysql_duration_us", kDurationHelp, "op=\"update\"");
+static Metrics::Id connectErrors = Metrics::counter("chat_mysql_errors_total", kErrorsHelp, "op=\"connect\"");
+static Metrics::Id queryErrors = Metrics::counter("chat_mysql_errors_total", kErrorsHelp, "op=\"query\"");
+static Metrics::Id updateErrors = Metrics::counter("chat_mysql_errors_total", kErrorsHelp, "op=\"update\"");
+
+static atomic<int> slowQueryMs{100};
+
+// 数据库断开时每次调用都会失败，限制错误日志的速度
+static LogRateLimiter connectErrorLog("mysql_connect", 10);
+static LogRateLimiter statementErrorLog("mysql_statement", 10);
+
+// 每个指纹的耗时（执行加取结果）、返回的行数和失败次数
+struct StatementStats
+{
+    Metrics::Id duration;
+    Metrics::Id rows;
+    Metrics::Id errors;
+};
+
+// 指纹的种类超过这个数（比如有人拼了不定长的IN列表）之后都记到other
+static const size_t kMaxStatements = 32;
+static mutex statementsMutex;
+static unordered_map<string, StatementStats> statements;
+
+static StatementStats statementStats(const string &fingerprint)
+{
+    lock_guard<mutex> lock(statementsMutex);
+    auto it = statements.find(fingerprint);
+    if (it != statements.end())
+    {
+        return it->second;
+    }
+    string key = statements.size() < kMaxStatements ? fingerprint : "other";
+    it = statements.find(key);
+    if (it != statements.end())
+    {
+        return it->second;
+    }
+
+    // 指纹里的字符串常量已经换掉了，label里还是要转义引号和反斜杠
+    string labels = "statement=\"";
+    for (char c : key)
+    {
+        if (c == '"' || c == '\\')
+        {
+            labels.push_back('\\');
+        }
+        labels.push_back(c);
+    }
+    labels.push_back('"');
+    StatementStats stats;
+    stats.duration = Metrics::histogram("chat_mysql_statement_duration_us", "MySQL statement latency by fingerprint in microseconds", labels);
+    stats.rows = Metrics::counter("chat_mysql_statement_rows_total", "Rows returned by fingerprint", labels);
+    stats.errors = Metrics::counter("chat_mysql_statement_errors_total", "Failed MySQL statements by fingerprint", labels);
+    statements.insert({key, stats});
+    return stats;
+}
+
+// 记录一条语句：按指纹统计，超过阈值时记慢查询日志
+static void recordStatement(const string &fingerprint, int64_t execUs, int64_t fetchUs, uint64_t rows, bool failed)
+{
+    StatementStats stats = statementStats(fingerprint);
+    int64_t totalUs = execUs + fetchUs;
+    Metrics::observe(stats.duration, totalUs);
+    Metrics::add(stats.rows, rows);
+    if (failed)
+    {
+        Metrics::add(stats.errors);
+    }
+
+    int threshold = slowQueryMs.load(memory_order_relaxed);
+    if (threshold > 0 && totalUs >= threshold * 1000LL)
+    {
+        LOG_WARN << "slow mysql statement " << totalUs / 1000 << "ms (exec " << execUs << "us, fetch " << fetchUs
+                 << "us, " << rows << " rows): " << fingerprint;
+    }
+}
+
 
 // 初始化连接数据库
 MySQL::MySQL()
@@ -26,17 +117,31 @@ MySQL::~MySQL()
 // 连接数据库
 bool MySQL::connect()
 {
+    int64_t start = Metrics::nowUs();
     MYSQL *p = mysql_real_connect(_conn, server.c_str(), user.c_str(),
                                   password.c_str(), dbname.c_str(), 3306, nullptr, 0);
     if (p != nullptr)
     {
         // C和C++代码默认的编码字符是ASCII，如果不设置，从MySQL上拉下来的中文显示？
         mysql_query(_conn, "set names gbk");
-        LOG_INFO << "connect mysql success!";
+        LOG_DEBUG << "connect mysql success!";
     }
     else
     {
-        LOG_INFO << "connect mysql fail!";
+        Metrics::add(connectErrors);
+        uint64_t suppressed = 0;
+        if (connectErrorLog.allow(&suppressed))
+        {
+            LOG_ERROR << "connect mysql fail: " << mysql_error(_conn) << LogRateLimiter::note(suppressed);
+        }
+    }
+    int64_t elapsed = Metrics::nowUs() - start;
+    Metrics::observe(connectUs, elapsed);
+    // 每次业务调用都新建连接，连接慢也会拖慢所有语句
+    int threshold = slowQueryMs.load(memory_order_relaxed);
+    if (threshold > 0 && elapsed >= threshold * 1000LL)
+    {
+        LOG_WARN << "slow mysql connect " << elapsed / 1000 << "ms";
     }
     return p;
 }
@@ -44,10 +149,22 @@ bool MySQL::connect()
 // 更新操作
 bool MySQL::update(string sql)
 {
-    if (mysql_query(_conn, sql.c_str()))
+    int64_t start = Metrics::nowUs();
+    bool failed = mysql_query(_conn, sql.c_str()) != 0;
+    int64_t elapsed = Metrics::nowUs() - start;
+    Metrics::observe(updateUs, elapsed);
+
+    // 日志里只有指纹，不带消息内容之类的参数
+    string fp = fingerprint(sql);
+    recordStatement(fp, elapsed, 0, 0, failed);
+    if (failed)
     {
-        LOG_INFO << __FILE__ << ":" << __LINE__ << ":"
-                 << sql << "更新失败！";
+        Metrics::add(updateErrors);
+        uint64_t suppressed = 0;
+        if (statementErrorLog.allow(&suppressed))
+        {
+            LOG_ERROR << "mysql update failed: " << mysql_error(_conn) << ": " << fp << LogRateLimiter::note(suppressed);
+        }
         return false;
     }
     return true;
@@ -56,13 +173,33 @@ bool MySQL::update(string sql)
 // 查询操作
 MYSQL_RES* MySQL::query(string sql)
 {
-    if (mysql_query(_conn, sql.c_str()))
+    int64_t start = Metrics::nowUs();
+    bool failed = mysql_query(_conn, sql.c_str()) != 0;
+    int64_t queried = Metrics::nowUs();
+    Metrics::observe(queryUs, queried - start);
+
+    // 一次取回全部结果，取结果的时间单独统计，model逐行读取时不再等网络
+    MYSQL_RES *res = failed ? nullptr : mysql_store_result(_conn);
+    failed = failed || (res == nullptr && mysql_field_count(_conn) != 0);
+    int64_t fetched = Metrics::nowUs();
+    if (!failed)
+    {
+        Metrics::observe(fetchUs, fetched - queried);
+    }
+
+    string fp = fingerprint(sql);
+    recordStatement(fp, queried - start, fetched - queried, res != nullptr ? mysql_num_rows(res) : 0, failed);
+    if (failed)
     {
-        LOG_INFO << __FILE__ << ":" << __LINE__ << ":"
-                 << sql << "查询失败！";
+        Metrics::add(queryErrors);
+        uint64_t suppressed = 0;
+        if (statementErrorLog.allow(&suppressed))
+        {
+            LOG_ERROR << "mysql query failed: " << mysql_error(_conn) << ": " << fp << LogRateLimiter::note(suppressed);
+        }
         return nullptr;
     }
-    return mysql_use_result(_conn);
+    return res;
 }
 
 // 获取连接
@@ -71,3 +208,72 @@ MYSQL* MySQL::getConnection()
     return _conn;
 }
 
+// 设置慢查询阈值
+void MySQL::setSlowQueryMs(int ms)
+{
+    slowQueryMs = ms;
+}
+
+// 语句的指纹
+string MySQL::fingerprint(const string &sql)
+{
+    string out;
+    out.reserve(sql.size());
+    size_t n = sql.size();
+    size_t i = 0;
+    while (i < n)
+    {
+        unsigned char c = static_cast<unsigned char>(sql[i]);
+        if (c == '\'' || c == '"')
+        {
+            // 字符串常量，跳过反斜杠转义和两个连续的引号
+            ++i;
+            while (i < n)
+            {
+                if (sql[i] == '\\')
+                {
+                    i += 2;
+                }
+                else if (sql[i] == static_cast<char>(c) && i + 1 < n && sql[i + 1] == static_cast<char>(c))
+                {
+                    i += 2;
+                }
+                else if (sql[i++] == static_cast<char>(c))
+                {
+                    break;
+                }
+            }
+            out.push_back('?');
+        }
+        else if (isdigit(c) && (out.empty() || !(isalnum(static_cast<unsigned char>(out.back())) || out.back() == '_')))
+        {
+            // 数字常量，标识符里的数字不算
+            while (i < n && (isalnum(static_cast<unsigned char>(sql[i])) || sql[i] == '.'))
+            {
+                ++i;
+            }
+            out.push_back('?');
+        }
+        else if (isspace(c))
+        {
+            while (i < n && isspace(static_cast<unsigned char>(sql[i])))
+            {
+                ++i;
+            }
+            if (!out.empty())
+            {
+                out.push_back(' ');
+            }
+        }
+        else
+        {
+            out.push_back(static_cast<char>(c));
+            ++i;
+        }
+    }
+    if (!out.empty() && out.back() == ' ')
+    {
+        out.pop_back();
+    }
+    return out;
+}
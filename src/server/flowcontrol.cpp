@@ -0,0 +1,329 @@
+#include "flowcontrol.hpp"
+#include "session.hpp"
+#include "metrics.hpp"
+
+#include <muduo/base/Logging.h>
+#include <muduo/net/Buffer.h>
+#include <muduo/net/EventLoop.h>
+
+namespace
+{
+
+FlowControl::Policy g_policy = FlowControl::kSpill;
+size_t g_highWaterMark = 1024 * 1024;
+WriteCompleteCallback g_drainCallback;
+FlowControl::SpillCallback g_spillCallback;
+
+// 每次发送之后输出缓冲区里积压的字节数
+const Metrics::Id kOutputBufferBytes = Metrics::histogram("chat_output_buffer_bytes",
+                                                          "Output buffer size after each send, in bytes");
+
+// 统计用的连接登记表  连接名 => 连接
+mutex g_connsMutex;
+unordered_map<string, weak_ptr<TcpConnection>> g_conns;
+
+void updatePeak(FlowState &flow)
+{
+    size_t buffered = flow.buffered();
+    size_t peak = flow.peakBytes.load(memory_order_relaxed);
+    while (buffered > peak && !flow.peakBytes.compare_exchange_weak(peak, buffered, memory_order_relaxed))
+    {
+    }
+}
+
+} // namespace
+
+// 设置策略和高水位
+void FlowControl::configure(Policy policy, size_t highWaterMark)
+{
+    g_policy = policy;
+    g_highWaterMark = highWaterMark;
+}
+
+// 策略名转成Policy
+bool FlowControl::parsePolicy(const string &name, Policy *policy)
+{
+    static const Policy kPolicies[] = {kPause, kSpill, kDrop, kDisconnect};
+    for (Policy p : kPolicies)
+    {
+        if (name == policyName(p))
+        {
+            *policy = p;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char *FlowControl::policyName(Policy policy)
+{
+    switch (policy)
+    {
+    case kPause:
+        return "pause";
+    case kSpill:
+        return "spill";
+    case kDrop:
+        return "drop";
+    case kDisconnect:
+        return "disconnect";
+    }
+    return "unknown";
+}
+
+// 输出缓冲区写完时的回调
+void FlowControl::setDrainCallback(const WriteCompleteCallback &cb)
+{
+    g_drainCallback = cb;
+}
+
+// 冻结的连接上排队的聊天消息
+void FlowControl::setSpillCallback(const SpillCallback &cb)
+{
+    g_spillCallback = cb;
+}
+
+// 设置高水位回调并登记到统计里
+void FlowControl::attach(const TcpConnectionPtr &conn)
+{
+    conn->setHighWaterMarkCallback(&FlowControl::onHighWaterMark, g_highWaterMark);
+    lock_guard<mutex> lock(g_connsMutex);
+    g_conns[conn->name()] = conn;
+}
+
+// 从统计里去掉
+void FlowControl::detach(const TcpConnectionPtr &conn)
+{
+    lock_guard<mutex> lock(g_connsMutex);
+    g_conns.erase(conn->name());
+}
+
+// 把一帧交给连接发送
+FlowControl::Verdict FlowControl::send(const TcpConnectionPtr &conn, const StringPiece &frame, MsgClass cls)
+{
+    Session *session = getSession(conn);
+    if (session == nullptr)
+    {
+        conn->send(frame);
+        return kSent;
+    }
+    FlowState &flow = session->flow;
+
+    // 连接已经交给新进程：聊天消息存成离线消息，其他的只能丢弃
+    if (session->frozen.load(memory_order_relaxed))
+    {
+        if (cls == kEssential)
+        {
+            ++flow.dropped;
+            return kDropped;
+        }
+        ++flow.spilled;
+        return kSpilled;
+    }
+
+    // 硬上限：积压已经多到不可能是正常的网络抖动，断开连接释放缓冲区。
+    // 缓存的outputBytes只在发送和高水位/写完成回调里更新，部分写出之后会偏大：
+    // 在IO线程里直接读输出缓冲区，其他线程只能用缓存的值估计
+    size_t buffered = conn->getLoop()->isInLoopThread()
+                          ? conn->outputBuffer()->readableBytes() + flow.pendingBytes.load(memory_order_relaxed)
+                          : flow.buffered();
+    if (buffered + frame.size() > g_highWaterMark * kHardLimitFactor)
+    {
+        if (!flow.congested.exchange(true))
+        {
+            ++flow.highWaterHits;
+        }
+        LOG_WARN << conn->name() << " buffered " << buffered << " bytes, over hard limit, disconnect!";
+        conn->forceClose();
+        if (cls == kEssential)
+        {
+            ++flow.dropped;
+            return kDropped;
+        }
+        ++flow.spilled;
+        return kSpilled;
+    }
+
+    if (cls != kEssential && flow.congested.load(memory_order_relaxed))
+    {
+        switch (g_policy)
+        {
+        case kPause:
+            break;
+        case kDrop:
+            if (cls == kBulk)
+            {
+                ++flow.dropped;
+                return kDropped;
+            }
+            ++flow.spilled;
+            return kSpilled;
+        case kSpill:
+        case kDisconnect:
+            ++flow.spilled;
+            return kSpilled;
+        }
+    }
+
+    if (conn->getLoop()->isInLoopThread())
+    {
+        sendInLoop(conn, frame);
+        return kSent;
+    }
+
+    // 跨线程转发：和muduo的TcpConnection::send一样拷贝一次放到连接所属的IO线程里发送，
+    // 在途的字节也算进积压里
+    size_t len = frame.size();
+    flow.pendingBytes += len;
+    updatePeak(flow);
+    conn->getLoop()->runInLoop([conn, len, cls, data = frame.as_string()]()
+    {
+        Session *session = getSession(conn);
+        if (session != nullptr)
+        {
+            session->flow.pendingBytes -= len;
+            // 排队期间连接被冻结了，和冻结之后直接发送的一样：聊天消息存成离线消息
+            if (session->frozen.load(memory_order_relaxed) && cls != kEssential && g_spillCallback)
+            {
+                ++session->flow.spilled;
+                g_spillCallback(conn, data);
+                return;
+            }
+        }
+        sendInLoop(conn, data);
+    });
+    return kSent;
+}
+
+// 在IO线程里发送，更新输出缓冲区的统计
+void FlowControl::sendInLoop(const TcpConnectionPtr &conn, const StringPiece &frame)
+{
+    Session *session = getSession(conn);
+    // 冻结之后输出缓冲区已经交给新进程，响应类的消息只能丢弃
+    if (session != nullptr && session->frozen.load(memory_order_relaxed))
+    {
+        LOG_WARN << conn->name() << " frozen for hot restart, drop " << frame.size() << " bytes";
+        ++session->flow.dropped;
+        return;
+    }
+    conn->send(frame);
+    size_t buffered = conn->outputBuffer()->readableBytes();
+    Metrics::observe(kOutputBufferBytes, static_cast<int64_t>(buffered));
+    if (session != nullptr)
+    {
+        session->flow.outputBytes.store(buffered, memory_order_relaxed);
+        updatePeak(session->flow);
+    }
+}
+
+// 输出缓冲区写完时需要收到回调
+void FlowControl::watchDrain(const TcpConnectionPtr &conn)
+{
+    conn->setWriteCompleteCallback(&FlowControl::onWriteComplete);
+}
+
+// 输出缓冲区超过高水位
+void FlowControl::onHighWaterMark(const TcpConnectionPtr &conn, size_t bytes)
+{
+    Session *session = getSession(conn);
+    if (session == nullptr || session->frozen.load(memory_order_relaxed))
+    {
+        return;
+    }
+    FlowState &flow = session->flow;
+    flow.outputBytes.store(bytes, memory_order_relaxed);
+    updatePeak(flow);
+    if (flow.congested.exchange(true))
+    {
+        return;
+    }
+    ++flow.highWaterHits;
+    LOG_WARN << conn->name() << " user " << session->userid.load() << " output buffer " << bytes
+             << " bytes over high water mark, policy " << policyName(g_policy);
+
+    switch (g_policy)
+    {
+    case kPause:
+        // 先不读它的请求，等它把积压的消息收完
+        conn->stopRead();
+        flow.paused = true;
+        break;
+    case kDisconnect:
+        conn->forceClose();
+        return;
+    default:
+        break;
+    }
+    // 写完时退出拥塞状态
+    watchDrain(conn);
+}
+
+// 输出缓冲区写完
+void FlowControl::onWriteComplete(const TcpConnectionPtr &conn)
+{
+    Session *session = getSession(conn);
+    if (session == nullptr)
+    {
+        return;
+    }
+    FlowState &flow = session->flow;
+    flow.outputBytes.store(0, memory_order_relaxed);
+    if (flow.congested.exchange(false))
+    {
+        LOG_INFO << conn->name() << " output buffer drained, leave congested state";
+    }
+    if (flow.paused)
+    {
+        conn->startRead();
+        flow.paused = false;
+    }
+
+    if (session->offline && g_drainCallback)
+    {
+        g_drainCallback(conn);
+    }
+    // 平时不设置写完成回调，每次send都不用多排队一个回调
+    if (!session->offline)
+    {
+        conn->setWriteCompleteCallback(WriteCompleteCallback());
+    }
+}
+
+// 所有连接的缓冲统计
+vector<FlowStats> FlowControl::stats()
+{
+    vector<TcpConnectionPtr> conns;
+    {
+        lock_guard<mutex> lock(g_connsMutex);
+        for (auto &entry : g_conns)
+        {
+            TcpConnectionPtr conn = entry.second.lock();
+            if (conn)
+            {
+                conns.push_back(conn);
+            }
+        }
+    }
+
+    vector<FlowStats> result;
+    for (const TcpConnectionPtr &conn : conns)
+    {
+        Session *session = getSession(conn);
+        if (session == nullptr)
+        {
+            continue;
+        }
+        const FlowState &flow = session->flow;
+        FlowStats stats;
+        stats.name = conn->name();
+        stats.userid = session->userid.load(memory_order_relaxed);
+        stats.buffered = flow.buffered();
+        stats.peak = flow.peakBytes.load(memory_order_relaxed);
+        stats.congested = flow.congested.load(memory_order_relaxed);
+        stats.highWaterHits = flow.highWaterHits.load(memory_order_relaxed);
+        stats.spilled = flow.spilled.load(memory_order_relaxed);
+        stats.dropped = flow.dropped.load(memory_order_relaxed);
+        result.push_back(stats);
+    }
+    return result;
+}
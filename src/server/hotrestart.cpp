@@ -0,0 +1,438 @@
+#include "hotrestart.hpp"
+
+#include <muduo/base/Logging.h>
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace
+{
+
+const uint32_t kMagic = 0x43485231; // "CHR1"
+// 等对方的超时（秒），对方卡住时不至于一直等下去
+const int kTimeoutSeconds = 10;
+
+enum RecordKind
+{
+    kHello = 1,
+    kListen = 2,
+    kConn = 3,
+};
+
+struct Record
+{
+    uint32_t magic;
+    uint32_t kind;
+    uint32_t count;
+    uint32_t extra;
+};
+
+bool fillUnixAddr(const string &path, sockaddr_un *addr)
+{
+    memset(addr, 0, sizeof *addr);
+    addr->sun_family = AF_UNIX;
+    if (path.size() >= sizeof addr->sun_path)
+    {
+        LOG_ERROR << "control socket path too long: " << path;
+        return false;
+    }
+    memcpy(addr->sun_path, path.c_str(), path.size());
+    return true;
+}
+
+void setTimeout(int fd)
+{
+    timeval tv = {kTimeoutSeconds, 0};
+    ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof tv);
+    ::setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof tv);
+}
+
+bool writen(int fd, const char *data, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = ::write(fd, data, len);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            return false;
+        }
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+bool readn(int fd, char *data, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = ::read(fd, data, len);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            return false;
+        }
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+// 发送一个Record，fd不是-1时用SCM_RIGHTS一起发送
+bool sendRecord(int sock, const Record &record, int fd)
+{
+    iovec iov;
+    iov.iov_base = const_cast<Record *>(&record);
+    iov.iov_len = sizeof record;
+    msghdr msg = {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+
+    char control[CMSG_SPACE(sizeof(int))] = {};
+    if (fd >= 0)
+    {
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof control;
+        cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &fd, sizeof fd);
+    }
+
+    ssize_t n;
+    do
+    {
+        n = ::sendmsg(sock, &msg, MSG_NOSIGNAL);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0)
+    {
+        return false;
+    }
+    // 带fd的那部分已经发出去了，剩下的按普通数据补发
+    return writen(sock, reinterpret_cast<const char *>(&record) + n, sizeof record - n);
+}
+
+// 接收一个Record和它带的fd，没有fd时*fd是-1
+bool recvRecord(int sock, Record *record, int *fd)
+{
+    iovec iov;
+    iov.iov_base = record;
+    iov.iov_len = sizeof *record;
+    char control[CMSG_SPACE(sizeof(int))] = {};
+    msghdr msg = {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof control;
+
+    ssize_t n;
+    do
+    {
+        n = ::recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+    } while (n < 0 && errno == EINTR);
+    if (n <= 0 || (msg.msg_flags & MSG_CTRUNC))
+    {
+        return false;
+    }
+
+    *fd = -1;
+    for (cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr; cmsg = CMSG_NXTHDR(&msg, cmsg))
+    {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+        {
+            memcpy(fd, CMSG_DATA(cmsg), sizeof *fd);
+        }
+    }
+    if (!readn(sock, reinterpret_cast<char *>(record) + n, sizeof *record - n))
+    {
+        return false;
+    }
+    return record->magic == kMagic;
+}
+
+void appendU32(uint32_t v, string *out)
+{
+    out->append(reinterpret_cast<const char *>(&v), sizeof v);
+}
+
+void appendBytes(const string &bytes, string *out)
+{
+    appendU32(static_cast<uint32_t>(bytes.size()), out);
+    out->append(bytes);
+}
+
+// 按顺序读取负载
+struct PayloadReader
+{
+    const char *p;
+    const char *end;
+
+    bool readU32(uint32_t *v)
+    {
+        if (end - p < static_cast<ptrdiff_t>(sizeof *v))
+        {
+            return false;
+        }
+        memcpy(v, p, sizeof *v);
+        p += sizeof *v;
+        return true;
+    }
+
+    bool readBytes(string *bytes)
+    {
+        uint32_t len;
+        if (!readU32(&len) || static_cast<size_t>(end - p) < len)
+        {
+            return false;
+        }
+        bytes->assign(p, len);
+        p += len;
+        return true;
+    }
+};
+
+void encodeConn(const ConnHandoff &conn, string *out)
+{
+    appendU32(static_cast<uint32_t>(conn.userid), out);
+    appendU32(static_cast<uint32_t>(conn.protocol), out);
+    appendBytes(conn.input, out);
+    appendBytes(conn.output, out);
+    appendU32(static_cast<uint32_t>(conn.offline.size()), out);
+    for (const string &msg : conn.offline)
+    {
+        appendBytes(msg, out);
+    }
+}
+
+bool decodeConn(const string &payload, ConnHandoff *conn)
+{
+    PayloadReader reader = {payload.data(), payload.data() + payload.size()};
+    uint32_t userid, protocol, count;
+    if (!reader.readU32(&userid) || !reader.readU32(&protocol) ||
+        !reader.readBytes(&conn->input) || !reader.readBytes(&conn->output) || !reader.readU32(&count))
+    {
+        return false;
+    }
+    conn->userid = static_cast<int>(userid);
+    conn->protocol = static_cast<int>(protocol);
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        string msg;
+        if (!reader.readBytes(&msg))
+        {
+            return false;
+        }
+        conn->offline.push_back(std::move(msg));
+    }
+    return reader.p == reader.end;
+}
+
+// 接管失败：关掉已经收到的监听socket、连接和控制连接，清空inheritance
+void closeInheritance(Inheritance *inheritance)
+{
+    for (int fd : inheritance->listenFds)
+    {
+        ::close(fd);
+    }
+    inheritance->listenFds.clear();
+    for (const ConnHandoff &conn : inheritance->conns)
+    {
+        ::close(conn.fd);
+    }
+    inheritance->conns.clear();
+    if (inheritance->control >= 0)
+    {
+        ::close(inheritance->control);
+        inheritance->control = -1;
+    }
+}
+
+} // namespace
+
+// 老进程：在path上监听接管请求
+int HotRestart::listenControl(const string &path)
+{
+    sockaddr_un addr;
+    if (!fillUnixAddr(path, &addr))
+    {
+        return -1;
+    }
+    int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+    {
+        LOG_SYSERR << "create control socket failed";
+        return -1;
+    }
+    // 上一个进程留下的socket文件，接管之后老进程已经不再监听
+    ::unlink(path.c_str());
+    if (::bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof addr) < 0 || ::listen(fd, 1) < 0)
+    {
+        LOG_SYSERR << "listen control socket " << path << " failed";
+        ::close(fd);
+        return -1;
+    }
+    // 拿到这个socket就能接管所有的连接，只允许同一个用户访问
+    ::chmod(path.c_str(), 0600);
+    return fd;
+}
+
+// 老进程：接受一个接管请求
+int HotRestart::acceptTakeover(int listenFd)
+{
+    int control = ::accept4(listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+    if (control < 0)
+    {
+        return -1;
+    }
+    setTimeout(control);
+    char request = 0;
+    if (!readn(control, &request, 1) || request != 'T')
+    {
+        LOG_ERROR << "bad takeover request";
+        ::close(control);
+        return -1;
+    }
+    return control;
+}
+
+// 老进程：把监听socket和连接交给新进程
+bool HotRestart::handoff(int control, const vector<int> &listenFds, const vector<ConnHandoff> &conns,
+                         size_t *sentConns)
+{
+    *sentConns = 0;
+    Record hello = {kMagic, kHello, static_cast<uint32_t>(listenFds.size()), static_cast<uint32_t>(conns.size())};
+    if (!sendRecord(control, hello, -1))
+    {
+        return false;
+    }
+    for (int fd : listenFds)
+    {
+        Record record = {kMagic, kListen, 0, 0};
+        if (!sendRecord(control, record, fd))
+        {
+            return false;
+        }
+    }
+    string payload;
+    for (const ConnHandoff &conn : conns)
+    {
+        payload.clear();
+        encodeConn(conn, &payload);
+        Record record = {kMagic, kConn, static_cast<uint32_t>(payload.size()), 0};
+        if (!sendRecord(control, record, conn.fd) || !writen(control, payload.data(), payload.size()))
+        {
+            return false;
+        }
+        ++*sentConns;
+    }
+
+    char done = 0;
+    return readn(control, &done, 1) && done == 'D';
+}
+
+// 新进程：连接path上的老进程，接过监听socket和连接
+bool HotRestart::takeover(const string &path, Inheritance *inheritance)
+{
+    sockaddr_un addr;
+    if (!fillUnixAddr(path, &addr))
+    {
+        return false;
+    }
+    int control = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (control < 0 || ::connect(control, reinterpret_cast<sockaddr *>(&addr), sizeof addr) < 0)
+    {
+        LOG_SYSERR << "connect control socket " << path << " failed";
+        if (control >= 0)
+        {
+            ::close(control);
+        }
+        return false;
+    }
+    setTimeout(control);
+    inheritance->control = control;
+
+    // 失败时关掉已经收到的fd，调用方直接退出也不会让老进程的连接多一份引用
+    Record hello;
+    int fd = -1;
+    if (!writen(control, "T", 1) || !recvRecord(control, &hello, &fd) || hello.kind != kHello)
+    {
+        LOG_ERROR << "takeover handshake failed";
+        if (fd >= 0)
+        {
+            ::close(fd);
+        }
+        closeInheritance(inheritance);
+        return false;
+    }
+    for (uint32_t i = 0; i < hello.count; ++i)
+    {
+        Record record;
+        fd = -1;
+        if (!recvRecord(control, &record, &fd) || record.kind != kListen || fd < 0)
+        {
+            LOG_ERROR << "receive listen socket failed";
+            if (fd >= 0)
+            {
+                ::close(fd);
+            }
+            closeInheritance(inheritance);
+            return false;
+        }
+        inheritance->listenFds.push_back(fd);
+    }
+    string payload;
+    for (uint32_t i = 0; i < hello.extra; ++i)
+    {
+        Record record;
+        fd = -1;
+        if (!recvRecord(control, &record, &fd) || record.kind != kConn || fd < 0)
+        {
+            LOG_ERROR << "receive connection failed";
+            if (fd >= 0)
+            {
+                ::close(fd);
+            }
+            closeInheritance(inheritance);
+            return false;
+        }
+        ConnHandoff conn;
+        conn.fd = fd;
+        payload.resize(record.count);
+        if (!readn(control, &payload[0], payload.size()) || !decodeConn(payload, &conn))
+        {
+            LOG_ERROR << "receive connection state failed";
+            ::close(fd);
+            closeInheritance(inheritance);
+            return false;
+        }
+        inheritance->conns.push_back(std::move(conn));
+    }
+    LOG_INFO << "took over " << inheritance->listenFds.size() << " listen sockets and "
+             << inheritance->conns.size() << " connections";
+    return true;
+}
+
+// 新进程：接管完成，通知老进程退出
+void HotRestart::finish(Inheritance *inheritance)
+{
+    if (inheritance->control < 0)
+    {
+        return;
+    }
+    writen(inheritance->control, "D", 1);
+    ::close(inheritance->control);
+    inheritance->control = -1;
+}
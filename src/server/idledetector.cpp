@@ -0,0 +1,94 @@
+#include "idledetector.hpp"
+#include "session.hpp"
+
+#include <muduo/base/Logging.h>
+
+IdleDetector::Entry::Entry(IdleDetector *detectorArg, const TcpConnectionPtr &connArg)
+    : detector(detectorArg), conn(connArg), tick(-1)
+{
+}
+
+IdleDetector::Entry::~Entry()
+{
+    if (detector->_stopping)
+    {
+        return;
+    }
+    TcpConnectionPtr idle = conn.lock();
+    if (!idle || !idle->connected())
+    {
+        return;
+    }
+    // 交给新进程的连接由新进程重新计时
+    Session *session = getSession(idle);
+    if (session != nullptr && session->frozen.load(memory_order_relaxed))
+    {
+        return;
+    }
+    LOG_INFO << idle->name() << " idle for " << detector->_buckets.size() << "s, close";
+    idle->forceClose();
+}
+
+IdleDetector::IdleDetector(EventLoop *loop, int idleSeconds)
+    : _loop(loop), _buckets(idleSeconds), _tick(0), _stopping(false)
+{
+    _loop->runEvery(1.0, std::bind(&IdleDetector::onTick, this));
+}
+
+IdleDetector::~IdleDetector()
+{
+    _stopping = true;
+}
+
+// 在loop上创建时间轮
+void IdleDetector::install(EventLoop *loop, int idleSeconds)
+{
+    if (ofLoop(loop) != nullptr)
+    {
+        return;
+    }
+    loop->setContext(std::make_shared<IdleDetector>(loop, idleSeconds));
+}
+
+// loop上的时间轮
+IdleDetector *IdleDetector::ofLoop(EventLoop *loop)
+{
+    const shared_ptr<IdleDetector> *detector = boost::any_cast<shared_ptr<IdleDetector>>(&loop->getContext());
+    return detector != nullptr ? detector->get() : nullptr;
+}
+
+// 新连接开始计时，时间轮只持有Entry，会话里保存弱引用
+void IdleDetector::add(const TcpConnectionPtr &conn, Session *session)
+{
+    auto entry = std::make_shared<Entry>(this, conn);
+    session->idle = entry;
+    refresh(entry);
+}
+
+// 连接上收到了消息
+void IdleDetector::touch(Session *session)
+{
+    shared_ptr<Entry> entry = session->idle.lock();
+    if (entry)
+    {
+        entry->detector->refresh(entry);
+    }
+}
+
+void IdleDetector::refresh(const shared_ptr<Entry> &entry)
+{
+    if (entry->tick == _tick)
+    {
+        return;
+    }
+    entry->tick = _tick;
+    _buckets[_tick % _buckets.size()].push_back(entry);
+}
+
+// 转一格：清空最老的一格，这一格里没有在后面的格子里再出现的连接就超时了
+void IdleDetector::onTick()
+{
+    ++_tick;
+    vector<shared_ptr<Entry>> expired;
+    expired.swap(_buckets[_tick % _buckets.size()]);
+}
@@ -0,0 +1,14 @@
+#include "instrumentedmutex.hpp"
+
+atomic_bool InstrumentedMutex::s_enabled{false};
+
+// 注册调用点
+InstrumentedMutex::Site InstrumentedMutex::site(const string &mutexName, const string &siteName)
+{
+    string labels = "mutex=\"" + mutexName + "\",site=\"" + siteName + "\"";
+    Site site;
+    site.wait = Metrics::histogram("chat_mutex_wait_us", "Time spent waiting for a mutex in microseconds", labels);
+    site.hold = Metrics::histogram("chat_mutex_hold_us", "Time a mutex was held in microseconds", labels);
+    site.contended = Metrics::counter("chat_mutex_contended_total", "Lock acquisitions that had to wait", labels);
+    return site;
+}
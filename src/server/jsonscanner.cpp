@@ -0,0 +1,311 @@
+#include "jsonscanner.hpp"
+
+#include <climits>
+#include <cstring>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+
+inline bool isSpace(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+inline const char *skipSpace(const char *p, const char *end)
+{
+    while (p < end && isSpace(*p))
+    {
+        ++p;
+    }
+    return p;
+}
+
+// 找到[p, end)中第一个'"'或者'\\'，找不到返回end
+const char *findQuoteOrEscape(const char *p, const char *end)
+{
+#ifdef __SSE2__
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i escape = _mm_set1_epi8('\\');
+    while (end - p >= 16)
+    {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+        int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(chunk, quote),
+                                                  _mm_cmpeq_epi8(chunk, escape)));
+        if (mask != 0)
+        {
+            return p + __builtin_ctz(mask);
+        }
+        p += 16;
+    }
+#endif
+    while (p < end && *p != '"' && *p != '\\')
+    {
+        ++p;
+    }
+    return p;
+}
+
+// 找到[p, end)中第一个'"'或者括号，找不到返回end
+const char *findStructural(const char *p, const char *end)
+{
+#ifdef __SSE2__
+    // '['|0x20 == '{'，']'|0x20 == '}'，一次或运算就能把四种括号归成两种来比较
+    const __m128i lower = _mm_set1_epi8(0x20);
+    const __m128i open = _mm_set1_epi8('{');
+    const __m128i close = _mm_set1_epi8('}');
+    const __m128i quote = _mm_set1_epi8('"');
+    while (end - p >= 16)
+    {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+        __m128i folded = _mm_or_si128(chunk, lower);
+        __m128i hit = _mm_or_si128(_mm_cmpeq_epi8(chunk, quote),
+                                   _mm_or_si128(_mm_cmpeq_epi8(folded, open),
+                                                _mm_cmpeq_epi8(folded, close)));
+        int mask = _mm_movemask_epi8(hit);
+        if (mask != 0)
+        {
+            return p + __builtin_ctz(mask);
+        }
+        p += 16;
+    }
+#endif
+    while (p < end && *p != '"' && *p != '{' && *p != '}' && *p != '[' && *p != ']')
+    {
+        ++p;
+    }
+    return p;
+}
+
+// 跳过字符串，p指向左引号的下一个字节，返回右引号的下一个字节，数据不完整返回nullptr
+const char *skipString(const char *p, const char *end)
+{
+    for (;;)
+    {
+        p = findQuoteOrEscape(p, end);
+        if (p == end)
+        {
+            return nullptr;
+        }
+        if (*p == '"')
+        {
+            return p + 1;
+        }
+        // 转义字符，连同它后面的一个字节一起跳过
+        p += 2;
+        if (p > end)
+        {
+            return nullptr;
+        }
+    }
+}
+
+// 跳过嵌套的对象或数组，p指向左括号的下一个字节，返回配对右括号的下一个字节，数据不完整返回nullptr
+const char *skipContainer(const char *p, const char *end)
+{
+    int depth = 1;
+    while (depth > 0)
+    {
+        p = findStructural(p, end);
+        if (p == end)
+        {
+            return nullptr;
+        }
+        char c = *p++;
+        if (c == '"')
+        {
+            p = skipString(p, end);
+            if (p == nullptr)
+            {
+                return nullptr;
+            }
+        }
+        else if (c == '{' || c == '[')
+        {
+            ++depth;
+        }
+        else
+        {
+            --depth;
+        }
+    }
+    return p;
+}
+
+// 数字、true/false/null这类标量值的结束位置
+inline bool isScalarEnd(char c)
+{
+    return c == ',' || c == '}' || c == ']' || isSpace(c);
+}
+
+// [begin, end)是一个整数就写入*out，带小数点或者指数的数字不算
+void parseInt(const char *begin, const char *end, int *out)
+{
+    const char *p = begin;
+    bool negative = false;
+    if (p < end && *p == '-')
+    {
+        negative = true;
+        ++p;
+    }
+    if (p == end || end - p > 10)
+    {
+        return;
+    }
+    long long value = 0;
+    for (; p < end; ++p)
+    {
+        if (*p < '0' || *p > '9')
+        {
+            return;
+        }
+        value = value * 10 + (*p - '0');
+    }
+    // 超出int范围的不是合法的id，按不是整数处理，不能截断成别的用户的id
+    if (value > static_cast<long long>(INT_MAX) + (negative ? 1 : 0))
+    {
+        return;
+    }
+    *out = static_cast<int>(negative ? -value : value);
+}
+
+// 关心的路由字段返回对应的成员地址，其他字段返回nullptr
+int *routeField(MsgRoute *route, const char *key, size_t len)
+{
+    switch (len)
+    {
+    case 2:
+        return memcmp(key, "id", 2) == 0 ? &route->id : nullptr;
+    case 4:
+        return memcmp(key, "toid", 4) == 0 ? &route->toid : nullptr;
+    case 5:
+        return memcmp(key, "msgid", 5) == 0 ? &route->msgid : nullptr;
+    case 7:
+        return memcmp(key, "groupid", 7) == 0 ? &route->groupid : nullptr;
+    default:
+        return nullptr;
+    }
+}
+
+} // namespace
+
+JsonScanner::Status JsonScanner::scan(const char *begin, const char *end, MsgRoute *route, const char **frameEnd)
+{
+    const char *p = skipSpace(begin, end);
+    if (p == end)
+    {
+        return kIncomplete;
+    }
+    if (*p != '{')
+    {
+        return kInvalid;
+    }
+    p = skipSpace(p + 1, end);
+    if (p == end)
+    {
+        return kIncomplete;
+    }
+    if (*p == '}')
+    {
+        *frameEnd = p + 1;
+        return kComplete;
+    }
+
+    for (;;)
+    {
+        // "key"
+        if (*p != '"')
+        {
+            return kInvalid;
+        }
+        const char *key = p + 1;
+        p = skipString(key, end);
+        if (p == nullptr)
+        {
+            return kIncomplete;
+        }
+        int *field = routeField(route, key, p - 1 - key);
+
+        // :
+        p = skipSpace(p, end);
+        if (p == end)
+        {
+            return kIncomplete;
+        }
+        if (*p != ':')
+        {
+            return kInvalid;
+        }
+        p = skipSpace(p + 1, end);
+        if (p == end)
+        {
+            return kIncomplete;
+        }
+
+        // value
+        if (*p == '"')
+        {
+            p = skipString(p + 1, end);
+        }
+        else if (*p == '{' || *p == '[')
+        {
+            p = skipContainer(p + 1, end);
+        }
+        else
+        {
+            const char *token = p;
+            while (p < end && !isScalarEnd(*p))
+            {
+                ++p;
+            }
+            if (p == end)
+            {
+                return kIncomplete;
+            }
+            if (p == token)
+            {
+                return kInvalid;
+            }
+            if (field != nullptr)
+            {
+                parseInt(token, p, field);
+            }
+        }
+        if (p == nullptr)
+        {
+            return kIncomplete;
+        }
+
+        // , 或者 }
+        p = skipSpace(p, end);
+        if (p == end)
+        {
+            return kIncomplete;
+        }
+        if (*p == '}')
+        {
+            *frameEnd = p + 1;
+            return kComplete;
+        }
+        if (*p != ',')
+        {
+            return kInvalid;
+        }
+        p = skipSpace(p + 1, end);
+        if (p == end)
+        {
+            return kIncomplete;
+        }
+    }
+}
+
+const char *JsonScanner::skipDelimiters(const char *begin, const char *end)
+{
+    while (begin < end && (*begin == '\0' || isSpace(*begin)))
+    {
+        ++begin;
+    }
+    return begin;
+}
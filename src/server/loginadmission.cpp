@@ -0,0 +1,172 @@
+#include "loginadmission.hpp"
+#include "metrics.hpp"
+
+#include <muduo/base/Logging.h>
+#include <algorithm>
+#include <random>
+
+namespace
+{
+
+const Metrics::Id kWaitUs = Metrics::histogram("chat_login_queue_wait_us", "Time a login waited for a worker, in microseconds");
+const Metrics::Id kRunUs = Metrics::histogram("chat_login_duration_us", "Time to run a login on a worker, in microseconds");
+
+// 滑动平均，新样本占1/8
+void updateAverage(atomic<int64_t> &average, int64_t sample)
+{
+    int64_t old = average.load(memory_order_relaxed);
+    average.store(old == 0 ? sample : old + (sample - old) / 8, memory_order_relaxed);
+}
+
+void updateMax(atomic<int64_t> &max, int64_t sample)
+{
+    int64_t old = max.load(memory_order_relaxed);
+    while (sample > old && !max.compare_exchange_weak(old, sample, memory_order_relaxed))
+    {
+    }
+}
+
+int64_t elapsedUs(chrono::steady_clock::time_point since)
+{
+    return chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - since).count();
+}
+
+} // namespace
+
+LoginAdmission::LoginAdmission()
+    : _stopping(false),
+      _running(0),
+      _admitted(0),
+      _rejected(0),
+      _expired(0),
+      _waitUs(0),
+      _maxWaitUs(0),
+      _serviceUs(0)
+{
+}
+
+LoginAdmission::~LoginAdmission()
+{
+    {
+        lock_guard<mutex> lock(_mutex);
+        _stopping = true;
+    }
+    _cond.notify_all();
+    for (thread &worker : _workers)
+    {
+        worker.join();
+    }
+}
+
+// 启动工作线程
+void LoginAdmission::start(const Options &options)
+{
+    _options = options;
+    for (int i = 0; i < _options.concurrency; ++i)
+    {
+        _workers.emplace_back(&LoginAdmission::workerLoop, this);
+    }
+    LOG_INFO << "login admission concurrency " << _options.concurrency << ", queue " << _options.queueSize
+             << ", deadline " << _options.deadlineMs << "ms";
+}
+
+// 提交一个登录
+void LoginAdmission::submit(const Task &run, const RejectCallback &reject)
+{
+    if (_workers.empty())
+    {
+        ++_admitted;
+        run();
+        return;
+    }
+
+    size_t queued;
+    {
+        lock_guard<mutex> lock(_mutex);
+        queued = _queue.size();
+        if (queued < _options.queueSize)
+        {
+            _queue.push_back(Pending{run, reject, Clock::now()});
+            queued = 0;
+        }
+    }
+    // 队列满了，不排队直接让客户端稍后重试
+    if (queued > 0)
+    {
+        ++_rejected;
+        reject(retryAfterMs(queued));
+        return;
+    }
+    _cond.notify_one();
+}
+
+// 工作线程
+void LoginAdmission::workerLoop()
+{
+    while (true)
+    {
+        Pending pending;
+        size_t queued;
+        {
+            unique_lock<mutex> lock(_mutex);
+            _cond.wait(lock, [this]() { return _stopping || !_queue.empty(); });
+            if (_stopping)
+            {
+                return;
+            }
+            pending = std::move(_queue.front());
+            _queue.pop_front();
+            queued = _queue.size();
+        }
+
+        int64_t waitUs = elapsedUs(pending.enqueued);
+        Metrics::observe(kWaitUs, waitUs);
+        updateAverage(_waitUs, waitUs);
+        updateMax(_maxWaitUs, waitUs);
+        // 客户端多半已经超时放弃了，不再为它查数据库
+        if (waitUs > static_cast<int64_t>(_options.deadlineMs) * 1000)
+        {
+            ++_expired;
+            pending.reject(retryAfterMs(queued));
+            continue;
+        }
+
+        ++_running;
+        ++_admitted;
+        Clock::time_point start = Clock::now();
+        pending.run();
+        int64_t serviceUs = elapsedUs(start);
+        Metrics::observe(kRunUs, serviceUs);
+        updateAverage(_serviceUs, serviceUs);
+        --_running;
+    }
+}
+
+// 按排队长度估算的重试时间：排在前面的登录都执行完大约要多久，再向下随机抖动最多一半，
+// 抖动之后再按下限截断，结果不会超过kMaxRetryAfterMs
+int LoginAdmission::retryAfterMs(size_t queued)
+{
+    int concurrency = max(_options.concurrency, 1);
+    int64_t drainMs = static_cast<int64_t>(queued / concurrency + 1) * _serviceUs.load(memory_order_relaxed) / 1000;
+    int64_t retry = min<int64_t>(max<int64_t>(drainMs, kMinRetryAfterMs), kMaxRetryAfterMs);
+    thread_local minstd_rand random(static_cast<unsigned>(hash<thread::id>()(this_thread::get_id())));
+    retry -= random() % (retry / 2 + 1);
+    return static_cast<int>(max<int64_t>(retry, kMinRetryAfterMs));
+}
+
+AdmissionStats LoginAdmission::stats() const
+{
+    AdmissionStats stats;
+    {
+        lock_guard<mutex> lock(_mutex);
+        stats.queued = _queue.size();
+    }
+    stats.running = _running.load(memory_order_relaxed);
+    stats.admitted = _admitted.load(memory_order_relaxed);
+    stats.rejected = _rejected.load(memory_order_relaxed);
+    stats.expired = _expired.load(memory_order_relaxed);
+    stats.waitUs = _waitUs.load(memory_order_relaxed);
+    stats.maxWaitUs = _maxWaitUs.load(memory_order_relaxed);
+    stats.serviceUs = _serviceUs.load(memory_order_relaxed);
+    return stats;
+}
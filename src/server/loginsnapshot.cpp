@@ -0,0 +1,251 @@
+#include "loginsnapshot.hpp"
+#include "binarycodec.hpp"
+#include "jsonwriter.hpp"
+#include "public.hpp"
+
+LoginSnapshot::LoginSnapshot(User &user, const vector<string> &offlinemsg)
+    : _user(user), _offlinemsg(offlinemsg)
+{
+}
+
+// 好友列表
+void LoginSnapshot::setFriends(vector<User> &friends, int version, bool changed)
+{
+    _friends = &friends;
+    _friendVersion = version;
+    _friendsChanged = changed;
+    if (changed)
+    {
+        for (User &u : friends)
+        {
+            addUser(&u);
+        }
+    }
+}
+
+// 群组列表
+void LoginSnapshot::setGroups(vector<Group> &groups, const unordered_map<int, int> &knownVersions)
+{
+    _groups = &groups;
+    _groupsChanged.clear();
+    for (Group &group : groups)
+    {
+        auto it = knownVersions.find(group.getId());
+        bool changed = (it == knownVersions.end() || it->second != group.getVersion());
+        _groupsChanged.push_back(changed);
+        if (changed)
+        {
+            for (GroupUser &u : group.getUsers())
+            {
+                addUser(&u);
+            }
+        }
+    }
+}
+
+void LoginSnapshot::addUser(User *user)
+{
+    if (_userIndex.insert({user->getId(), _users.size()}).second)
+    {
+        _users.push_back(user);
+    }
+}
+
+void LoginSnapshot::toJsonText(string *out) const
+{
+    out->append("{\"msgid\":");
+    JsonWriter::writeInt(LOGIN_MSG_ACK, out);
+    out->append(",\"errno\":0,\"id\":");
+    JsonWriter::writeInt(_user.getId(), out);
+    out->append(",\"name\":");
+    JsonWriter::writeString(_user.getName(), out);
+    out->append(",\"snapshot\":");
+    JsonWriter::writeInt(kVersion, out);
+
+    out->append(",\"users\":[");
+    for (size_t i = 0; i < _users.size(); ++i)
+    {
+        out->append(i == 0 ? "[" : ",[");
+        JsonWriter::writeInt(_users[i]->getId(), out);
+        out->push_back(',');
+        JsonWriter::writeString(_users[i]->getName(), out);
+        out->push_back(',');
+        JsonWriter::writeString(_users[i]->getState(), out);
+        out->push_back(']');
+    }
+    out->push_back(']');
+
+    if (_friends != nullptr)
+    {
+        out->append(",\"friendver\":");
+        JsonWriter::writeInt(_friendVersion, out);
+        // 好友列表没变时只刷新在线状态
+        out->append(_friendsChanged ? ",\"friends\":[" : ",\"online\":[");
+        bool first = true;
+        for (User &user : *_friends)
+        {
+            if (!_friendsChanged && user.getState() != "online")
+            {
+                continue;
+            }
+            if (!first)
+            {
+                out->push_back(',');
+            }
+            first = false;
+            JsonWriter::writeInt(user.getId(), out);
+        }
+        out->push_back(']');
+    }
+
+    if (_groups != nullptr)
+    {
+        out->append(",\"groups\":[");
+        for (size_t i = 0; i < _groups->size(); ++i)
+        {
+            Group &group = (*_groups)[i];
+            out->append(i == 0 ? "[" : ",[");
+            JsonWriter::writeInt(group.getId(), out);
+            if (_groupsChanged[i])
+            {
+                out->push_back(',');
+                JsonWriter::writeString(group.getName(), out);
+                out->push_back(',');
+                JsonWriter::writeString(group.getDesc(), out);
+                out->append(",[");
+                vector<GroupUser> &members = group.getUsers();
+                for (size_t j = 0; j < members.size(); ++j)
+                {
+                    out->append(j == 0 ? "[" : ",[");
+                    JsonWriter::writeInt(members[j].getId(), out);
+                    out->push_back(',');
+                    JsonWriter::writeString(members[j].getRole(), out);
+                    out->push_back(']');
+                }
+                out->push_back(']');
+            }
+            out->push_back(',');
+            JsonWriter::writeInt(group.getVersion(), out);
+            out->push_back(']');
+        }
+        out->push_back(']');
+    }
+
+    if (!_offlinemsg.empty())
+    {
+        out->append(",\"offlinemsg\":[");
+        for (size_t i = 0; i < _offlinemsg.size(); ++i)
+        {
+            if (i != 0)
+            {
+                out->push_back(',');
+            }
+            JsonWriter::writeString(_offlinemsg[i], out);
+        }
+        out->push_back(']');
+    }
+    if (_offlineCount >= 0)
+    {
+        out->append(",\"offlinecount\":");
+        JsonWriter::writeInt(_offlineCount, out);
+    }
+    out->push_back('}');
+}
+
+void LoginSnapshot::toBinary(string *out) const
+{
+    size_t start = BinaryCodec::beginFrame(out);
+    BinaryCodec::writeKey("errno", out);
+    BinaryCodec::writeInt(0, out);
+    BinaryCodec::writeKey("name", out);
+    BinaryCodec::writeStringValue(_user.getName(), out);
+    BinaryCodec::writeKey("snapshot", out);
+    BinaryCodec::writeInt(kVersion, out);
+
+    BinaryCodec::writeKey("users", out);
+    BinaryCodec::writeArrayHeader(_users.size(), out);
+    for (User *user : _users)
+    {
+        BinaryCodec::writeArrayHeader(3, out);
+        BinaryCodec::writeInt(user->getId(), out);
+        BinaryCodec::writeStringValue(user->getName(), out);
+        BinaryCodec::writeStringValue(user->getState(), out);
+    }
+
+    if (_friends != nullptr)
+    {
+        BinaryCodec::writeKey("friendver", out);
+        BinaryCodec::writeInt(_friendVersion, out);
+        if (_friendsChanged)
+        {
+            BinaryCodec::writeKey("friends", out);
+            BinaryCodec::writeArrayHeader(_friends->size(), out);
+            for (User &user : *_friends)
+            {
+                BinaryCodec::writeInt(user.getId(), out);
+            }
+        }
+        else
+        {
+            vector<int> online;
+            for (User &user : *_friends)
+            {
+                if (user.getState() == "online")
+                {
+                    online.push_back(user.getId());
+                }
+            }
+            BinaryCodec::writeKey("online", out);
+            BinaryCodec::writeArrayHeader(online.size(), out);
+            for (int id : online)
+            {
+                BinaryCodec::writeInt(id, out);
+            }
+        }
+    }
+
+    if (_groups != nullptr)
+    {
+        BinaryCodec::writeKey("groups", out);
+        BinaryCodec::writeArrayHeader(_groups->size(), out);
+        for (size_t i = 0; i < _groups->size(); ++i)
+        {
+            Group &group = (*_groups)[i];
+            if (!_groupsChanged[i])
+            {
+                BinaryCodec::writeArrayHeader(2, out);
+                BinaryCodec::writeInt(group.getId(), out);
+                BinaryCodec::writeInt(group.getVersion(), out);
+                continue;
+            }
+            BinaryCodec::writeArrayHeader(5, out);
+            BinaryCodec::writeInt(group.getId(), out);
+            BinaryCodec::writeStringValue(group.getName(), out);
+            BinaryCodec::writeStringValue(group.getDesc(), out);
+            BinaryCodec::writeArrayHeader(group.getUsers().size(), out);
+            for (GroupUser &member : group.getUsers())
+            {
+                BinaryCodec::writeArrayHeader(2, out);
+                BinaryCodec::writeInt(member.getId(), out);
+                BinaryCodec::writeStringValue(member.getRole(), out);
+            }
+            BinaryCodec::writeInt(group.getVersion(), out);
+        }
+    }
+
+    if (!_offlinemsg.empty())
+    {
+        BinaryCodec::writeKey("offlinemsg", out);
+        BinaryCodec::writeArrayHeader(_offlinemsg.size(), out);
+        for (const string &msg : _offlinemsg)
+        {
+            BinaryCodec::writeStringValue(msg, out);
+        }
+    }
+    if (_offlineCount >= 0)
+    {
+        BinaryCodec::writeKey("offlinecount", out);
+        BinaryCodec::writeInt(_offlineCount, out);
+    }
+    BinaryCodec::finishFrame(out, start, LOGIN_MSG_ACK, _user.getId(), BinaryCodec::kAbsent);
+}
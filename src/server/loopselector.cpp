@@ -0,0 +1,175 @@
+#include "loopselector.hpp"
+#include "metrics.hpp"
+#include "overloadguard.hpp"
+
+#include <algorithm>
+#include <functional>
+
+// 每次探针测到的调度延迟，滑动平均看不出偶尔的长停顿
+static Metrics::Id lagSampleUs = Metrics::histogram("chat_loop_lag_sample_us", "IO loop scheduling lag samples in microseconds");
+
+LoopSelector::LoopSelector(Policy policy)
+    : _policy(policy), _next(0)
+{
+}
+
+LoopSelector::~LoopSelector()
+{
+    for (auto &load : _loads)
+    {
+        load->loop->cancel(load->probeTimer);
+    }
+}
+
+// 策略名转成Policy
+bool LoopSelector::parsePolicy(const string &name, Policy *policy)
+{
+    static const Policy kPolicies[] = {kRoundRobin, kLeastConnections, kLeastLag, kPeerHash};
+    for (Policy p : kPolicies)
+    {
+        if (name == policyName(p))
+        {
+            *policy = p;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char *LoopSelector::policyName(Policy policy)
+{
+    switch (policy)
+    {
+    case kRoundRobin:
+        return "rr";
+    case kLeastConnections:
+        return "conn";
+    case kLeastLag:
+        return "lag";
+    case kPeerHash:
+        return "hash";
+    }
+    return "unknown";
+}
+
+// 开始在每个loop上测量调度延迟
+void LoopSelector::start(const vector<EventLoop *> &loops)
+{
+    for (EventLoop *loop : loops)
+    {
+        _loads.emplace_back(new LoopLoad);
+        LoopLoad *load = _loads.back().get();
+        load->loop = loop;
+        load->probeTimer = loop->runEvery(kProbeInterval, std::bind(&LoopSelector::probe, this, load));
+    }
+}
+
+// 在loop线程里测量一次调度延迟：定时器实际触发的间隔比设定的间隔多出来的部分
+void LoopSelector::probe(LoopLoad *load)
+{
+    Timestamp now = Timestamp::now();
+    if (load->lastProbe.valid())
+    {
+        int64_t sample = now.microSecondsSinceEpoch() - load->lastProbe.microSecondsSinceEpoch()
+                         - static_cast<int64_t>(kProbeInterval * Timestamp::kMicroSecondsPerSecond);
+        if (sample < 0)
+        {
+            sample = 0;
+        }
+        Metrics::observe(lagSampleUs, sample);
+        // 滑动平均，新样本占1/8，过载判断也用平均值，一次长停顿不会触发
+        int64_t lag = load->lagUs.load(memory_order_relaxed);
+        lag += (sample - lag) / 8;
+        load->lagUs.store(lag, memory_order_relaxed);
+        load->overloaded.store(OverloadGuard::reportLag(lag), memory_order_relaxed);
+        if (sample > load->maxLagUs.load(memory_order_relaxed))
+        {
+            load->maxLagUs.store(sample, memory_order_relaxed);
+        }
+    }
+    load->lastProbe = now;
+}
+
+// 给新连接选一个loop
+int LoopSelector::select(const InetAddress &peerAddr)
+{
+    int n = static_cast<int>(_loads.size());
+    if (n == 1)
+    {
+        return 0;
+    }
+
+    // 从轮询的位置开始找，负载一样时不总是落在第一个loop上
+    int start = static_cast<int>(_next++ % n);
+    switch (_policy)
+    {
+    case kRoundRobin:
+        return start;
+    case kPeerHash:
+        return static_cast<int>(std::hash<string>()(peerAddr.toIp()) % n);
+    case kLeastConnections:
+    {
+        int best = start;
+        for (int i = 1; i < n; ++i)
+        {
+            int index = (start + i) % n;
+            if (_loads[index]->connections.load(memory_order_relaxed) < _loads[best]->connections.load(memory_order_relaxed))
+            {
+                best = index;
+            }
+        }
+        return best;
+    }
+    case kLeastLag:
+    {
+        int64_t minLag = _loads[0]->lagUs.load(memory_order_relaxed);
+        for (int i = 1; i < n; ++i)
+        {
+            minLag = std::min(minLag, _loads[i]->lagUs.load(memory_order_relaxed));
+        }
+        // 只看延迟最低的那一档，一档之内按连接数，避免新连接一窝蜂地涌向延迟最低的一个loop
+        int best = -1;
+        for (int i = 0; i < n; ++i)
+        {
+            int index = (start + i) % n;
+            if (_loads[index]->lagUs.load(memory_order_relaxed) > minLag + kLagToleranceUs)
+            {
+                continue;
+            }
+            if (best == -1 || _loads[index]->connections.load(memory_order_relaxed) < _loads[best]->connections.load(memory_order_relaxed))
+            {
+                best = index;
+            }
+        }
+        return best;
+    }
+    }
+    return start;
+}
+
+void LoopSelector::connectionAdded(int index)
+{
+    ++_loads[index]->connections;
+}
+
+void LoopSelector::connectionRemoved(int index)
+{
+    --_loads[index]->connections;
+}
+
+// 各个loop的负载统计
+vector<LoopStats> LoopSelector::stats() const
+{
+    vector<LoopStats> result;
+    for (size_t i = 0; i < _loads.size(); ++i)
+    {
+        LoopStats stats;
+        stats.index = static_cast<int>(i);
+        stats.connections = _loads[i]->connections.load(memory_order_relaxed);
+        stats.lagUs = _loads[i]->lagUs.load(memory_order_relaxed);
+        stats.maxLagUs = _loads[i]->maxLagUs.load(memory_order_relaxed);
+        stats.overloaded = _loads[i]->overloaded.load(memory_order_relaxed);
+        result.push_back(stats);
+    }
+    return result;
+}
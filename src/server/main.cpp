@@ -1,35 +1,312 @@
 #include "chatserver.hpp"
 #include "chatservice.hpp"
+#include "flowcontrol.hpp"
+#include "cpuaffinity.hpp"
+#include "hotrestart.hpp"
+#include "recorder.hpp"
+#include "asynclog.hpp"
+#include "mysqlstorage.hpp"
+#include "logstorage.hpp"
+#include <muduo/base/Logging.h>
 #include <iostream>
 #include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
 using namespace std;
 
 // 处理服务器ctrl+c结束后，重置user的状态信息
 void resetHandler(int)
 {
     ChatService::instance()->reset();
+    Recorder::flush();
+    AsyncLog::stop();
     exit(0);
 }
 
+// SIGUSR2打开或者关闭锁的统计
+void lockStatsHandler(int)
+{
+    InstrumentedMutex::setEnabled(!InstrumentedMutex::enabled());
+}
+
+void usage(const char *prog)
+{
+    cerr << "Usage: " << prog << " [-t threads|auto] [-c cpulist|all] [-r] [-b conn|lag|hash|rr] [-i seconds] [-l logins[:queue[:deadline ms]]] [-m port] [-x file[:every]] [-q ms] [-o lag ms] [-k] [-w file] [-f basename[:roll MB]] [-s file] [-u path [-T]] <ip> <port>"
+         << " [pause|spill|drop|disconnect] [high water mark KB]" << endl;
+    cerr << "  -t  io thread count, auto (default) = one per cpu core, 0 = single loop" << endl;
+    cerr << "  -c  pin the acceptor and io threads to cpus, e.g. 0-15 or 0,2,4,6; all = every online cpu" << endl;
+    cerr << "  -r  every io loop listens on the port with SO_REUSEPORT and accepts its own connections" << endl;
+    cerr << "  -b  how new connections are assigned to io loops: least connections (default),"
+         << " least loop lag, peer ip hash, round robin" << endl;
+    cerr << "  -i  close connections idle for this many seconds (default 90, clients heartbeat every 30), 0 = never" << endl;
+    cerr << "  -l  logins run on this many worker threads (default 8, 0 = on io threads), at most queue waiting"
+         << " (default 1024) for at most deadline ms (default 3000); the rest are told to retry later" << endl;
+    cerr << "  -m  serve prometheus metrics on http://127.0.0.1:port/metrics" << endl;
+    cerr << "  -x  trace 1 of every n chat messages (default 1000) across the redis hop, chrome trace format" << endl;
+    cerr << "  -q  log mysql connects and statements slower than this many ms (default 100), 0 = never" << endl;
+    cerr << "  -o  defer friend/group changes and skip heartbeat acks on io loops lagging more than this many ms"
+         << " (default 50), 0 = never; later messages on that connection wait behind a deferred one" << endl;
+    cerr << "  -k  record mutex wait and hold times from startup (SIGUSR2 toggles at runtime)" << endl;
+    cerr << "  -w  record every inbound frame to file for ChatReplay (contains passwords and messages)" << endl;
+    cerr << "  -f  write logs asynchronously to basename.<time>.<host>.<pid>.log in the current directory,"
+         << " a new file every roll MB (default 100) and every day; default is synchronous stdout" << endl;
+    cerr << "  -s  keep users, friends, groups and offline messages in this append-only file instead of mysql"
+         << " (single server, no hot restart)" << endl;
+    cerr << "  -u  wait on this unix socket for a new binary to take over the listen sockets and connections" << endl;
+    cerr << "  -T  take over from the server waiting on -u path, then wait on the same path for the next upgrade" << endl;
+}
+
 int main(int argc, char **argv)
 {
+    // 解析命令行选项，剩下的是位置参数
+    const char *prog = argv[0];
+    ServerOptions options;
+    string controlPath;
+    bool takeover = false;
+    string logBasename;
+    int logRollMB = 100;
+    string storagePath;
+    int opt;
+    while ((opt = getopt(argc, argv, "t:c:rb:i:l:m:x:q:o:kw:f:s:u:T")) != -1)
+    {
+        switch (opt)
+        {
+        case 't':
+            if (strcmp(optarg, "auto") == 0)
+            {
+                options.threadNum = ServerOptions::kAutoThreads;
+            }
+            else if (optarg[0] >= '0' && optarg[0] <= '9')
+            {
+                options.threadNum = atoi(optarg);
+            }
+            else
+            {
+                cerr << "invalid thread count: " << optarg << endl;
+                return -1;
+            }
+            break;
+        case 'c':
+            if (strcmp(optarg, "all") == 0)
+            {
+                for (int cpu = 0; cpu < CpuAffinity::onlineCpus(); ++cpu)
+                {
+                    options.cpus.push_back(cpu);
+                }
+            }
+            else if (!CpuAffinity::parseCpuList(optarg, &options.cpus))
+            {
+                cerr << "invalid cpu list: " << optarg << endl;
+                return -1;
+            }
+            break;
+        case 'r':
+            options.reusePort = true;
+            break;
+        case 'b':
+            if (!LoopSelector::parsePolicy(optarg, &options.balance))
+            {
+                cerr << "unknown balance policy: " << optarg << endl;
+                return -1;
+            }
+            break;
+        case 'i':
+            if (optarg[0] < '0' || optarg[0] > '9')
+            {
+                cerr << "invalid idle timeout: " << optarg << endl;
+                return -1;
+            }
+            options.idleSeconds = atoi(optarg);
+            break;
+        case 'l':
+        {
+            int concurrency = options.login.concurrency;
+            int queueSize = static_cast<int>(options.login.queueSize);
+            int deadlineMs = options.login.deadlineMs;
+            if (sscanf(optarg, "%d:%d:%d", &concurrency, &queueSize, &deadlineMs) < 1 ||
+                concurrency < 0 || queueSize <= 0 || deadlineMs <= 0)
+            {
+                cerr << "invalid login admission: " << optarg << endl;
+                return -1;
+            }
+            options.login.concurrency = concurrency;
+            options.login.queueSize = static_cast<size_t>(queueSize);
+            options.login.deadlineMs = deadlineMs;
+            break;
+        }
+        case 'm':
+        {
+            int metricsPort = atoi(optarg);
+            if (metricsPort <= 0 || metricsPort > 65535)
+            {
+                cerr << "invalid metrics port: " << optarg << endl;
+                return -1;
+            }
+            options.metricsPort = static_cast<uint16_t>(metricsPort);
+            break;
+        }
+        case 'x':
+        {
+            string arg = optarg;
+            size_t colon = arg.rfind(':');
+            if (colon != string::npos)
+            {
+                options.traceSampleEvery = atoi(arg.c_str() + colon + 1);
+                arg.resize(colon);
+            }
+            if (arg.empty() || options.traceSampleEvery <= 0)
+            {
+                cerr << "invalid trace option: " << optarg << endl;
+                return -1;
+            }
+            options.tracePath = arg;
+            break;
+        }
+        case 'q':
+            if (optarg[0] < '0' || optarg[0] > '9')
+            {
+                cerr << "invalid slow query threshold: " << optarg << endl;
+                return -1;
+            }
+            options.slowQueryMs = atoi(optarg);
+            break;
+        case 'o':
+            if (optarg[0] < '0' || optarg[0] > '9')
+            {
+                cerr << "invalid overload lag: " << optarg << endl;
+                return -1;
+            }
+            options.overload.lagThresholdUs = atoi(optarg) * 1000LL;
+            break;
+        case 'k':
+            InstrumentedMutex::setEnabled(true);
+            break;
+        case 'w':
+            options.recordPath = optarg;
+            break;
+        case 'f':
+        {
+            string arg = optarg;
+            size_t colon = arg.rfind(':');
+            if (colon != string::npos)
+            {
+                logRollMB = atoi(arg.c_str() + colon + 1);
+                arg.resize(colon);
+            }
+            // muduo的LogFile只接受文件名，不能带目录
+            if (arg.empty() || arg.find('/') != string::npos || logRollMB <= 0)
+            {
+                cerr << "invalid log option: " << optarg << endl;
+                return -1;
+            }
+            logBasename = arg;
+            break;
+        }
+        case 's':
+            storagePath = optarg;
+            break;
+        case 'u':
+            controlPath = optarg;
+            break;
+        case 'T':
+            takeover = true;
+            break;
+        default:
+            usage(prog);
+            return -1;
+        }
+    }
+    argc -= optind - 1;
+    argv += optind - 1;
 
-    if(argc < 3)
+    if(argc < 3 || (takeover && controlPath.empty()))
     {
-        cerr << "Usage: " << argv[0] << " <ip> <port>" << endl;
+        usage(prog);
+        return -1;
+    }
+    // 新老进程会同时打开同一个日志文件，各自的内存索引互相看不到对方的修改
+    if (!storagePath.empty() && !controlPath.empty())
+    {
+        cerr << "-s can not be used with hot restart (-u)" << endl;
         return -1;
     }
     signal(SIGINT, resetHandler);
+    signal(SIGUSR2, lockStatsHandler);
 
     // 解析命令行参数
     char *ip = argv[1];
     uint16_t port = atoi(argv[2]);
 
+    // 慢消费者的处理策略和输出缓冲区的高水位，默认spill、1MB
+    FlowControl::Policy policy = FlowControl::kSpill;
+    if (argc > 3 && !FlowControl::parsePolicy(argv[3], &policy))
+    {
+        cerr << "unknown flow control policy: " << argv[3] << endl;
+        return -1;
+    }
+    int highWaterKB = argc > 4 ? atoi(argv[4]) : 1024;
+    if (highWaterKB <= 0)
+    {
+        cerr << "invalid high water mark: " << argv[4] << endl;
+        return -1;
+    }
+    FlowControl::configure(policy, static_cast<size_t>(highWaterKB) * 1024);
+
+    // 之后的LOG_*都只写内存缓冲，由后台线程写文件
+    if (!logBasename.empty())
+    {
+        AsyncLog::start(logBasename, logRollMB * 1024LL * 1024);
+    }
+
+    // 存储后端，默认MySQL
+    if (storagePath.empty())
+    {
+        Storage::setInstance(new MySQLStorage());
+    }
+    else
+    {
+        LogStorage *storage = new LogStorage();
+        string error;
+        if (!storage->open(storagePath, &error))
+        {
+            cerr << "open storage " << storagePath << " failed: " << error << endl;
+            return -1;
+        }
+        if (storage->discardedBytes() > 0)
+        {
+            LOG_WARN << "storage " << storagePath << ": discarded " << storage->discardedBytes()
+                     << " bytes of incomplete records at the end";
+        }
+        LOG_INFO << "storage " << storagePath << ": replayed " << storage->replayedRecords() << " records";
+        Storage::setInstance(storage);
+    }
+
+    // 不停机升级：先从老进程接过监听socket，不然绑定端口会失败
+    Inheritance inheritance;
+    if (takeover)
+    {
+        if (!HotRestart::takeover(controlPath, &inheritance))
+        {
+            cerr << "take over from " << controlPath << " failed" << endl;
+            return -1;
+        }
+        options.listenFds = inheritance.listenFds;
+    }
+
     EventLoop loop;
     InetAddress addr(ip, port);
-    ChatServer server(&loop, addr, "ChatServer");
+    ChatServer server(&loop, addr, "ChatServer", options);
 
     server.start();
+    if (takeover)
+    {
+        server.adopt(&inheritance);
+    }
+    if (!controlPath.empty())
+    {
+        server.enableHotRestart(controlPath);
+    }
     loop.loop();
 
     return 0;
@@ -0,0 +1,400 @@
+#include "metrics.hpp"
+
+#include <atomic>
+#include <mutex>
+#include <stdio.h>
+#include <vector>
+
+namespace
+{
+
+const int kSubBits = 3;
+static_assert((1 << kSubBits) == Metrics::kSubBuckets, "kSubBuckets must be 1 << kSubBits");
+// 超过2^kMaxExponent的值都记在最后一档
+const int kMaxExponent = 40;
+const int kBuckets = (kMaxExponent - kSubBits + 2) * Metrics::kSubBuckets;
+// 输出的le边界是2^0-1到2^kExportExponent-1，微秒是67秒，字节是64MB
+const int kExportExponent = 26;
+// 额外输出的分位数
+const double kQuantiles[] = {0.5, 0.9, 0.99, 0.999};
+
+struct HistogramCells
+{
+    atomic<uint64_t> buckets[kBuckets];
+    atomic<uint64_t> count;
+    atomic<uint64_t> sum;
+};
+
+// 一个线程的计数，只有这个线程写
+struct Shard
+{
+    atomic<uint64_t> counters[Metrics::kMaxCounters];
+    atomic<HistogramCells *> histograms[Metrics::kMaxHistograms];
+};
+
+struct Series
+{
+    string labels;
+    Metrics::Id id;
+};
+
+struct Family
+{
+    string name;
+    string help;
+    bool histogram;
+    vector<Series> series;
+};
+
+struct Registry
+{
+    mutex lock;
+    vector<Family> families;
+    int counters = 0;
+    int histograms = 0;
+    vector<Shard *> shards; // 线程退出之后也保留，计数器是累计值
+    vector<Metrics::Collector> collectors;
+};
+
+Registry &registry()
+{
+    static Registry instance;
+    return instance;
+}
+
+thread_local Shard *t_shard = nullptr;
+
+Shard *localShard()
+{
+    if (t_shard == nullptr)
+    {
+        // 值初始化，计数都是0
+        t_shard = new Shard();
+        Registry &r = registry();
+        lock_guard<mutex> lock(r.lock);
+        r.shards.push_back(t_shard);
+    }
+    return t_shard;
+}
+
+// 只有本线程写，读出来加上再写回去，不需要原子的读改写
+inline void bump(atomic<uint64_t> &cell, uint64_t n)
+{
+    cell.store(cell.load(memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+int bucketIndex(uint64_t value)
+{
+    if (value < static_cast<uint64_t>(Metrics::kSubBuckets))
+    {
+        return static_cast<int>(value);
+    }
+    int exponent = 63 - __builtin_clzll(value);
+    if (exponent > kMaxExponent)
+    {
+        return kBuckets - 1;
+    }
+    int sub = static_cast<int>((value >> (exponent - kSubBits)) & (Metrics::kSubBuckets - 1));
+    return (exponent - kSubBits + 1) * Metrics::kSubBuckets + sub;
+}
+
+// 一档里最大的值
+uint64_t bucketUpper(int index)
+{
+    if (index < Metrics::kSubBuckets)
+    {
+        return index;
+    }
+    int exponent = index / Metrics::kSubBuckets + kSubBits - 1;
+    uint64_t sub = index % Metrics::kSubBuckets;
+    uint64_t width = 1ULL << (exponent - kSubBits);
+    return (Metrics::kSubBuckets + sub) * width + width - 1;
+}
+
+// 注册一个序列，调用方持有锁
+Metrics::Id addSeries(Registry &r, const string &name, const string &help, const string &labels,
+                      bool histogram, int *next, int limit)
+{
+    Family *family = nullptr;
+    for (Family &f : r.families)
+    {
+        if (f.name == name)
+        {
+            family = &f;
+            break;
+        }
+    }
+    if (family == nullptr)
+    {
+        r.families.push_back(Family{name, help, histogram, {}});
+        family = &r.families.back();
+    }
+    for (const Series &series : family->series)
+    {
+        if (series.labels == labels)
+        {
+            return series.id;
+        }
+    }
+    if (family->histogram != histogram || *next >= limit)
+    {
+        return -1;
+    }
+    family->series.push_back(Series{labels, *next});
+    return (*next)++;
+}
+
+string joinLabels(const string &labels, const string &extra)
+{
+    if (labels.empty())
+    {
+        return extra;
+    }
+    return extra.empty() ? labels : labels + "," + extra;
+}
+
+// 把所有线程的一个直方图加起来，调用方持有锁
+void mergeHistogram(const vector<Shard *> &shards, Metrics::Id id, vector<uint64_t> *buckets, uint64_t *count, uint64_t *sum)
+{
+    buckets->assign(kBuckets, 0);
+    *count = 0;
+    *sum = 0;
+    for (Shard *shard : shards)
+    {
+        HistogramCells *cells = shard->histograms[id].load(memory_order_acquire);
+        if (cells == nullptr)
+        {
+            continue;
+        }
+        for (int i = 0; i < kBuckets; ++i)
+        {
+            (*buckets)[i] += cells->buckets[i].load(memory_order_relaxed);
+        }
+        *count += cells->count.load(memory_order_relaxed);
+        *sum += cells->sum.load(memory_order_relaxed);
+    }
+}
+
+// 分位数q所在的档里最大的值
+uint64_t quantileOf(const vector<uint64_t> &buckets, uint64_t count, double q)
+{
+    uint64_t rank = static_cast<uint64_t>(q * count + 0.5);
+    rank = rank == 0 ? 1 : rank;
+    uint64_t seen = 0;
+    int i = 0;
+    for (; i < kBuckets - 1; ++i)
+    {
+        seen += buckets[i];
+        if (seen >= rank)
+        {
+            break;
+        }
+    }
+    return bucketUpper(i);
+}
+
+void renderHistogram(string *out, const Family &family, const Series &series, const vector<Shard *> &shards,
+                     string *quantiles)
+{
+    vector<uint64_t> buckets;
+    uint64_t count;
+    uint64_t sum;
+    mergeHistogram(shards, series.id, &buckets, &count, &sum);
+
+    // 细分的档不会跨过2^k-1（2^k是一档的第一个值），le取档的上界2^k-1，每个边界上的累计都是精确的
+    int index = 0;
+    uint64_t cumulative = 0;
+    for (int exponent = 0; exponent <= kExportExponent; ++exponent)
+    {
+        uint64_t le = (1ULL << exponent) - 1;
+        while (index < kBuckets && bucketUpper(index) <= le)
+        {
+            cumulative += buckets[index++];
+        }
+        Metrics::writeSample(out, family.name + "_bucket", joinLabels(series.labels, "le=\"" + to_string(le) + "\""),
+                             static_cast<double>(cumulative));
+    }
+    Metrics::writeSample(out, family.name + "_bucket", joinLabels(series.labels, "le=\"+Inf\""), static_cast<double>(count));
+    Metrics::writeSample(out, family.name + "_sum", series.labels, static_cast<double>(sum));
+    Metrics::writeSample(out, family.name + "_count", series.labels, static_cast<double>(count));
+
+    // 分位数按细分的档计算，取档里最大的值
+    if (count == 0)
+    {
+        return;
+    }
+    for (double q : kQuantiles)
+    {
+        char label[32];
+        snprintf(label, sizeof label, "quantile=\"%g\"", q);
+        Metrics::writeSample(quantiles, family.name + "_quantile", joinLabels(series.labels, label),
+                             static_cast<double>(quantileOf(buckets, count, q)));
+    }
+}
+
+} // namespace
+
+// 注册计数器
+Metrics::Id Metrics::counter(const string &name, const string &help, const string &labels)
+{
+    Registry &r = registry();
+    lock_guard<mutex> lock(r.lock);
+    return addSeries(r, name, help, labels, false, &r.counters, kMaxCounters);
+}
+
+// 注册直方图
+Metrics::Id Metrics::histogram(const string &name, const string &help, const string &labels)
+{
+    Registry &r = registry();
+    lock_guard<mutex> lock(r.lock);
+    return addSeries(r, name, help, labels, true, &r.histograms, kMaxHistograms);
+}
+
+// 注册输出时调用的Collector
+void Metrics::addCollector(const Collector &collector)
+{
+    Registry &r = registry();
+    lock_guard<mutex> lock(r.lock);
+    r.collectors.push_back(collector);
+}
+
+// 计数器加n
+void Metrics::add(Id counter, uint64_t n)
+{
+    if (counter < 0 || counter >= kMaxCounters)
+    {
+        return;
+    }
+    bump(localShard()->counters[counter], n);
+}
+
+// 直方图记录一个值
+void Metrics::observe(Id histogram, int64_t value)
+{
+    if (histogram < 0 || histogram >= kMaxHistograms)
+    {
+        return;
+    }
+    Shard *shard = localShard();
+    HistogramCells *cells = shard->histograms[histogram].load(memory_order_relaxed);
+    if (cells == nullptr)
+    {
+        cells = new HistogramCells();
+        shard->histograms[histogram].store(cells, memory_order_release);
+    }
+    uint64_t v = value < 0 ? 0 : static_cast<uint64_t>(value);
+    bump(cells->buckets[bucketIndex(v)], 1);
+    bump(cells->count, 1);
+    bump(cells->sum, v);
+}
+
+// 所有指标的Prometheus文本格式
+string Metrics::render()
+{
+    Registry &r = registry();
+    vector<Collector> collectors;
+    string out;
+    {
+        lock_guard<mutex> lock(r.lock);
+        for (const Family &family : r.families)
+        {
+            writeHeader(&out, family.name, family.histogram ? "histogram" : "counter", family.help);
+            string quantiles;
+            for (const Series &series : family.series)
+            {
+                if (family.histogram)
+                {
+                    renderHistogram(&out, family, series, r.shards, &quantiles);
+                    continue;
+                }
+                uint64_t total = 0;
+                for (Shard *shard : r.shards)
+                {
+                    total += shard->counters[series.id].load(memory_order_relaxed);
+                }
+                writeSample(&out, family.name, series.labels, static_cast<double>(total));
+            }
+            if (!quantiles.empty())
+            {
+                writeHeader(&out, family.name + "_quantile", "gauge", family.help + " (quantiles)");
+                out += quantiles;
+            }
+        }
+        collectors = r.collectors;
+    }
+    // Collector可能要取其他模块的锁，不在注册表的锁里调用
+    for (const Collector &collector : collectors)
+    {
+        collector(&out);
+    }
+    return out;
+}
+
+// 计数器的当前值
+uint64_t Metrics::counterValue(Id counter)
+{
+    if (counter < 0 || counter >= kMaxCounters)
+    {
+        return 0;
+    }
+    Registry &r = registry();
+    lock_guard<mutex> lock(r.lock);
+    uint64_t total = 0;
+    for (Shard *shard : r.shards)
+    {
+        total += shard->counters[counter].load(memory_order_relaxed);
+    }
+    return total;
+}
+
+// 直方图记录过的次数
+uint64_t Metrics::histogramCount(Id histogram)
+{
+    if (histogram < 0 || histogram >= kMaxHistograms)
+    {
+        return 0;
+    }
+    Registry &r = registry();
+    lock_guard<mutex> lock(r.lock);
+    vector<uint64_t> buckets;
+    uint64_t count;
+    uint64_t sum;
+    mergeHistogram(r.shards, histogram, &buckets, &count, &sum);
+    return count;
+}
+
+// 分位数q所在的档里最大的值
+int64_t Metrics::quantile(Id histogram, double q)
+{
+    if (histogram < 0 || histogram >= kMaxHistograms)
+    {
+        return 0;
+    }
+    Registry &r = registry();
+    lock_guard<mutex> lock(r.lock);
+    vector<uint64_t> buckets;
+    uint64_t count;
+    uint64_t sum;
+    mergeHistogram(r.shards, histogram, &buckets, &count, &sum);
+    return count == 0 ? 0 : static_cast<int64_t>(quantileOf(buckets, count, q));
+}
+
+// 一族指标的HELP和TYPE
+void Metrics::writeHeader(string *out, const string &name, const char *type, const string &help)
+{
+    *out += "# HELP " + name + " " + help + "\n";
+    *out += "# TYPE " + name + " " + type + "\n";
+}
+
+// 一个样本
+void Metrics::writeSample(string *out, const string &name, const string &labels, double value)
+{
+    char buf[32];
+    snprintf(buf, sizeof buf, " %.15g\n", value);
+    *out += name;
+    if (!labels.empty())
+    {
+        *out += "{" + labels + "}";
+    }
+    *out += buf;
+}
@@ -0,0 +1,70 @@
+#include "metricsserver.hpp"
+#include "metrics.hpp"
+
+#include <muduo/base/Logging.h>
+#include <algorithm>
+#include <functional>
+#include <string>
+using namespace std;
+using namespace placeholders;
+
+MetricsServer::MetricsServer(EventLoop *loop, const InetAddress &listenAddr)
+    : _server(loop, listenAddr, "MetricsServer")
+{
+    _server.setConnectionCallback(std::bind(&MetricsServer::onConnection, this, _1));
+    _server.setMessageCallback(std::bind(&MetricsServer::onMessage, this, _1, _2, _3));
+}
+
+void MetricsServer::start()
+{
+    _server.start();
+    LOG_INFO << "metrics on http://" << _server.ipPort() << "/metrics";
+}
+
+void MetricsServer::onConnection(const TcpConnectionPtr &conn)
+{
+    if (conn->connected())
+    {
+        conn->setTcpNoDelay(true);
+    }
+}
+
+void MetricsServer::onMessage(const TcpConnectionPtr &conn, Buffer *buffer, Timestamp time)
+{
+    if (buffer->readableBytes() > kMaxRequestSize)
+    {
+        conn->forceClose();
+        return;
+    }
+    // 请求头还没收完
+    static const char kHeaderEnd[] = "\r\n\r\n";
+    const char *last = buffer->peek() + buffer->readableBytes();
+    if (std::search(buffer->peek(), last, kHeaderEnd, kHeaderEnd + 4) == last)
+    {
+        return;
+    }
+
+    // 请求行：GET /metrics HTTP/1.1
+    string requestLine(buffer->peek(), buffer->findCRLF());
+    buffer->retrieveAll();
+    string status = "200 OK";
+    string body;
+    size_t pathEnd = requestLine.find_first_of(" ?", 4);
+    if (requestLine.compare(0, 4, "GET ") == 0 && requestLine.compare(4, pathEnd - 4, "/metrics") == 0)
+    {
+        body = Metrics::render();
+    }
+    else
+    {
+        status = "404 Not Found";
+        body = "try GET /metrics\n";
+    }
+
+    string response = "HTTP/1.1 " + status + "\r\n"
+                      "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+                      "Content-Length: " + to_string(body.size()) + "\r\n"
+                      "Connection: close\r\n\r\n";
+    response += body;
+    conn->send(response);
+    conn->shutdown();
+}
@@ -1,65 +1,20 @@
 #include "offlinemessagemodel.hpp"
-#include "db.h"
-
-
-/*
-sprintf 只是把变量拼接进 SQL 字符串，容易被 SQL 注入攻击。
-参数化查询（Prepared Statement）是数据库驱动提供的安全机制，把 SQL 和数据分开传递，防止注入。
-例如 MySQL C API 的 mysql_stmt_prepare，或 C++ 的 QSqlQuery::prepare，而不是直接拼接字符串。
-*/
+#include "storage.hpp"
 
 // 存储用户的离线消息
 void OfflineMsgModel::insert(int userid, string msg)
 {
-    // 1. 组装sql语句
-    char sql[1024] = {0};
-    sprintf(sql, "insert into offlineMessage(userid, message) values(%d, '%s')", userid, msg.c_str());
-
-    MySQL mysql;
-    if(mysql.connect())
-    {
-        mysql.update(sql);
-    }
-
+    Storage::instance()->insertOfflineMsg(userid, msg);
 }
 
 // 删除用户的离线消息
 void OfflineMsgModel::remove(int userid)
 {
-    // 1. 组装sql语句
-    char sql[1024] = {0};
-    sprintf(sql, "delete from offlineMessage where userid=%d", userid);
-
-    MySQL mysql;
-    if(mysql.connect())
-    {
-        mysql.update(sql);
-    }
+    Storage::instance()->removeOfflineMsg(userid);
 }
 
 // 查询用户的离线消息
 vector<string> OfflineMsgModel::query(int userid)
 {
-    // 1. 组装sql语句
-    char sql[1024] = {0};
-    sprintf(sql, "select message from offlineMessage where userid=%d", userid);
-
-    MySQL mysql;
-    vector<string> vec;
-    if(mysql.connect())
-    {
-        MYSQL_RES* res = mysql.query(sql);
-        if(res != nullptr)
-        {
-            MYSQL_ROW row;
-            // 把userid用户的所有离线消息放入vec中返回
-            while((row = mysql_fetch_row(res)) != nullptr)
-            {
-                vec.push_back(row[0]);
-            }
-            mysql_free_result(res);
-            return vec;
-        }
-    }
-    return vec;
-}
\ No newline at end of file
+    return Storage::instance()->queryOfflineMsg(userid);
+}
@@ -0,0 +1,126 @@
+#include "msgcodec.hpp"
+#include "binarycodec.hpp"
+#include "session.hpp"
+
+#include <muduo/base/Logging.h>
+
+// 连接上协商好的协议，还没有会话的连接按json处理
+int MsgCodec::protocolOf(const TcpConnectionPtr &conn)
+{
+    Session *session = getSession(conn);
+    return session != nullptr ? session->protocol.load(std::memory_order_relaxed) : PROTO_JSON;
+}
+
+// 编码用的线程局部缓冲区
+string &MsgCodec::scratch()
+{
+    static thread_local string buf;
+    return buf;
+}
+
+// 按照连接上的协议发送预先编码好的消息
+void MsgCodec::sendEncoded(const TcpConnectionPtr &conn, const EncodedMsg &msg)
+{
+    FlowControl::send(conn, protocolOf(conn) == PROTO_BINARY ? msg.binary : msg.text, FlowControl::kEssential);
+}
+
+// 按照连接上的协议发送一条消息
+FlowControl::Verdict MsgCodec::send(const TcpConnectionPtr &conn, const json &js, FlowControl::MsgClass cls)
+{
+    if (protocolOf(conn) == PROTO_BINARY)
+    {
+        string frame;
+        if (BinaryCodec::encode(js, &frame))
+        {
+            return FlowControl::send(conn, frame, cls);
+        }
+        LOG_ERROR << "binary encode error, fallback to json!";
+    }
+    return FlowControl::send(conn, js.dump(), cls);
+}
+
+// 发送一条json文本消息
+FlowControl::Verdict MsgCodec::sendText(const TcpConnectionPtr &conn, const string &text, FlowControl::MsgClass cls)
+{
+    if (protocolOf(conn) == PROTO_JSON)
+    {
+        return FlowControl::send(conn, text, cls);
+    }
+
+    json js;
+    try
+    {
+        js = json::parse(text);
+    }
+    catch (const json::exception &e)
+    {
+        LOG_ERROR << "json parse error:" << e.what();
+        return FlowControl::kDropped;
+    }
+    return send(conn, js, cls);
+}
+
+// 把收到的一帧转发给conn
+FlowControl::Verdict MsgCodec::forward(const TcpConnectionPtr &conn, const MsgRoute &route, const StringPiece &frame,
+                                       FlowControl::MsgClass cls)
+{
+    // 协议一致：原始字节直接写到接收方的socket或者输出缓冲区，最多一次拷贝
+    if (protocolOf(conn) == route.protocol)
+    {
+        return FlowControl::send(conn, frame, cls);
+    }
+
+    json js;
+    if (!decode(route, frame, &js))
+    {
+        return FlowControl::kDropped;
+    }
+    return send(conn, js, cls);
+}
+
+// 把收到的一帧转成json文本
+string MsgCodec::toJsonText(const MsgRoute &route, const StringPiece &frame)
+{
+    if (route.protocol == PROTO_JSON)
+    {
+        // json帧只经过JsonScanner，没有检查过编码，不合法的UTF-8存下来之后每次dump都会抛异常
+        if (!BinaryCodec::validUtf8(reinterpret_cast<const uint8_t *>(frame.data()), frame.size()))
+        {
+            LOG_ERROR << "json frame is not valid utf-8!";
+            return string();
+        }
+        return frame.as_string();
+    }
+
+    json js;
+    if (!decode(route, frame, &js))
+    {
+        return string();
+    }
+    return js.dump();
+}
+
+// 把收到的一帧解码成json对象
+bool MsgCodec::decode(const MsgRoute &route, const StringPiece &frame, json *js)
+{
+    if (route.protocol == PROTO_BINARY)
+    {
+        if (!BinaryCodec::decode(frame.data(), frame.size(), js))
+        {
+            LOG_ERROR << "binary decode error!";
+            return false;
+        }
+        return true;
+    }
+
+    try
+    {
+        *js = json::parse(frame.begin(), frame.end());
+    }
+    catch (const json::exception &e)
+    {
+        LOG_ERROR << "json parse error:" << e.what();
+        return false;
+    }
+    return true;
+}
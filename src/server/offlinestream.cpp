@@ -0,0 +1,103 @@
+#include "offlinestream.hpp"
+#include "binarycodec.hpp"
+#include "jsonscanner.hpp"
+#include "jsonwriter.hpp"
+#include "msgcodec.hpp"
+#include "public.hpp"
+#include "session.hpp"
+
+#include <muduo/net/Buffer.h>
+
+OfflineStream::OfflineStream(int userid, vector<string> msgs)
+    : _userid(userid), _msgs(std::move(msgs)), _next(0)
+{
+}
+
+// 推送到输出缓冲区超过高水位或者全部推送完
+bool OfflineStream::pump(const TcpConnectionPtr &conn)
+{
+    Session *session = getSession(conn);
+    int protocol = session != nullptr ? session->protocol.load(std::memory_order_relaxed) : PROTO_JSON;
+
+    string frame;
+    while (_next < _msgs.size() && conn->outputBuffer()->readableBytes() < kHighWaterMark)
+    {
+        // 凑一批：条数和字节数都有上限，至少一条
+        size_t end = _next;
+        size_t bytes = 0;
+        while (end < _msgs.size() && end - _next < kBatchMsgs && (end == _next || bytes + _msgs[end].size() <= kBatchBytes))
+        {
+            bytes += _msgs[end].size();
+            ++end;
+        }
+
+        frame.clear();
+        encodeBatch(protocol, end, &frame);
+        _next = end;
+        FlowControl::send(conn, frame, FlowControl::kEssential);
+    }
+
+    if (_next < _msgs.size())
+    {
+        return false;
+    }
+    _msgs.clear();
+    return true;
+}
+
+// 取出还没有推送的离线消息
+vector<string> OfflineStream::takeRemaining()
+{
+    vector<string> remaining(std::make_move_iterator(_msgs.begin() + _next), std::make_move_iterator(_msgs.end()));
+    _msgs.clear();
+    _next = 0;
+    return remaining;
+}
+
+// 编码[_next, end)这一批消息
+void OfflineStream::encodeBatch(int protocol, size_t end, string *out) const
+{
+    size_t remain = _msgs.size() - end;
+    if (protocol == PROTO_BINARY)
+    {
+        size_t start = BinaryCodec::beginFrame(out);
+        BinaryCodec::writeKey("remain", out);
+        BinaryCodec::writeInt(remain, out);
+        BinaryCodec::writeKey("msgs", out);
+        BinaryCodec::writeArrayHeader(end - _next, out);
+        for (size_t i = _next; i < end; ++i)
+        {
+            BinaryCodec::writeStringValue(_msgs[i], out);
+        }
+        BinaryCodec::finishFrame(out, start, OFFLINE_MSG, BinaryCodec::kAbsent, BinaryCodec::kAbsent);
+        return;
+    }
+
+    out->append("{\"msgid\":");
+    JsonWriter::writeInt(OFFLINE_MSG, out);
+    out->append(",\"remain\":");
+    JsonWriter::writeInt(remain, out);
+    out->append(",\"msgs\":[");
+    for (size_t i = _next; i < end; ++i)
+    {
+        if (i != _next)
+        {
+            out->push_back(',');
+        }
+        // 离线消息是服务器自己存的json文本，是一个合法的json对象才原样嵌入，否则当字符串发送。
+        // JsonScanner只检查结构，不检查值（比如"msg":x），一条坏的消息会让整批都解析失败，所以再完整校验一次
+        const string &msg = _msgs[i];
+        MsgRoute route;
+        const char *frameEnd = nullptr;
+        if (JsonScanner::scan(msg.data(), msg.data() + msg.size(), &route, &frameEnd) == JsonScanner::kComplete &&
+            json::accept(msg.begin(), msg.end()))
+        {
+            out->append(msg);
+        }
+        else
+        {
+            JsonWriter::writeString(msg, out);
+        }
+    }
+    out->append("]}");
+}
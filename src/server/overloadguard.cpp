@@ -0,0 +1,76 @@
+#include "overloadguard.hpp"
+#include "metrics.hpp"
+#include "public.hpp"
+
+namespace
+{
+
+OverloadGuard::Options g_options;
+
+// 每个loop线程自己的过载状态，探针和handler都在这个线程里
+thread_local bool t_overloaded = false;
+
+const Metrics::Id kDeferred = Metrics::counter("chat_overload_deferred_total", "Low priority messages deferred on an overloaded IO loop");
+const Metrics::Id kShed = Metrics::counter("chat_overload_shed_total", "Low priority messages dropped on an overloaded IO loop");
+const Metrics::Id kTransitions = Metrics::counter("chat_overload_transitions_total", "Times an IO loop became overloaded");
+
+} // namespace
+
+void OverloadGuard::configure(const Options &options)
+{
+    g_options = options;
+}
+
+const OverloadGuard::Options &OverloadGuard::options()
+{
+    return g_options;
+}
+
+bool OverloadGuard::reportLag(int64_t lagUs)
+{
+    int64_t threshold = g_options.lagThresholdUs;
+    if (threshold <= 0)
+    {
+        t_overloaded = false;
+    }
+    else if (!t_overloaded && lagUs > threshold)
+    {
+        t_overloaded = true;
+        Metrics::add(kTransitions);
+    }
+    else if (t_overloaded && lagUs < threshold / 2)
+    {
+        t_overloaded = false;
+    }
+    return t_overloaded;
+}
+
+bool OverloadGuard::overloaded()
+{
+    return t_overloaded;
+}
+
+OverloadGuard::Action OverloadGuard::admit(int msgid, int deferred)
+{
+    if (!t_overloaded)
+    {
+        return kRun;
+    }
+    switch (msgid)
+    {
+    case ADD_FRIEND_MSG:
+    case CREATE_GROUP_MSG:
+    case ADD_GROUP_MSG:
+        if (deferred >= g_options.maxDefers)
+        {
+            return kRun;
+        }
+        Metrics::add(kDeferred);
+        return kDefer;
+    case HEARTBEAT_MSG:
+        Metrics::add(kShed);
+        return kShed;
+    default:
+        return kRun;
+    }
+}
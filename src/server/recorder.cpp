@@ -0,0 +1,302 @@
+#include "recorder.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+/*
+双缓冲，和muduo AsyncLogging一样：IO线程在锁里只把记录追加到当前的缓冲，
+写满一块（或者每秒一次）交给后台线程，后台线程在锁外fwrite和fflush，写完的缓冲还回来复用。
+录制的记录不能丢（回放要靠kOpen和时间差），后台线程写不过来时缓冲会一直积压，录制只在测试环境打开。
+*/
+namespace
+{
+
+const char kMagic[4] = {'C', 'R', 'P', '1'};
+const size_t kHeaderLen = 12;
+// 一块缓冲的大小，写满了交给后台线程
+const size_t kBufferBytes = 256 * 1024;
+// 没写满的缓冲最多等这么久写到文件
+const int kFlushIntervalSec = 1;
+// 留着复用的空缓冲个数
+const size_t kMaxSpare = 4;
+
+// 启动之后不再释放：exit析构全局变量时后台线程可能还在写
+struct Writer
+{
+    mutex bufferMutex;
+    // 交给了后台线程和后台线程写完
+    condition_variable fullCond;
+    condition_variable writtenCond;
+    FILE *file = nullptr;
+    int64_t startUs = 0;
+    int64_t lastUs = 0;
+    string current;
+    vector<string> full;
+    vector<string> spare;
+    // 交给后台线程的缓冲个数和其中已经写到文件的个数，flush等两者相等
+    uint64_t queued = 0;
+    uint64_t written = 0;
+};
+
+Writer *g_writer = nullptr;
+atomic_bool g_enabled{false};
+atomic<uint32_t> g_nextConn{1};
+
+void writeVarint(uint64_t v, string *out)
+{
+    while (v >= 0x80)
+    {
+        out->push_back(static_cast<char>(v | 0x80));
+        v >>= 7;
+    }
+    out->push_back(static_cast<char>(v));
+}
+
+void writeUint64(uint64_t v, char *p)
+{
+    for (int i = 0; i < 8; ++i)
+    {
+        p[i] = static_cast<char>(v >> (8 * i));
+    }
+}
+
+// 调用方持有bufferMutex，把当前的缓冲交给后台线程，换一块空缓冲
+void handOffLocked(Writer *w)
+{
+    if (w->current.empty())
+    {
+        return;
+    }
+    w->full.push_back(std::move(w->current));
+    if (!w->spare.empty())
+    {
+        w->current = std::move(w->spare.back());
+        w->spare.pop_back();
+    }
+    else
+    {
+        w->current = string();
+        w->current.reserve(kBufferBytes);
+    }
+    ++w->queued;
+    w->fullCond.notify_one();
+}
+
+// 后台线程，进程退出时不停止，退出之前调用flush
+void writerThread(Writer *w)
+{
+    vector<string> writing;
+    for (;;)
+    {
+        uint64_t queued = 0;
+        {
+            unique_lock<mutex> lock(w->bufferMutex);
+            if (w->full.empty())
+            {
+                w->fullCond.wait_for(lock, chrono::seconds(kFlushIntervalSec));
+            }
+            // 到时间了，没写满的也写
+            handOffLocked(w);
+            writing.swap(w->full);
+            queued = w->queued;
+        }
+        for (const string &buffer : writing)
+        {
+            fwrite(buffer.data(), 1, buffer.size(), w->file);
+        }
+        if (!writing.empty())
+        {
+            fflush(w->file);
+        }
+        {
+            lock_guard<mutex> lock(w->bufferMutex);
+            for (string &buffer : writing)
+            {
+                if (w->spare.size() < kMaxSpare)
+                {
+                    buffer.clear();
+                    w->spare.push_back(std::move(buffer));
+                }
+            }
+            w->written = queued;
+        }
+        writing.clear();
+        w->writtenCond.notify_all();
+    }
+}
+
+// 调用方持有bufferMutex
+void appendRecord(Writer *w, int type, uint32_t conn, int64_t timeUs, const char *data, size_t len)
+{
+    int64_t delta = timeUs - w->lastUs;
+    w->lastUs = timeUs;
+    w->current.push_back(static_cast<char>(type));
+    writeVarint(conn, &w->current);
+    writeVarint((static_cast<uint64_t>(delta) << 1) ^ static_cast<uint64_t>(delta >> 63), &w->current);
+    if (type == Recorder::kFrame)
+    {
+        writeVarint(len, &w->current);
+        w->current.append(data, len);
+    }
+    if (w->current.size() >= kBufferBytes)
+    {
+        handOffLocked(w);
+    }
+}
+
+} // namespace
+
+bool Recorder::start(const string &path)
+{
+    FILE *file = fopen(path.c_str(), "wb");
+    if (file == nullptr)
+    {
+        return false;
+    }
+    Writer *w = new Writer;
+    w->file = file;
+    w->current.reserve(kBufferBytes);
+    g_writer = w;
+    thread(writerThread, w).detach();
+    g_enabled = true;
+    return true;
+}
+
+bool Recorder::enabled()
+{
+    return g_enabled.load(memory_order_relaxed);
+}
+
+uint32_t Recorder::open(int64_t timeUs)
+{
+    Writer *w = g_writer;
+    uint32_t conn = g_nextConn.fetch_add(1, memory_order_relaxed);
+    lock_guard<mutex> lock(w->bufferMutex);
+    // 第一条记录的时间作为录制开始的时间，文件头在第一块缓冲的开头
+    if (w->startUs == 0)
+    {
+        char header[kHeaderLen];
+        memcpy(header, kMagic, sizeof kMagic);
+        writeUint64(static_cast<uint64_t>(timeUs), header + sizeof kMagic);
+        w->current.append(header, kHeaderLen);
+        w->startUs = timeUs;
+        w->lastUs = timeUs;
+    }
+    appendRecord(w, kOpen, conn, timeUs, nullptr, 0);
+    return conn;
+}
+
+void Recorder::frame(uint32_t conn, int64_t timeUs, const char *begin, const char *end)
+{
+    Writer *w = g_writer;
+    lock_guard<mutex> lock(w->bufferMutex);
+    appendRecord(w, kFrame, conn, timeUs, begin, static_cast<size_t>(end - begin));
+}
+
+void Recorder::close(uint32_t conn, int64_t timeUs)
+{
+    Writer *w = g_writer;
+    lock_guard<mutex> lock(w->bufferMutex);
+    appendRecord(w, kClose, conn, timeUs, nullptr, 0);
+}
+
+void Recorder::flush()
+{
+    if (!enabled())
+    {
+        return;
+    }
+    Writer *w = g_writer;
+    unique_lock<mutex> lock(w->bufferMutex);
+    handOffLocked(w);
+    uint64_t queued = w->queued;
+    w->writtenCond.wait(lock, [w, queued]() { return w->written >= queued; });
+}
+
+Recorder::Reader::Reader() : _file(nullptr), _startUs(0), _lastUs(0)
+{
+}
+
+Recorder::Reader::~Reader()
+{
+    if (_file != nullptr)
+    {
+        fclose(_file);
+    }
+}
+
+bool Recorder::Reader::open(const string &path)
+{
+    _file = fopen(path.c_str(), "rb");
+    if (_file == nullptr)
+    {
+        return false;
+    }
+    unsigned char header[kHeaderLen];
+    if (fread(header, 1, kHeaderLen, _file) != kHeaderLen || memcmp(header, kMagic, sizeof kMagic) != 0)
+    {
+        return false;
+    }
+    uint64_t start = 0;
+    for (int i = 0; i < 8; ++i)
+    {
+        start |= static_cast<uint64_t>(header[sizeof kMagic + i]) << (8 * i);
+    }
+    _startUs = static_cast<int64_t>(start);
+    _lastUs = _startUs;
+    return true;
+}
+
+bool Recorder::Reader::readVarint(uint64_t *v)
+{
+    *v = 0;
+    for (int shift = 0; shift < 64; shift += 7)
+    {
+        int byte = getc(_file);
+        if (byte == EOF)
+        {
+            return false;
+        }
+        *v |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool Recorder::Reader::next(Record *record)
+{
+    int type = getc(_file);
+    uint64_t conn = 0;
+    uint64_t zigzag = 0;
+    if (type == EOF || !readVarint(&conn) || !readVarint(&zigzag))
+    {
+        return false;
+    }
+    int64_t delta = static_cast<int64_t>((zigzag >> 1) ^ (~(zigzag & 1) + 1));
+    _lastUs += delta;
+    record->type = type;
+    record->conn = static_cast<uint32_t>(conn);
+    record->timeUs = _lastUs - _startUs;
+    record->data.clear();
+    if (type == kFrame)
+    {
+        uint64_t len = 0;
+        if (!readVarint(&len) || len > 64 * 1024 * 1024)
+        {
+            return false;
+        }
+        record->data.resize(len);
+        if (len > 0 && fread(&record->data[0], 1, len, _file) != len)
+        {
+            return false;
+        }
+    }
+    return type == kOpen || type == kFrame || type == kClose;
+}
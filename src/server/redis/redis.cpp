@@ -1,5 +1,7 @@
 #include "redis.hpp"
-#include <iostream>
+#include "asynclog.hpp"
+#include "metrics.hpp"
+#include <muduo/base/Logging.h>
 using namespace std;
 
 
@@ -27,7 +29,7 @@ bool Redis::connect()
     _publish_context = redisConnect("127.0.0.1", 6379);
     if(_publish_context == nullptr)
     {
-        cerr << "Redis publish context connect error!" << endl;
+        LOG_ERROR << "Redis publish context connect error!";
         return false;
     }
 
@@ -35,7 +37,7 @@ bool Redis::connect()
     _subscribe_context = redisConnect("127.0.1", 6379);
     if(_subscribe_context == nullptr)
     {
-        cerr << "Redis subscribe context connect error!" << endl;
+        LOG_ERROR << "Redis subscribe context connect error!";
         return false;
     }
 
@@ -44,17 +46,29 @@ bool Redis::connect()
     });
 
     t.detach(); // 分离线程，独立运行
-    cout << "Redis connect success!" << endl;
+    LOG_INFO << "Redis connect success!";
     return true;
 }
 
+// publish的耗时和失败次数
+static Metrics::Id publishUs = Metrics::histogram("chat_redis_publish_duration_us", "Redis PUBLISH latency in microseconds");
+static Metrics::Id publishErrors = Metrics::counter("chat_redis_publish_errors_total", "Failed Redis PUBLISH calls");
+// redis断开时每条消息都会失败，限制日志的速度
+static LogRateLimiter publishErrorLog("redis_publish", 10);
+
 // 向redis指定的通道channel发布消息
 bool Redis::publish(int channel, string message)
 {
+    ScopedTimer timer(publishUs);
     redisReply *reply = (redisReply *)redisCommand(_publish_context, "PUBLISH %d %s", channel, message.c_str());
     if (reply == nullptr)
     {
-        cerr << "Redis publish error!" << endl;
+        Metrics::add(publishErrors);
+        uint64_t suppressed = 0;
+        if (publishErrorLog.allow(&suppressed))
+        {
+            LOG_ERROR << "Redis publish error!" << LogRateLimiter::note(suppressed);
+        }
         return false;
     }
     freeReplyObject(reply);
@@ -69,7 +83,7 @@ bool Redis::subscribe(int channel)
     // 只负责发送命令，不阻塞接受redis server响应消息，否则和notifyMsg线程抢占响应资源
     if(REDIS_ERR == redisAppendCommand(_subscribe_context, "SUBSCRIBE %d", channel))
     {
-        cerr << "Redis subscribe error!" << endl;
+        LOG_ERROR << "Redis subscribe error!";
         return false;
     }
     // redisBufferWriter可以循环发送缓冲区，知道缓冲区数据发送完毕（done被置为1）
@@ -78,7 +92,7 @@ bool Redis::subscribe(int channel)
     {
         if(REDIS_ERR == redisBufferWrite(this->_subscribe_context, &done))
         {
-            cerr << "subscribe redisBufferWrite error!" << endl;
+            LOG_ERROR << "subscribe redisBufferWrite error!";
             return false;
         }
     }
@@ -92,7 +106,7 @@ bool Redis::unsubscribe(int channel)
 {
     if(REDIS_ERR == redisAppendCommand(_subscribe_context, "UNSUBSCRIBE %d", channel))
     {
-        cerr << "Redis unsubscribe error!" << endl;
+        LOG_ERROR << "Redis unsubscribe error!";
         return false;
     }
     // redisBufferWriter可以循环发送缓冲区，知道缓冲区数据发送完毕（done被置为1）
@@ -101,7 +115,7 @@ bool Redis::unsubscribe(int channel)
     {
         if(REDIS_ERR == redisBufferWrite(this->_subscribe_context, &done))
         {
-            cerr << "unsubscribe redisBufferWrite error!" << endl;
+            LOG_ERROR << "unsubscribe redisBufferWrite error!";
             return false;
         }
     }
@@ -124,7 +138,7 @@ void Redis::observer_channel_message()
         freeReplyObject(reply);
     }
 
-    cerr << ">>>>>>>>>> observer_channel_message exit! <<<<<<<<<<<<" << endl;
+    LOG_ERROR << ">>>>>>>>>> observer_channel_message exit! <<<<<<<<<<<<";
 }
 
 void Redis::init_notify_handler(function<void(int, string)> fn)
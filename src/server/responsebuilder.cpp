@@ -0,0 +1,87 @@
+#include "responsebuilder.hpp"
+#include "binarycodec.hpp"
+#include "messages.hpp"
+
+namespace
+{
+
+LoginMsgAck loginError(int err, const string &errmsg)
+{
+    LoginMsgAck response;
+    response.err = err;
+    response.setErrmsg(errmsg);
+    return response;
+}
+
+} // namespace
+
+// 内容固定的响应只在这里编码一次
+ResponseBuilder::ResponseBuilder()
+    : _loginFailed(MsgCodec::encode(loginError(1, "用户名或密码错误"))),
+      _loginRepeated(MsgCodec::encode(loginError(2, "该帐号已经登录，请不要重复登录")))
+{
+    RegMsgAck regAck;
+    regAck.err = 1; // 1表示失败
+    _regFailed = MsgCodec::encode(regAck);
+    _heartbeatAck = MsgCodec::encode(HeartbeatMsgAck());
+
+    for (int version = 0; version <= BinaryCodec::kVersion; ++version)
+    {
+        ProtoMsgAck protoAck;
+        protoAck.version = version;
+        string text;
+        protoAck.toJsonText(&text);
+        _protoAcks.push_back(text);
+    }
+}
+
+// 登录失败：用户名或密码错误
+void ResponseBuilder::loginFailed(const TcpConnectionPtr &conn) const
+{
+    MsgCodec::sendEncoded(conn, _loginFailed);
+}
+
+// 登录失败：该帐号已经登录
+void ResponseBuilder::loginRepeated(const TcpConnectionPtr &conn) const
+{
+    MsgCodec::sendEncoded(conn, _loginRepeated);
+}
+
+// 登录没有执行：服务器繁忙，重试时间每次不同，不能预先编码
+void ResponseBuilder::loginBusy(const TcpConnectionPtr &conn, int retryAfterMs) const
+{
+    LoginMsgAck response = loginError(3, "服务器繁忙，请稍后重试");
+    response.setRetryafter(retryAfterMs);
+    MsgCodec::sendMsg(conn, response);
+}
+
+// 注册成功，带上新用户的id
+void ResponseBuilder::regSucceeded(const TcpConnectionPtr &conn, int userid) const
+{
+    RegMsgAck response;
+    response.err = 0; // 0表示成功
+    response.setId(userid);
+    MsgCodec::sendMsg(conn, response);
+}
+
+// 注册失败
+void ResponseBuilder::regFailed(const TcpConnectionPtr &conn) const
+{
+    MsgCodec::sendEncoded(conn, _regFailed);
+}
+
+// 协议协商响应
+void ResponseBuilder::protoAck(const TcpConnectionPtr &conn, int version) const
+{
+    if (version < 0 || version >= static_cast<int>(_protoAcks.size()))
+    {
+        version = 0;
+    }
+    FlowControl::send(conn, _protoAcks[version], FlowControl::kEssential);
+}
+
+// 心跳响应
+void ResponseBuilder::heartbeatAck(const TcpConnectionPtr &conn) const
+{
+    MsgCodec::sendEncoded(conn, _heartbeatAck);
+}
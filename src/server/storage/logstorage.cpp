@@ -0,0 +1,517 @@
+#include "logstorage.hpp"
+#include "metrics.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+namespace
+{
+
+// 追加一条记录（写文件加fflush）的耗时和失败次数
+const Metrics::Id kAppendUs = Metrics::histogram("chat_storage_append_us", "Embedded storage log append latency in microseconds");
+const Metrics::Id kAppendErrors = Metrics::counter("chat_storage_append_errors_total", "Failed embedded storage log appends");
+
+bool contains(const vector<int> &ids, int id)
+{
+    return find(ids.begin(), ids.end(), id) != ids.end();
+}
+
+// 按id排序的键，压缩时让文件内容和id顺序一致
+template <typename Map>
+vector<int> sortedKeys(const Map &map)
+{
+    vector<int> keys;
+    keys.reserve(map.size());
+    for (const auto &item : map)
+    {
+        keys.push_back(item.first);
+    }
+    sort(keys.begin(), keys.end());
+    return keys;
+}
+
+bool writeLine(FILE *file, const string &line)
+{
+    return fwrite(line.data(), 1, line.size(), file) == line.size();
+}
+
+bool writeLine(FILE *file, const json &record)
+{
+    string line = record.dump();
+    line.push_back('\n');
+    return writeLine(file, line);
+}
+
+} // namespace
+
+LogStorage::LogStorage()
+    : _file(nullptr),
+      _replayed(0),
+      _discarded(0),
+      _nextUserId(1),
+      _nextGroupId(1)
+{
+}
+
+LogStorage::~LogStorage()
+{
+    if (_file != nullptr)
+    {
+        fclose(_file);
+    }
+}
+
+bool LogStorage::open(const string &path, string *error)
+{
+    lock_guard<mutex> lock(_mutex);
+    _path = path;
+
+    // 按顺序重放。只有最后一行没有换行符时才是崩溃时写了一半的记录，丢掉；
+    // 其他解析或者应用不了的记录说明文件坏了，不能压缩，否则它后面的记录都会被删掉
+    ifstream in(path, ios::binary);
+    string content((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+    size_t pos = 0;
+    size_t lineno = 0;
+    while (pos < content.size())
+    {
+        size_t end = content.find('\n', pos);
+        if (end == string::npos)
+        {
+            _discarded = content.size() - pos;
+            break;
+        }
+        ++lineno;
+        json record = json::parse(content.begin() + pos, content.begin() + end, nullptr, false);
+        bool applied = false;
+        try
+        {
+            applied = !record.is_discarded() && apply(record);
+        }
+        catch (const json::exception &)
+        {
+            applied = false;
+        }
+        if (!applied)
+        {
+            *error = path + ": bad record at line " + to_string(lineno);
+            return false;
+        }
+        pos = end + 1;
+        ++_replayed;
+    }
+    return compact(error);
+}
+
+bool LogStorage::compact(string *error)
+{
+    string tmpPath = _path + ".tmp";
+    FILE *file = fopen(tmpPath.c_str(), "w");
+    if (file == nullptr)
+    {
+        *error = "open " + tmpPath + ": " + strerror(errno);
+        return false;
+    }
+
+    bool ok = true;
+    for (int id : sortedKeys(_users))
+    {
+        const UserRow &row = _users[id];
+        ok = ok && writeLine(file, {{"op", "user"}, {"id", id}, {"name", row.name}, {"password", row.password},
+                                    {"state", row.state}, {"friendver", row.friendver}, {"friends", row.friends}});
+    }
+    for (int id : sortedKeys(_groups))
+    {
+        const GroupRow &row = _groups[id];
+        json members = json::array();
+        for (const auto &member : row.members)
+        {
+            members.push_back({member.first, member.second});
+        }
+        ok = ok && writeLine(file, {{"op", "group"}, {"id", id}, {"name", row.name}, {"desc", row.desc},
+                                    {"version", row.version}, {"members", members}});
+    }
+    for (int userid : sortedKeys(_offlineMsgs))
+    {
+        for (const string &msg : _offlineMsgs[userid])
+        {
+            ok = ok && writeLine(file, {{"op", "offline"}, {"userid", userid}, {"msg", msg}});
+        }
+    }
+    // 新文件落盘之后才替换旧文件，中途失败旧文件还在
+    ok = ok && fflush(file) == 0 && fsync(fileno(file)) == 0;
+    ok = (fclose(file) == 0) && ok;
+    if (!ok || rename(tmpPath.c_str(), _path.c_str()) != 0)
+    {
+        *error = "write " + tmpPath + ": " + strerror(errno);
+        return false;
+    }
+
+    _file = fopen(_path.c_str(), "a");
+    if (_file == nullptr)
+    {
+        *error = "open " + _path + ": " + strerror(errno);
+        return false;
+    }
+    return true;
+}
+
+bool LogStorage::apply(const json &record, bool dryRun)
+{
+    string op = record.at("op").get<string>();
+    if (op == "user")
+    {
+        int id = record.at("id").get<int>();
+        string name = record.at("name").get<string>();
+        // 用户名唯一，和user表的UNIQUE约束一样
+        if (id <= 0 || _users.count(id) != 0 || _userNames.count(name) != 0)
+        {
+            return false;
+        }
+        if (dryRun)
+        {
+            return true;
+        }
+        UserRow &row = _users[id];
+        row.name = name;
+        row.password = record.at("password").get<string>();
+        row.state = record.value("state", string("offline"));
+        row.friendver = record.value("friendver", 0);
+        if (record.contains("friends"))
+        {
+            row.friends = record["friends"].get<vector<int>>();
+        }
+        _userNames[name] = id;
+        _nextUserId = max(_nextUserId, id + 1);
+        return true;
+    }
+    if (op == "state")
+    {
+        auto it = _users.find(record.at("id").get<int>());
+        if (it == _users.end())
+        {
+            return false;
+        }
+        string state = record.at("state").get<string>();
+        if (!dryRun)
+        {
+            it->second.state = state;
+        }
+        return true;
+    }
+    if (op == "reset")
+    {
+        if (dryRun)
+        {
+            return true;
+        }
+        for (auto &item : _users)
+        {
+            if (item.second.state == "online")
+            {
+                item.second.state = "offline";
+            }
+        }
+        return true;
+    }
+    if (op == "friend")
+    {
+        int userid = record.at("userid").get<int>();
+        int friendid = record.at("friendid").get<int>();
+        auto it = _users.find(userid);
+        // (userid, friendid)是主键，重复添加失败，版本号不变
+        if (it == _users.end() || _users.count(friendid) == 0 || contains(it->second.friends, friendid))
+        {
+            return false;
+        }
+        if (dryRun)
+        {
+            return true;
+        }
+        it->second.friends.push_back(friendid);
+        ++it->second.friendver;
+        return true;
+    }
+    if (op == "group")
+    {
+        int id = record.at("id").get<int>();
+        if (id <= 0 || _groups.count(id) != 0)
+        {
+            return false;
+        }
+        // 先检查完所有成员再修改，不合法的记录不留下一半
+        vector<pair<int, string>> members;
+        if (record.contains("members"))
+        {
+            for (const json &member : record["members"])
+            {
+                int userid = member.at(0).get<int>();
+                if (_users.count(userid) == 0)
+                {
+                    return false;
+                }
+                members.push_back({userid, member.at(1).get<string>()});
+            }
+        }
+        string name = record.at("name").get<string>();
+        string desc = record.value("desc", string());
+        int version = record.value("version", 0);
+        if (dryRun)
+        {
+            return true;
+        }
+        GroupRow &row = _groups[id];
+        row.name = name;
+        row.desc = desc;
+        row.version = version;
+        for (const auto &member : members)
+        {
+            _users[member.first].groups.push_back(id);
+        }
+        row.members = std::move(members);
+        _nextGroupId = max(_nextGroupId, id + 1);
+        return true;
+    }
+    if (op == "member")
+    {
+        int groupid = record.at("groupid").get<int>();
+        int userid = record.at("userid").get<int>();
+        auto group = _groups.find(groupid);
+        auto user = _users.find(userid);
+        if (group == _groups.end() || user == _users.end() || contains(user->second.groups, groupid))
+        {
+            return false;
+        }
+        string role = record.at("role").get<string>();
+        if (dryRun)
+        {
+            return true;
+        }
+        group->second.members.push_back({userid, role});
+        ++group->second.version;
+        user->second.groups.push_back(groupid);
+        return true;
+    }
+    if (op == "offline")
+    {
+        int userid = record.at("userid").get<int>();
+        string msg = record.at("msg").get<string>();
+        if (!dryRun)
+        {
+            _offlineMsgs[userid].push_back(std::move(msg));
+        }
+        return true;
+    }
+    if (op == "removeoffline")
+    {
+        int userid = record.at("userid").get<int>();
+        if (!dryRun)
+        {
+            _offlineMsgs.erase(userid);
+        }
+        return true;
+    }
+    return false;
+}
+
+bool LogStorage::commit(const json &record)
+{
+    // 先序列化：字符串不是合法的UTF-8时dump会抛异常，这时内存和日志都还没有改
+    string line;
+    try
+    {
+        line = record.dump();
+    }
+    catch (const json::exception &)
+    {
+        Metrics::add(kAppendErrors);
+        return false;
+    }
+    line.push_back('\n');
+    if (_file == nullptr || !apply(record, true))
+    {
+        return false;
+    }
+
+    // 写到内核缓冲就返回，进程崩溃不丢数据，机器掉电可能丢最后几条
+    {
+        ScopedTimer timer(kAppendUs);
+        if (!writeLine(_file, line) || fflush(_file) != 0)
+        {
+            // 可能写了半行，之后不再追加，半行留在文件末尾，下次open时当成不完整的记录丢掉
+            Metrics::add(kAppendErrors);
+            fclose(_file);
+            _file = nullptr;
+            return false;
+        }
+    }
+    return apply(record);
+}
+
+bool LogStorage::insertUser(User &user)
+{
+    lock_guard<mutex> lock(_mutex);
+    int id = _nextUserId;
+    if (!commit({{"op", "user"}, {"id", id}, {"name", user.getName()}, {"password", user.getPwd()},
+                 {"state", user.getState()}}))
+    {
+        return false;
+    }
+    user.setId(id);
+    return true;
+}
+
+User LogStorage::queryUser(int id)
+{
+    lock_guard<mutex> lock(_mutex);
+    auto it = _users.find(id);
+    if (it == _users.end())
+    {
+        return User();
+    }
+    return User(id, it->second.name, it->second.password, it->second.state);
+}
+
+bool LogStorage::updateUserState(int id, const string &state)
+{
+    lock_guard<mutex> lock(_mutex);
+    auto it = _users.find(id);
+    // 状态没变不写日志
+    if (it != _users.end() && it->second.state == state)
+    {
+        return true;
+    }
+    return commit({{"op", "state"}, {"id", id}, {"state", state}});
+}
+
+void LogStorage::resetUserState()
+{
+    lock_guard<mutex> lock(_mutex);
+    commit({{"op", "reset"}});
+}
+
+void LogStorage::insertFriend(int userid, int friendid)
+{
+    lock_guard<mutex> lock(_mutex);
+    commit({{"op", "friend"}, {"userid", userid}, {"friendid", friendid}});
+}
+
+vector<User> LogStorage::queryFriends(int userid)
+{
+    lock_guard<mutex> lock(_mutex);
+    vector<User> vec;
+    auto it = _users.find(userid);
+    if (it == _users.end())
+    {
+        return vec;
+    }
+    for (int friendid : it->second.friends)
+    {
+        const UserRow &row = _users[friendid];
+        vec.push_back(User(friendid, row.name, "", row.state));
+    }
+    return vec;
+}
+
+int LogStorage::queryFriendVersion(int userid)
+{
+    lock_guard<mutex> lock(_mutex);
+    auto it = _users.find(userid);
+    return it == _users.end() ? 0 : it->second.friendver;
+}
+
+bool LogStorage::createGroup(Group &group)
+{
+    lock_guard<mutex> lock(_mutex);
+    int id = _nextGroupId;
+    if (!commit({{"op", "group"}, {"id", id}, {"name", group.getName()}, {"desc", group.getDesc()}}))
+    {
+        return false;
+    }
+    group.setId(id);
+    return true;
+}
+
+void LogStorage::addGroup(int userid, int groupid, const string &role)
+{
+    lock_guard<mutex> lock(_mutex);
+    commit({{"op", "member"}, {"groupid", groupid}, {"userid", userid}, {"role", role}});
+}
+
+vector<Group> LogStorage::queryGroups(int userid, const unordered_map<int, int> &knownVersions)
+{
+    lock_guard<mutex> lock(_mutex);
+    vector<Group> groupVec;
+    auto user = _users.find(userid);
+    if (user == _users.end())
+    {
+        return groupVec;
+    }
+    for (int groupid : user->second.groups)
+    {
+        const GroupRow &row = _groups[groupid];
+        groupVec.push_back(Group(groupid, row.name, row.desc, row.version));
+        auto known = knownVersions.find(groupid);
+        if (known != knownVersions.end() && known->second == row.version)
+        {
+            continue;
+        }
+        for (const auto &member : row.members)
+        {
+            const UserRow &memberRow = _users[member.first];
+            GroupUser groupUser;
+            groupUser.setId(member.first);
+            groupUser.setName(memberRow.name);
+            groupUser.setState(memberRow.state);
+            groupUser.setRole(member.second);
+            groupVec.back().getUsers().push_back(groupUser);
+        }
+    }
+    return groupVec;
+}
+
+vector<int> LogStorage::queryGroupUsers(int userid, int groupid)
+{
+    lock_guard<mutex> lock(_mutex);
+    vector<int> idVec;
+    auto it = _groups.find(groupid);
+    if (it == _groups.end())
+    {
+        return idVec;
+    }
+    idVec.reserve(it->second.members.size());
+    for (const auto &member : it->second.members)
+    {
+        if (member.first != userid)
+        {
+            idVec.push_back(member.first);
+        }
+    }
+    return idVec;
+}
+
+void LogStorage::insertOfflineMsg(int userid, const string &msg)
+{
+    lock_guard<mutex> lock(_mutex);
+    commit({{"op", "offline"}, {"userid", userid}, {"msg", msg}});
+}
+
+void LogStorage::removeOfflineMsg(int userid)
+{
+    lock_guard<mutex> lock(_mutex);
+    if (_offlineMsgs.count(userid) != 0)
+    {
+        commit({{"op", "removeoffline"}, {"userid", userid}});
+    }
+}
+
+vector<string> LogStorage::queryOfflineMsg(int userid)
+{
+    lock_guard<mutex> lock(_mutex);
+    auto it = _offlineMsgs.find(userid);
+    return it == _offlineMsgs.end() ? vector<string>() : it->second;
+}
@@ -0,0 +1,389 @@
+#include "mysqlstorage.hpp"
+#include "db.h"
+
+/*
+sprintf 只是把变量拼接进 SQL 字符串，容易被 SQL 注入攻击，字符串参数长了还会写穿 char sql[1024]。
+整数参数仍然用sprintf拼接；字符串参数（用户名、密码、群名、离线消息）用quote()按连接的字符集转义，
+拼到按参数长度分配的std::string里。
+*/
+namespace
+{
+
+// 转义字符串参数并加上单引号，mysql_real_escape_string最多把每个字节变成两个字节
+string quote(MYSQL *conn, const string &value)
+{
+    string out(value.size() * 2 + 3, '\0');
+    out[0] = '\'';
+    unsigned long len = mysql_real_escape_string(conn, &out[1], value.data(), value.size());
+    out[len + 1] = '\'';
+    out.resize(len + 2);
+    return out;
+}
+
+} // namespace
+
+string MySQLStorage::insertUserSql(MYSQL *conn, User &user)
+{
+    // 字符串常量在 SQL 里必须用单引号，而不是双引号
+    return "insert into user(name, password, state) values(" + quote(conn, user.getName()) + ", " +
+           quote(conn, user.getPwd()) + ", " + quote(conn, user.getState()) + ")";
+}
+
+string MySQLStorage::updateUserStateSql(MYSQL *conn, int id, const string &state)
+{
+    return "update user set state = " + quote(conn, state) + " where id = '" + to_string(id) + "'";
+}
+
+string MySQLStorage::createGroupSql(MYSQL *conn, Group &group)
+{
+    return "insert into ALLGroup(groupname, groupdesc) values(" + quote(conn, group.getName()) + ", " +
+           quote(conn, group.getDesc()) + ")";
+}
+
+string MySQLStorage::addGroupSql(MYSQL *conn, int userid, int groupid, const string &role)
+{
+    return "insert into GroupUser values('" + to_string(groupid) + "', '" + to_string(userid) + "', " +
+           quote(conn, role) + ")";
+}
+
+string MySQLStorage::insertOfflineMsgSql(MYSQL *conn, int userid, const string &msg)
+{
+    // 消息最长是一帧（64KB），不能放进固定大小的缓冲区
+    return "insert into offlineMessage(userid, message) values(" + to_string(userid) + ", " + quote(conn, msg) + ")";
+}
+
+string MySQLStorage::groupMembersSql(int groupid)
+{
+    char sql[1024] = {0};
+    sprintf(sql, "select a.id, a.name, a.state, b.grouprole from user a inner join \
+        GroupUser b on b.userid = a.id where b.groupid=%d", groupid);
+    return sql;
+}
+
+// User表的增加方法
+bool MySQLStorage::insertUser(User &user)
+{
+    MySQL mysql;
+    if(mysql.connect())
+    {
+        // 1 组装sql语句
+        string sql = insertUserSql(mysql.getConnection(), user);
+        if(mysql.update(sql))
+        {
+            // 获取插入成功的用户数据生成的主键id
+            // mysql_insert_id获取的是当前连接上最近一次插入生成的自增id，不会拿到其他连接插入的id
+            user.setId(mysql_insert_id(mysql.getConnection()));
+            return true;
+        }
+    }
+    return false;
+}
+
+// 根据用户id查询用户信息
+User MySQLStorage::queryUser(int id)
+{
+    // 1 组装sql语句
+    char sql[1024] = {0};
+    sprintf(sql, "select * from user where id = %d", id);
+
+    MySQL mysql;
+    if(mysql.connect())
+    {
+        MYSQL_RES* res = mysql.query(sql);
+        if(res != nullptr)
+        {
+            MYSQL_ROW row = mysql_fetch_row(res);
+            if(row != nullptr)
+            {
+                User user;
+                user.setId(atoi(row[0]));
+                user.setName(row[1]);
+                user.setPwd(row[2]);
+                user.setState(row[3]);
+
+                mysql_free_result(res);
+                return user;
+            }
+            mysql_free_result(res);
+        }
+    }
+    return User(); // 返回一个默认构造的User对象，表示查询失败
+}
+
+// 更新用户的状态信息
+bool MySQLStorage::updateUserState(int id, const string &state)
+{
+    MySQL mysql;
+    if(mysql.connect())
+    {
+        // 1 组装sql语句
+        string sql = updateUserStateSql(mysql.getConnection(), id, state);
+        if(mysql.update(sql))
+        {
+            return true; // 更新成功
+        }
+    }
+    return false;
+}
+
+// 重置状态的用户信息
+void MySQLStorage::resetUserState()
+{
+    // 1 组装sql语句
+    char sql[1024] = "update user set state = 'offline' where state = 'online'";
+
+    MySQL mysql;
+    if(mysql.connect())
+    {
+        mysql.update(sql);
+    }
+}
+
+// 添加好友关系
+void MySQLStorage::insertFriend(int userid, int friendid)
+{
+    // 1. 组装sql语句
+    char sql[1024] = {0};
+    sprintf(sql, "insert into friend values(%d, %d)", userid, friendid);
+
+    MySQL mysql;
+    if(mysql.connect())
+    {
+        if(mysql.update(sql))
+        {
+            // 好友列表变了，客户端下次登录时需要同步
+            sprintf(sql, "update user set friendver = friendver + 1 where id = %d", userid);
+            mysql.update(sql);
+        }
+    }
+}
+
+// 返回用户的好友列表
+vector<User> MySQLStorage::queryFriends(int userid)
+{
+    // 1. 组装sql语句
+    char sql[1024] = {0};
+    sprintf(sql, "select a.id, a.name, a.state from user a inner join \
+        friend b on b.friendid = a.id where b.userid=%d", userid);
+
+    MySQL mysql;
+    vector<User> vec;
+    if(mysql.connect())
+    {
+        MYSQL_RES* res = mysql.query(sql);
+        if(res != nullptr)
+        {
+            MYSQL_ROW row;
+            while((row = mysql_fetch_row(res)) != nullptr)
+            {
+                User user;
+                user.setId(atoi(row[0]));
+                user.setName(row[1]);
+                user.setState(row[2]);
+                vec.push_back(user);
+            }
+            mysql_free_result(res);
+        }
+    }
+    return vec;
+}
+
+// 返回用户好友列表的版本号
+int MySQLStorage::queryFriendVersion(int userid)
+{
+    char sql[1024] = {0};
+    sprintf(sql, "select friendver from user where id = %d", userid);
+
+    int version = 0;
+    MySQL mysql;
+    if(mysql.connect())
+    {
+        MYSQL_RES *res = mysql.query(sql);
+        if(res != nullptr)
+        {
+            MYSQL_ROW row = mysql_fetch_row(res);
+            if(row != nullptr && row[0] != nullptr)
+            {
+                version = atoi(row[0]);
+            }
+            mysql_free_result(res);
+        }
+    }
+    return version;
+}
+
+// 创建群组
+bool MySQLStorage::createGroup(Group &group)
+{
+    MySQL mysql;
+    if(mysql.connect())
+    {
+        // 1 组装sql语句
+        string sql = createGroupSql(mysql.getConnection(), group);
+        if(mysql.update(sql))
+        {
+            group.setId(mysql_insert_id(mysql.getConnection()));
+            return true; // 插入成功
+        }
+    }
+    return false; // 插入失败
+}
+
+// 加入群组
+void MySQLStorage::addGroup(int userid, int groupid, const string &role)
+{
+    MySQL mysql;
+    if(mysql.connect())
+    {
+        // 1 组装sql语句
+        string sql = addGroupSql(mysql.getConnection(), userid, groupid, role);
+        if(mysql.update(sql))
+        {
+            // 群成员变了，群里的客户端下次登录时需要同步这个群
+            char version[128] = {0};
+            sprintf(version, "update ALLGroup set version = version + 1 where id = %d", groupid);
+            mysql.update(version);
+        }
+    }
+}
+
+// 查询用户所在群组信息，客户端已有的最新版本的群组不查询群成员
+vector<Group> MySQLStorage::queryGroups(int userid, const unordered_map<int, int> &knownVersions)
+{
+    /*
+    1. 先根据userid在groupuser表中查询出该用户所属的群组信息
+    2. 再根据群组信息，查询属于该群组的所有用户的userid，并且和user表进行多表联合查询，查询用户的详细信息
+    */
+
+    // 1 组装sql语句
+    char sql[1024] = {0};
+    // 先读版本再读群成员，并发修改时客户端拿到的版本只会偏旧，下次登录再同步一次
+    sprintf(sql, "select a.id, a.groupname, a.groupdesc, a.version from ALLGroup a inner join \
+        GroupUser b on a.id = b.groupid where b.userid=%d", userid);
+
+    vector<Group> groupVec;
+
+    MySQL mysql;
+    if(mysql.connect())
+    {
+        MYSQL_RES *res = mysql.query(sql);
+        if(res != nullptr)
+        {
+            MYSQL_ROW row;
+            // 查出userid所有的群组信息
+            while((row = mysql_fetch_row(res)) != nullptr)
+            {
+                Group group;
+                group.setId(atoi(row[0]));
+                group.setName(row[1]);
+                group.setDesc(row[2]);
+                group.setVersion(row[3] != nullptr ? atoi(row[3]) : 0);
+                groupVec.push_back(group);
+            }
+            mysql_free_result(res);
+        }
+    }
+
+    // 查询群组的用户信息
+    for(Group &group : groupVec)
+    {
+        auto it = knownVersions.find(group.getId());
+        if(it != knownVersions.end() && it->second == group.getVersion())
+        {
+            continue;
+        }
+        MYSQL_RES *res = mysql.query(groupMembersSql(group.getId()));
+        if(res != nullptr)
+        {
+            MYSQL_ROW row;
+            // 查处groupid群组的所有用户信息
+            while((row = mysql_fetch_row(res)) != nullptr)
+            {
+                GroupUser user;
+                user.setId(atoi(row[0]));
+                user.setName(row[1]);
+                user.setState(row[2]);
+                user.setRole(row[3]);
+                group.getUsers().push_back(user);
+            }
+            mysql_free_result(res);
+        }
+    }
+    return groupVec;
+}
+
+// 根据指定的groupid查询群组用户id列表， 除userid自己， 主要用户群聊业务给群组其他成员群发消息
+vector<int> MySQLStorage::queryGroupUsers(int userid, int groupid)
+{
+    char sql[1024] = {0};
+    sprintf(sql, "select userid from GroupUser where groupid=%d and userid != %d", groupid, userid);
+
+    vector<int> idVec;
+    MySQL mysql;
+    if(mysql.connect())
+    {
+        MYSQL_RES *res = mysql.query(sql);
+        if(res != nullptr)
+        {
+            MYSQL_ROW row;
+            while((row = mysql_fetch_row(res)) != nullptr)
+            {
+                idVec.push_back(atoi(row[0]));
+            }
+            mysql_free_result(res);
+        }
+    }
+    return idVec;
+}
+
+// 存储用户的离线消息
+void MySQLStorage::insertOfflineMsg(int userid, const string &msg)
+{
+    MySQL mysql;
+    if(mysql.connect())
+    {
+        // 1. 组装sql语句
+        string sql = insertOfflineMsgSql(mysql.getConnection(), userid, msg);
+        mysql.update(sql);
+    }
+}
+
+// 删除用户的离线消息
+void MySQLStorage::removeOfflineMsg(int userid)
+{
+    // 1. 组装sql语句
+    char sql[1024] = {0};
+    sprintf(sql, "delete from offlineMessage where userid=%d", userid);
+
+    MySQL mysql;
+    if(mysql.connect())
+    {
+        mysql.update(sql);
+    }
+}
+
+// 查询用户的离线消息
+vector<string> MySQLStorage::queryOfflineMsg(int userid)
+{
+    // 1. 组装sql语句
+    char sql[1024] = {0};
+    sprintf(sql, "select message from offlineMessage where userid=%d", userid);
+
+    MySQL mysql;
+    vector<string> vec;
+    if(mysql.connect())
+    {
+        MYSQL_RES* res = mysql.query(sql);
+        if(res != nullptr)
+        {
+            MYSQL_ROW row;
+            // 把userid用户的所有离线消息放入vec中返回
+            while((row = mysql_fetch_row(res)) != nullptr)
+            {
+                vec.push_back(row[0]);
+            }
+            mysql_free_result(res);
+        }
+    }
+    return vec;
+}
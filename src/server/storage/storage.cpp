@@ -0,0 +1,18 @@
+#include "storage.hpp"
+
+namespace
+{
+
+Storage *g_storage = nullptr;
+
+} // namespace
+
+Storage *Storage::instance()
+{
+    return g_storage;
+}
+
+void Storage::setInstance(Storage *storage)
+{
+    g_storage = storage;
+}
@@ -0,0 +1,252 @@
+#include "tracer.hpp"
+#include "metrics.hpp"
+#include "public.hpp"
+
+#include <muduo/base/CurrentThread.h>
+#include <muduo/base/Timestamp.h>
+
+#include <atomic>
+#include <mutex>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+namespace
+{
+
+// 追加在json文本末尾的trace字段：,"trace":"<16位十六进制id>-<16位十进制publish时间>"
+// 定长，收到时只比较末尾，不带trace的消息不用扫描整个文本
+const char kFieldPrefix[] = ",\"trace\":\"";
+const size_t kPrefixLen = sizeof kFieldPrefix - 1;
+const size_t kFieldLen = kPrefixLen + 16 + 1 + 16 + 1;
+
+mutex g_fileMutex;
+FILE *g_file = nullptr;
+int g_pid = 0;
+// 0表示不追踪
+atomic<int> g_sampleEvery{0};
+atomic<uint64_t> g_nextId{0};
+
+// 每个线程自己数采样
+thread_local unsigned t_counter = 0;
+thread_local Tracer::Scope *t_current = nullptr;
+
+const char *kStageHelp = "Per-stage latency of sampled chat messages in microseconds";
+const Metrics::Id kQueueUs = Metrics::histogram("chat_trace_stage_us", kStageHelp, "stage=\"queue\"");
+const Metrics::Id kPresenceUs = Metrics::histogram("chat_trace_stage_us", kStageHelp, "stage=\"presence\"");
+const Metrics::Id kPublishUs = Metrics::histogram("chat_trace_stage_us", kStageHelp, "stage=\"publish\"");
+const Metrics::Id kHandlerUs = Metrics::histogram("chat_trace_stage_us", kStageHelp, "stage=\"handler\"");
+const Metrics::Id kRedisUs = Metrics::histogram("chat_trace_stage_us", kStageHelp, "stage=\"redis\"");
+const Metrics::Id kRemoteSendUs = Metrics::histogram("chat_trace_stage_us", kStageHelp, "stage=\"remote_send\"");
+const Metrics::Id kSampled = Metrics::counter("chat_trace_sampled_total", "Chat messages sampled for tracing");
+const Metrics::Id kRemote = Metrics::counter("chat_trace_remote_total", "Traced messages received from redis");
+
+int64_t nowUs()
+{
+    return muduo::Timestamp::now().microSecondsSinceEpoch();
+}
+
+// 序号打散成trace id，不同节点的种子不同
+uint64_t newTraceId()
+{
+    uint64_t z = g_nextId.fetch_add(0x9e3779b97f4a7c15ULL, memory_order_relaxed);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+// 一个完整的时间段（ph X）
+void appendSlice(string *out, const char *name, int64_t begin, int64_t end, uint64_t id)
+{
+    char buf[256];
+    snprintf(buf, sizeof buf,
+             "{\"name\":\"%s\",\"cat\":\"chat\",\"ph\":\"X\",\"ts\":%lld,\"dur\":%lld,\"pid\":%d,\"tid\":%d,"
+             "\"args\":{\"trace\":\"%016llx\"}},\n",
+             name, static_cast<long long>(begin), static_cast<long long>(end - begin), g_pid,
+             muduo::CurrentThread::tid(), static_cast<unsigned long long>(id));
+    out->append(buf);
+}
+
+// 跨节点的箭头，phase是s（起点）或者f（终点），绑定到ts所在的时间段
+void appendFlow(string *out, char phase, int64_t ts, uint64_t id)
+{
+    char buf[192];
+    snprintf(buf, sizeof buf,
+             "{\"name\":\"redis\",\"cat\":\"chat\",\"ph\":\"%c\",\"bp\":\"e\",\"id\":\"0x%016llx\",\"ts\":%lld,\"pid\":%d,\"tid\":%d},\n",
+             phase, static_cast<unsigned long long>(id), static_cast<long long>(ts), g_pid, muduo::CurrentThread::tid());
+    out->append(buf);
+}
+
+void writeEvents(const string &events)
+{
+    lock_guard<mutex> lock(g_fileMutex);
+    if (g_file != nullptr)
+    {
+        fwrite(events.data(), 1, events.size(), g_file);
+        fflush(g_file);
+    }
+}
+
+} // namespace
+
+bool Tracer::start(const string &path, int sampleEvery)
+{
+    FILE *file = fopen(path.c_str(), "a");
+    if (file == nullptr)
+    {
+        return false;
+    }
+    g_pid = static_cast<int>(getpid());
+    g_nextId = static_cast<uint64_t>(nowUs()) ^ (static_cast<uint64_t>(g_pid) << 40);
+
+    // json数组格式允许没有结尾的]，热升级之后新进程接着追加
+    string header;
+    fseek(file, 0, SEEK_END);
+    if (ftell(file) == 0)
+    {
+        header = "[\n";
+    }
+    char buf[128];
+    snprintf(buf, sizeof buf, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"ChatServer %d\"}},\n",
+             g_pid, g_pid);
+    header += buf;
+    {
+        lock_guard<mutex> lock(g_fileMutex);
+        if (g_file != nullptr)
+        {
+            fclose(g_file);
+        }
+        g_file = file;
+    }
+    writeEvents(header);
+    g_sampleEvery = sampleEvery;
+    return true;
+}
+
+Tracer::Scope::Scope(int msgid, int64_t receiveUs)
+    : _sampled(false), _msgid(msgid), _id(0), _injectUs(0)
+{
+    int every = g_sampleEvery.load(memory_order_relaxed);
+    if (every <= 0 || (msgid != ONE_CHAT_MSG && msgid != GROUP_CHAT_MSG) || ++t_counter % every != 0)
+    {
+        return;
+    }
+    _sampled = true;
+    _id = newTraceId();
+    for (int64_t &stage : _stages)
+    {
+        stage = 0;
+    }
+    _stages[kReceive] = receiveUs;
+    _stages[kDispatch] = nowUs();
+    t_current = this;
+    Metrics::add(kSampled);
+}
+
+Tracer::Scope::~Scope()
+{
+    if (!_sampled)
+    {
+        return;
+    }
+    t_current = nullptr;
+    int64_t end = nowUs();
+    int64_t receive = _stages[kReceive];
+    int64_t dispatch = _stages[kDispatch];
+    int64_t presence = _stages[kPresence];
+    int64_t publish = _stages[kPublish];
+
+    Metrics::observe(kQueueUs, dispatch - receive);
+    Metrics::observe(kHandlerUs, end - dispatch);
+
+    // 整条消息一个时间段，下面是各个阶段
+    string events;
+    appendSlice(&events, _msgid == ONE_CHAT_MSG ? "one_chat" : "group_chat", receive, end, _id);
+    appendSlice(&events, "queue", receive, dispatch, _id);
+    if (presence != 0)
+    {
+        Metrics::observe(kPresenceUs, presence - dispatch);
+        appendSlice(&events, "presence", dispatch, presence, _id);
+        if (publish >= presence)
+        {
+            Metrics::observe(kPublishUs, publish - presence);
+            appendSlice(&events, "publish", presence, publish, _id);
+        }
+    }
+    if (_injectUs != 0)
+    {
+        appendFlow(&events, 's', _injectUs, _id);
+    }
+    writeEvents(events);
+}
+
+void Tracer::mark(Stage stage)
+{
+    Scope *scope = t_current;
+    if (scope != nullptr && scope->_stages[stage] == 0)
+    {
+        scope->_stages[stage] = nowUs();
+    }
+}
+
+string Tracer::inject(const string &text)
+{
+    Scope *scope = t_current;
+    if (scope == nullptr || text.size() < 2 || text.back() != '}')
+    {
+        return text;
+    }
+    int64_t now = nowUs();
+    if (scope->_injectUs == 0)
+    {
+        scope->_injectUs = now;
+    }
+    char field[64];
+    snprintf(field, sizeof field, "%s%016llx-%016lld\"", kFieldPrefix,
+             static_cast<unsigned long long>(scope->_id), static_cast<long long>(now));
+
+    string out;
+    out.reserve(text.size() + kFieldLen);
+    out.append(text, 0, text.size() - 1);
+    out.append(field, kFieldLen);
+    out.push_back('}');
+    return out;
+}
+
+bool Tracer::extract(string *text, Remote *remote)
+{
+    size_t size = text->size();
+    if (size < kFieldLen + 2 || (*text)[size - 1] != '}')
+    {
+        return false;
+    }
+    size_t pos = size - 1 - kFieldLen;
+    if (text->compare(pos, kPrefixLen, kFieldPrefix) != 0)
+    {
+        return false;
+    }
+    const char *value = text->c_str() + pos + kPrefixLen;
+    remote->id = strtoull(value, nullptr, 16);
+    remote->publishUs = strtoll(value + 17, nullptr, 10);
+    remote->receiveUs = nowUs();
+    text->erase(pos, kFieldLen);
+    return true;
+}
+
+void Tracer::finishRemote(const Remote &remote)
+{
+    // 本节点没有开启追踪时只去掉trace字段，不输出
+    if (g_sampleEvery.load(memory_order_relaxed) <= 0)
+    {
+        return;
+    }
+    int64_t send = nowUs();
+    Metrics::add(kRemote);
+    Metrics::observe(kRedisUs, remote.receiveUs - remote.publishUs);
+    Metrics::observe(kRemoteSendUs, send - remote.receiveUs);
+
+    string events;
+    appendSlice(&events, "remote_send", remote.receiveUs, send, remote.id);
+    appendFlow(&events, 'f', remote.receiveUs, remote.id);
+    writeEvents(events);
+}
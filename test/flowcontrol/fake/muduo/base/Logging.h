@@ -0,0 +1,22 @@
+#ifndef FAKE_MUDUO_BASE_LOGGING_H
+#define FAKE_MUDUO_BASE_LOGGING_H
+
+// FlowControlTest用的替身，日志全部丢掉
+namespace muduo
+{
+
+struct NullLogStream
+{
+    template <typename T>
+    NullLogStream &operator<<(const T &)
+    {
+        return *this;
+    }
+};
+
+} // namespace muduo
+
+#define LOG_INFO muduo::NullLogStream()
+#define LOG_WARN muduo::NullLogStream()
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef FAKE_MUDUO_BASE_STRINGPIECE_H
+#define FAKE_MUDUO_BASE_STRINGPIECE_H
+
+#include <string.h>
+#include <string>
+
+// FlowControlTest用的替身，只有FlowControl用到的接口
+namespace muduo
+{
+
+class StringPiece
+{
+public:
+    StringPiece(const char *str) : _ptr(str), _length(strlen(str)) {}
+    StringPiece(const std::string &str) : _ptr(str.data()), _length(str.size()) {}
+    StringPiece(const char *offset, int len) : _ptr(offset), _length(len) {}
+
+    const char *data() const { return _ptr; }
+    size_t size() const { return _length; }
+    std::string as_string() const { return std::string(_ptr, _length); }
+
+private:
+    const char *_ptr;
+    size_t _length;
+};
+
+} // namespace muduo
+
+#endif
@@ -0,0 +1,26 @@
+#ifndef FAKE_MUDUO_NET_BUFFER_H
+#define FAKE_MUDUO_NET_BUFFER_H
+
+#include <string>
+
+// FlowControlTest用的替身，输出缓冲区只记内容
+namespace muduo
+{
+namespace net
+{
+
+class Buffer
+{
+public:
+    size_t readableBytes() const { return _data.size(); }
+    void append(const char *data, size_t len) { _data.append(data, len); }
+    void retrieve(size_t len) { _data.erase(0, len); }
+
+private:
+    std::string _data;
+};
+
+} // namespace net
+} // namespace muduo
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef FAKE_MUDUO_NET_EVENTLOOP_H
+#define FAKE_MUDUO_NET_EVENTLOOP_H
+
+#include <functional>
+#include <vector>
+
+/*
+FlowControlTest用的替身，不起线程：inLoopThread表示调用方当前是不是在loop线程里，
+不在loop线程里runInLoop的回调和queueInLoop的回调都排队，runPending时按顺序执行。
+*/
+namespace muduo
+{
+namespace net
+{
+
+class EventLoop
+{
+public:
+    typedef std::function<void()> Functor;
+
+    bool isInLoopThread() const { return inLoopThread; }
+
+    void runInLoop(Functor cb)
+    {
+        if (inLoopThread)
+        {
+            cb();
+        }
+        else
+        {
+            queueInLoop(std::move(cb));
+        }
+    }
+
+    void queueInLoop(Functor cb) { _pending.push_back(std::move(cb)); }
+
+    // 在loop线程里执行排队的回调，回调里又排队的也执行完
+    void runPending()
+    {
+        bool saved = inLoopThread;
+        inLoopThread = true;
+        while (!_pending.empty())
+        {
+            std::vector<Functor> functors;
+            functors.swap(_pending);
+            for (Functor &functor : functors)
+            {
+                functor();
+            }
+        }
+        inLoopThread = saved;
+    }
+
+    size_t pendingCount() const { return _pending.size(); }
+
+    bool inLoopThread = true;
+
+private:
+    std::vector<Functor> _pending;
+};
+
+} // namespace net
+} // namespace muduo
+
+#endif
@@ -0,0 +1,93 @@
+#ifndef FAKE_MUDUO_NET_TCPCONNECTION_H
+#define FAKE_MUDUO_NET_TCPCONNECTION_H
+
+#include <muduo/base/StringPiece.h>
+#include <muduo/net/Buffer.h>
+#include <muduo/net/EventLoop.h>
+
+#include <boost/any.hpp>
+#include <functional>
+#include <memory>
+#include <string>
+
+/*
+FlowControlTest用的替身：对端不读，send的数据全部留在输出缓冲区里，drain模拟对端收走数据。
+高水位回调和写完成回调和muduo一样用queueInLoop排队，不在send里直接调用。
+*/
+namespace muduo
+{
+namespace net
+{
+
+class TcpConnection;
+typedef std::shared_ptr<TcpConnection> TcpConnectionPtr;
+typedef std::function<void(const TcpConnectionPtr &)> WriteCompleteCallback;
+typedef std::function<void(const TcpConnectionPtr &, size_t)> HighWaterMarkCallback;
+
+class TcpConnection : public std::enable_shared_from_this<TcpConnection>
+{
+public:
+    TcpConnection(EventLoop *loop, const std::string &name) : _loop(loop), _name(name) {}
+
+    EventLoop *getLoop() const { return _loop; }
+    const std::string &name() const { return _name; }
+
+    void send(const StringPiece &message)
+    {
+        if (forceClosed)
+        {
+            return;
+        }
+        size_t oldLen = _output.readableBytes();
+        _output.append(message.data(), message.size());
+        size_t newLen = oldLen + message.size();
+        if (newLen >= _highWaterMark && oldLen < _highWaterMark && _highWaterMarkCallback)
+        {
+            _loop->queueInLoop(std::bind(_highWaterMarkCallback, shared_from_this(), newLen));
+        }
+    }
+
+    // 对端收走len字节，输出缓冲区写完时排队写完成回调
+    void drain(size_t len)
+    {
+        _output.retrieve(len);
+        if (_output.readableBytes() == 0 && _writeCompleteCallback)
+        {
+            _loop->queueInLoop(std::bind(_writeCompleteCallback, shared_from_this()));
+        }
+    }
+
+    Buffer *outputBuffer() { return &_output; }
+
+    void forceClose() { forceClosed = true; }
+    void stopRead() { reading = false; }
+    void startRead() { reading = true; }
+
+    void setHighWaterMarkCallback(const HighWaterMarkCallback &cb, size_t highWaterMark)
+    {
+        _highWaterMarkCallback = cb;
+        _highWaterMark = highWaterMark;
+    }
+    void setWriteCompleteCallback(const WriteCompleteCallback &cb) { _writeCompleteCallback = cb; }
+    bool hasWriteCompleteCallback() const { return static_cast<bool>(_writeCompleteCallback); }
+
+    void setContext(const boost::any &context) { _context = context; }
+    const boost::any &getContext() const { return _context; }
+
+    bool reading = true;
+    bool forceClosed = false;
+
+private:
+    EventLoop *_loop;
+    std::string _name;
+    Buffer _output;
+    size_t _highWaterMark = 64 * 1024 * 1024;
+    HighWaterMarkCallback _highWaterMarkCallback;
+    WriteCompleteCallback _writeCompleteCallback;
+    boost::any _context;
+};
+
+} // namespace net
+} // namespace muduo
+
+#endif
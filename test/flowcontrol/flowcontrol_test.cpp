@@ -0,0 +1,271 @@
+#include "flowcontrol.hpp"
+#include "session.hpp"
+
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+using namespace std;
+
+/*
+FlowControl的测试，连接是fake/下的TcpConnection替身：对端不读，数据都留在输出缓冲区里，
+高水位和写完成回调排在EventLoop替身里，runPending时执行。
+每种策略在拥塞时的处理、退出拥塞、硬上限、跨线程发送时pendingBytes的记账、冻结的连接。
+*/
+namespace
+{
+
+int g_failures = 0;
+
+#define CHECK(cond)                                                          \
+    do                                                                       \
+    {                                                                        \
+        if (!(cond))                                                         \
+        {                                                                    \
+            cerr << __FILE__ << ":" << __LINE__ << ": CHECK(" #cond ") failed" << endl; \
+            ++g_failures;                                                    \
+        }                                                                    \
+    } while (0)
+
+const size_t kHighWater = 100;
+const size_t kHardLimit = kHighWater * FlowControl::kHardLimitFactor;
+
+// 一条带Session的连接，按给定的策略配置FlowControl
+struct Fixture
+{
+    EventLoop loop;
+    TcpConnectionPtr conn;
+    Session *session;
+
+    explicit Fixture(FlowControl::Policy policy)
+    {
+        FlowControl::configure(policy, kHighWater);
+        conn = make_shared<TcpConnection>(&loop, "conn");
+        SessionPtr s = make_shared<Session>();
+        session = s.get();
+        conn->setContext(s);
+        FlowControl::attach(conn);
+    }
+
+    ~Fixture()
+    {
+        FlowControl::detach(conn);
+    }
+
+    FlowControl::Verdict send(size_t len, FlowControl::MsgClass cls)
+    {
+        return FlowControl::send(conn, string(len, 'x'), cls);
+    }
+
+    // 写满高水位，执行排队的高水位回调
+    void congest()
+    {
+        CHECK(send(kHighWater, FlowControl::kEssential) == FlowControl::kSent);
+        loop.runPending();
+        CHECK(session->flow.congested);
+    }
+
+    // 对端把输出缓冲区收完，执行排队的写完成回调
+    void drainAll()
+    {
+        conn->drain(conn->outputBuffer()->readableBytes());
+        loop.runPending();
+    }
+};
+
+void testSpill()
+{
+    Fixture f(FlowControl::kSpill);
+    CHECK(f.send(60, FlowControl::kChat) == FlowControl::kSent);
+    CHECK(f.session->flow.outputBytes == 60);
+    CHECK(!f.session->flow.congested);
+
+    // 超过高水位之后回调执行之前还不算拥塞
+    CHECK(f.send(60, FlowControl::kChat) == FlowControl::kSent);
+    CHECK(!f.session->flow.congested);
+    f.loop.runPending();
+    CHECK(f.session->flow.congested);
+    CHECK(f.session->flow.highWaterHits == 1);
+    CHECK(f.conn->hasWriteCompleteCallback());
+
+    // 拥塞时聊天消息改存离线消息，响应照常发送
+    CHECK(f.send(10, FlowControl::kChat) == FlowControl::kSpilled);
+    CHECK(f.send(10, FlowControl::kBulk) == FlowControl::kSpilled);
+    CHECK(f.send(10, FlowControl::kEssential) == FlowControl::kSent);
+    CHECK(f.session->flow.spilled == 2);
+    CHECK(f.conn->outputBuffer()->readableBytes() == 130);
+
+    // 写完之后退出拥塞状态，不再保留写完成回调
+    f.drainAll();
+    CHECK(!f.session->flow.congested);
+    CHECK(f.session->flow.outputBytes == 0);
+    CHECK(!f.conn->hasWriteCompleteCallback());
+    CHECK(f.send(10, FlowControl::kChat) == FlowControl::kSent);
+    CHECK(f.session->flow.peakBytes == 130);
+    CHECK(!f.conn->forceClosed);
+}
+
+void testDrop()
+{
+    Fixture f(FlowControl::kDrop);
+    f.congest();
+    CHECK(f.send(10, FlowControl::kBulk) == FlowControl::kDropped);
+    CHECK(f.send(10, FlowControl::kChat) == FlowControl::kSpilled);
+    CHECK(f.send(10, FlowControl::kEssential) == FlowControl::kSent);
+    CHECK(f.session->flow.dropped == 1);
+    CHECK(f.session->flow.spilled == 1);
+    f.drainAll();
+    CHECK(f.send(10, FlowControl::kBulk) == FlowControl::kSent);
+}
+
+void testPause()
+{
+    Fixture f(FlowControl::kPause);
+    f.congest();
+    // 暂停读，消息照常发送
+    CHECK(!f.conn->reading);
+    CHECK(f.session->flow.paused);
+    CHECK(f.send(10, FlowControl::kChat) == FlowControl::kSent);
+    CHECK(f.send(10, FlowControl::kBulk) == FlowControl::kSent);
+    CHECK(f.session->flow.spilled == 0 && f.session->flow.dropped == 0);
+
+    f.drainAll();
+    CHECK(f.conn->reading);
+    CHECK(!f.session->flow.paused);
+    CHECK(!f.session->flow.congested);
+}
+
+void testDisconnect()
+{
+    Fixture f(FlowControl::kDisconnect);
+    f.congest();
+    CHECK(f.conn->forceClosed);
+    CHECK(f.send(10, FlowControl::kChat) == FlowControl::kSpilled);
+    CHECK(f.session->flow.spilled == 1);
+}
+
+void testHardLimit()
+{
+    // kPause下拥塞时照常发送，只有硬上限能断开
+    Fixture f(FlowControl::kPause);
+    f.congest();
+    CHECK(f.send(kHardLimit - kHighWater, FlowControl::kEssential) == FlowControl::kSent);
+    CHECK(!f.conn->forceClosed);
+    CHECK(f.send(1, FlowControl::kEssential) == FlowControl::kDropped);
+    CHECK(f.conn->forceClosed);
+    CHECK(f.session->flow.dropped == 1);
+
+    Fixture g(FlowControl::kSpill);
+    g.congest();
+    CHECK(g.send(kHardLimit, FlowControl::kChat) == FlowControl::kSpilled);
+    CHECK(g.conn->forceClosed);
+}
+
+void testHardLimitAfterPartialDrain()
+{
+    Fixture f(FlowControl::kPause);
+    f.congest();
+    CHECK(f.send(kHardLimit - kHighWater - 10, FlowControl::kEssential) == FlowControl::kSent);
+    // 对端收走了大部分，输出缓冲区没写完，没有写完成回调，缓存的outputBytes还是旧值
+    f.conn->drain(kHardLimit - 20);
+    f.loop.runPending();
+    CHECK(f.session->flow.outputBytes == kHardLimit - 10);
+    // loop线程里按实际的输出缓冲区判断，不断开
+    CHECK(f.send(100, FlowControl::kEssential) == FlowControl::kSent);
+    CHECK(!f.conn->forceClosed);
+    CHECK(f.session->flow.outputBytes == 110);
+}
+
+void testPendingBytes()
+{
+    Fixture f(FlowControl::kSpill);
+    // 其他IO线程转发：在途的字节算进积压，进入输出缓冲区之后从pendingBytes里减掉
+    f.loop.inLoopThread = false;
+    CHECK(f.send(50, FlowControl::kChat) == FlowControl::kSent);
+    CHECK(f.send(30, FlowControl::kBulk) == FlowControl::kSent);
+    CHECK(f.session->flow.pendingBytes == 80);
+    CHECK(f.session->flow.buffered() == 80);
+    CHECK(f.session->flow.peakBytes == 80);
+    CHECK(f.conn->outputBuffer()->readableBytes() == 0);
+
+    f.loop.runPending();
+    CHECK(f.session->flow.pendingBytes == 0);
+    CHECK(f.session->flow.outputBytes == 80);
+    CHECK(f.conn->outputBuffer()->readableBytes() == 80);
+
+    // 其他线程只能用缓存的outputBytes加上在途的字节估计，超过硬上限也断开
+    CHECK(f.send(kHardLimit - 80 - 10, FlowControl::kEssential) == FlowControl::kSent);
+    CHECK(f.session->flow.pendingBytes == kHardLimit - 90);
+    CHECK(f.send(20, FlowControl::kChat) == FlowControl::kSpilled);
+    CHECK(f.conn->forceClosed);
+    f.loop.runPending();
+    CHECK(f.session->flow.pendingBytes == 0);
+}
+
+void testFrozen()
+{
+    Fixture f(FlowControl::kSpill);
+    vector<string> spilled;
+    FlowControl::setSpillCallback([&spilled](const TcpConnectionPtr &, const string &frame)
+    {
+        spilled.push_back(frame);
+    });
+
+    // 跨线程排队期间连接被冻结，聊天消息交给回调存成离线消息，响应丢弃
+    f.loop.inLoopThread = false;
+    CHECK(FlowControl::send(f.conn, "chat", FlowControl::kChat) == FlowControl::kSent);
+    CHECK(FlowControl::send(f.conn, "ack", FlowControl::kEssential) == FlowControl::kSent);
+    f.session->frozen = true;
+    f.loop.runPending();
+    CHECK(spilled.size() == 1 && spilled[0] == "chat");
+    CHECK(f.session->flow.spilled == 1);
+    CHECK(f.session->flow.dropped == 1);
+    CHECK(f.session->flow.pendingBytes == 0);
+    CHECK(f.conn->outputBuffer()->readableBytes() == 0);
+
+    // 冻结之后直接发送的，由调用方存成离线消息
+    f.loop.inLoopThread = true;
+    CHECK(f.send(10, FlowControl::kChat) == FlowControl::kSpilled);
+    CHECK(f.send(10, FlowControl::kEssential) == FlowControl::kDropped);
+    CHECK(f.conn->outputBuffer()->readableBytes() == 0);
+    FlowControl::setSpillCallback(FlowControl::SpillCallback());
+}
+
+void testStats()
+{
+    Fixture f(FlowControl::kSpill);
+    f.session->userid = 7;
+    f.congest();
+    vector<FlowStats> stats = FlowControl::stats();
+    CHECK(stats.size() == 1);
+    if (!stats.empty())
+    {
+        CHECK(stats[0].userid == 7);
+        CHECK(stats[0].congested);
+        CHECK(stats[0].buffered == kHighWater);
+        CHECK(stats[0].highWaterHits == 1);
+    }
+}
+
+} // namespace
+
+int main()
+{
+    testSpill();
+    testDrop();
+    testPause();
+    testDisconnect();
+    testHardLimit();
+    testHardLimitAfterPartialDrain();
+    testPendingBytes();
+    testFrozen();
+    testStats();
+
+    if (g_failures != 0)
+    {
+        cerr << g_failures << " check(s) failed" << endl;
+        return 1;
+    }
+    cout << "all FlowControl tests passed" << endl;
+    return 0;
+}
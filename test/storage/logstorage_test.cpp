@@ -0,0 +1,261 @@
+#include "logstorage.hpp"
+
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+using namespace std;
+
+/*
+LogStorage的测试，每个用例在临时目录下用一个新文件：
+重放之后的数据和写入时一致，open之后文件被压缩；最后一行不完整时丢掉这一行，
+中间有坏记录时open失败、文件不变；用户名、好友、群成员的唯一性；序列化失败的记录不改内存也不写文件。
+*/
+namespace
+{
+
+int g_failures = 0;
+
+#define CHECK(cond)                                                          \
+    do                                                                       \
+    {                                                                        \
+        if (!(cond))                                                         \
+        {                                                                    \
+            cerr << __FILE__ << ":" << __LINE__ << ": CHECK(" #cond ") failed" << endl; \
+            ++g_failures;                                                    \
+        }                                                                    \
+    } while (0)
+
+string g_dir;
+
+string tempPath(const string &name)
+{
+    string path = g_dir + "/" + name;
+    ::unlink(path.c_str());
+    return path;
+}
+
+string readFile(const string &path)
+{
+    ifstream in(path, ios::binary);
+    return string((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+}
+
+void appendFile(const string &path, const string &data)
+{
+    ofstream out(path, ios::binary | ios::app);
+    out << data;
+}
+
+size_t countLines(const string &content)
+{
+    size_t n = 0;
+    for (char c : content)
+    {
+        n += c == '\n';
+    }
+    return n;
+}
+
+// 两个用户、一个好友关系、一个群（两个成员）、两条离线消息
+void populate(LogStorage &storage)
+{
+    User a(-1, "alice", "pa", "offline");
+    User b(-1, "bob", "pb", "offline");
+    CHECK(storage.insertUser(a));
+    CHECK(storage.insertUser(b));
+    CHECK(a.getId() == 1 && b.getId() == 2);
+    CHECK(storage.updateUserState(a.getId(), "online"));
+    storage.insertFriend(a.getId(), b.getId());
+    Group group(-1, "g", "desc");
+    CHECK(storage.createGroup(group));
+    storage.addGroup(a.getId(), group.getId(), "creator");
+    storage.addGroup(b.getId(), group.getId(), "normal");
+    storage.insertOfflineMsg(b.getId(), "{\"msgid\":5,\"msg\":\"hi\"}");
+    storage.insertOfflineMsg(b.getId(), "{\"msgid\":5,\"msg\":\"there\"}");
+}
+
+void checkPopulated(LogStorage &storage)
+{
+    User a = storage.queryUser(1);
+    CHECK(a.getName() == "alice" && a.getPwd() == "pa" && a.getState() == "online");
+    CHECK(storage.queryUser(2).getName() == "bob");
+    vector<User> friends = storage.queryFriends(1);
+    CHECK(friends.size() == 1 && friends[0].getId() == 2);
+    CHECK(storage.queryFriendVersion(1) == 1);
+    vector<Group> groups = storage.queryGroups(2, {});
+    CHECK(groups.size() == 1 && groups[0].getUsers().size() == 2 && groups[0].getVersion() == 2);
+    vector<int> others = storage.queryGroupUsers(1, 1);
+    CHECK(others.size() == 1 && others[0] == 2);
+    vector<string> msgs = storage.queryOfflineMsg(2);
+    CHECK(msgs.size() == 2 && msgs[1] == "{\"msgid\":5,\"msg\":\"there\"}");
+}
+
+void testReplayAndCompact()
+{
+    string path = tempPath("replay.log");
+    string error;
+    {
+        LogStorage storage;
+        CHECK(storage.open(path, &error));
+        populate(storage);
+        checkPopulated(storage);
+    }
+    // 每次修改一行
+    CHECK(countLines(readFile(path)) == 9);
+
+    LogStorage storage;
+    CHECK(storage.open(path, &error));
+    CHECK(storage.replayedRecords() == 9);
+    CHECK(storage.discardedBytes() == 0);
+    checkPopulated(storage);
+    // 压缩成每个用户、每个群、每条离线消息一行
+    CHECK(countLines(readFile(path)) == 5);
+
+    // 压缩之后新分配的id接着原来的
+    User c(-1, "carol", "pc", "offline");
+    CHECK(storage.insertUser(c));
+    CHECK(c.getId() == 3);
+}
+
+void testTornTail()
+{
+    string path = tempPath("torn.log");
+    string error;
+    {
+        LogStorage storage;
+        CHECK(storage.open(path, &error));
+        populate(storage);
+    }
+    string tail = "{\"op\":\"offline\",\"userid\":2,\"ms";
+    appendFile(path, tail);
+
+    LogStorage storage;
+    CHECK(storage.open(path, &error));
+    CHECK(storage.replayedRecords() == 9);
+    CHECK(storage.discardedBytes() == tail.size());
+    checkPopulated(storage);
+    // 压缩之后不完整的记录不在了，新的修改追加在完整的行后面
+    string content = readFile(path);
+    CHECK(!content.empty() && content.back() == '\n');
+    storage.insertOfflineMsg(1, "{\"msgid\":5}");
+    LogStorage reopened;
+    CHECK(reopened.open(path, &error));
+    CHECK(reopened.queryOfflineMsg(1).size() == 1);
+}
+
+void testCorruptMiddle()
+{
+    // 一条好记录、一条应用不了的记录（好友不存在）、一条好记录
+    string path = tempPath("corrupt.log");
+    appendFile(path, "{\"op\":\"user\",\"id\":1,\"name\":\"alice\",\"password\":\"pa\"}\n");
+    appendFile(path, "{\"op\":\"friend\",\"userid\":1,\"friendid\":9}\n");
+    appendFile(path, "{\"op\":\"user\",\"id\":2,\"name\":\"bob\",\"password\":\"pb\"}\n");
+    string before = readFile(path);
+
+    string error;
+    LogStorage storage;
+    CHECK(!storage.open(path, &error));
+    CHECK(error.find("line 2") != string::npos);
+    // 坏记录后面的记录还在，文件没有被压缩覆盖
+    CHECK(readFile(path) == before);
+
+    // 解析不了的行也一样，即使它后面只剩一个不完整的行
+    path = tempPath("garbage.log");
+    appendFile(path, "{\"op\":\"user\",\"id\":1,\"name\":\"alice\",\"password\":\"pa\"}\n");
+    appendFile(path, "not json\n{\"op\":\"res");
+    before = readFile(path);
+    LogStorage garbage;
+    CHECK(!garbage.open(path, &error));
+    CHECK(readFile(path) == before);
+}
+
+void testUniqueness()
+{
+    string path = tempPath("unique.log");
+    string error;
+    LogStorage storage;
+    CHECK(storage.open(path, &error));
+    User a(-1, "alice", "pa", "offline");
+    User dup(-1, "alice", "other", "offline");
+    User b(-1, "bob", "pb", "offline");
+    CHECK(storage.insertUser(a));
+    CHECK(!storage.insertUser(dup));
+    CHECK(storage.insertUser(b));
+    // 失败的插入不占用id
+    CHECK(b.getId() == 2);
+
+    storage.insertFriend(1, 2);
+    storage.insertFriend(1, 2);
+    storage.insertFriend(1, 99);
+    CHECK(storage.queryFriends(1).size() == 1);
+    CHECK(storage.queryFriendVersion(1) == 1);
+
+    Group group(-1, "g", "");
+    CHECK(storage.createGroup(group));
+    storage.addGroup(1, group.getId(), "creator");
+    storage.addGroup(1, group.getId(), "normal");
+    storage.addGroup(99, group.getId(), "normal");
+    vector<Group> groups = storage.queryGroups(1, {});
+    CHECK(groups.size() == 1 && groups[0].getUsers().size() == 1 && groups[0].getVersion() == 1);
+
+    // 被拒绝的修改不写日志，重放之后一样
+    LogStorage reopened;
+    CHECK(reopened.open(path, &error));
+    CHECK(reopened.queryUser(1).getPwd() == "pa");
+    CHECK(reopened.queryFriendVersion(1) == 1);
+    CHECK(reopened.queryGroups(1, {})[0].getVersion() == 1);
+}
+
+void testInvalidUtf8()
+{
+    string path = tempPath("utf8.log");
+    string error;
+    LogStorage storage;
+    CHECK(storage.open(path, &error));
+    User a(-1, "alice", "pa", "offline");
+    CHECK(storage.insertUser(a));
+    string before = readFile(path);
+
+    // 序列化失败：不抛异常，内存和文件都不变
+    storage.insertOfflineMsg(1, "{\"msg\":\"\xff\"}");
+    User bad(-1, "\xc0\xaf", "p", "offline");
+    CHECK(!storage.insertUser(bad));
+    CHECK(storage.queryOfflineMsg(1).empty());
+    CHECK(readFile(path) == before);
+
+    storage.insertOfflineMsg(1, "{\"msg\":\"ok\"}");
+    LogStorage reopened;
+    CHECK(reopened.open(path, &error));
+    CHECK(reopened.queryOfflineMsg(1).size() == 1);
+}
+
+} // namespace
+
+int main()
+{
+    char dir[] = "/tmp/logstorage_test.XXXXXX";
+    if (mkdtemp(dir) == nullptr)
+    {
+        perror("mkdtemp");
+        return 1;
+    }
+    g_dir = dir;
+
+    testReplayAndCompact();
+    testTornTail();
+    testCorruptMiddle();
+    testUniqueness();
+    testInvalidUtf8();
+
+    system(("rm -rf " + g_dir).c_str());
+    if (g_failures != 0)
+    {
+        cerr << g_failures << " check(s) failed" << endl;
+        return 1;
+    }
+    cout << "all LogStorage tests passed" << endl;
+    return 0;
+}
@@ -2,7 +2,8 @@ CREATE TABLE user(
 	id INT PRIMARY KEY AUTO_INCREMENT COMMENT '用户id',
 	name VARCHAR(50) NOT NULL UNIQUE COMMENT '用户名',
 	password VARCHAR(50) NOT NULL COMMENT '用户密码',
-	state ENUM('online', 'offline') DEFAULT 'offline' COMMENT '当前登录状态'
+	state ENUM('online', 'offline') DEFAULT 'offline' COMMENT '当前登录状态',
+	friendver INT NOT NULL DEFAULT 0 COMMENT '好友列表版本号'
 ) ENGINE=InnoDB DEFAULT CHARSET=utf8mb4;
 
 CREATE TABLE friend(
@@ -15,7 +16,8 @@ CREATE TABLE friend(
 CREATE TABLE ALLGroup(
 	id INT PRIMARY KEY AUTO_INCREMENT COMMENT '组id',
 	groupname VARCHAR(50) NOT NULL COMMENT '组名',
-	groupdesc VARCHAR(200) DEFAULT '' COMMENT '组功能描述'
+	groupdesc VARCHAR(200) DEFAULT '' COMMENT '组功能描述',
+	version INT NOT NULL DEFAULT 0 COMMENT '群成员版本号'
 );
 
 CREATE TABLE GroupUser(
@@ -28,3 +30,7 @@ CREATE TABLE offlineMessage(
 	userid INT PRIMARY KEY,
 	message VARCHAR(500) NOT NULL COMMENT '离线消息(存储json字符串)'
 );
+
+-- 已有的库升级：登录增量同步用到的版本号
+-- ALTER TABLE user ADD COLUMN friendver INT NOT NULL DEFAULT 0 COMMENT '好友列表版本号';
+-- ALTER TABLE ALLGroup ADD COLUMN version INT NOT NULL DEFAULT 0 COMMENT '群成员版本号';